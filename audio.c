@@ -149,13 +149,28 @@ static int AudioBufferTime = 336;	///< audio buffer time in ms
 #ifdef USE_AUDIO_THREAD
 static pthread_t AudioThread;		///< audio play thread
 static pthread_mutex_t AudioMutex;	///< audio condition mutex
-pthread_mutex_t PTS_mutex;		///< PTS mutex
-pthread_mutex_t ReadAdvance_mutex;	///< PTS mutex
+static pthread_mutex_t PTS_mutex;	///< PTS mutex
+
+///
+///	Audio clock published by the play thread.
+///
+///	Seqlock: the sequence is odd while the play thread writes.  The
+///	display threads read the clock without locks and extrapolate it
+///	with the time since it was published.
+///
+static struct _audio_clock_stamp_
+{
+    unsigned Sequence;			///< publish sequence
+    int64_t Clock;			///< audio clock at publish time
+    int64_t Delay;			///< buffered audio in 90kHz ticks
+    uint32_t Time;			///< publish time in us
+} AudioClockStamp;
 static pthread_cond_t AudioStartCond;	///< condition variable
 static char AudioThreadStop;		///< stop audio thread
 #else
 static const int AudioThread;		///< dummy audio thread
 #endif
+static void (*AudioFreeCallback)(void);	///< called when ring space is freed
 
 static char AudioSoftVolume;		///< flag use soft volume
 static char AudioNormalize;		///< flag use volume normalize
@@ -216,79 +231,86 @@ static int AudioNormIndex;		///< index into average table
 static int AudioNormReady;		///< index counter
 static int AudioNormCounter;		///< sample counter
 
+//----------------------------------------------------------------------------
+//	filter kernels
+//----------------------------------------------------------------------------
+
 /**
-**	Audio normalizer.
+**	Audio sample filter kernels.
+**
+**	All kernels work on @a n 16 bit samples.
+*/
+typedef struct _audio_filter_kernels_
+{
+    const char *Name;			///< instruction set name
+    int (*const Supported) (void);	///< check cpu support, NULL always
+    /// loudest sample (absolute value)
+    int (*const MaxAbs) (const int16_t *, int);
+    /// sum of sample * sample / AudioNormSamples
+     uint32_t(*const NormSum) (const int16_t *, int);
+    /// sample * factor / 1000 with clipping
+    void (*const Gain) (int16_t *, int, int);
+} AudioFilterKernels;
+
+/**
+**	Find loudest sample, C reference.
 **
 **	@param samples	sample buffer
-**	@param count	number of bytes in sample buffer
+**	@param n	number of samples
 */
-static void AudioNormalizer(int16_t * samples, int count)
+static int AudioMaxAbsC(const int16_t * samples, int n)
 {
+    int max_sample;
     int i;
-    int l;
-    int n;
-    uint32_t avg;
-    int factor;
-    int16_t *data;
 
-    // average samples
-    l = count / AudioBytesProSample;
-    data = samples;
-    do {
-	n = l;
-	if (AudioNormCounter + n > AudioNormSamples) {
-	    n = AudioNormSamples - AudioNormCounter;
-	}
-	avg = AudioNormAverage[AudioNormIndex];
-	for (i = 0; i < n; ++i) {
-	    int t;
+    max_sample = 0;
+    for (i = 0; i < n; ++i) {
+	int t;
 
-	    t = data[i];
-	    avg += (t * t) / AudioNormSamples;
+	t = abs(samples[i]);
+	if (t > max_sample) {
+	    max_sample = t;
 	}
-	AudioNormAverage[AudioNormIndex] = avg;
-	AudioNormCounter += n;
-	if (AudioNormCounter >= AudioNormSamples) {
-	    if (AudioNormReady < AudioNormMaxIndex) {
-		AudioNormReady++;
-	    } else {
-		avg = 0;
-		for (i = 0; i < AudioNormMaxIndex; ++i) {
-		    avg += AudioNormAverage[i] / AudioNormMaxIndex;
-		}
+    }
+    return max_sample;
+}
 
-		// calculate normalize factor
-		if (avg > 0) {
-		    factor = ((INT16_MAX / 8) * 1000U) / (uint32_t) sqrt(avg);
-		    // smooth normalize
-		    AudioNormalizeFactor =
-			(AudioNormalizeFactor * 500 + factor * 500) / 1000;
-		    if (AudioNormalizeFactor < AudioMinNormalize) {
-			AudioNormalizeFactor = AudioMinNormalize;
-		    }
-		    if (AudioNormalizeFactor > AudioMaxNormalize) {
-			AudioNormalizeFactor = AudioMaxNormalize;
-		    }
-		} else {
-		    factor = 1000;
-		}
-		Debug(4, "audio/noramlize: avg %8d, fac=%6.3f, norm=%6.3f\n",
-		    avg, factor / 1000.0, AudioNormalizeFactor / 1000.0);
-	    }
+/**
+**	Sum squared samples for the normalizer, C reference.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+static uint32_t AudioNormSumC(const int16_t * samples, int n)
+{
+    uint32_t sum;
+    int i;
 
-	    AudioNormIndex = (AudioNormIndex + 1) % AudioNormMaxIndex;
-	    AudioNormCounter = 0;
-	    AudioNormAverage[AudioNormIndex] = 0U;
-	}
-	data += n;
-	l -= n;
-    } while (l > 0);
+    sum = 0;
+    for (i = 0; i < n; ++i) {
+	int t;
 
-    // apply normalize factor
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
+	t = samples[i];
+	sum += (t * t) / AudioNormSamples;
+    }
+    return sum;
+}
+
+/**
+**	Apply gain factor to samples, C reference.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+**	@param factor	gain factor (1000 = 1.0)
+*/
+static void AudioGainC(int16_t * samples, int n, int factor)
+{
+    int i;
+
+    for (i = 0; i < n; ++i) {
 	int t;
 
-	t = (samples[i] * AudioNormalizeFactor) / 1000;
+	t = (samples[i] * factor) / 1000;
 	if (t < INT16_MIN) {
 	    t = INT16_MIN;
 	} else if (t > INT16_MAX) {
@@ -298,6 +320,456 @@ static void AudioNormalizer(int16_t * samples, int count)
     }
 }
 
+    /// C reference kernels
+static const AudioFilterKernels AudioKernelsC = {
+    .Name = "C",
+    .MaxAbs = AudioMaxAbsC,
+    .NormSum = AudioNormSumC,
+    .Gain = AudioGainC,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+//
+//	The gain kernels multiply 16x16 -> 32 bit and divide as float.  The
+//	quotient is exact, as long as sample * factor fits the 24 bit
+//	mantissa, else it can be off by 1 LSB.  packs saturates to int16.
+//	The normalizer sum uses (t * t) >> 12, AudioNormSamples is 4096.
+//
+
+/**
+**	Check SSE2 support.
+*/
+static int AudioCpuSse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+/**
+**	Find loudest sample, SSE2 version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+__attribute__ ((target("sse2")))
+static int AudioMaxAbsSse2(const int16_t * samples, int n)
+{
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    __m128i max;
+    uint16_t lanes[8];
+    int max_sample;
+    int i;
+
+    max = bias;				// biased 0
+    for (i = 0; i + 8 <= n; i += 8) {
+	__m128i s;
+	__m128i sign;
+
+	s = _mm_loadu_si128((const __m128i *)(samples + i));
+	sign = _mm_srai_epi16(s, 15);
+	// unsigned abs, -32768 gives 32768; no unsigned max in SSE2: bias
+	s = _mm_sub_epi16(_mm_xor_si128(s, sign), sign);
+	max = _mm_max_epi16(max, _mm_xor_si128(s, bias));
+    }
+    _mm_storeu_si128((__m128i *) lanes, _mm_xor_si128(max, bias));
+
+    max_sample = AudioMaxAbsC(samples + i, n - i);
+    for (i = 0; i < 8; ++i) {
+	if (lanes[i] > max_sample) {
+	    max_sample = lanes[i];
+	}
+    }
+    return max_sample;
+}
+
+/**
+**	Sum squared samples for the normalizer, SSE2 version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+__attribute__ ((target("sse2")))
+static uint32_t AudioNormSumSse2(const int16_t * samples, int n)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i sum_hi;
+    __m128i sum_lo;
+    uint32_t lanes[8];
+    uint32_t sum;
+    int i;
+
+    sum_hi = _mm_setzero_si128();
+    sum_lo = _mm_setzero_si128();
+    for (i = 0; i + 8 <= n; i += 8) {
+	__m128i s;
+
+	s = _mm_loadu_si128((const __m128i *)(samples + i));
+	// t * t >> 12 == (high 16 bits << 4) + (low 16 bits >> 12)
+	sum_hi = _mm_add_epi32(sum_hi, _mm_madd_epi16(_mm_mulhi_epi16(s, s),
+		one));
+	sum_lo = _mm_add_epi32(sum_lo,
+	    _mm_madd_epi16(_mm_srli_epi16(_mm_mullo_epi16(s, s), 12), one));
+    }
+    _mm_storeu_si128((__m128i *) lanes, sum_hi);
+    _mm_storeu_si128((__m128i *) (lanes + 4), sum_lo);
+
+    sum = AudioNormSumC(samples + i, n - i);
+    sum += (lanes[0] + lanes[1] + lanes[2] + lanes[3]) << 4;
+    sum += lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    return sum;
+}
+
+/**
+**	Apply gain factor to samples, SSE2 version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+**	@param factor	gain factor (1000 = 1.0)
+*/
+__attribute__ ((target("sse2")))
+static void AudioGainSse2(int16_t * samples, int n, int factor)
+{
+    const __m128i f = _mm_set1_epi16(factor);
+    const __m128 d = _mm_set1_ps(1000.0f);
+    int i;
+
+    if (factor < 0 || factor > INT16_MAX) {	// no 16 bit factor
+	AudioGainC(samples, n, factor);
+	return;
+    }
+    for (i = 0; i + 8 <= n; i += 8) {
+	__m128i s;
+	__m128i lo;
+	__m128i hi;
+	__m128i p0;
+	__m128i p1;
+
+	s = _mm_loadu_si128((const __m128i *)(samples + i));
+	lo = _mm_mullo_epi16(s, f);
+	hi = _mm_mulhi_epi16(s, f);
+	p0 = _mm_unpacklo_epi16(lo, hi);
+	p1 = _mm_unpackhi_epi16(lo, hi);
+	p0 = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(p0), d));
+	p1 = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(p1), d));
+	_mm_storeu_si128((__m128i *) (samples + i), _mm_packs_epi32(p0, p1));
+    }
+    AudioGainC(samples + i, n - i, factor);
+}
+
+    /// SSE2 kernels
+static const AudioFilterKernels AudioKernelsSse2 = {
+    .Name = "SSE2",
+    .Supported = AudioCpuSse2,
+    .MaxAbs = AudioMaxAbsSse2,
+    .NormSum = AudioNormSumSse2,
+    .Gain = AudioGainSse2,
+};
+
+/**
+**	Check AVX2 support.
+*/
+static int AudioCpuAvx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/**
+**	Find loudest sample, AVX2 version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+__attribute__ ((target("avx2")))
+static int AudioMaxAbsAvx2(const int16_t * samples, int n)
+{
+    __m256i max;
+    uint16_t lanes[16];
+    int max_sample;
+    int i;
+
+    max = _mm256_setzero_si256();
+    for (i = 0; i + 16 <= n; i += 16) {
+	__m256i s;
+
+	s = _mm256_loadu_si256((const __m256i *)(samples + i));
+	// abs of -32768 is 0x8000, which is 32768 unsigned
+	max = _mm256_max_epu16(max, _mm256_abs_epi16(s));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, max);
+
+    max_sample = AudioMaxAbsC(samples + i, n - i);
+    for (i = 0; i < 16; ++i) {
+	if (lanes[i] > max_sample) {
+	    max_sample = lanes[i];
+	}
+    }
+    return max_sample;
+}
+
+/**
+**	Sum squared samples for the normalizer, AVX2 version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+__attribute__ ((target("avx2")))
+static uint32_t AudioNormSumAvx2(const int16_t * samples, int n)
+{
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i sum_hi;
+    __m256i sum_lo;
+    uint32_t lanes[16];
+    uint32_t sum;
+    int i;
+
+    sum_hi = _mm256_setzero_si256();
+    sum_lo = _mm256_setzero_si256();
+    for (i = 0; i + 16 <= n; i += 16) {
+	__m256i s;
+
+	s = _mm256_loadu_si256((const __m256i *)(samples + i));
+	sum_hi = _mm256_add_epi32(sum_hi,
+	    _mm256_madd_epi16(_mm256_mulhi_epi16(s, s), one));
+	sum_lo = _mm256_add_epi32(sum_lo,
+	    _mm256_madd_epi16(_mm256_srli_epi16(_mm256_mullo_epi16(s, s),
+		    12), one));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, sum_hi);
+    _mm256_storeu_si256((__m256i *) (lanes + 8), sum_lo);
+
+    sum = AudioNormSumC(samples + i, n - i);
+    for (i = 0; i < 8; ++i) {
+	sum += (lanes[i] << 4) + lanes[i + 8];
+    }
+    return sum;
+}
+
+/**
+**	Apply gain factor to samples, AVX2 version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+**	@param factor	gain factor (1000 = 1.0)
+*/
+__attribute__ ((target("avx2")))
+static void AudioGainAvx2(int16_t * samples, int n, int factor)
+{
+    const __m256i f = _mm256_set1_epi16(factor);
+    const __m256 d = _mm256_set1_ps(1000.0f);
+    int i;
+
+    if (factor < 0 || factor > INT16_MAX) {	// no 16 bit factor
+	AudioGainC(samples, n, factor);
+	return;
+    }
+    for (i = 0; i + 16 <= n; i += 16) {
+	__m256i s;
+	__m256i lo;
+	__m256i hi;
+	__m256i p0;
+	__m256i p1;
+
+	s = _mm256_loadu_si256((const __m256i *)(samples + i));
+	lo = _mm256_mullo_epi16(s, f);
+	hi = _mm256_mulhi_epi16(s, f);
+	// unpack and pack work per 128 bit lane, order is kept
+	p0 = _mm256_unpacklo_epi16(lo, hi);
+	p1 = _mm256_unpackhi_epi16(lo, hi);
+	p0 = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(p0), d));
+	p1 = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(p1), d));
+	_mm256_storeu_si256((__m256i *) (samples + i),
+	    _mm256_packs_epi32(p0, p1));
+    }
+    AudioGainC(samples + i, n - i, factor);
+}
+
+    /// AVX2 kernels
+static const AudioFilterKernels AudioKernelsAvx2 = {
+    .Name = "AVX2",
+    .Supported = AudioCpuAvx2,
+    .MaxAbs = AudioMaxAbsAvx2,
+    .NormSum = AudioNormSumAvx2,
+    .Gain = AudioGainAvx2,
+};
+
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+/**
+**	Find loudest sample, NEON version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+static int AudioMaxAbsNeon(const int16_t * samples, int n)
+{
+    uint16x8_t max;
+    int max_sample;
+    int i;
+
+    max = vdupq_n_u16(0);
+    for (i = 0; i + 8 <= n; i += 8) {
+	// abs of -32768 is 0x8000, which is 32768 unsigned
+	max = vmaxq_u16(max,
+	    vreinterpretq_u16_s16(vabsq_s16(vld1q_s16(samples + i))));
+    }
+    max_sample = AudioMaxAbsC(samples + i, n - i);
+    if (vmaxvq_u16(max) > max_sample) {
+	max_sample = vmaxvq_u16(max);
+    }
+    return max_sample;
+}
+
+/**
+**	Sum squared samples for the normalizer, NEON version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+*/
+static uint32_t AudioNormSumNeon(const int16_t * samples, int n)
+{
+    uint32x4_t sum;
+    int i;
+
+    sum = vdupq_n_u32(0);
+    for (i = 0; i + 8 <= n; i += 8) {
+	int16x8_t s;
+
+	s = vld1q_s16(samples + i);
+	// AudioNormSamples is 4096: shift right and accumulate
+	sum = vsraq_n_u32(sum,
+	    vreinterpretq_u32_s32(vmull_s16(vget_low_s16(s),
+		    vget_low_s16(s))), 12);
+	sum = vsraq_n_u32(sum, vreinterpretq_u32_s32(vmull_high_s16(s, s)),
+	    12);
+    }
+    return vaddvq_u32(sum) + AudioNormSumC(samples + i, n - i);
+}
+
+/**
+**	Apply gain factor to samples, NEON version.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+**	@param factor	gain factor (1000 = 1.0)
+*/
+static void AudioGainNeon(int16_t * samples, int n, int factor)
+{
+    const float32x4_t d = vdupq_n_f32(1000.0f);
+    int i;
+
+    if (factor < 0 || factor > INT16_MAX) {	// no 16 bit factor
+	AudioGainC(samples, n, factor);
+	return;
+    }
+    for (i = 0; i + 8 <= n; i += 8) {
+	int16x8_t s;
+	int32x4_t p0;
+	int32x4_t p1;
+
+	s = vld1q_s16(samples + i);
+	p0 = vmull_n_s16(vget_low_s16(s), factor);
+	p1 = vmull_high_n_s16(s, factor);
+	p0 = vcvtq_s32_f32(vdivq_f32(vcvtq_f32_s32(p0), d));
+	p1 = vcvtq_s32_f32(vdivq_f32(vcvtq_f32_s32(p1), d));
+	vst1q_s16(samples + i, vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1)));
+    }
+    AudioGainC(samples + i, n - i, factor);
+}
+
+    /// NEON kernels
+static const AudioFilterKernels AudioKernelsNeon = {
+    .Name = "NEON",
+    .MaxAbs = AudioMaxAbsNeon,
+    .NormSum = AudioNormSumNeon,
+    .Gain = AudioGainNeon,
+};
+
+#endif
+
+    /// available filter kernels, best first
+static const AudioFilterKernels *const AudioKernelsTable[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    &AudioKernelsAvx2,
+    &AudioKernelsSse2,
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    &AudioKernelsNeon,
+#endif
+    &AudioKernelsC,
+};
+
+    /// selected filter kernels
+static const AudioFilterKernels *AudioKernels = &AudioKernelsC;
+
+/**
+**	Select filter kernels by cpu features.
+*/
+static void AudioKernelsInit(void)
+{
+    unsigned u;
+
+    for (u = 0; u < sizeof(AudioKernelsTable) / sizeof(*AudioKernelsTable);
+	++u) {
+	if (!AudioKernelsTable[u]->Supported
+	    || AudioKernelsTable[u]->Supported()) {
+	    AudioKernels = AudioKernelsTable[u];
+	    break;
+	}
+    }
+    Info(_("audio: using %s sample filters\n"), AudioKernels->Name);
+}
+
+/**
+**	Audio normalizer, a block of samples is averaged.
+**
+**	Calculates the new normalize factor from the block averages.
+*/
+static void AudioNormalizerUpdate(void)
+{
+    int i;
+    uint32_t avg;
+    int factor;
+
+    if (AudioNormReady < AudioNormMaxIndex) {
+	AudioNormReady++;
+    } else {
+	avg = 0;
+	for (i = 0; i < AudioNormMaxIndex; ++i) {
+	    avg += AudioNormAverage[i] / AudioNormMaxIndex;
+	}
+
+	// calculate normalize factor
+	if (avg > 0) {
+	    factor = ((INT16_MAX / 8) * 1000U) / (uint32_t) sqrt(avg);
+	    // smooth normalize
+	    AudioNormalizeFactor =
+		(AudioNormalizeFactor * 500 + factor * 500) / 1000;
+	    if (AudioNormalizeFactor < AudioMinNormalize) {
+		AudioNormalizeFactor = AudioMinNormalize;
+	    }
+	    if (AudioNormalizeFactor > AudioMaxNormalize) {
+		AudioNormalizeFactor = AudioMaxNormalize;
+	    }
+	} else {
+	    factor = 1000;
+	}
+	Debug(4, "audio/noramlize: avg %8d, fac=%6.3f, norm=%6.3f\n",
+	    avg, factor / 1000.0, AudioNormalizeFactor / 1000.0);
+    }
+
+    AudioNormIndex = (AudioNormIndex + 1) % AudioNormMaxIndex;
+    AudioNormCounter = 0;
+    AudioNormAverage[AudioNormIndex] = 0U;
+}
+
 /**
 **	Reset normalizer.
 */
@@ -314,27 +786,20 @@ static void AudioResetNormalizer(void)
 }
 
 /**
-**	Audio compression.
+**	Audio compression, calculate compression factor.
 **
 **	@param samples	sample buffer
 **	@param count	number of bytes in sample buffer
+**
+**	@returns true if the compression factor must be applied.
 */
-static void AudioCompressor(int16_t * samples, int count)
+static int AudioCompressorUpdate(const int16_t * samples, int count)
 {
     int max_sample;
-    int i;
     int factor;
 
     // find loudest sample
-    max_sample = 0;
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
-	int t;
-
-	t = abs(samples[i]);
-	if (t > max_sample) {
-	    max_sample = t;
-	}
-    }
+    max_sample = AudioKernels->MaxAbs(samples, count / AudioBytesProSample);
 
     // calculate compression factor
     if (max_sample > 0) {
@@ -349,24 +814,13 @@ static void AudioCompressor(int16_t * samples, int count)
 	    AudioCompressionFactor = AudioMaxCompression;
 	}
     } else {
-	return;				// silent nothing todo
+	return 0;			// silent nothing todo
     }
 
     Debug(4, "audio/compress: max %5d, fac=%6.3f, com=%6.3f\n", max_sample,
 	factor / 1000.0, AudioCompressionFactor / 1000.0);
 
-    // apply compression factor
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
-	int t;
-
-	t = (samples[i] * AudioCompressionFactor) / 1000;
-	if (t < INT16_MIN) {
-	    t = INT16_MIN;
-	} else if (t > INT16_MAX) {
-	    t = INT16_MAX;
-	}
-	samples[i] = t;
-    }
+    return 1;
 }
 
 /**
@@ -380,6 +834,53 @@ static void AudioResetCompressor(void)
     }
 }
 
+/**
+**	Audio compression and normalizer.
+**
+**	The compressed samples are averaged for the normalizer.  The
+**	normalize factor of the previous packet is applied, it is smoothed
+**	over seconds anyway.
+**
+**	@param samples	sample buffer
+**	@param count	number of bytes in sample buffer
+*/
+static void AudioFilter(int16_t * samples, int count)
+{
+    int normalize_factor;
+    int16_t *data;
+    int l;
+    int n;
+
+    l = count / AudioBytesProSample;
+    normalize_factor = AudioNormalizeFactor;
+
+    if (AudioCompression && AudioCompressorUpdate(samples, count)) {
+	AudioKernels->Gain(samples, l, AudioCompressionFactor);
+    }
+    if (!AudioNormalize) {
+	return;
+    }
+    // average samples
+    data = samples;
+    do {
+	n = l;
+	if (AudioNormCounter + n > AudioNormSamples) {
+	    n = AudioNormSamples - AudioNormCounter;
+	}
+	AudioNormAverage[AudioNormIndex] += AudioKernels->NormSum(data, n);
+	AudioNormCounter += n;
+	if (AudioNormCounter >= AudioNormSamples) {
+	    AudioNormalizerUpdate();
+	}
+	data += n;
+	l -= n;
+    } while (l > 0);
+
+    // apply normalize factor
+    AudioKernels->Gain(samples, count / AudioBytesProSample,
+	normalize_factor);
+}
+
 /**
 **	Audio software amplifier.
 **
@@ -390,25 +891,13 @@ static void AudioResetCompressor(void)
 */
 static void AudioSoftAmplifier(int16_t * samples, int count)
 {
-    int i;
-
     // silence
     if (AudioMute || !AudioAmplifier) {
 	memset(samples, 0, count);
 	return;
     }
 
-    for (i = 0; i < count / AudioBytesProSample; ++i) {
-	int t;
-
-	t = (samples[i] * AudioAmplifier) / 1000;
-	if (t < INT16_MIN) {
-	    t = INT16_MIN;
-	} else if (t > INT16_MAX) {
-	    t = INT16_MAX;
-	}
-	samples[i] = t;
-    }
+    AudioKernels->Gain(samples, count / AudioBytesProSample, AudioAmplifier);
 }
 
 #ifdef USE_AUDIO_MIXER
@@ -647,6 +1136,41 @@ static int AudioRingRead;		///< audio ring read pointer
 static atomic_t AudioRingFilled;	///< how many of the ring is used
 static unsigned AudioStartThreshold;	///< start play, if filled
 
+    /// frames of a decoded audio packet, the scratch buffer is sized for
+#define AUDIO_SCRATCH_FRAMES 8192
+
+static int16_t *AudioScratch;		///< sample modification buffer
+static size_t AudioScratchSize;		///< size of scratch buffer in bytes
+
+/**
+**	Reserve scratch buffer for sample modification.
+**
+**	Only used by AudioEnqueue, if the samples don't fit unwrapped into
+**	the ring buffer.
+**
+**	@param size	number of bytes needed
+**
+**	@returns cache-line aligned scratch buffer, NULL if out of memory.
+*/
+static int16_t *AudioScratchReserve(size_t size)
+{
+    void *buf;
+
+    if (size <= AudioScratchSize) {
+	return AudioScratch;
+    }
+    size = (size + 4095) & ~(size_t) 4095;
+    if (posix_memalign(&buf, 64, size)) {
+	Error(_("audio: out of memory\n"));
+	return NULL;
+    }
+    free(AudioScratch);
+    AudioScratch = buf;
+    AudioScratchSize = size;
+
+    return buf;
+}
+
 /**
 **	Add sample-rate, number of channels change to ring.
 **
@@ -697,6 +1221,10 @@ static int AudioRingAdd(unsigned sample_rate, int channels, int passthrough)
     AudioRing[AudioRingWrite].HwChannels = AudioChannelMatrix[u][channels];
     AudioRing[AudioRingWrite].PTS = INT64_C(0x8000000000000000);
     RingBufferReset(AudioRing[AudioRingWrite].RingBuffer);
+    if (!passthrough) {
+	AudioScratchReserve(AUDIO_SCRATCH_FRAMES *
+	    AudioRing[AudioRingWrite].HwChannels * AudioBytesProSample);
+    }
 
     Debug(3, "audio: %d ring buffer prepared\n",
 	atomic_read(&AudioRingFilled) + 1);
@@ -745,6 +1273,10 @@ static void AudioRingExit(void)
     }
     AudioRingRead = 0;
     AudioRingWrite = 0;
+
+    free(AudioScratch);
+    AudioScratch = NULL;
+    AudioScratchSize = 0;
 }
 
 #ifdef USE_ALSA
@@ -863,7 +1395,6 @@ static int AlsaPlayRingbuffer(void)
 #endif
 
 	for (;;) {
-	    pthread_mutex_lock(&ReadAdvance_mutex);
 	    if (AlsaUseMmap) {
 		err = snd_pcm_mmap_writei(AlsaPCMHandle, p, frames);
 	    } else {
@@ -872,7 +1403,6 @@ static int AlsaPlayRingbuffer(void)
 	    //Debug(3, "audio/alsa: wrote %d/%d frames\n", err, frames);
 	    if (err != frames) {
 		if (err < 0) {
-		    pthread_mutex_unlock(&ReadAdvance_mutex);
 		    if (err == -EAGAIN) {
 			continue;
 		    }
@@ -898,7 +1428,6 @@ static int AlsaPlayRingbuffer(void)
 	    break;
 	}
 	RingBufferReadAdvance(AudioRing[AudioRingRead].RingBuffer, avail);
-	pthread_mutex_unlock(&ReadAdvance_mutex);
 	first = 0;
     }
 
@@ -2065,6 +2594,38 @@ static int AudioNextRing(void)
     return 1;
 }
 
+/**
+**	Publish the audio clock for AudioGetClock().
+**
+**	@note only called from the play thread, with PTS_mutex locked
+*/
+static void AudioPublishClock(void)
+{
+    unsigned sequence;
+    int64_t clock;
+    int64_t delay;
+
+    clock = INT64_C(0x8000000000000000);
+    // (cast) needed for the evil gcc
+    // delay zero, if no valid time stamp
+    if (AudioRing[AudioRingRead].PTS != (int64_t) INT64_C(0x8000000000000000)
+	&& (delay = AudioGetDelay())) {
+	clock = AudioRing[AudioRingRead].PTS - delay;
+    } else {
+	delay = 0;
+    }
+
+    sequence = AudioClockStamp.Sequence;
+    __atomic_store_n(&AudioClockStamp.Sequence, sequence + 1,
+	__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&AudioClockStamp.Clock, clock, __ATOMIC_RELAXED);
+    __atomic_store_n(&AudioClockStamp.Delay, delay, __ATOMIC_RELAXED);
+    __atomic_store_n(&AudioClockStamp.Time, GetUsTicks(), __ATOMIC_RELAXED);
+    __atomic_store_n(&AudioClockStamp.Sequence, sequence + 2,
+	__ATOMIC_RELEASE);
+}
+
 /**
 **	Audio play thread.
 **
@@ -2083,6 +2644,9 @@ static void *AudioPlayHandlerThread(void *dummy)
 	Debug(3, "audio: wait on start condition\n");
 	pthread_mutex_lock(&AudioMutex);
 	AudioRunning = 0;
+	pthread_mutex_lock(&PTS_mutex);
+	AudioPublishClock();		// invalid, while not running
+	pthread_mutex_unlock(&PTS_mutex);
 	do {
 	    pthread_cond_wait(&AudioStartCond, &AudioMutex);
 	    // cond_wait can return, without signal!
@@ -2126,6 +2690,9 @@ static void *AudioPlayHandlerThread(void *dummy)
 		Debug(3, "audio: flush %d ring buffer(s)\n", flush);
 		AudioUsedModule->FlushBuffers();
 		atomic_sub(flush, &AudioRingFilled);
+		if (AudioFreeCallback) {
+		    AudioFreeCallback();
+		}
 		if (AudioNextRing()) {
 		    Debug(3, "audio: break after flush\n");
 		    break;
@@ -2136,7 +2703,14 @@ static void *AudioPlayHandlerThread(void *dummy)
 	    err = 0;
 	    if (RingBufferUsedBytes(AudioRing[AudioRingRead].RingBuffer)) {
 		err = AudioUsedModule->Thread();
+		// samples moved to the device, tell waiting producers
+		if (err && AudioFreeCallback) {
+		    AudioFreeCallback();
+		}
 	    }
+	    pthread_mutex_lock(&PTS_mutex);
+	    AudioPublishClock();
+	    pthread_mutex_unlock(&PTS_mutex);
 	    // underrun, check if new ring buffer is available
 	    if (!err) {
 		int passthrough;
@@ -2194,7 +2768,6 @@ static void AudioInitThread(void)
     AudioThreadStop = 0;
     pthread_mutex_init(&AudioMutex, NULL);
     pthread_mutex_init(&PTS_mutex, NULL);
-    pthread_mutex_init(&ReadAdvance_mutex, NULL);
     pthread_cond_init(&AudioStartCond, NULL);
     pthread_create(&AudioThread, NULL, AudioPlayHandlerThread, NULL);
     pthread_setname_np(AudioThread, "softhddev audio");
@@ -2219,7 +2792,6 @@ static void AudioExitThread(void)
 	pthread_cond_destroy(&AudioStartCond);
 	pthread_mutex_destroy(&AudioMutex);
 	pthread_mutex_destroy(&PTS_mutex);
-	pthread_mutex_destroy(&ReadAdvance_mutex);
 	AudioThread = 0;
     }
 }
@@ -2252,6 +2824,7 @@ void AudioEnqueue(const void *samples, int count)
 {
     size_t n;
     int16_t *buffer;
+    int direct;
 
 #ifdef noDEBUG
     static uint32_t last_tick;
@@ -2275,20 +2848,30 @@ void AudioEnqueue(const void *samples, int count)
     }
     // audio sample modification allowed and needed?
     buffer = (void *)samples;
+    direct = 0;
     if (!AudioRing[AudioRingWrite].Passthrough && (AudioCompression
 	    || AudioNormalize
 	    || AudioRing[AudioRingWrite].InChannels !=
 	    AudioRing[AudioRingWrite].HwChannels)) {
 	int frames;
+	size_t size;
+	void *wp;
 
-	// resample into ring-buffer is too complex in the case of a roundabout
-	// just use a temporary buffer
 	frames =
 	    count / (AudioRing[AudioRingWrite].InChannels *
 	    AudioBytesProSample);
-	buffer =
-	    alloca(frames * AudioRing[AudioRingWrite].HwChannels *
-	    AudioBytesProSample);
+	size =
+	    frames * AudioRing[AudioRingWrite].HwChannels *
+	    AudioBytesProSample;
+	// modify samples in place in the ring-buffer, only in the case of a
+	// roundabout use the scratch buffer
+	if (RingBufferGetWritePointer(AudioRing[AudioRingWrite].RingBuffer,
+		&wp) >= size) {
+	    buffer = wp;
+	    direct = 1;
+	} else if (!(buffer = AudioScratchReserve(size))) {
+	    return;
+	}
 #ifdef USE_AUDIO_MIXER
 	// Convert / resample input to hardware format
 	AudioResample(samples, AudioRing[AudioRingWrite].InChannels, frames,
@@ -2303,20 +2886,21 @@ void AudioEnqueue(const void *samples, int count)
 #endif
 	memcpy(buffer, samples, count);
 #endif
-	count =
-	    frames * AudioRing[AudioRingWrite].HwChannels *
-	    AudioBytesProSample;
+	count = size;
 
-	if (AudioCompression) {		// in place operation
-	    AudioCompressor(buffer, count);
-	}
-	if (AudioNormalize) {		// in place operation
-	    AudioNormalizer(buffer, count);
+	if (AudioCompression || AudioNormalize) {	// in place operation
+	    AudioFilter(buffer, count);
 	}
     }
 
     pthread_mutex_lock(&PTS_mutex);
-    n = RingBufferWrite(AudioRing[AudioRingWrite].RingBuffer, buffer, count);
+    if (direct) {
+	n = RingBufferWriteAdvance(AudioRing[AudioRingWrite].RingBuffer,
+	    count);
+    } else {
+	n = RingBufferWrite(AudioRing[AudioRingWrite].RingBuffer, buffer,
+	    count);
+    }
     if (n != (size_t) count) {
 	Error(_("audio: can't place %d samples in ring buffer\n"), count);
 	// too many bytes are lost
@@ -2621,23 +3205,41 @@ void AudioSetClock(int64_t pts)
 /**
 **	Get current audio clock.
 **
+**	Reads the clock published by the play thread, never blocks.
+**
 **	@returns the audio clock in time stamps.
 */
 int64_t AudioGetClock(void)
 {
-    // (cast) needed for the evil gcc
-    if (AudioRing[AudioRingRead].PTS != (int64_t) INT64_C(0x8000000000000000)) {
-	int64_t delay;
+    unsigned sequence;
+    int64_t clock;
+    int64_t delay;
+    int64_t elapsed;
+    uint32_t time;
 
-	// delay zero, if no valid time stamp
-	if ((delay = AudioGetDelay())) {
-	    if (AudioRing[AudioRingRead].Passthrough) {
-		return AudioRing[AudioRingRead].PTS + 0 * 90 - delay;
-	    }
-	    return AudioRing[AudioRingRead].PTS + 0 * 90 - delay;
-	}
+    do {
+	sequence = __atomic_load_n(&AudioClockStamp.Sequence, __ATOMIC_ACQUIRE);
+	clock = __atomic_load_n(&AudioClockStamp.Clock, __ATOMIC_RELAXED);
+	delay = __atomic_load_n(&AudioClockStamp.Delay, __ATOMIC_RELAXED);
+	time = __atomic_load_n(&AudioClockStamp.Time, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1)
+	|| sequence != __atomic_load_n(&AudioClockStamp.Sequence,
+	    __ATOMIC_RELAXED));
+
+    // (cast) needed for the evil gcc
+    if (clock == (int64_t) INT64_C(0x8000000000000000) || !AudioRunning) {
+	return INT64_C(0x8000000000000000);
+    }
+    if (AudioPaused) {
+	return clock;
     }
-    return INT64_C(0x8000000000000000);
+    // the output played since, but not more than was buffered
+    elapsed = ((int64_t) (uint32_t) (GetUsTicks() - time) * 90) / 1000;
+    if (elapsed > delay) {
+	elapsed = delay;
+    }
+    return clock + elapsed;
 }
 
 /**
@@ -2864,6 +3466,16 @@ void AudioSetAutoAES(int onoff)
     }
 }
 
+/**
+**	Set callback, called from audio thread when ring buffer space is freed.
+**
+**	@param callback	function to wake producers waiting for free space
+*/
+void AudioSetFreeCallback(void (*callback)(void))
+{
+    AudioFreeCallback = callback;
+}
+
 /**
 **	Initialize audio output module.
 **
@@ -2876,6 +3488,7 @@ void AudioInit(void)
     int freq;
     int chan;
 
+    AudioKernelsInit();
     name = "noop";
 #ifdef USE_OSS
     name = "oss";
@@ -3191,3 +3804,210 @@ int main(int argc, char *const argv[])
 }
 
 #endif
+
+#ifdef AUDIO_FILTER_TEST
+
+//----------------------------------------------------------------------------
+//	Filter kernel benchmark
+//----------------------------------------------------------------------------
+
+#include <getopt.h>
+#include <time.h>
+
+int LogLevel;				///< required
+int VideoAudioDelay;			///< required
+volatile char SoftIsPlayingVideo;	///< required
+
+    /// samples of one packet: 8 channel 48kHz AC-3 frame
+#define FILTER_TEST_SAMPLES (1536 * 8)
+
+    /// gain factors checked against the C reference
+static const int FilterTestFactors[] = {
+    0, 1, 333, 500, 999, 1000, 1001, 1500, 2000, 7777, 10000, INT16_MAX
+};
+
+/**
+**	Get monotonic time in ns.
+*/
+static uint64_t FilterTestNs(void)
+{
+    struct timespec tspec;
+
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * 1000000000ULL + tspec.tv_nsec;
+}
+
+/**
+**	Fill buffer with random samples, including the extremes.
+**
+**	@param samples	sample buffer
+**	@param n	number of samples
+**	@param seed	random seed
+*/
+static void FilterTestFill(int16_t * samples, int n, unsigned seed)
+{
+    int i;
+
+    for (i = 0; i < n; ++i) {
+	samples[i] = rand_r(&seed);
+	if (!(i % 61)) {
+	    samples[i] = i & 1 ? INT16_MAX : INT16_MIN;
+	}
+    }
+}
+
+/**
+**	Check filter kernels against the C reference.
+**
+**	@param kernels	filter kernels to check
+**	@param in	input samples
+**	@param n	number of samples
+**
+**	@returns max. gain difference in LSB, -1 for a wrong max/sum.
+*/
+static int FilterTestCheck(const AudioFilterKernels * kernels,
+    const int16_t * in, int n)
+{
+    int16_t *ref;
+    int16_t *out;
+    unsigned u;
+    int diff;
+    int i;
+
+    if (kernels->MaxAbs(in, n) != AudioMaxAbsC(in, n)
+	|| kernels->NormSum(in, n) != AudioNormSumC(in, n)) {
+	return -1;
+    }
+    ref = malloc(n * sizeof(*ref));
+    out = malloc(n * sizeof(*out));
+    diff = 0;
+    for (u = 0; u < sizeof(FilterTestFactors) / sizeof(*FilterTestFactors);
+	++u) {
+	memcpy(ref, in, n * sizeof(*ref));
+	memcpy(out, in, n * sizeof(*out));
+	AudioGainC(ref, n, FilterTestFactors[u]);
+	kernels->Gain(out, n, FilterTestFactors[u]);
+	for (i = 0; i < n; ++i) {
+	    if (abs(ref[i] - out[i]) > diff) {
+		diff = abs(ref[i] - out[i]);
+	    }
+	}
+    }
+    free(ref);
+    free(out);
+
+    return diff;
+}
+
+/**
+**	Print usage.
+*/
+static void PrintUsage(void)
+{
+    printf("Usage: bench-audio [-n packets]\n"
+	"\t-n packets\tnumber of %d sample packets (default 20000)\n"
+	"Compares the audio filter kernels against the C reference.\n",
+	FILTER_TEST_SAMPLES);
+}
+
+/**
+**	Main entry point.
+**
+**	@param argc	number of arguments
+**	@param argv	arguments vector
+**
+**	@returns -1 on failures, 1 on kernel mismatch, 0 clean exit.
+*/
+int main(int argc, char *const argv[])
+{
+    static int16_t in[FILTER_TEST_SAMPLES];
+    static int16_t work[FILTER_TEST_SAMPLES];
+    volatile uint32_t sink;
+    double c_ns[3];
+    int packets;
+    int failed;
+    unsigned u;
+
+    packets = 20000;
+    for (;;) {
+	switch (getopt(argc, argv, "hn:")) {
+	    case 'n':
+		packets = atoi(optarg);
+		continue;
+	    case EOF:
+		break;
+	    case 'h':
+		PrintUsage();
+		return 0;
+	    default:
+		PrintUsage();
+		return -1;
+	}
+	break;
+    }
+    if (packets <= 0 || optind < argc) {
+	PrintUsage();
+	return -1;
+    }
+
+    FilterTestFill(in, FILTER_TEST_SAMPLES, 1);
+    failed = 0;
+    c_ns[0] = c_ns[1] = c_ns[2] = 0.0;
+
+    printf("%d packets of %d samples, ns per packet:\n", packets,
+	FILTER_TEST_SAMPLES);
+    printf("%-6s %10s %10s %10s  %s\n", "kernel", "max-abs", "norm-sum",
+	"gain", "check");
+    // reference is the last entry, run it first
+    for (u = sizeof(AudioKernelsTable) / sizeof(*AudioKernelsTable); u--;) {
+	const AudioFilterKernels *kernels;
+	uint64_t start;
+	double ns[3];
+	int diff;
+	int i;
+
+	kernels = AudioKernelsTable[u];
+	if (kernels->Supported && !kernels->Supported()) {
+	    printf("%-6s unsupported\n", kernels->Name);
+	    continue;
+	}
+	diff = FilterTestCheck(kernels, in, FILTER_TEST_SAMPLES);
+	// 1 LSB is the float division with products over 24 bit
+	if (diff < 0 || diff > 1) {
+	    failed = 1;
+	}
+
+	sink = 0;
+	start = FilterTestNs();
+	for (i = 0; i < packets; ++i) {
+	    sink += kernels->MaxAbs(in, FILTER_TEST_SAMPLES);
+	}
+	ns[0] = (double)(FilterTestNs() - start) / packets;
+	start = FilterTestNs();
+	for (i = 0; i < packets; ++i) {
+	    sink += kernels->NormSum(in, FILTER_TEST_SAMPLES);
+	}
+	ns[1] = (double)(FilterTestNs() - start) / packets;
+	memcpy(work, in, sizeof(work));
+	start = FilterTestNs();
+	for (i = 0; i < packets; ++i) {	// unity gain keeps the samples
+	    kernels->Gain(work, FILTER_TEST_SAMPLES, 1000);
+	}
+	ns[2] = (double)(FilterTestNs() - start) / packets;
+	if (!c_ns[0]) {
+	    c_ns[0] = ns[0];
+	    c_ns[1] = ns[1];
+	    c_ns[2] = ns[2];
+	}
+
+	printf("%-6s %10.0f %10.0f %10.0f  %s (%.1fx %.1fx %.1fx)\n",
+	    kernels->Name, ns[0], ns[1], ns[2],
+	    diff < 0 ? "max/sum mismatch" : diff > 1 ? "gain mismatch" :
+	    diff ? "+-1 LSB" : "exact", c_ns[0] / ns[0], c_ns[1] / ns[1],
+	    c_ns[2] / ns[2]);
+    }
+
+    return failed;
+}
+
+#endif
@@ -53,6 +53,9 @@ extern void AudioSetDevice(const char *);	///< set PCM audio device
 extern void AudioSetPassthroughDevice(const char *);
 extern void AudioSetChannel(const char *);	///< set mixer channel
 extern void AudioSetAutoAES(int);	///< set automatic AES flag handling
+
+    /// set callback for freed ring buffer space
+extern void AudioSetFreeCallback(void (*)(void));
 extern void AudioInit(void);		///< setup audio module
 extern void AudioExit(void);		///< cleanup and exit audio module
 
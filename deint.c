@@ -0,0 +1,1057 @@
+///
+///	@file deint.c	@brief Software deinterlace module
+///
+///	Copyright (c) 2026 by the softhddevice contributors.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	@defgroup Deint The software deinterlace module.
+///
+///	yadif and bwdif style deinterlacers for the CPU deinterlace paths.
+///	The line kernels are written with the gcc vector extension, which
+///	compiles to SSE2 on x86 and NEON on ARM, and are checked bit exact
+///	against the C reference.  The lines of a frame are split into bands,
+///	which a small worker pool processes in parallel.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef __USE_GNU
+#define __USE_GNU
+#endif
+#include <pthread.h>
+#ifndef HAVE_PTHREAD_NAME
+    /// only available with newer glibc
+#define pthread_setname_np(thread, name)
+#endif
+
+#include "deint.h"
+
+#define DEINT_THREADS_MAX	4	///< max. number of worker threads
+
+//----------------------------------------------------------------------------
+//	Line kernels
+//----------------------------------------------------------------------------
+
+    /// Return the absolute value of an integer.
+#define ABS(i)	((i) >= 0 ? (i) : (-(i)))
+    /// Return the larger of two integers.
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+    /// Return the smaller of two integers.
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+    ///
+    /// One line to interpolate.
+    ///
+    /// Prev2/Next2 are the temporal neighbours of the missing line,
+    /// Prev/Next the frames before and after Cur.  All pointers point to
+    /// the missing line, the refs are the byte offsets of the lines above
+    /// (negative) and below.
+    ///
+typedef struct _deint_line_
+{
+    uint8_t *Dst;			///< output line
+    const uint8_t *Prev;		///< previous frame
+    const uint8_t *Cur;			///< current frame
+    const uint8_t *Next;		///< next frame
+    const uint8_t *Prev2;		///< earlier temporal neighbour
+    const uint8_t *Next2;		///< later temporal neighbour
+    int Mrefs;				///< offset of kept line above
+    int Prefs;				///< offset of kept line below
+    int Width;				///< bytes in line
+    int Step;				///< bytes between horizontal neighbours
+    int Spatial;			///< flag 2 lines above/below available
+} DeintLine;
+
+    /// bwdif low-frequency filter coefficients
+static const int DeintCoefLf[2] = { 4309, 213 };
+
+    /// bwdif high-frequency filter coefficients
+static const int DeintCoefHf[3] = { 5570, 3801, 1016 };
+
+    /// bwdif spatial filter coefficients
+static const int DeintCoefSp[2] = { 5077, 981 };
+
+///
+///	yadif one line, C reference version.
+///
+///	The edge directed search needs 3 neighbours on each side, it is
+///	disabled for the first and last 3 pixels.
+///
+///	@param l	line to interpolate
+///	@param x0	first byte
+///	@param x1	last byte + 1
+///
+static void DeintYadifC(const DeintLine * l, int x0, int x1)
+{
+    const uint8_t *cur;
+    int mrefs;
+    int prefs;
+    int n;
+    int x;
+
+    cur = l->Cur;
+    mrefs = l->Mrefs;
+    prefs = l->Prefs;
+    n = l->Step;
+    for (x = x0; x < x1; ++x) {
+	int c;
+	int d;
+	int e;
+	int diff;
+	int spatial_pred;
+	int spatial_score;
+
+	c = cur[x + mrefs];
+	d = (l->Prev2[x] + l->Next2[x]) >> 1;
+	e = cur[x + prefs];
+	diff =
+	    MAX(MAX(ABS(l->Prev2[x] - l->Next2[x]) >> 1,
+		(ABS(l->Prev[x + mrefs] - c) + ABS(l->Prev[x + prefs] -
+			e)) >> 1), (ABS(l->Next[x + mrefs] - c) +
+		ABS(l->Next[x + prefs] - e)) >> 1);
+	spatial_pred = (c + e) >> 1;
+
+	if (x >= 3 * n && x < l->Width - 3 * n) {
+	    int score;
+
+#define CHECK(j) \
+	    score = ABS(cur[x + mrefs - n + (j)] - cur[x + prefs - n - (j)]) \
+		+ ABS(cur[x + mrefs + (j)] - cur[x + prefs - (j)]) \
+		+ ABS(cur[x + mrefs + n + (j)] - cur[x + prefs + n - (j)]); \
+	    if (score < spatial_score) { \
+		spatial_score = score; \
+		spatial_pred = (cur[x + mrefs + (j)] + cur[x + prefs - (j)]) >> 1;
+
+	    spatial_score =
+		ABS(cur[x + mrefs - n] - cur[x + prefs - n]) + ABS(c - e) +
+		ABS(cur[x + mrefs + n] - cur[x + prefs + n]) - 1;
+
+	    CHECK(-n) CHECK(-2 * n) }}
+	    CHECK(n) CHECK(2 * n) }}
+#undef CHECK
+	}
+
+	if (l->Spatial) {
+	    int b;
+	    int f;
+	    int max;
+	    int min;
+
+	    b = (l->Prev2[x + 2 * mrefs] + l->Next2[x + 2 * mrefs]) >> 1;
+	    f = (l->Prev2[x + 2 * prefs] + l->Next2[x + 2 * prefs]) >> 1;
+	    max = MAX(MAX(d - e, d - c), MIN(b - c, f - e));
+	    min = MIN(MIN(d - e, d - c), MAX(b - c, f - e));
+	    diff = MAX(MAX(diff, min), -max);
+	}
+
+	if (spatial_pred > d + diff) {
+	    spatial_pred = d + diff;
+	} else if (spatial_pred < d - diff) {
+	    spatial_pred = d - diff;
+	}
+	l->Dst[x] = spatial_pred;
+    }
+}
+
+///
+///	bwdif one line, C reference version.
+///
+///	@note Needs 4 lines above and below, use yadif on the border lines.
+///
+///	@param l	line to interpolate
+///	@param x0	first byte
+///	@param x1	last byte + 1
+///
+static void DeintBwdifC(const DeintLine * l, int x0, int x1)
+{
+    const uint8_t *prev2;
+    const uint8_t *next2;
+    const uint8_t *cur;
+    int mrefs;
+    int prefs;
+    int x;
+
+    prev2 = l->Prev2;
+    next2 = l->Next2;
+    cur = l->Cur;
+    mrefs = l->Mrefs;
+    prefs = l->Prefs;
+    for (x = x0; x < x1; ++x) {
+	int c;
+	int d;
+	int e;
+	int td0;
+	int diff;
+	int b;
+	int f;
+	int max;
+	int min;
+	int interpol;
+
+	c = cur[x + mrefs];
+	d = (prev2[x] + next2[x]) >> 1;
+	e = cur[x + prefs];
+	td0 = ABS(prev2[x] - next2[x]);
+	diff =
+	    MAX(MAX(td0 >> 1, (ABS(l->Prev[x + mrefs] - c) +
+		    ABS(l->Prev[x + prefs] - e)) >> 1),
+	    (ABS(l->Next[x + mrefs] - c) + ABS(l->Next[x + prefs] - e)) >> 1);
+	if (!diff) {
+	    l->Dst[x] = d;
+	    continue;
+	}
+
+	b = ((prev2[x + 2 * mrefs] + next2[x + 2 * mrefs]) >> 1) - c;
+	f = ((prev2[x + 2 * prefs] + next2[x + 2 * prefs]) >> 1) - e;
+	max = MAX(MAX(d - e, d - c), MIN(b, f));
+	min = MIN(MIN(d - e, d - c), MAX(b, f));
+	diff = MAX(MAX(diff, min), -max);
+
+	if (ABS(c - e) > td0) {
+	    interpol = (((DeintCoefHf[0] * (prev2[x] + next2[x])
+			- DeintCoefHf[1] * (prev2[x + 2 * mrefs] +
+			    next2[x + 2 * mrefs] + prev2[x + 2 * prefs] +
+			    next2[x + 2 * prefs])
+			+ DeintCoefHf[2] * (prev2[x + 4 * mrefs] +
+			    next2[x + 4 * mrefs] + prev2[x + 4 * prefs] +
+			    next2[x + 4 * prefs])) >> 2)
+		+ DeintCoefLf[0] * (c + e) - DeintCoefLf[1] * (cur[x +
+			3 * mrefs] + cur[x + 3 * prefs])) >> 13;
+	} else {
+	    interpol = (DeintCoefSp[0] * (c + e) - DeintCoefSp[1] * (cur[x +
+			3 * mrefs] + cur[x + 3 * prefs])) >> 13;
+	}
+
+	if (interpol > d + diff) {
+	    interpol = d + diff;
+	} else if (interpol < d - diff) {
+	    interpol = d - diff;
+	}
+	l->Dst[x] = interpol < 0 ? 0 : interpol > 255 ? 255 : interpol;
+    }
+}
+
+//
+//	Vector kernels.  The gcc vector extension has no select and no
+//	min/max, they are built from the compare masks (-1/0 lanes).
+//
+
+typedef uint8_t DeintU8 __attribute__ ((vector_size(8)));
+typedef uint8_t DeintU8x4 __attribute__ ((vector_size(4)));
+typedef int16_t DeintI16 __attribute__ ((vector_size(16)));
+typedef int32_t DeintI32 __attribute__ ((vector_size(16)));
+
+    /// Load 8 bytes, widened to 16 bit.
+static inline DeintI16 DeintLoad16(const uint8_t * p)
+{
+    DeintU8 v;
+
+    memcpy(&v, p, sizeof(v));
+    return __builtin_convertvector(v, DeintI16);
+}
+
+    /// Load 4 bytes, widened to 32 bit.
+static inline DeintI32 DeintLoad32(const uint8_t * p)
+{
+    DeintU8x4 v;
+
+    memcpy(&v, p, sizeof(v));
+    return __builtin_convertvector(v, DeintI32);
+}
+
+    /// Select a where mask m is set, else b.
+#define VSEL(m, a, b)	(((a) & (m)) | ((b) & ~(m)))
+    /// Absolute value of vector.
+#define VABS(a)		VSEL((a) < 0, -(a), (a))
+    /// Minimum of two vectors.
+#define VMIN(a, b)	VSEL((a) < (b), (a), (b))
+    /// Maximum of two vectors.
+#define VMAX(a, b)	VSEL((a) > (b), (a), (b))
+
+///
+///	yadif one line, vector version.
+///
+///	@param l	line to interpolate
+///	@param x0	first byte, >= 3 * step
+///	@param x1	last byte + 1, x1 - x0 multiple of 8
+///
+static void DeintYadifV(const DeintLine * l, int x0, int x1)
+{
+    const uint8_t *cur;
+    int mrefs;
+    int prefs;
+    int n;
+    int x;
+
+    cur = l->Cur;
+    mrefs = l->Mrefs;
+    prefs = l->Prefs;
+    n = l->Step;
+    for (x = x0; x < x1; x += 8) {
+	DeintI16 c;
+	DeintI16 d;
+	DeintI16 e;
+	DeintI16 p2;
+	DeintI16 n2;
+	DeintI16 diff;
+	DeintI16 pred;
+	DeintI16 best;
+	DeintI16 score;
+	DeintI16 m;
+	DeintI16 m1;
+	DeintU8 out;
+
+	c = DeintLoad16(cur + x + mrefs);
+	e = DeintLoad16(cur + x + prefs);
+	p2 = DeintLoad16(l->Prev2 + x);
+	n2 = DeintLoad16(l->Next2 + x);
+	d = (p2 + n2) >> 1;
+	diff = VABS(p2 - n2) >> 1;
+	diff = VMAX(diff, (VABS(DeintLoad16(l->Prev + x + mrefs) - c)
+		+ VABS(DeintLoad16(l->Prev + x + prefs) - e)) >> 1);
+	diff = VMAX(diff, (VABS(DeintLoad16(l->Next + x + mrefs) - c)
+		+ VABS(DeintLoad16(l->Next + x + prefs) - e)) >> 1);
+
+	pred = (c + e) >> 1;
+	best = VABS(DeintLoad16(cur + x + mrefs - n) - DeintLoad16(cur + x +
+		prefs - n)) + VABS(c - e) + VABS(DeintLoad16(cur + x + mrefs +
+		n) - DeintLoad16(cur + x + prefs + n)) - 1;
+
+#define SCORE(j) \
+	(VABS(DeintLoad16(cur + x + mrefs - n + (j)) \
+		- DeintLoad16(cur + x + prefs - n - (j))) \
+	    + VABS(DeintLoad16(cur + x + mrefs + (j)) \
+		- DeintLoad16(cur + x + prefs - (j))) \
+	    + VABS(DeintLoad16(cur + x + mrefs + n + (j)) \
+		- DeintLoad16(cur + x + prefs + n - (j))))
+#define PRED(j) \
+	((DeintLoad16(cur + x + mrefs + (j)) \
+		+ DeintLoad16(cur + x + prefs - (j))) >> 1)
+
+	// second step of each direction only, if the first improved
+	score = SCORE(-n);
+	m1 = score < best;
+	best = VSEL(m1, score, best);
+	pred = VSEL(m1, PRED(-n), pred);
+	score = SCORE(-2 * n);
+	m = m1 & (score < best);
+	best = VSEL(m, score, best);
+	pred = VSEL(m, PRED(-2 * n), pred);
+
+	score = SCORE(n);
+	m1 = score < best;
+	best = VSEL(m1, score, best);
+	pred = VSEL(m1, PRED(n), pred);
+	score = SCORE(2 * n);
+	m = m1 & (score < best);
+	pred = VSEL(m, PRED(2 * n), pred);
+#undef SCORE
+#undef PRED
+
+	if (l->Spatial) {
+	    DeintI16 b;
+	    DeintI16 f;
+	    DeintI16 max;
+	    DeintI16 min;
+
+	    b = (DeintLoad16(l->Prev2 + x + 2 * mrefs) +
+		DeintLoad16(l->Next2 + x + 2 * mrefs)) >> 1;
+	    f = (DeintLoad16(l->Prev2 + x + 2 * prefs) +
+		DeintLoad16(l->Next2 + x + 2 * prefs)) >> 1;
+	    max = VMAX(VMAX(d - e, d - c), VMIN(b - c, f - e));
+	    min = VMIN(VMIN(d - e, d - c), VMAX(b - c, f - e));
+	    diff = VMAX(VMAX(diff, min), -max);
+	}
+
+	// diff >= 0: clamping into d +- diff keeps pred in 0 .. 255
+	pred = VMIN(VMAX(pred, d - diff), d + diff);
+	out = __builtin_convertvector(pred, DeintU8);
+	memcpy(l->Dst + x, &out, sizeof(out));
+    }
+}
+
+///
+///	bwdif one line, vector version.
+///
+///	The filters need 32 bit, 4 pixels per step.
+///
+///	@param l	line to interpolate
+///	@param x0	first byte
+///	@param x1	last byte + 1, x1 - x0 multiple of 8
+///
+static void DeintBwdifV(const DeintLine * l, int x0, int x1)
+{
+    const uint8_t *prev2;
+    const uint8_t *next2;
+    const uint8_t *cur;
+    const DeintI32 zero = { 0, 0, 0, 0 };
+    const DeintI32 full = zero + 255;
+    int mrefs;
+    int prefs;
+    int x;
+
+    prev2 = l->Prev2;
+    next2 = l->Next2;
+    cur = l->Cur;
+    mrefs = l->Mrefs;
+    prefs = l->Prefs;
+    for (x = x0; x < x1; x += 4) {
+	DeintI32 c;
+	DeintI32 d;
+	DeintI32 e;
+	DeintI32 s0;
+	DeintI32 s2;
+	DeintI32 td0;
+	DeintI32 diff;
+	DeintI32 still;
+	DeintI32 b;
+	DeintI32 f;
+	DeintI32 max;
+	DeintI32 min;
+	DeintI32 lf;
+	DeintI32 hf;
+	DeintI32 sp;
+	DeintI32 interpol;
+	DeintU8x4 out;
+
+	c = DeintLoad32(cur + x + mrefs);
+	e = DeintLoad32(cur + x + prefs);
+	s0 = DeintLoad32(prev2 + x) + DeintLoad32(next2 + x);
+	d = s0 >> 1;
+	td0 = VABS(DeintLoad32(prev2 + x) - DeintLoad32(next2 + x));
+	diff = VMAX(td0 >> 1, (VABS(DeintLoad32(l->Prev + x + mrefs) - c)
+		+ VABS(DeintLoad32(l->Prev + x + prefs) - e)) >> 1);
+	diff = VMAX(diff, (VABS(DeintLoad32(l->Next + x + mrefs) - c)
+		+ VABS(DeintLoad32(l->Next + x + prefs) - e)) >> 1);
+	still = diff == 0;
+
+	b = DeintLoad32(prev2 + x + 2 * mrefs) + DeintLoad32(next2 + x +
+	    2 * mrefs);
+	f = DeintLoad32(prev2 + x + 2 * prefs) + DeintLoad32(next2 + x +
+	    2 * prefs);
+	s2 = b + f;
+	b = (b >> 1) - c;
+	f = (f >> 1) - e;
+	max = VMAX(VMAX(d - e, d - c), VMIN(b, f));
+	min = VMIN(VMIN(d - e, d - c), VMAX(b, f));
+	diff = VMAX(VMAX(diff, min), -max);
+
+	lf = DeintLoad32(cur + x + 3 * mrefs) + DeintLoad32(cur + x +
+	    3 * prefs);
+	hf = ((DeintCoefHf[0] * s0 - DeintCoefHf[1] * s2
+		+ DeintCoefHf[2] * (DeintLoad32(prev2 + x + 4 * mrefs) +
+		    DeintLoad32(next2 + x + 4 * mrefs) + DeintLoad32(prev2 +
+			x + 4 * prefs) + DeintLoad32(next2 + x +
+			4 * prefs))) >> 2)
+	    + DeintCoefLf[0] * (c + e) - DeintCoefLf[1] * lf;
+	sp = DeintCoefSp[0] * (c + e) - DeintCoefSp[1] * lf;
+	interpol = VSEL(VABS(c - e) > td0, hf, sp) >> 13;
+
+	interpol = VMIN(VMAX(interpol, d - diff), d + diff);
+	interpol = VMIN(VMAX(interpol, zero), full);
+	interpol = VSEL(still, d, interpol);
+	out = __builtin_convertvector(interpol, DeintU8x4);
+	memcpy(l->Dst + x, &out, sizeof(out));
+    }
+}
+
+    ///
+    /// Deinterlace kernels.
+    ///
+typedef struct _deint_kernels_
+{
+    const char *Name;			///< name for logs and benchmark
+    /// yadif kernel for the bytes x0 .. x1 of a line
+    void (*const Yadif)(const DeintLine *, int, int);
+    /// bwdif kernel for the bytes x0 .. x1 of a line
+    void (*const Bwdif)(const DeintLine *, int, int);
+    int Vector;				///< kernels need 8 byte blocks
+} DeintKernels;
+
+#ifdef DEINT_TEST
+
+    /// C reference kernels
+static const DeintKernels DeintKernelsC = {
+    .Name = "C",
+    .Yadif = DeintYadifC,
+    .Bwdif = DeintBwdifC,
+};
+
+#endif
+
+    /// vector kernels
+static const DeintKernels DeintKernelsVector = {
+#if defined(__x86_64__) || defined(__i386__)
+    .Name = "SSE2",
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    .Name = "NEON",
+#else
+    .Name = "vector",
+#endif
+    .Yadif = DeintYadifV,
+    .Bwdif = DeintBwdifV,
+    .Vector = 1,
+};
+
+    /// used kernels
+static const DeintKernels *DeintKernelsUsed = &DeintKernelsVector;
+
+///
+///	Interpolate one line with the kernels.
+///
+///	The vector kernels run on the inner 8 byte blocks, the C kernels
+///	do the borders, where the edge search is disabled.
+///
+///	@param kernels	deinterlace kernels
+///	@param mode	deinterlace algorithm
+///	@param l	line to interpolate
+///
+static void DeintLineRun(const DeintKernels * kernels, enum DeintMode mode,
+    const DeintLine * l)
+{
+    void (*fn)(const DeintLine *, int, int);
+    void (*ref)(const DeintLine *, int, int);
+    int x0;
+    int x1;
+
+    if (mode == DeintBwdif && l->Spatial > 1) {
+	fn = kernels->Bwdif;
+	ref = DeintBwdifC;
+    } else {
+	fn = kernels->Yadif;
+	ref = DeintYadifC;
+    }
+    if (!kernels->Vector) {
+	fn(l, 0, l->Width);
+	return;
+    }
+    // yadif edge search reads 3 neighbours + 8 byte block
+    x0 = 3 * l->Step;
+    x1 = x0 + ((l->Width - 6 * l->Step) & ~7);
+    if (x1 <= x0) {
+	ref(l, 0, l->Width);
+	return;
+    }
+    ref(l, 0, x0);
+    fn(l, x0, x1);
+    ref(l, x1, l->Width);
+}
+
+//----------------------------------------------------------------------------
+//	Frame
+//----------------------------------------------------------------------------
+
+    /// software deinterlace job
+typedef struct _deint_job_
+{
+    const DeintKernels *Kernels;	///< line kernels
+    enum DeintMode Mode;		///< deinterlace algorithm
+    const DeintPlane *Planes;		///< planes of frame
+    int PlaneN;				///< number of planes
+} DeintJob;
+
+///
+///	Deinterlace one band of lines of all planes.
+///
+///	@param job	deinterlace job
+///	@param band	band number
+///	@param bands	number of bands
+///
+static void DeintBand(const DeintJob * job, int band, int bands)
+{
+    int p;
+
+    for (p = 0; p < job->PlaneN; ++p) {
+	const DeintPlane *plane;
+	const uint8_t *prev;
+	const uint8_t *next;
+	int y0;
+	int y1;
+	int y;
+
+	plane = job->Planes + p;
+	prev = plane->Prev ? plane->Prev : plane->Cur;
+	next = plane->Next ? plane->Next : plane->Cur;
+	y0 = plane->Height * band / bands;
+	y1 = plane->Height * (band + 1) / bands;
+
+	for (y = y0; y < y1; ++y) {
+	    DeintLine line;
+	    int offset;
+	    int field;
+
+	    offset = y * plane->Pitch;
+	    // kept line of the field
+	    field = y & 1;
+	    memcpy(plane->Dst[field] + offset, plane->Cur + offset,
+		plane->Width);
+	    if (plane->Copy) {
+		memcpy(plane->Dst[!field] + offset, plane->Cur + offset,
+		    plane->Width);
+		continue;
+	    }
+	    // missing line of the other field
+	    field = !field;
+	    line.Dst = plane->Dst[field] + offset;
+	    line.Prev = prev + offset;
+	    line.Cur = plane->Cur + offset;
+	    line.Next = next + offset;
+	    line.Prev2 = (field ? plane->Cur : prev) + offset;
+	    line.Next2 = (field ? next : plane->Cur) + offset;
+	    line.Mrefs = y ? -plane->Pitch : plane->Pitch;
+	    line.Prefs = y + 1 < plane->Height ? plane->Pitch : -plane->Pitch;
+	    line.Width = plane->Width;
+	    line.Step = plane->Step;
+	    // 1: 2 lines above/below for yadif, 2: 4 lines for bwdif
+	    line.Spatial = y >= 2 && y + 2 < plane->Height;
+	    if (y >= 4 && y + 4 < plane->Height) {
+		line.Spatial = 2;
+	    }
+	    DeintLineRun(job->Kernels, job->Mode, &line);
+	}
+    }
+}
+
+//----------------------------------------------------------------------------
+//	Worker pool
+//----------------------------------------------------------------------------
+
+static pthread_t DeintThreads[DEINT_THREADS_MAX];	///< worker threads
+static int DeintThreadN = -1;		///< number of workers, -1 no init
+static pthread_mutex_t DeintMutex = PTHREAD_MUTEX_INITIALIZER;	///< pool lock
+static pthread_cond_t DeintStartCond = PTHREAD_COND_INITIALIZER;	///< new job
+static pthread_cond_t DeintDoneCond = PTHREAD_COND_INITIALIZER;	///< job done
+static const DeintJob *DeintWork;	///< current job
+static unsigned DeintGeneration;	///< job counter
+static int DeintBusy;			///< workers still running
+static char DeintQuit;			///< workers should exit
+
+    /// one caller at a time (PIP has a second decoder)
+static pthread_mutex_t DeintCallMutex = PTHREAD_MUTEX_INITIALIZER;
+
+///
+///	Worker thread, processes band 1 .. n of each job.
+///
+///	@param arg	band number
+///
+static void *DeintWorker(void *arg)
+{
+    unsigned generation;
+    int band;
+
+    band = (intptr_t) arg;
+    generation = 0;
+
+    pthread_mutex_lock(&DeintMutex);
+    for (;;) {
+	const DeintJob *job;
+
+	while (!DeintQuit && generation == DeintGeneration) {
+	    pthread_cond_wait(&DeintStartCond, &DeintMutex);
+	}
+	if (DeintQuit) {
+	    break;
+	}
+	generation = DeintGeneration;
+	job = DeintWork;
+	pthread_mutex_unlock(&DeintMutex);
+
+	DeintBand(job, band, DeintThreadN + 1);
+
+	pthread_mutex_lock(&DeintMutex);
+	if (!--DeintBusy) {
+	    pthread_cond_signal(&DeintDoneCond);
+	}
+    }
+    pthread_mutex_unlock(&DeintMutex);
+
+    return NULL;
+}
+
+///
+///	Setup software deinterlace worker threads.
+///
+///	@param threads	number of worker threads, < 0 auto: one less than
+///			the online cpus, at most #DEINT_THREADS_MAX.
+///
+void DeintInit(int threads)
+{
+    int i;
+
+    DeintExit();
+
+    if (threads < 0) {
+	threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    }
+    if (threads > DEINT_THREADS_MAX) {
+	threads = DEINT_THREADS_MAX;
+    }
+    DeintQuit = 0;
+    DeintGeneration = 0;
+    for (i = 0; i < threads; ++i) {
+	if (pthread_create(&DeintThreads[i], NULL, DeintWorker,
+		(void *)(intptr_t) (i + 1))) {
+	    break;
+	}
+	pthread_setname_np(DeintThreads[i], "softhddev deint");
+    }
+    DeintThreadN = i;
+}
+
+///
+///	Stop software deinterlace worker threads.
+///
+void DeintExit(void)
+{
+    int i;
+
+    if (DeintThreadN <= 0) {
+	DeintThreadN = -1;
+	return;
+    }
+    pthread_mutex_lock(&DeintMutex);
+    DeintQuit = 1;
+    pthread_cond_broadcast(&DeintStartCond);
+    pthread_mutex_unlock(&DeintMutex);
+    for (i = 0; i < DeintThreadN; ++i) {
+	pthread_join(DeintThreads[i], NULL);
+    }
+    DeintThreadN = -1;
+}
+
+///
+///	Name of the used deinterlace kernels.
+///
+const char *DeintKernelName(void)
+{
+    return DeintKernelsUsed->Name;
+}
+
+///
+///	Deinterlace a frame into two field frames.
+///
+///	The lines are split into bands, the caller does the first band,
+///	the workers the others.
+///
+///	@param mode	deinterlace algorithm
+///	@param planes	planes of the frame
+///	@param n	number of planes
+///
+void DeintFrame(enum DeintMode mode, const DeintPlane * planes, int n)
+{
+    DeintJob job;
+    int cancel;
+
+    job.Kernels = DeintKernelsUsed;
+    job.Mode = mode;
+    job.Planes = planes;
+    job.PlaneN = n;
+
+    // decoder threads are canceled, never while holding the pool
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+    pthread_mutex_lock(&DeintCallMutex);
+    if (DeintThreadN < 0) {
+	DeintInit(-1);
+    }
+    if (!DeintThreadN) {
+	DeintBand(&job, 0, 1);
+    } else {
+	pthread_mutex_lock(&DeintMutex);
+	DeintWork = &job;
+	DeintBusy = DeintThreadN;
+	++DeintGeneration;
+	pthread_cond_broadcast(&DeintStartCond);
+	pthread_mutex_unlock(&DeintMutex);
+
+	DeintBand(&job, 0, DeintThreadN + 1);
+
+	pthread_mutex_lock(&DeintMutex);
+	while (DeintBusy) {
+	    pthread_cond_wait(&DeintDoneCond, &DeintMutex);
+	}
+	pthread_mutex_unlock(&DeintMutex);
+    }
+    pthread_mutex_unlock(&DeintCallMutex);
+    pthread_setcancelstate(cancel, NULL);
+}
+
+#ifdef DEINT_TEST
+
+//----------------------------------------------------------------------------
+//	Deinterlace benchmark
+//----------------------------------------------------------------------------
+
+#include <getopt.h>
+#include <time.h>
+
+/**
+**	Get monotonic time in ns.
+*/
+static uint64_t DeintTestNs(void)
+{
+    struct timespec tspec;
+
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * 1000000000ULL + tspec.tv_nsec;
+}
+
+/**
+**	Fill synthetic interlaced frame.
+**
+**	A moving diagonal bar with the bottom field half a step ahead,
+**	a sine like pattern and some noise.
+**
+**	@param buf	frame buffer
+**	@param width	width in pixels
+**	@param height	height in pixels
+**	@param nv12	flag NV12 else YV12
+**	@param t	frame number
+*/
+static void DeintTestFill(uint8_t * buf, int width, int height, int nv12,
+    int t)
+{
+    unsigned seed;
+    int x;
+    int y;
+
+    seed = t + 1;
+    for (y = 0; y < height; ++y) {
+	int pos;
+
+	pos = t * 16 + (y & 1) * 8;
+	for (x = 0; x < width; ++x) {
+	    int v;
+
+	    v = ((x + y + pos) % 256 < 48) ? 235 : 16 + ((x * 7 + y) & 63);
+	    v += rand_r(&seed) % 9 - 4;
+	    buf[y * width + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+    }
+    // chroma: NV12 one interleaved plane, YV12 two planes
+    buf += width * height;
+    for (y = 0; y < height / 2; ++y) {
+	for (x = 0; x < width; ++x) {
+	    buf[y * width + x] = 128 + ((x + y * 3 + t * 5) & 31) - 16
+		+ (nv12 && (x & 1) ? 20 : 0);
+	}
+    }
+}
+
+/**
+**	Setup planes of a frame.
+**
+**	@param planes	planes to setup
+**	@param dst	two output frames
+**	@param frames	previous, current and next frame
+**	@param width	width in pixels
+**	@param height	height in pixels
+**	@param nv12	flag NV12 else YV12
+**
+**	@returns number of planes.
+*/
+static int DeintTestPlanes(DeintPlane * planes, uint8_t * const *dst,
+    uint8_t * const *frames, int width, int height, int nv12)
+{
+    size_t offset[3];
+    int n;
+    int p;
+
+    n = nv12 ? 2 : 3;
+    offset[0] = 0;
+    offset[1] = width * height;
+    offset[2] = offset[1] + width / 2 * height / 2;
+    for (p = 0; p < n; ++p) {
+	planes[p].Dst[0] = dst[0] + offset[p];
+	planes[p].Dst[1] = dst[1] + offset[p];
+	planes[p].Prev = frames[0] + offset[p];
+	planes[p].Cur = frames[1] + offset[p];
+	planes[p].Next = frames[2] + offset[p];
+	planes[p].Pitch = p && !nv12 ? width / 2 : width;
+	planes[p].Width = planes[p].Pitch;
+	planes[p].Height = p ? height / 2 : height;
+	planes[p].Step = p && nv12 ? 2 : 1;
+	planes[p].Copy = 0;
+    }
+    return n;
+}
+
+/**
+**	Print usage.
+*/
+static void PrintUsage(void)
+{
+    printf("Usage: bench-deint [-w width] [-h height] [-n frames] "
+	"[-t threads] [-y]\n"
+	"\t-w width\tframe width (default 1920)\n"
+	"\t-h height\tframe height (default 1080)\n"
+	"\t-n frames\tnumber of frames (default 100)\n"
+	"\t-t threads\tworker threads (default auto)\n"
+	"\t-y\t\tYV12 frames, default NV12\n"
+	"Compares the deinterlace kernels against the C reference.\n");
+}
+
+/**
+**	Main entry point.
+**
+**	@param argc	number of arguments
+**	@param argv	arguments vector
+**
+**	@returns -1 on failures, 1 on kernel mismatch, 0 clean exit.
+*/
+int main(int argc, char *const argv[])
+{
+    static const DeintKernels *const kernels[] = {
+	&DeintKernelsC, &DeintKernelsVector
+    };
+    static const char *const modes[] = { "yadif", "bwdif" };
+    uint8_t *frames[4];
+    uint8_t *dst[2];
+    uint8_t *ref[2];
+    DeintPlane planes[3];
+    size_t size;
+    int width;
+    int height;
+    int count;
+    int threads;
+    int nv12;
+    int failed;
+    int mode;
+    int i;
+
+    width = 1920;
+    height = 1080;
+    count = 100;
+    threads = -1;
+    nv12 = 1;
+    for (;;) {
+	switch (getopt(argc, argv, "w:h:n:t:y")) {
+	    case 'w':
+		width = atoi(optarg);
+		continue;
+	    case 'h':
+		height = atoi(optarg);
+		continue;
+	    case 'n':
+		count = atoi(optarg);
+		continue;
+	    case 't':
+		threads = atoi(optarg);
+		continue;
+	    case 'y':
+		nv12 = 0;
+		continue;
+	    case EOF:
+		break;
+	    default:
+		PrintUsage();
+		return -1;
+	}
+	break;
+    }
+    if (width < 16 || height < 16 || (width | height) & 3 || count <= 0
+	|| optind < argc) {
+	PrintUsage();
+	return -1;
+    }
+
+    size = width * height * 3 / 2;
+    for (i = 0; i < 4; ++i) {
+	frames[i] = malloc(size);
+	DeintTestFill(frames[i], width, height, nv12, i);
+    }
+    for (i = 0; i < 2; ++i) {
+	dst[i] = malloc(size);
+	ref[i] = malloc(size);
+    }
+
+    DeintInit(threads);
+    printf("%dx%d %s, %d frames, %d worker threads\n", width, height,
+	nv12 ? "NV12" : "YV12", count, DeintThreadN);
+    printf("%-6s %-6s %8s %8s %10s  %s\n", "mode", "kernel", "threads",
+	"ms/frame", "fields/s", "check");
+
+    failed = 0;
+    for (mode = DeintYadif; mode <= DeintBwdif; ++mode) {
+	unsigned k;
+	int n;
+
+	// reference output
+	n = DeintTestPlanes(planes, ref, frames, width, height, nv12);
+	DeintKernelsUsed = &DeintKernelsC;
+	DeintFrame(mode, planes, n);
+
+	for (k = 0; k < sizeof(kernels) / sizeof(*kernels); ++k) {
+	    int t;
+
+	    DeintKernelsUsed = kernels[k];
+	    for (t = 0; t < 2; ++t) {
+		uint64_t start;
+		double ms;
+		int ok;
+		int saved;
+
+		saved = DeintThreadN;
+		if (!t) {		// single threaded
+		    DeintThreadN = 0;
+		} else if (!saved) {
+		    continue;
+		}
+		n = DeintTestPlanes(planes, dst, frames, width, height, nv12);
+		DeintFrame(mode, planes, n);
+		ok = !memcmp(dst[0], ref[0], size)
+		    && !memcmp(dst[1], ref[1], size);
+		if (!ok) {
+		    failed = 1;
+		}
+
+		start = DeintTestNs();
+		for (i = 0; i < count; ++i) {
+		    // rotate the frames, as the history would
+		    n = DeintTestPlanes(planes, dst, frames + (i & 1), width,
+			height, nv12);
+		    DeintFrame(mode, planes, n);
+		}
+		ms = (double)(DeintTestNs() - start) / count / 1e6;
+		DeintThreadN = saved;
+
+		printf("%-6s %-6s %8d %8.2f %10.1f  %s\n", modes[mode],
+		    kernels[k]->Name, t ? saved + 1 : 1, ms, 2000.0 / ms,
+		    ok ? "ok" : "MISMATCH");
+	    }
+	}
+    }
+    DeintExit();
+
+    for (i = 0; i < 4; ++i) {
+	free(frames[i]);
+    }
+    for (i = 0; i < 2; ++i) {
+	free(dst[i]);
+	free(ref[i]);
+    }
+
+    return failed;
+}
+
+#endif
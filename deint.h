@@ -0,0 +1,66 @@
+///
+///	@file deint.h	@brief Software deinterlace module header file
+///
+///	Copyright (c) 2026 by the softhddevice contributors.
+///
+///	Contributor(s):
+///
+///	License: AGPLv3
+///
+///	This program is free software: you can redistribute it and/or modify
+///	it under the terms of the GNU Affero General Public License as
+///	published by the Free Software Foundation, either version 3 of the
+///	License.
+///
+///	This program is distributed in the hope that it will be useful,
+///	but WITHOUT ANY WARRANTY; without even the implied warranty of
+///	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+///	GNU Affero General Public License for more details.
+///
+///	$Id$
+//////////////////////////////////////////////////////////////////////////////
+
+/// @addtogroup Deint
+/// @{
+
+    /// software deinterlace algorithms
+enum DeintMode
+{
+    DeintYadif,				///< yadif, temporal + edge directed
+    DeintBwdif,				///< bwdif, yadif with w3fdif filters
+};
+
+    ///
+    /// One plane of a software deinterlace job.
+    ///
+    /// Dst[0] keeps the even (top field) lines of Cur and interpolates
+    /// the odd lines with Prev and Cur as temporal neighbours, Dst[1]
+    /// keeps the odd lines and interpolates with Cur and Next.  Prev
+    /// and Next can be NULL, Cur is used then.
+    ///
+typedef struct _deint_plane_
+{
+    uint8_t *Dst[2];			///< output of first and second field
+    const uint8_t *Prev;		///< previous frame or NULL
+    const uint8_t *Cur;			///< current frame
+    const uint8_t *Next;		///< next frame or NULL
+    int Pitch;				///< bytes per line of all buffers
+    int Width;				///< bytes to process per line
+    int Height;				///< number of lines
+    int Step;				///< bytes between neighbours (2 = NV12 UV)
+    int Copy;				///< flag only copy, don't deinterlace
+} DeintPlane;
+
+    /// Deinterlace a frame into two field frames.
+extern void DeintFrame(enum DeintMode, const DeintPlane *, int);
+
+    /// Name of the used deinterlace kernels.
+extern const char *DeintKernelName(void);
+
+    /// Setup software deinterlace worker threads.
+extern void DeintInit(int);
+
+    /// Stop software deinterlace worker threads.
+extern void DeintExit(void);
+
+/// @}
@@ -1,5 +1,10 @@
 #define __STL_CONFIG_H
 #include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdarg>
+#include <map>
+#include <string>
 #include "openglosd.h"
 
 extern "C"
@@ -115,11 +120,73 @@ uniform sampler2D glyphTexture; \
 \
 void main() \
 {  \
-    vec4 sampled = vec4(1.0, 1.0, 1.0, texture(glyphTexture, TexCoords).r); \
+    vec2 atlasCoords = TexCoords / vec2(textureSize(glyphTexture, 0)); \
+    vec4 sampled = vec4(1.0, 1.0, 1.0, texture(glyphTexture, atlasCoords).r); \
     color = textColor * sampled; \
 } \
 ";
 
+// Ellipses and slopes are drawn from one quad: the signed distance to the
+// outline gives the coverage of each pixel, which replaces the framebuffer
+// color proportionally (dual source blending, core since OpenGL 3.3).
+const char *shapeVertexShader =
+"#version 330 core \n\
+\
+layout (location = 0) in vec2 position; \
+out vec2 local; \
+uniform mat4 projection; \
+uniform vec2 origin; \
+\
+void main() \
+{ \
+    gl_Position = projection * vec4(position.x, position.y, 0.0, 1.0); \
+    local = position - origin; \
+} \
+";
+
+const char *shapeFragmentShader =
+"#version 330 core \n\
+\
+in vec2 local; \
+layout (location = 0, index = 0) out vec4 color; \
+layout (location = 0, index = 1) out vec4 coverage; \
+uniform vec4 inColor; \
+uniform int shape; \
+uniform int mode; \
+uniform vec2 size; \
+uniform vec2 center; \
+uniform vec2 radius; \
+\
+void main() \
+{ \
+    float f; \
+    if (shape == 0) { \
+        f = 1.0 - length((local - center) / radius); \
+        if (mode != 0) \
+            f = -f; \
+    } else if ((mode & 4) == 0) { \
+        float c = cos(3.14159265 * local.x / size.x); \
+        if ((mode & 2) != 0) \
+            c = -c; \
+        f = local.y - size.y * 0.5 * (1.0 + c); \
+        if ((mode & 1) != 0) \
+            f = -f; \
+    } else { \
+        float c = cos(3.14159265 * local.y / size.y); \
+        if ((mode & 2) != 0) \
+            c = -c; \
+        f = local.x - size.x * 0.5 * (1.0 + c); \
+        if (mode == 5 || mode == 6) \
+            f = -f; \
+    } \
+    float a = clamp(f / max(fwidth(f), 0.0001) + 0.5, 0.0, 1.0); \
+    if (a <= 0.0) \
+        discard; \
+    color = inColor; \
+    coverage = vec4(a); \
+} \
+";
+
 static cShader *Shaders[stCount];
 
 void cShader::Use(void) {
@@ -145,6 +212,10 @@ bool cShader::Load(eShaderType type) {
             vertexCode = textVertexShader;
             fragmentCode = textFragmentShader;
             break;
+        case stShape:
+            vertexCode = shapeVertexShader;
+            fragmentCode = shapeFragmentShader;
+            break;
         default:
             esyslog("[softhddev]unknown shader type\n");
             break;
@@ -234,66 +305,24 @@ bool cShader::CheckCompileErrors(GLuint object, bool program) {
     return true;
 }
 
-#define KERNING_UNKNOWN  (-10000)
 /****************************************************************************************
 * cOglGlyph
 ****************************************************************************************/
-cOglGlyph::cOglGlyph(uint charCode, FT_BitmapGlyph ftGlyph) {
+cOglGlyph::cOglGlyph(uint charCode, FT_BitmapGlyph ftGlyph, int atlasX, int atlasY) {
     this->charCode = charCode;
     bearingLeft = ftGlyph->left;
     bearingTop = ftGlyph->top;
     width = ftGlyph->bitmap.width;
     height = ftGlyph->bitmap.rows;
     advanceX = ftGlyph->root.advance.x >> 16;   //value in 1/2^16 pixel
-    LoadTexture(ftGlyph);
+    this->atlasX = atlasX;
+    this->atlasY = atlasY;
 }
 
 cOglGlyph::~cOglGlyph(void) {
 
 }
 
-int cOglGlyph::GetKerningCache(uint prevSym) {
-    for (int i = kerningCache.Size(); --i > 0; ) {
-        if (kerningCache[i].prevSym == prevSym)
-            return kerningCache[i].kerning;
-    }
-    return KERNING_UNKNOWN;
-}
-
-void cOglGlyph::SetKerningCache(uint prevSym, int kerning) {
-    kerningCache.Append(tKerning(prevSym, kerning));
-}
-
-void cOglGlyph::BindTexture(void) {
-    glBindTexture(GL_TEXTURE_2D, texture);
-}
-
-void cOglGlyph::LoadTexture(FT_BitmapGlyph ftGlyph) {
-    // Disable byte-alignment restriction
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        GL_RED,
-        ftGlyph->bitmap.width,
-        ftGlyph->bitmap.rows,
-        0,
-        GL_RED,
-        GL_UNSIGNED_BYTE,
-        ftGlyph->bitmap.buffer
-    );
-    // Set texture options
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-}
-
-
 /****************************************************************************************
 * cOglFont
 ****************************************************************************************/
@@ -301,10 +330,20 @@ FT_Library cOglFont::ftLib = 0;
 cList<cOglFont> *cOglFont::fonts = 0;
 bool cOglFont::initiated = false;
 
+#define GLYPH_ATLAS_WIDTH   1024
+#define GLYPH_ATLAS_HEIGHT  128
+#define GLYPH_ATLAS_PADDING 1
+
 cOglFont::cOglFont(const char *fontName, int charHeight) : name(fontName) {
     size = charHeight;
     height = 0;
     bottom = 0;
+    atlas = 0;
+    atlasWidth = 0;
+    atlasHeight = 0;
+    atlasX = GLYPH_ATLAS_PADDING;
+    atlasY = GLYPH_ATLAS_PADDING;
+    atlasRowHeight = 0;
 
     int error = FT_New_Face(ftLib, fontName, 0, &face);
     if (error)
@@ -316,6 +355,10 @@ cOglFont::cOglFont(const char *fontName, int charHeight) : name(fontName) {
 }
 
 cOglFont::~cOglFont(void) {
+    for (auto &it : glyphCache)
+        delete it.second;
+    if (atlas)
+        glDeleteTextures(1, &atlas);
     FT_Done_Face(face);
 }
 
@@ -358,11 +401,12 @@ cOglGlyph* cOglFont::Glyph(uint charCode) const {
         charCode = 0x20;
 
     // Lookup in cache:
-    for (cOglGlyph *g = glyphCache.First(); g; g = glyphCache.Next(g)) {
-        if (g->CharCode() == charCode) {
-            return g;
-        }
+    auto it = glyphCache.find(charCode);
+    if (it != glyphCache.end()) {
+        OglStats.glyphHits++;
+        return it->second;
     }
+    OglStats.glyphMisses++;
 
     FT_UInt glyph_index = FT_Get_Char_Index(face, charCode);
 
@@ -408,8 +452,14 @@ cOglGlyph* cOglFont::Glyph(uint charCode) const {
         return NULL;        
     }
     
-    cOglGlyph *Glyph = new cOglGlyph(charCode, (FT_BitmapGlyph)ftGlyph);
-    glyphCache.Add(Glyph);
+    int x, y;
+    if (!AtlasPlace((FT_BitmapGlyph)ftGlyph, x, y)) {
+        esyslog("[softhddev]glyph atlas of %s %d is full", *name, size);
+        FT_Done_Glyph(ftGlyph);
+        return NULL;
+    }
+    cOglGlyph *Glyph = new cOglGlyph(charCode, (FT_BitmapGlyph)ftGlyph, x, y);
+    glyphCache[charCode] = Glyph;
     FT_Done_Glyph(ftGlyph);
 
     return Glyph;
@@ -417,20 +467,209 @@ cOglGlyph* cOglFont::Glyph(uint charCode) const {
 
 int cOglFont::Kerning(cOglGlyph *glyph, uint prevSym) const {
     int kerning = 0;
-    if (glyph && prevSym) {
-        kerning = glyph->GetKerningCache(prevSym);
-        if (kerning == KERNING_UNKNOWN) {
-            FT_Vector delta;
-            FT_UInt glyph_index = FT_Get_Char_Index(face, glyph->CharCode());
-            FT_UInt glyph_index_prev = FT_Get_Char_Index(face, prevSym);
-            FT_Get_Kerning(face, glyph_index_prev, glyph_index, FT_KERNING_DEFAULT, &delta);
-            kerning = delta.x / 64;
-            glyph->SetKerningCache(prevSym, kerning);
-        }
+    if (glyph && prevSym && FT_HAS_KERNING(face)) {
+        uint64_t key = (uint64_t)prevSym << 32 | glyph->CharCode();
+        auto it = kerningCache.find(key);
+        if (it != kerningCache.end())
+            return it->second;
+        FT_Vector delta;
+        FT_UInt glyph_index = FT_Get_Char_Index(face, glyph->CharCode());
+        FT_UInt glyph_index_prev = FT_Get_Char_Index(face, prevSym);
+        FT_Get_Kerning(face, glyph_index_prev, glyph_index, FT_KERNING_DEFAULT, &delta);
+        kerning = delta.x / 64;
+        kerningCache[key] = kerning;
     }
     return kerning;
 }
 
+void cOglFont::BindAtlas(void) const {
+    glBindTexture(GL_TEXTURE_2D, atlas);
+}
+
+// Double the atlas height, the glyphs keep their pixel position.
+bool cOglFont::AtlasGrow(void) const {
+    GLint maxTextureSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+    int newHeight = atlasHeight ? atlasHeight * 2 : GLYPH_ATLAS_HEIGHT;
+    if (GLYPH_ATLAS_WIDTH > maxTextureSize || newHeight > maxTextureSize)
+        return false;
+
+    atlasWidth = GLYPH_ATLAS_WIDTH;
+    atlasHeight = newHeight;
+    atlasBitmap.resize(atlasWidth * atlasHeight, 0);
+
+    if (!atlas) {
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    } else
+        glBindTexture(GL_TEXTURE_2D, atlas);
+    // Disable byte-alignment restriction
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, atlasWidth, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, &atlasBitmap[0]);
+    OglStats.uploadBytes += atlasWidth * atlasHeight;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+// Place glyph bitmap on the next free shelf of the atlas and upload it.
+bool cOglFont::AtlasPlace(FT_BitmapGlyph ftGlyph, int &x, int &y) const {
+    int width = ftGlyph->bitmap.width;
+    int rows = ftGlyph->bitmap.rows;
+
+    x = 0;
+    y = 0;
+    if (!width || !rows)        // nothing to draw, e.g. space
+        return true;
+    if (width + 2 * GLYPH_ATLAS_PADDING > GLYPH_ATLAS_WIDTH)
+        return false;
+
+    if (atlasX + width + GLYPH_ATLAS_PADDING > GLYPH_ATLAS_WIDTH) {
+        atlasX = GLYPH_ATLAS_PADDING;
+        atlasY += atlasRowHeight + GLYPH_ATLAS_PADDING;
+        atlasRowHeight = 0;
+    }
+    while (atlasY + rows + GLYPH_ATLAS_PADDING > atlasHeight) {
+        if (!AtlasGrow())
+            return false;
+    }
+
+    x = atlasX;
+    y = atlasY;
+    for (int row = 0; row < rows; row++)
+        memcpy(&atlasBitmap[(y + row) * atlasWidth + x], ftGlyph->bitmap.buffer + row * ftGlyph->bitmap.pitch, width);
+    atlasX += width + GLYPH_ATLAS_PADDING;
+    if (rows > atlasRowHeight)
+        atlasRowHeight = rows;
+
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, atlasWidth);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, rows, GL_RED, GL_UNSIGNED_BYTE, &atlasBitmap[y * atlasWidth + x]);
+    OglStats.uploadBytes += width * rows;
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+/****************************************************************************************
+* cOglTextureCache
+****************************************************************************************/
+std::unordered_map<uint64_t, cOglTextureCache::sEntry> cOglTextureCache::entries;
+std::list<uint64_t> cOglTextureCache::lru;
+long cOglTextureCache::memUsed = 0;
+long cOglTextureCache::maxSize = 0;
+GLuint cOglTextureCache::pbo = 0;
+
+// The whole image is hashed, a sampled hash could hand out a stale logo.
+uint64_t cOglTextureCache::Hash(const tColor *argb, GLint width, GLint height) {
+    uint64_t hash = ((uint64_t)width << 32 | (uint32_t)height) * 0x9E3779B97F4A7C15ull;
+    size_t count = (size_t)width * height;
+    size_t i;
+
+    for (i = 0; i + 2 <= count; i += 2) {
+        uint64_t v;
+
+        memcpy(&v, argb + i, sizeof(v));
+        hash = (hash ^ v) * 0x100000001B3ull;
+        hash ^= hash >> 32;
+    }
+    if (i < count)
+        hash = (hash ^ argb[i]) * 0x100000001B3ull;
+
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+GLuint cOglTextureCache::Upload(const tColor *argb, GLint width, GLint height) {
+    GLsizeiptr size = (GLsizeiptr)width * height * sizeof(tColor);
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (GLEW_ARB_texture_storage)
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+
+    // stream the pixels through a pixel buffer, the driver copies them
+    // to the texture without stalling this thread
+    if (!pbo)
+        glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst) {
+        memcpy(dst, argb, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, (GLvoid *)0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, argb);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    OglStats.uploadBytes += size;
+    return texture;
+}
+
+/**
+**  Get the texture for an image, uploads it only if these pixels are not
+**  cached yet.  The texture stays valid until the next call.
+*/
+GLuint cOglTextureCache::Get(const tColor *argb, GLint width, GLint height) {
+    uint64_t key = Hash(argb, width, height);
+
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return it->second.texture;
+    }
+
+    long bytes = (long)width * height * sizeof(tColor);
+    while (memUsed + bytes > maxSize && !lru.empty()) {
+        auto old = entries.find(lru.back());
+        glDeleteTextures(1, &old->second.texture);
+        memUsed -= old->second.bytes;
+        entries.erase(old);
+        lru.pop_back();
+    }
+
+    sEntry entry;
+    entry.texture = Upload(argb, width, height);
+    entry.bytes = bytes;
+    lru.push_front(key);
+    entry.lru = lru.begin();
+    entries[key] = entry;
+    memUsed += bytes;
+    return entry.texture;
+}
+
+void cOglTextureCache::Cleanup(void) {
+    for (auto &it : entries)
+        glDeleteTextures(1, &it.second.texture);
+    entries.clear();
+    lru.clear();
+    memUsed = 0;
+    if (pbo)
+        glDeleteBuffers(1, &pbo);
+    pbo = 0;
+}
+
 /****************************************************************************************
 * cOglFb
 ****************************************************************************************/
@@ -506,9 +745,38 @@ void cOglFb::Blit(GLint destX1, GLint destY1, GLint destX2, GLint destY2) {
     glFlush();
 }
 
+// Blit the Source rectangle (osd coordinates) flipped like the full Blit above.
+void cOglFb::Blit(const cRect &Source, GLint destX, GLint destY) {
+    GLint srcX1 = Source.X();
+    GLint srcX2 = Source.X() + Source.Width();
+    GLint srcY1 = height - Source.Y() - Source.Height();
+    GLint srcY2 = height - Source.Y();
+    glBlitFramebuffer(srcX1, srcY1, srcX2, srcY2,
+                      destX + srcX1, destY + Source.Y() + Source.Height(), destX + srcX2, destY + Source.Y(),
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glFlush();
+}
+
+// Limit drawing into the bound framebuffer to Clip (osd coordinates),
+// an empty Clip disables the limit.
+void cOglFb::Scissor(const cRect &Clip) {
+    if (Clip.IsEmpty()) {
+        glDisable(GL_SCISSOR_TEST);
+        return;
+    }
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(Clip.X(), height - Clip.Y() - Clip.Height(), Clip.Width(), Clip.Height());
+}
+
 /****************************************************************************************
 * cOglOutputFb
 ****************************************************************************************/
+// Without VDPAU or CUVID interop the OSD is rendered offscreen and read
+// back into the OSD of the video module (VA-API, noop).
+static bool OglOffscreen(void) {
+    return !VideoIsDriverVdpau() && !VideoIsDriverCuvid();
+}
+
 cOglOutputFb::cOglOutputFb(GLint width, GLint height) : cOglFb(width, height, width, height) {
     surface = 0;
 }
@@ -562,7 +830,6 @@ bool cOglOutputFb::Init(void) {
     }
 #endif
     glBindTexture(GL_TEXTURE_2D, texture);
-#ifdef USE_VDPAU
     if (!VideoIsDriverVdpau()) {
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -570,7 +837,6 @@ bool cOglOutputFb::Init(void) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     }
-#endif
     glGenFramebuffers(1, &fb);
     glBindFramebuffer(GL_FRAMEBUFFER, fb);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
@@ -599,6 +865,31 @@ void cOglOutputFb::Unbind(void) {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+/**
+**  Offscreen output: read an area back and stage it for the OSD of the
+**  video module.  The display thread uploads it, GLX must not be used
+**  from this thread.  The rows of the output framebuffer are top down.
+*/
+void cOglOutputFb::CopyToVideo(GLint x, GLint y, GLint w, GLint h) {
+    GLint x2 = std::min(x + w, width);
+    GLint y2 = std::min(y + h, height);
+
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    w = x2 - x;
+    h = y2 - y;
+    if (w <= 0 || h <= 0)
+        return;
+
+    pixels.resize(w * h);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fb);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(x, y, w, h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &pixels[0]);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    VideoOsdStageARGB(0, 0, w, h, w * sizeof(tColor), (const uint8_t *)&pixels[0], x, y);
+}
+
 /****************************************************************************************
 * cOglVb
 ****************************************************************************************/
@@ -611,6 +902,7 @@ cOglVb::cOglVb(int type) {
     sizeVertex1 = 0;
     sizeVertex2 = 0;
     numVertices = 0;
+    maxVertices = 0;
     drawMode = 0;
 }
 
@@ -633,20 +925,13 @@ bool cOglVb::Init(void) {
         numVertices = 4;
         drawMode = GL_TRIANGLE_FAN;
         shader = stRect;
-    } else if (type == vbEllipse) {
-        //Ellipse VBO definition
-        sizeVertex1 = 2;
-        sizeVertex2 = 0;
-        numVertices = 182;
-        drawMode = GL_TRIANGLE_FAN;
-        shader = stRect;
-    } else if (type == vbSlope) {
-        //Slope VBO definition
+    } else if (type == vbShape) {
+        //Ellipse and slope VBO definition, one quad
         sizeVertex1 = 2;
         sizeVertex2 = 0;
-        numVertices = 102;
+        numVertices = 4;
         drawMode = GL_TRIANGLE_FAN;
-        shader = stRect;
+        shader = stShape;
     } else if (type == vbText) {
         //Text VBO definition
         sizeVertex1 = 2;
@@ -661,6 +946,7 @@ bool cOglVb::Init(void) {
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * (sizeVertex1 + sizeVertex2) * numVertices, NULL, GL_DYNAMIC_DRAW);
+    maxVertices = numVertices;
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, sizeVertex1, GL_FLOAT, GL_FALSE, (sizeVertex1 + sizeVertex2) * sizeof(GLfloat), (GLvoid*)0);
@@ -696,6 +982,13 @@ void cOglVb::DisableBlending(void) {
     glDisable(GL_BLEND);
 }
 
+// the coverage of the second fragment output mixes all channels, a fully
+// covered pixel is replaced like without blending
+void cOglVb::EnableCoverageBlending(void) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC1_ALPHA, GL_ONE_MINUS_SRC1_ALPHA);
+}
+
 void cOglVb::SetShaderColor(GLint color) {
     glm::vec4 col;
     ConvertColor(color, col);
@@ -715,6 +1008,11 @@ void cOglVb::SetVertexData(GLfloat *vertices, int count) {
     if (count == 0)
         count = numVertices;
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    // batched text can need more than the default vertices
+    if (count > maxVertices) {
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * (sizeVertex1 + sizeVertex2) * count, NULL, GL_DYNAMIC_DRAW);
+        maxVertices = count;
+    }
     glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * (sizeVertex1 + sizeVertex2) * count, vertices);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
@@ -730,6 +1028,35 @@ void cOglVb::DrawArrays(int count) {
 /****************************************************************************************
 * cOpenGLCmd
 ****************************************************************************************/
+// Commands are bump allocated from a preallocated arena.  The OSD threads
+// allocate them in order and the worker thread deletes them in the same
+// order, so the next slot is free again in practice; oversized commands
+// and a full arena fall back to the heap.
+#define OGL_CMD_SLOT_SIZE 128
+#define OGL_CMD_ARENA_SLOTS (OGL_CMDQUEUE_SIZE + 64)
+
+alignas(16) static char cmdArena[OGL_CMD_ARENA_SLOTS][OGL_CMD_SLOT_SIZE];
+static std::atomic<bool> cmdArenaUsed[OGL_CMD_ARENA_SLOTS];
+static std::atomic<unsigned> cmdArenaNext(0);
+
+void *cOglCmd::operator new(size_t size) {
+    if (size <= OGL_CMD_SLOT_SIZE) {
+        unsigned slot = cmdArenaNext.fetch_add(1, std::memory_order_relaxed) % OGL_CMD_ARENA_SLOTS;
+        if (!cmdArenaUsed[slot].exchange(true, std::memory_order_acquire))
+            return cmdArena[slot];
+    }
+    return ::operator new(size);
+}
+
+void cOglCmd::operator delete(void *ptr) {
+    char *p = (char *)ptr;
+    if (p >= cmdArena[0] && p < cmdArena[0] + sizeof(cmdArena)) {
+        cmdArenaUsed[(p - cmdArena[0]) / OGL_CMD_SLOT_SIZE].store(false, std::memory_order_release);
+        return;
+    }
+    ::operator delete(ptr);
+}
+
 //------------------ cOglCmdInitOutputFb --------------------
 cOglCmdInitOutputFb::cOglCmdInitOutputFb(cOglOutputFb *oFb) : cOglCmd(NULL) {
     this->oFb = oFb;
@@ -765,8 +1092,9 @@ if(fb)
 }
 
 //------------------ cOglCmdRenderFbToBufferFb --------------------
-cOglCmdRenderFbToBufferFb::cOglCmdRenderFbToBufferFb(cOglFb *fb, cOglFb *buffer, GLint x, GLint y, GLint transparency, GLint drawPortX, GLint drawPortY) : cOglCmd(fb) {
+cOglCmdRenderFbToBufferFb::cOglCmdRenderFbToBufferFb(cOglFb *fb, cOglFb *buffer, GLint x, GLint y, GLint transparency, GLint drawPortX, GLint drawPortY, const cRect &clip) : cOglCmd(fb) {
     this->buffer = buffer;
+    this->clip = clip;
     this->x = (GLfloat)x;
     this->y = (GLfloat)y;
     this->drawPortX = (GLfloat)drawPortX;
@@ -809,44 +1137,57 @@ bool cOglCmdRenderFbToBufferFb::Execute(void) {
     buffer->Bind();
     if (!fb->BindTexture())
         return false;
+    buffer->Scissor(clip);
     VertexBuffers[vbTexture]->Bind();
     VertexBuffers[vbTexture]->SetVertexData(quadVertices);
     VertexBuffers[vbTexture]->DrawArrays();
     VertexBuffers[vbTexture]->Unbind();
+    buffer->Scissor(cRect::Null);
     buffer->Unbind();
 
     return true;
 }
 
 //------------------ cOglCmdCopyBufferToOutputFb --------------------
-cOglCmdCopyBufferToOutputFb::cOglCmdCopyBufferToOutputFb(cOglFb *fb, cOglOutputFb *oFb, GLint x, GLint y) : cOglCmd(fb) {
+cOglCmdCopyBufferToOutputFb::cOglCmdCopyBufferToOutputFb(cOglFb *fb, cOglOutputFb *oFb, GLint x, GLint y, const cRect &clip) : cOglCmd(fb) {
     this->oFb = oFb;
     this->x = x;
     this->y = y;
+    this->clip = clip;
 }
 
 bool cOglCmdCopyBufferToOutputFb::Execute(void) {
     
     fb->BindRead();
     oFb->BindWrite();
-    fb->Blit(x, y + fb->Height(), x + fb->Width(), y);
+    if (clip.IsEmpty())
+        fb->Blit(x, y + fb->Height(), x + fb->Width(), y);
+    else
+        fb->Blit(clip, x, y);
     oFb->Unbind();
 
-    ActivateOsd();
+    if (OglOffscreen()) {
+        cRect area = clip.IsEmpty() ? cRect(0, 0, fb->Width(), fb->Height()) : clip;
+        oFb->CopyToVideo(x + area.X(), y + area.Y(), area.Width(), area.Height());
+    } else
+        ActivateOsd();
     return true;
 }
 
 //------------------ cOglCmdFill --------------------
-cOglCmdFill::cOglCmdFill(cOglFb *fb, GLint color) : cOglCmd(fb) {
+cOglCmdFill::cOglCmdFill(cOglFb *fb, GLint color, const cRect &clip) : cOglCmd(fb) {
     this->color = color;
+    this->clip = clip;
 }
 
 bool cOglCmdFill::Execute(void) {
     glm::vec4 col;
     ConvertColor(color, col);
     fb->Bind();
+    fb->Scissor(clip);
     glClearColor(col.r, col.g, col.b, col.a);
     glClear(GL_COLOR_BUFFER_BIT);
+    fb->Scissor(cRect::Null);
     fb->Unbind();
     return true;
 }
@@ -890,6 +1231,38 @@ bool cOglCmdDrawRectangle::Execute(void) {
 }
 
 //------------------ cOglCmdDrawEllipse --------------------
+static void DrawShape(cOglFb *fb, GLint x, GLint y, GLint width, GLint height, GLint color,
+                      GLint shape, GLint mode, GLfloat centerX = 0.0f, GLfloat centerY = 0.0f,
+                      GLfloat radiusX = 1.0f, GLfloat radiusY = 1.0f) {
+    GLfloat x2 = x + width;
+    GLfloat y2 = y + height;
+    GLfloat vertices[] = {
+        (GLfloat)x, (GLfloat)y,
+        x2,         (GLfloat)y,
+        x2,         y2,
+        (GLfloat)x, y2
+    };
+
+    VertexBuffers[vbShape]->ActivateShader();
+    VertexBuffers[vbShape]->SetShaderColor(color);
+    VertexBuffers[vbShape]->SetShaderProjectionMatrix(fb->Width(), fb->Height());
+    Shaders[stShape]->SetVector2f("origin", x, y);
+    Shaders[stShape]->SetInteger("shape", shape);
+    Shaders[stShape]->SetInteger("mode", mode);
+    Shaders[stShape]->SetVector2f("size", width, height);
+    Shaders[stShape]->SetVector2f("center", centerX, centerY);
+    Shaders[stShape]->SetVector2f("radius", radiusX, radiusY);
+
+    fb->Bind();
+    VertexBuffers[vbShape]->EnableCoverageBlending();
+    VertexBuffers[vbShape]->Bind();
+    VertexBuffers[vbShape]->SetVertexData(vertices);
+    VertexBuffers[vbShape]->DrawArrays();
+    VertexBuffers[vbShape]->Unbind();
+    VertexBuffers[vbShape]->EnableBlending();
+    fb->Unbind();
+}
+
 ///quadrants:
 ///< 0       draws the entire ellipse
 ///< 1..4    draws only the first, second, third or fourth quadrant, respectively
@@ -905,174 +1278,63 @@ cOglCmdDrawEllipse::cOglCmdDrawEllipse( cOglFb *fb, GLint x, GLint y, GLint widt
 }
 
 bool cOglCmdDrawEllipse::Execute(void) {
-    int numVertices = 0;
-    GLfloat *vertices = NULL;
-
-    switch (quadrants) {
-        case 0:
-            vertices = CreateVerticesFull(numVertices);
-            break;
-        case 1: case 2: case 3: case 4: case -1: case -2: case -3: case -4:
-            vertices = CreateVerticesQuadrant(numVertices);
-            break;
-        case 5: case 6: case 7: case 8:
-            vertices = CreateVerticesHalf(numVertices);
-            break;
-        default:
-            break;
-    }
-
-    VertexBuffers[vbEllipse]->ActivateShader();
-    VertexBuffers[vbEllipse]->SetShaderColor(color);
-    VertexBuffers[vbEllipse]->SetShaderProjectionMatrix(fb->Width(), fb->Height());
-
-    //not antialiased
-    fb->Bind();
-    VertexBuffers[vbEllipse]->DisableBlending();
-    VertexBuffers[vbEllipse]->Bind();
-    VertexBuffers[vbEllipse]->SetVertexData(vertices, numVertices);
-    VertexBuffers[vbEllipse]->DrawArrays(numVertices);
-    VertexBuffers[vbEllipse]->Unbind();
-    VertexBuffers[vbEllipse]->EnableBlending();
-    fb->Unbind();
-
-    delete[] vertices;
-    return true;
-}
-
-GLfloat *cOglCmdDrawEllipse::CreateVerticesFull(int &numVertices) {
-    int size = 364;
-    numVertices = size/2;
-    GLfloat radiusX = (GLfloat)width/2;
-    GLfloat radiusY = (GLfloat)height/2;
-    GLfloat *vertices = new GLfloat[size];
-    vertices[0] = x + radiusX;
-    vertices[1] = y + radiusY;
-    for (int i=0; i <= 180; i++) {
-        vertices[2*i+2] = x + radiusX + (GLfloat)cos(2*i * M_PI / 180.0f)*radiusX;
-        vertices[2*i+3] = y + radiusY - (GLfloat)sin(2*i * M_PI / 180.0f)*radiusY;
-    }
-    return vertices;
-}
-
-GLfloat *cOglCmdDrawEllipse::CreateVerticesQuadrant(int &numVertices) {
-    int size = 94;
-    numVertices = size/2;
+    GLfloat centerX, centerY;
     GLfloat radiusX = (GLfloat)width;
     GLfloat radiusY = (GLfloat)height;
-    GLint transX = 0;
-    GLint transY = 0;
-    GLint startAngle = 0;
-    GLfloat *vertices = new GLfloat[size];
+
+    if (width <= 0 || height <= 0)
+        return true;
+
+    //center of the ellipse relative to the rectangle
     switch (quadrants) {
-        case 1:
-            vertices[0] = x;
-            vertices[1] = y + height;
-            transY = radiusY;
-            break;
-        case 2:
-            vertices[0] = x + width;
-            vertices[1] = y + height;
-            transX = radiusX;
-            transY = radiusY;
-            startAngle = 90;
-            break;
-        case 3:
-            vertices[0] = x + width;
-            vertices[1] = y;
-            transX = radiusX;
-            startAngle = 180;
+        case 0:
+            radiusX = (GLfloat)width / 2;
+            radiusY = (GLfloat)height / 2;
+            centerX = radiusX;
+            centerY = radiusY;
             break;
-        case 4:
-            vertices[0] = x;
-            vertices[1] = y;
-            startAngle = 270;
+        case 1: case -1:
+            centerX = 0;
+            centerY = height;
             break;
-        case -1:
-            vertices[0] = x + width;
-            vertices[1] = y;
-            transY = radiusY;
+        case 2: case -2:
+            centerX = width;
+            centerY = height;
             break;
-        case -2:
-            vertices[0] = x;
-            vertices[1] = y;
-            transX = radiusX;
-            transY = radiusY;
-            startAngle = 90;
+        case 3: case -3:
+            centerX = width;
+            centerY = 0;
             break;
-        case -3:
-            vertices[0] = x;
-            vertices[1] = y + height;
-            transX = radiusX;
-            startAngle = 180;
+        case 4: case -4:
+            centerX = 0;
+            centerY = 0;
             break;
-        case -4:
-            vertices[0] = x + width;
-            vertices[1] = y + height;
-            startAngle = 270;
-            break;            
-        default:
-            break;
-    }
-    for (int i=0; i <= 45; i++) {
-        vertices[2*i+2] = x + transX + (GLfloat)cos((2*i + startAngle) * M_PI / 180.0f)*radiusX;
-        vertices[2*i+3] = y + transY - (GLfloat)sin((2*i + startAngle) * M_PI / 180.0f)*radiusY;
-    }
-    return vertices;
-}
-
-GLfloat *cOglCmdDrawEllipse::CreateVerticesHalf(int &numVertices) {
-    int size = 184;
-    numVertices = size/2;
-    GLfloat radiusX = 0.0f;
-    GLfloat radiusY = 0.0f;
-    GLint transX = 0;
-    GLint transY = 0;
-    GLint startAngle = 0;    
-    GLfloat *vertices = new GLfloat[size];
-    switch (quadrants) {
         case 5:
-            radiusX = (GLfloat)width;
-            radiusY = (GLfloat)height/2;
-            vertices[0] = x;
-            vertices[1] = y + radiusY;
-            startAngle = 270;
-            transY = radiusY;
+            radiusY = (GLfloat)height / 2;
+            centerX = 0;
+            centerY = radiusY;
             break;
         case 6:
-            radiusX = (GLfloat)width/2;
-            radiusY = (GLfloat)height;
-            vertices[0] = x + radiusX;
-            vertices[1] = y + radiusY;
-            startAngle = 0;
-            transX = radiusX;
-            transY = radiusY;
+            radiusX = (GLfloat)width / 2;
+            centerX = radiusX;
+            centerY = height;
             break;
         case 7:
-            radiusX = (GLfloat)width;
-            radiusY = (GLfloat)height/2;
-            vertices[0] = x + radiusX;
-            vertices[1] = y + radiusY;
-            startAngle = 90;
-            transX = radiusX;
-            transY = radiusY;
+            radiusY = (GLfloat)height / 2;
+            centerX = width;
+            centerY = radiusY;
             break;
         case 8:
-            radiusX = (GLfloat)width/2;
-            radiusY = (GLfloat)height;
-            vertices[0] = x + radiusX;
-            vertices[1] = y;
-            startAngle = 180;
-            transX = radiusX;
+            radiusX = (GLfloat)width / 2;
+            centerX = radiusX;
+            centerY = 0;
             break;
         default:
-            break;
-    }
-    for (int i=0; i <= 90; i++) {
-        vertices[2*i+2] = x + transX + (GLfloat)cos((2*i + startAngle) * M_PI / 180.0f)*radiusX;
-        vertices[2*i+3] = y + transY - (GLfloat)sin((2*i + startAngle) * M_PI / 180.0f)*radiusY;
+            return true;
     }
-    return vertices;
+
+    DrawShape(fb, x, y, width, height, color, 0, quadrants < 0, centerX, centerY, radiusX, radiusY);
+    return true;
 }
 
 //------------------ cOglCmdDrawSlope --------------------
@@ -1095,66 +1357,10 @@ cOglCmdDrawSlope::cOglCmdDrawSlope( cOglFb *fb, GLint x, GLint y, GLint width, G
 }
 
 bool cOglCmdDrawSlope::Execute(void) {
-    bool falling  = type & 0x02;
-    bool vertical = type & 0x04;
-
-    int steps = 100;
-    if (width < 100)
-        steps = 25;
-    int numVertices = steps + 2;
-    GLfloat *vertices = new GLfloat[numVertices*2];
-
-    switch (type) {
-        case 0: case 4:
-            vertices[0] = (GLfloat)(x + width);
-            vertices[1] = (GLfloat)(y + height);
-            break;
-        case 1: case 5:
-            vertices[0] = (GLfloat)x;
-            vertices[1] = (GLfloat)y;
-            break;
-        case 2: case 6:
-            vertices[0] = (GLfloat)x;
-            vertices[1] = (GLfloat)(y + height);
-            break;
-        case 3: case 7:
-            vertices[0] = (GLfloat)(x + width);
-            vertices[1] = (GLfloat)y;
-            break;
-        default:
-            vertices[0] = (GLfloat)(x);
-            vertices[1] = (GLfloat)(y);
-            break;
-    }
+    if (width <= 0 || height <= 0 || type < 0 || type > 7)
+        return true;
 
-    for (int i = 0; i <= steps; i++) {
-        GLfloat c = cos(i * M_PI / steps);
-        if (falling)
-            c = -c;
-        if (vertical) {
-            vertices[2*i+2] = (GLfloat)x + (GLfloat)width / 2.0f + (GLfloat)width * c / 2.0f;
-            vertices[2*i+3] = (GLfloat)y + (GLfloat)i * ((GLfloat)height) / steps ;
-        } else {
-            vertices[2*i+2] = (GLfloat)x + (GLfloat)i * ((GLfloat)width) / steps ;
-            vertices[2*i+3] = (GLfloat)y + (GLfloat)height / 2.0f + (GLfloat)height * c / 2.0f;
-        }
-    }
-
-    VertexBuffers[vbSlope]->ActivateShader();
-    VertexBuffers[vbSlope]->SetShaderColor(color);
-    VertexBuffers[vbSlope]->SetShaderProjectionMatrix(fb->Width(), fb->Height());
-
-    //not antialiased
-    fb->Bind();
-    VertexBuffers[vbSlope]->DisableBlending();
-    VertexBuffers[vbSlope]->Bind();
-    VertexBuffers[vbSlope]->SetVertexData(vertices, numVertices);
-    VertexBuffers[vbSlope]->DrawArrays(numVertices);
-    VertexBuffers[vbSlope]->Unbind();
-    VertexBuffers[vbSlope]->EnableBlending();
-    fb->Unbind();
-
-    delete[] vertices;
+    DrawShape(fb, x, y, width, height, color, 1, type);
     return true;
 }
 
@@ -1178,12 +1384,9 @@ bool cOglCmdDrawText::Execute(void) {
     if (!f)
         return false;
 
-    VertexBuffers[vbText]->ActivateShader();
-    VertexBuffers[vbText]->SetShaderColor(colorText);
-    VertexBuffers[vbText]->SetShaderProjectionMatrix(fb->Width(), fb->Height());
-
-    fb->Bind();
-    VertexBuffers[vbText]->Bind();
+    // only used by the OpenGL thread, keeps its capacity between strings
+    static std::vector<GLfloat> vertices;
+    vertices.clear();
 
     int xGlyph = x;
     int fontHeight = f->Height();
@@ -1197,6 +1400,7 @@ bool cOglCmdDrawText::Execute(void) {
         cOglGlyph *g = f->Glyph(sym);
         if (!g) {
             esyslog("[softhddev]ERROR: could not load glyph %x", sym);
+            continue;
         }
 
         if ( limitX && xGlyph + g->AdvanceX() > limitX )
@@ -1205,24 +1409,29 @@ bool cOglCmdDrawText::Execute(void) {
         kerning = f->Kerning(g, prevSym);
         prevSym = sym;
 
-        GLfloat x1 = xGlyph + kerning + g->BearingLeft();          //left
-        GLfloat y1 = y + (fontHeight - bottom - g->BearingTop());  //top
-        GLfloat x2 = x1 + g->Width();                              //right
-        GLfloat y2 = y1 + g->Height();                             //bottom
-
-        GLfloat vertices[] = {
-            x1, y2,   0.0, 1.0,     // left bottom
-            x1, y1,   0.0, 0.0,     // left top
-            x2, y1,   1.0, 0.0,     // right top
-
-            x1, y2,   0.0, 1.0,     // left bottom
-            x2, y1,   1.0, 0.0,     // right top
-            x2, y2,   1.0, 1.0      // right bottom     
-        };
-    
-        g->BindTexture();
-        VertexBuffers[vbText]->SetVertexData(vertices);
-        VertexBuffers[vbText]->DrawArrays();
+        if (g->Width() && g->Height()) {
+            GLfloat x1 = xGlyph + kerning + g->BearingLeft();          //left
+            GLfloat y1 = y + (fontHeight - bottom - g->BearingTop());  //top
+            GLfloat x2 = x1 + g->Width();                              //right
+            GLfloat y2 = y1 + g->Height();                             //bottom
+
+            // texture coordinates in atlas pixels, see text shader
+            GLfloat u1 = g->AtlasX();
+            GLfloat v1 = g->AtlasY();
+            GLfloat u2 = u1 + g->Width();
+            GLfloat v2 = v1 + g->Height();
+
+            GLfloat quad[] = {
+                x1, y2,   u1, v2,     // left bottom
+                x1, y1,   u1, v1,     // left top
+                x2, y1,   u2, v1,     // right top
+
+                x1, y2,   u1, v2,     // left bottom
+                x2, y1,   u2, v1,     // right top
+                x2, y2,   u2, v2      // right bottom
+            };
+            vertices.insert(vertices.end(), quad, quad + sizeof(quad) / sizeof(*quad));
+        }
 
         xGlyph += kerning + g->AdvanceX();
 
@@ -1230,6 +1439,21 @@ bool cOglCmdDrawText::Execute(void) {
             break;
     }
 
+    if (vertices.empty())
+        return true;
+
+    // all glyphs are in the font atlas, draw the whole string at once
+    int count = vertices.size() / 4;
+    VertexBuffers[vbText]->ActivateShader();
+    VertexBuffers[vbText]->SetShaderColor(colorText);
+    VertexBuffers[vbText]->SetShaderProjectionMatrix(fb->Width(), fb->Height());
+
+    fb->Bind();
+    f->BindAtlas();
+    VertexBuffers[vbText]->Bind();
+    VertexBuffers[vbText]->SetVertexData(&vertices[0], count);
+    VertexBuffers[vbText]->DrawArrays(count);
+
     glBindTexture(GL_TEXTURE_2D, 0);
     VertexBuffers[vbText]->Unbind();
     fb->Unbind();
@@ -1253,25 +1477,8 @@ cOglCmdDrawImage::~cOglCmdDrawImage(void) {
 }
 
 bool cOglCmdDrawImage::Execute(void) {
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        GL_RGBA8,
-        width,
-        height,
-        0,
-        GL_BGRA,
-        GL_UNSIGNED_INT_8_8_8_8_REV,
-        argb
-    );
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // skins redraw the same logos and icons, reuse their texture
+    GLuint texture = cOglTextureCache::Get(argb, width, height);
 
     GLfloat x1 = x;          //left
     GLfloat y1 = y;          //top
@@ -1305,19 +1512,24 @@ bool cOglCmdDrawImage::Execute(void) {
         VertexBuffers[vbTexture]->EnableBlending();
     fb->Unbind();
     glBindTexture(GL_TEXTURE_2D, 0);
-    glDeleteTextures(1, &texture);
 
     return true;
 }
 
 //------------------ cOglCmdDrawTexture --------------------
-cOglCmdDrawTexture::cOglCmdDrawTexture(cOglFb *fb, sOglImage *imageRef, GLint x, GLint y): cOglCmd(fb) {
-    this->imageRef = imageRef;
+cOglCmdDrawTexture::cOglCmdDrawTexture(cOglFb *fb, cOglThread *oglThread, int imageHandle, GLint x, GLint y): cOglCmd(fb) {
+    this->oglThread = oglThread;
+    this->imageHandle = imageHandle;
     this->x = x;
     this->y = y;
 }
 
 bool cOglCmdDrawTexture::Execute(void) {
+    // resolved here, the image can be dropped after the command was queued
+    sOglImage *imageRef = oglThread->GetImageRef(imageHandle);
+    if (!imageRef)
+        return false;
+
     GLfloat x1 = x;                    //top
     GLfloat y1 = y;                    //left
     GLfloat x2 = x + imageRef->width;  //right
@@ -1339,7 +1551,10 @@ bool cOglCmdDrawTexture::Execute(void) {
     VertexBuffers[vbTexture]->SetShaderProjectionMatrix(fb->Width(), fb->Height());
 
     fb->Bind();
-    glBindTexture(GL_TEXTURE_2D, imageRef->texture);
+    if (!oglThread->BindImage(imageRef)) {
+        fb->Unbind();
+        return false;
+    }
     VertexBuffers[vbTexture]->Bind();
     VertexBuffers[vbTexture]->SetVertexData(quadVertices);
     VertexBuffers[vbTexture]->DrawArrays();
@@ -1351,47 +1566,23 @@ bool cOglCmdDrawTexture::Execute(void) {
 
 
 //------------------ cOglCmdStoreImage --------------------
-cOglCmdStoreImage::cOglCmdStoreImage(sOglImage *imageRef, tColor *argb) : cOglCmd(NULL) {
+cOglCmdStoreImage::cOglCmdStoreImage(cOglThread *oglThread, sOglImage *imageRef) : cOglCmd(NULL) {
+    this->oglThread = oglThread;
     this->imageRef = imageRef;
-    data = argb;    
-}
-
-cOglCmdStoreImage::~cOglCmdStoreImage(void) {
-    free(data);
 }
 
 bool cOglCmdStoreImage::Execute(void) {
-    glGenTextures(1, &imageRef->texture);
-    glBindTexture(GL_TEXTURE_2D, imageRef->texture);
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        GL_RGBA8,
-        imageRef->width,
-        imageRef->height,
-        0,
-        GL_BGRA,
-        GL_UNSIGNED_INT_8_8_8_8_REV,
-        data
-    );
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return true;
+    return oglThread->UploadImage(imageRef);
 }
 
 //------------------ cOglCmdDropImage --------------------
-cOglCmdDropImage::cOglCmdDropImage(sOglImage *imageRef, cCondWait *wait) : cOglCmd(NULL) {
-    this->imageRef = imageRef;
-    this->wait = wait;
+cOglCmdDropImage::cOglCmdDropImage(cOglThread *oglThread, int imageHandle) : cOglCmd(NULL) {
+    this->oglThread = oglThread;
+    this->imageHandle = imageHandle;
 }
 
 bool cOglCmdDropImage::Execute(void) {
-    if (imageRef->texture != GL_NONE)
-        glDeleteTextures(1, &imageRef->texture);
-    wait->Signal();
+    oglThread->DeleteImage(imageHandle);
     return true;
 }
 
@@ -1400,17 +1591,25 @@ bool cOglCmdDropImage::Execute(void) {
 ******************************************************************************/
 cOglThread::cOglThread(cCondWait *startWait, int maxCacheSize) : cThread("oglThread") {
     stalled = false;
+    idle = false;
+    cmdHead = 0;
+    cmdTail = 0;
     memCached = 0;
-    this->maxCacheSize = maxCacheSize * 1024 * 1024;
+    memStored = 0;
+    lastImageHandle = 0;
+#ifdef USE_EGL
+    eglDisplay = EGL_NO_DISPLAY;
+    eglContext = EGL_NO_CONTEXT;
+    eglSurface = EGL_NO_SURFACE;
+#endif
+    // the texture cache of drawn images is part of the configured size
+    long cacheSize = maxCacheSize * 1024L * 1024L;
+    cOglTextureCache::SetMaxSize(cacheSize / OGL_TEXTURE_CACHE_SHARE);
+    this->maxCacheSize = cacheSize - cacheSize / OGL_TEXTURE_CACHE_SHARE;
     this->startWait = startWait;
     wait = new cCondWait();
+    stallWait = new cCondWait();
     maxTextureSize = 0;
-    for (int i = 0; i < OGL_MAX_OSDIMAGES; i++) {
-        imageCache[i].used = false;
-        imageCache[i].texture = GL_NONE;
-        imageCache[i].width = 0;
-        imageCache[i].height = 0;
-    }
 
     Start();
 }
@@ -1418,37 +1617,65 @@ cOglThread::cOglThread(cCondWait *startWait, int maxCacheSize) : cThread("oglThr
 cOglThread::~cOglThread() {
     delete wait;
     wait = NULL;
+    delete stallWait;
+    stallWait = NULL;
 }
 
 void cOglThread::Stop(void) {
-    for (int i = 0; i < OGL_MAX_OSDIMAGES; i++) {
-        if (imageCache[i].used) {
-            DropImageData(i);
-        }
-    }
+    // stored images are released by Cleanup() in the worker thread
+    // wake the idle thread, so it sees the stop request at once
+    Cancel(-1);
+    wait->Signal();
     Cancel(2);
     stalled = false;
-}
-
-void cOglThread::DoCmd(cOglCmd* cmd) {
-    while (stalled)
-        cCondWait::SleepMs(10);
-
-    bool doSignal = false;
-    Lock();
-    if (commands.size() == 0)
-        doSignal = true;
-    commands.push(cmd);
-    Unlock();
-
-    if (commands.size() > OGL_CMDQUEUE_SIZE) {
+    stallWait->Signal();
+}
+
+/**
+**  Hand commands over to the worker thread.
+**
+**  The command ring is single producer, single consumer: the OSD threads
+**  are serialized by cmdMutex, the worker thread never takes it.  A batch
+**  is published with one store of the head index and at most one wakeup.
+*/
+void cOglThread::DoCmds(cOglCmd **cmds, int count) {
+    cMutexLock MutexLock(&cmdMutex);
+    unsigned head = cmdHead.load(std::memory_order_relaxed);
+
+    OglStats.commands += count;
+
+    for (int i = 0; i < count; ) {
+        unsigned tail = cmdTail.load(std::memory_order_acquire);
+        if (head - tail < OGL_CMDQUEUE_SIZE) {
+            commands[head % OGL_CMDQUEUE_SIZE] = cmds[i++];
+            head++;
+            continue;
+        }
+        // ring full: publish what we have and wait until half drained
+        cmdHead.store(head);
+        if (!Active()) {
+            esyslog("[softhddev]OpenGL worker thread gone, dropping %d commands", count - i);
+            while (i < count)
+                delete cmds[i++];
+            return;
+        }
         stalled = true;
+        wait->Signal();
+        if (cmdTail.load() == tail)
+            stallWait->Wait(100);
     }
+    cmdHead.store(head);
 
-    if (doSignal || stalled)
+    if (idle)
         wait->Signal();
 }
 
+/**
+**  Store an image for the skins.
+**
+**  Returns the handle at once, the texture upload is queued and runs in
+**  order before any draw command using the handle.
+*/
 int cOglThread::StoreImage(const cImage &image) {
     if (image.Width() > maxTextureSize || image.Height() > maxTextureSize) {
         esyslog("[softhddev] cannot store image of %dpx x %dpx "
@@ -1460,91 +1687,192 @@ int cOglThread::StoreImage(const cImage &image) {
     }
 
     int imgSize = image.Width() * image.Height();
-    int newMemUsed = imgSize * sizeof(tColor) + memCached;
-    if (newMemUsed > maxCacheSize) {
-        float cachedMB = memCached / 1024.0f / 1024.0f;
-        float maxMB = maxCacheSize / 1024.0f / 1024.0f;
-        esyslog("[softhddev]Maximum size for GPU cache reached. Used: %.2fMB Max: %.2fMB", cachedMB, maxMB);
+    if (imgSize * (long)sizeof(tColor) > maxCacheSize) {
+        esyslog("[softhddev]OSD image of %d kb does not fit into the GPU cache of %ld kb", imgSize * (int)sizeof(tColor) / 1024, maxCacheSize / 1024);
         return 0;
     }
 
-    int slot = GetFreeSlot();
-    if (!slot)
-        return 0;
-
     tColor *argb = MALLOC(tColor, imgSize);
     if (!argb) {
         esyslog("[softhddev]memory allocation of %d kb for OSD image failed", imgSize  * sizeof(tColor) / 1024);
-        ClearSlot(slot);
-        slot = 0;
         return 0;
     }
-
     memcpy(argb, image.Data(), sizeof(tColor) * imgSize);
 
-    sOglImage *imageRef = GetImageRef(slot);
-    imageRef->width = image.Width();
-    imageRef->height = image.Height();
-    DoCmd(new cOglCmdStoreImage(imageRef, argb));
+    // evicted images keep their pixels in RAM until they are dropped;
+    // beyond the cache size on the GPU plus the same amount in RAM VDR
+    // draws the image in software
+    Lock();
+    if (memStored + imgSize * (long)sizeof(tColor) > 2 * maxCacheSize) {
+        Unlock();
+        free(argb);
+        esyslog("[softhddev]OSD image cache full, image of %dpx x %dpx not stored", image.Width(), image.Height());
+        return 0;
+    }
+    memStored += imgSize * sizeof(tColor);
+    sOglImage *imageRef = new sOglImage(image.Width(), image.Height(), argb);
+    int imageHandle;
+    do {
+        if (lastImageHandle == INT_MIN)
+            lastImageHandle = 0;
+        imageHandle = --lastImageHandle;
+    } while (images.count(imageHandle));
+    images[imageHandle] = imageRef;
+    Unlock();
 
-    cTimeMs timer(5000);
-    while (imageRef->used && imageRef->texture == 0 && !timer.TimedOut())
-        cCondWait::SleepMs(2);
+    DoCmd(new cOglCmdStoreImage(this, imageRef));
+    if (cOglTrace::Active())
+        cOglTrace::Record(image.Data(), imgSize * sizeof(tColor), "store %d %d %d", imageHandle, image.Width(), image.Height());
+    return imageHandle;
+}
 
-    if (imageRef->texture == GL_NONE) {
-        esyslog("[softhddev]failed to store OSD image texture! (%s)", timer.TimedOut() ? "timed out" : "allocation failed");
-        DropImageData(slot);
-        slot = 0;
+// Size of a stored image, false for an unknown handle.
+bool cOglThread::GetImageSize(int imageHandle, int *width, int *height) {
+    bool found = false;
+    Lock();
+    auto it = images.find(imageHandle);
+    if (it != images.end()) {
+        *width = it->second->width;
+        *height = it->second->height;
+        found = true;
     }
-
-    memCached += imgSize  * sizeof(tColor);
-    return slot;
+    Unlock();
+    return found;
 }
 
-int cOglThread::GetFreeSlot(void) {
+// Worker thread: the image is only deleted by the worker thread, the
+// reference is valid until the next drop command.
+sOglImage *cOglThread::GetImageRef(int imageHandle) {
+    sOglImage *imageRef = NULL;
     Lock();
-    int slot = 0;
-    for (int i = 0; i < OGL_MAX_OSDIMAGES && !slot; i++) {
-        if (!imageCache[i].used) {
-            imageCache[i].used = true;
-            slot = -i - 1;
+    auto it = images.find(imageHandle);
+    if (it != images.end())
+        imageRef = it->second;
+    Unlock();
+    return imageRef;
+}
+
+void cOglThread::DropImageData(int imageHandle) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "drop %d", imageHandle);
+    // queued draw commands still use the image, drop it after them; the
+    // handle stays reserved until then
+    DoCmd(new cOglCmdDropImage(this, imageHandle));
+}
+
+// Worker thread: evict least recently used textures until bytes fit
+// into the cache, their pixels are read back and uploaded again on use.
+// StoreImage() limits the pixels kept in RAM.
+void cOglThread::EvictImages(long bytes) {
+    sOglImage *imageRef;
+    while (memCached + bytes > maxCacheSize && (imageRef = imageLru.Last())) {
+        tColor *argb = MALLOC(tColor, imageRef->width * imageRef->height);
+        if (!argb) {
+            esyslog("[softhddev]memory allocation for evicted OSD image failed");
+            return;
         }
+        glBindTexture(GL_TEXTURE_2D, imageRef->texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, argb);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDeleteTextures(1, &imageRef->texture);
+        imageRef->texture = GL_NONE;
+        imageRef->data = argb;
+        memCached -= imageRef->Bytes();
+        imageLru.Del(imageRef, false);
     }
-    Unlock();
-    return slot;
 }
 
-void cOglThread::ClearSlot(int slot) {
-    int i = -slot - 1;
-    if (i >= 0 && i < OGL_MAX_OSDIMAGES) {
-        Lock();
-        imageCache[i].used = false;    
-        imageCache[i].texture = GL_NONE;
-        imageCache[i].width = 0;
-        imageCache[i].height = 0;
-        Unlock();
+// Worker thread: upload the pixels of an image, makes room in the cache first.
+bool cOglThread::UploadImage(sOglImage *imageRef) {
+    if (imageRef->texture != GL_NONE || !imageRef->data)
+        return imageRef->texture != GL_NONE;
+
+    EvictImages(imageRef->Bytes());
+
+    while (glGetError() != GL_NO_ERROR)     // errors of earlier commands
+        ;
+    glGenTextures(1, &imageRef->texture);
+    glBindTexture(GL_TEXTURE_2D, imageRef->texture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        imageRef->width,
+        imageRef->height,
+        0,
+        GL_BGRA,
+        GL_UNSIGNED_INT_8_8_8_8_REV,
+        imageRef->data
+    );
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (glGetError() != GL_NO_ERROR) {
+        // keep the pixels, the next draw tries again
+        esyslog("[softhddev]failed to store OSD image texture of %dpx x %dpx", imageRef->width, imageRef->height);
+        glDeleteTextures(1, &imageRef->texture);
+        imageRef->texture = GL_NONE;
+        return false;
     }
+
+    free(imageRef->data);
+    imageRef->data = NULL;
+    memCached += imageRef->Bytes();
+    OglStats.uploadBytes += imageRef->Bytes();
+    imageLru.Ins(imageRef);
+    return true;
 }
 
-sOglImage *cOglThread::GetImageRef(int slot) {
-    int i = -slot - 1;
-    if (0 <= i && i < OGL_MAX_OSDIMAGES)
-        return &imageCache[i];
-    return 0;
+// Worker thread: bind the texture of an image, uploads evicted images again.
+bool cOglThread::BindImage(sOglImage *imageRef) {
+    if (imageRef->texture == GL_NONE) {
+        if (!UploadImage(imageRef))
+            return false;
+    } else if (imageRef != imageLru.First()) {
+        imageLru.Del(imageRef, false);
+        imageLru.Ins(imageRef);
+    }
+    glBindTexture(GL_TEXTURE_2D, imageRef->texture);
+    return true;
 }
 
-void cOglThread::DropImageData(int imageHandle) {
-    sOglImage *imageRef = GetImageRef(imageHandle);
-    if (!imageRef)
+// Worker thread: drop a stored image.
+void cOglThread::DeleteImage(int imageHandle) {
+    Lock();
+    auto it = images.find(imageHandle);
+    if (it == images.end()) {
+        Unlock();
         return;
-    int imgSize = imageRef->width * imageRef->height * sizeof(tColor);
-    memCached -= imgSize;
-    cCondWait dropWait;
-    DoCmd(new cOglCmdDropImage(imageRef, &dropWait));
-    dropWait.Wait();
-    ClearSlot(imageHandle);
+    }
+    sOglImage *imageRef = it->second;
+    images.erase(it);
+    memStored -= imageRef->Bytes();
+    Unlock();
+    DeleteImage(imageRef);
 }
 
+// Worker thread: free texture and pixels of a dropped image.
+void cOglThread::DeleteImage(sOglImage *imageRef) {
+    if (imageRef->texture != GL_NONE) {
+        glDeleteTextures(1, &imageRef->texture);
+        memCached -= imageRef->Bytes();
+        imageLru.Del(imageRef, false);
+    }
+    delete imageRef;
+}
+
+// Worker thread: free all images at exit, including those whose drop
+// command did not run anymore.
+void cOglThread::DeleteImages(void) {
+    Lock();
+    for (auto &it : images)
+        DeleteImage(it.second);
+    images.clear();
+    memStored = 0;
+    Unlock();
+}
 
 void cOglThread::Action(void) {
     if (!InitOpenGL()) {
@@ -1590,21 +1918,28 @@ void cOglThread::Action(void) {
     stalled = false;
 
     while(Running()) {
-      if (commands.empty()) {
-            wait->Wait(20);
+        unsigned tail = cmdTail.load(std::memory_order_relaxed);
+        if (tail == cmdHead.load(std::memory_order_acquire)) {
+            // DoCmds and Stop signal, timeout is only a safety net
+            idle = true;
+            if (tail == cmdHead.load())
+                wait->Wait(100);
+            idle = false;
             continue;
         }
-        Lock();
-        cOglCmd* cmd = commands.front();
-        commands.pop();
-        Unlock();
+        cOglCmd* cmd = commands[tail % OGL_CMDQUEUE_SIZE];
         //uint64_t start = cTimeMs::Now();
         cmd->Execute();
-        //esyslog("[softhddev]\"%s\", %dms, %d commands left, time %" PRIu64 "", cmd->Description(), (int)(cTimeMs::Now() - start), commands.size(), cTimeMs::Now());
+        //esyslog("[softhddev]\"%s\", %dms, %d commands left, time %" PRIu64 "", cmd->Description(), (int)(cTimeMs::Now() - start), cmdHead - tail - 1, cTimeMs::Now());
         delete cmd;
-        if (stalled && commands.size() < OGL_CMDQUEUE_SIZE / 2)
+        cmdTail.store(tail + 1);
+        if (stalled && cmdHead.load() - (tail + 1) <= OGL_CMDQUEUE_SIZE / 2) {
             stalled = false;
+            stallWait->Signal();
+        }
     }
+    stalled = false;
+    stallWait->Signal();
     dsyslog("[softhddev]Cleaning up OpenGL stuff");
     Cleanup();
     dsyslog("[softhddev]OpenGL Worker Thread Ended");
@@ -1646,8 +1981,22 @@ bool cOglThread::InitOpenGL(void) {
         if (!CuvidInitGlx()) return false;
     }
 #endif
+    if (OglOffscreen()) {
+#ifdef USE_EGL
+        if (!InitEgl())
+            return false;
+#else
+        esyslog("[softhddev]offscreen OpenGL OSD needs EGL support\n");
+        return false;
+#endif
+    }
     glewExperimental = GL_TRUE;
     GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // GLEW built for GLX fails its GLX part on an EGL context
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY && OglOffscreen())
+        err = GLEW_OK;
+#endif
     if( err != GLEW_OK) {
         esyslog("[softhddev]glewInit failed, aborting\n");
         return false;
@@ -1657,6 +2006,99 @@ bool cOglThread::InitOpenGL(void) {
     return true;
 }
 
+#ifdef USE_EGL
+/**
+**  Create the EGL context for offscreen rendering.
+**
+**  Prefers the Mesa surfaceless platform, which needs neither X11 nor a
+**  GPU (llvmpipe), the rendering goes into framebuffer objects anyway.
+**  Without EGL_KHR_surfaceless_context a 1x1 pbuffer is made current.
+*/
+bool cOglThread::InitEgl(void) {
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    static const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    static const EGLint pbufferAttribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs;
+    EGLint major;
+    EGLint minor;
+    const char *extensions;
+
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+#endif
+    if (eglDisplay == EGL_NO_DISPLAY)
+        eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor)) {
+        esyslog("[softhddev]EGL: no display available");
+        eglDisplay = EGL_NO_DISPLAY;
+        return false;
+    }
+    dsyslog("[softhddev]EGL %d.%d %s", major, minor, eglQueryString(eglDisplay, EGL_VENDOR));
+
+    if (!eglBindAPI(EGL_OPENGL_API) ||
+        !eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+        esyslog("[softhddev]EGL: no OpenGL config available");
+        return false;
+    }
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (eglContext == EGL_NO_CONTEXT) {
+        esyslog("[softhddev]EGL: could not create OpenGL 3.3 context (%#x)", eglGetError());
+        return false;
+    }
+    extensions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+        eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+        if (eglSurface == EGL_NO_SURFACE) {
+            esyslog("[softhddev]EGL: could not create pbuffer (%#x)", eglGetError());
+            return false;
+        }
+    }
+    if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+        esyslog("[softhddev]EGL: could not make context current (%#x)", eglGetError());
+        return false;
+    }
+    return true;
+}
+
+void cOglThread::DeleteEgl(void) {
+    if (eglDisplay == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (eglSurface != EGL_NO_SURFACE)
+        eglDestroySurface(eglDisplay, eglSurface);
+    if (eglContext != EGL_NO_CONTEXT)
+        eglDestroyContext(eglDisplay, eglContext);
+    eglTerminate(eglDisplay);
+    eglSurface = EGL_NO_SURFACE;
+    eglContext = EGL_NO_CONTEXT;
+    eglDisplay = EGL_NO_DISPLAY;
+}
+#endif
+
 bool cOglThread::InitShaders(void) {
     for (int i=0; i < stCount; i++) {
         cShader *shader = new cShader();
@@ -1698,6 +2140,8 @@ void cOglThread::DeleteVertexBuffers(void) {
 }
 
 void cOglThread::Cleanup(void) {
+    DeleteImages();
+    cOglTextureCache::Cleanup();
     DeleteVertexBuffers();
     delete cOglOsd::oFb;
     cOglOsd::oFb = NULL;
@@ -1709,6 +2153,9 @@ void cOglThread::Cleanup(void) {
         glutExit();
     }
 #endif
+#ifdef USE_EGL
+    DeleteEgl();
+#endif
 }
 
 /****************************************************************************************
@@ -1721,6 +2168,7 @@ cOglPixmap::cOglPixmap(std::shared_ptr<cOglThread> oglThread, int Layer, const c
     int height = DrawPort.IsEmpty() ? ViewPort.Height() : DrawPort.Height();
     fb = new cOglFb(width, height, ViewPort.Width(), ViewPort.Height());
     dirty = true; 
+    MarkAllDamaged();
 }
 
 cOglPixmap::~cOglPixmap(void) {
@@ -1729,49 +2177,106 @@ cOglPixmap::~cOglPixmap(void) {
     oglThread->DoCmd(new cOglCmdDeleteFb(fb));
 }
 
+// Rect is in drawport coordinates
+void cOglPixmap::MarkDamaged(const cRect &Rect) {
+    if (Tile()) {
+        MarkAllDamaged();
+        return;
+    }
+    damage.Combine(Rect.Shifted(DrawPort().Point()).Intersected(cRect(cPoint(0, 0), ViewPort().Size())));
+}
+
+/**
+**  Add the osd buffer area to redraw for this pixmap to Region.
+**
+**  @param Area     area the pixmap covers in the osd buffer now,
+**                  empty if the pixmap is hidden
+**  @param Region   osd buffer area to re-composite
+*/
+void cOglPixmap::FlushDamage(const cRect &Area, cRect &Region) {
+    if (Area != flushedArea) {
+        Region.Combine(flushedArea);
+        Region.Combine(Area);
+    } else if (!Area.IsEmpty())
+        Region.Combine(damage.Shifted(Area.Point()));
+    flushedArea = Area;
+    damage = cRect::Null;
+}
+
+void cOglPixmap::SetLayer(int Layer) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "layer %p %d", this, Layer);
+    if (Layer != cPixmap::Layer()) {
+        cPixmap::SetLayer(Layer);
+        SetDirty();
+        MarkAllDamaged();
+    }
+}
+
 void cOglPixmap::SetAlpha(int Alpha) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "alpha %p %d", this, Alpha);
     Alpha = constrain(Alpha, ALPHA_TRANSPARENT, ALPHA_OPAQUE);
     if (Alpha != cPixmap::Alpha()) {
         cPixmap::SetAlpha(Alpha);
         SetDirty();
+        MarkAllDamaged();
     }
 }
 
 void cOglPixmap::SetTile(bool Tile) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "tile %p %d", this, Tile);
     cPixmap::SetTile(Tile);
     SetDirty();
+    MarkAllDamaged();
 }
 
 void cOglPixmap::SetViewPort(const cRect &Rect) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "viewport %p %d %d %d %d", this, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height());
     cPixmap::SetViewPort(Rect);
     SetDirty();
+    MarkAllDamaged();
 }
 
 void cOglPixmap::SetDrawPortPoint(const cPoint &Point, bool Dirty) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "drawport %p %d %d %d", this, Point.X(), Point.Y(), Dirty);
     cPixmap::SetDrawPortPoint(Point, Dirty);
-    if (Dirty)
+    if (Dirty) {
         SetDirty();
+        MarkAllDamaged();
+    }
 }
 
 void cOglPixmap::Clear(void) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "clear %p", this);
     if (!oglThread->Active())
         return;
     LOCK_PIXMAPS;
     oglThread->DoCmd(new cOglCmdFill(fb, clrTransparent));
     SetDirty();
     MarkDrawPortDirty(DrawPort());
+    MarkAllDamaged();
 }
 
 void cOglPixmap::Fill(tColor Color) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "fill %p %08x", this, Color);
     if (!oglThread->Active())
         return;
     LOCK_PIXMAPS;
     oglThread->DoCmd(new cOglCmdFill(fb, Color));
     SetDirty();
     MarkDrawPortDirty(DrawPort());
+    MarkAllDamaged();
 }
 
 void cOglPixmap::DrawImage(const cPoint &Point, const cImage &Image) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(Image.Data(), Image.Width() * Image.Height() * sizeof(tColor), "image %p %d %d %d %d", this, Point.X(), Point.Y(), Image.Width(), Image.Height());
     if (!oglThread->Active())
         return;
     tColor *argb = MALLOC(tColor, Image.Width() * Image.Height());
@@ -1783,14 +2288,19 @@ void cOglPixmap::DrawImage(const cPoint &Point, const cImage &Image) {
 
     SetDirty();
     MarkDrawPortDirty(cRect(Point, cSize(Image.Width(), Image.Height())).Intersected(DrawPort().Size()));
+    MarkDamaged(cRect(Point, cSize(Image.Width(), Image.Height())));
 }
 
 void cOglPixmap::DrawImage(const cPoint &Point, int ImageHandle) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "imageref %p %d %d %d", this, Point.X(), Point.Y(), ImageHandle);
     if (!oglThread->Active())
         return;
-    if (ImageHandle < 0 && oglThread->GetImageRef(ImageHandle)) {
-            sOglImage *img = oglThread->GetImageRef(ImageHandle);
-            oglThread->DoCmd(new cOglCmdDrawTexture(fb, img, Point.X(), Point.Y()));
+    int width, height;
+    if (ImageHandle < 0 && oglThread->GetImageSize(ImageHandle, &width, &height)) {
+            // the handle is resolved by the worker, the image can be dropped meanwhile
+            oglThread->DoCmd(new cOglCmdDrawTexture(fb, oglThread.get(), ImageHandle, Point.X(), Point.Y()));
+            MarkDamaged(cRect(Point, cSize(width, height)));
     }
     /*
     Fallback to VDR implementation, needs to separate cSoftOsdProvider from softhddevice.cpp 
@@ -1804,10 +2314,13 @@ void cOglPixmap::DrawImage(const cPoint &Point, int ImageHandle) {
 }
 
 void cOglPixmap::DrawPixel(const cPoint &Point, tColor Color) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "pixel %p %d %d %08x", this, Point.X(), Point.Y(), Color);
     cRect r(Point.X(), Point.Y(), 1, 1);
     oglThread->DoCmd(new cOglCmdDrawRectangle(fb, r.X(), r.Y(), r.Width(), r.Height(), Color));
     SetDirty();
     MarkDrawPortDirty(r);
+    MarkDamaged(r);
 }
 
 void cOglPixmap::DrawBitmap(const cPoint &Point, const cBitmap &Bitmap, tColor ColorFg, tColor ColorBg, bool Overlay) {
@@ -1827,12 +2340,19 @@ void cOglPixmap::DrawBitmap(const cPoint &Point, const cBitmap &Bitmap, tColor C
                         (index == 0 ? ColorBg : index == 1 ? ColorFg :
                                 Bitmap.Color(index)) : Bitmap.Color(index));
         }
+    // traced as true color image, the replay blends it like DrawImage
+    if (cOglTrace::Active())
+        cOglTrace::Record(argb, Bitmap.Width() * Bitmap.Height() * sizeof(tColor), "image %p %d %d %d %d", this, Point.X(), Point.Y(), Bitmap.Width(), Bitmap.Height());
     oglThread->DoCmd(new cOglCmdDrawImage(fb, argb, Bitmap.Width(), Bitmap.Height(), Point.X(), Point.Y(), Overlay));
     SetDirty();
     MarkDrawPortDirty(cRect(Point, cSize(Bitmap.Width(), Bitmap.Height())).Intersected(DrawPort().Size()));
+    MarkDamaged(cRect(Point, cSize(Bitmap.Width(), Bitmap.Height())));
 }
 
 void cOglPixmap::DrawText(const cPoint &Point, const char *s, tColor ColorFg, tColor ColorBg, const cFont *Font, int Width, int Height, int Alignment) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(s, s ? strlen(s) : 0, "text %p %d %d %08x %08x %d %d %d %d %d %s", this, Point.X(), Point.Y(), ColorFg, ColorBg,
+                          Width, Height, Alignment, Font->Size(), s ? (int)strlen(s) : 0, *Font->FontName());
     if (!oglThread->Active())
         return;
     LOCK_PIXMAPS;
@@ -1891,48 +2411,66 @@ void cOglPixmap::DrawText(const cPoint &Point, const char *s, tColor ColorFg, tC
 
     SetDirty();
     MarkDrawPortDirty(r);
+    MarkDamaged(r);
 }
 
 void cOglPixmap::DrawRectangle(const cRect &Rect, tColor Color) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "rect %p %d %d %d %d %08x", this, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height(), Color);
     if (!oglThread->Active())
         return;
     LOCK_PIXMAPS;
     oglThread->DoCmd(new cOglCmdDrawRectangle(fb, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height(), Color));
     SetDirty();
     MarkDrawPortDirty(Rect);
+    MarkDamaged(Rect);
 }
 
 void cOglPixmap::DrawEllipse(const cRect &Rect, tColor Color, int Quadrants) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "ellipse %p %d %d %d %d %08x %d", this, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height(), Color, Quadrants);
     if (!oglThread->Active())
         return;
     LOCK_PIXMAPS;
     oglThread->DoCmd(new cOglCmdDrawEllipse(fb, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height(), Color, Quadrants));
     SetDirty();
     MarkDrawPortDirty(Rect);
+    MarkDamaged(Rect);
 }
 
 void cOglPixmap::DrawSlope(const cRect &Rect, tColor Color, int Type) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "slope %p %d %d %d %d %08x %d", this, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height(), Color, Type);
     if (!oglThread->Active())
         return;
     LOCK_PIXMAPS;
     oglThread->DoCmd(new cOglCmdDrawSlope(fb, Rect.X(), Rect.Y(), Rect.Width(), Rect.Height(), Color, Type));
     SetDirty();
     MarkDrawPortDirty(Rect);
+    MarkDamaged(Rect);
 }
 
 void cOglPixmap::Render(const cPixmap *Pixmap, const cRect &Source, const cPoint &Dest) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "render %p %p %d %d %d %d %d %d", this, Pixmap, Source.X(), Source.Y(), Source.Width(), Source.Height(), Dest.X(), Dest.Y());
     esyslog("[softhddev] Render %d %d %d not implemented in OpenGl OSD", Pixmap->ViewPort().X(), Source.X(), Dest.X());
 }
 
 void cOglPixmap::Copy(const cPixmap *Pixmap, const cRect &Source, const cPoint &Dest) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "copy %p %p %d %d %d %d %d %d", this, Pixmap, Source.X(), Source.Y(), Source.Width(), Source.Height(), Dest.X(), Dest.Y());
     esyslog("[softhddev] Copy %d %d %d not implemented in OpenGl OSD", Pixmap->ViewPort().X(), Source.X(), Dest.X());
 }
 
 void cOglPixmap::Scroll(const cPoint &Dest, const cRect &Source) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "scroll %p %d %d %d %d %d %d", this, Dest.X(), Dest.Y(), Source.X(), Source.Y(), Source.Width(), Source.Height());
     esyslog("[softhddev] Scroll %d %d not implemented in OpenGl OSD", Source.X(), Dest.X());
 }
 
 void cOglPixmap::Pan(const cPoint &Dest, const cRect &Source) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "pan %p %d %d %d %d %d %d", this, Dest.X(), Dest.Y(), Source.X(), Source.Y(), Source.Width(), Source.Height());
     esyslog("[softhddev] Pan %d %d not implemented in OpenGl OSD", Source.X(), Dest.X());
 }
 
@@ -1942,6 +2480,8 @@ void cOglPixmap::Pan(const cPoint &Dest, const cRect &Source) {
 cOglOutputFb *cOglOsd::oFb = NULL;
 
 cOglOsd::cOglOsd(int Left, int Top, uint Level, std::shared_ptr<cOglThread> oglThread) : cOsd(Left, Top, Level) {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "osd %p %d %d %u", this, Left, Top, Level);
     this->oglThread = oglThread;
     bFb = NULL;
     isSubtitleOsd = false;
@@ -1959,6 +2499,8 @@ cOglOsd::cOglOsd(int Left, int Top, uint Level, std::shared_ptr<cOglThread> oglT
 }
 
 cOglOsd::~cOglOsd() {
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "close %p", this);
     oglThread->DoCmd(new cOglCmdFill(bFb, clrTransparent));
     oglThread->DoCmd(new cOglCmdCopyBufferToOutputFb(bFb, oFb, Left(), Top()));
     OsdClose();
@@ -1968,6 +2510,12 @@ cOglOsd::~cOglOsd() {
 
 eOsdError cOglOsd::SetAreas(const tArea *Areas, int NumAreas) {
     cRect r;
+    if (cOglTrace::Active()) {
+        cString areas = "";
+        for (int i = 0; i < NumAreas; i++)
+            areas = cString::sprintf("%s %d %d %d %d %d", *areas, Areas[i].x1, Areas[i].y1, Areas[i].x2, Areas[i].y2, Areas[i].bpp);
+        cOglTrace::Record(NULL, 0, "areas %p %d%s", this, NumAreas, *areas);
+    }
     if (NumAreas > 1)
         isSubtitleOsd = true;
     for (int i = 0; i < NumAreas; i++)
@@ -1981,6 +2529,7 @@ eOsdError cOglOsd::SetAreas(const tArea *Areas, int NumAreas) {
         DestroyPixmap(oglPixmaps[0]);
     }
     bFb = new cOglFb(r.Width(), r.Height(), r.Width(), r.Height());
+    damage = cRect(0, 0, r.Width(), r.Height());
     cCondWait initiated;
     oglThread->DoCmd(new cOglCmdInitFb(bFb, &initiated));
     initiated.Wait();
@@ -2005,6 +2554,10 @@ cPixmap *cOglOsd::CreatePixmap(int Layer, const cRect &ViewPort, const cRect &Dr
     cOglPixmap *p = new cOglPixmap(oglThread, Layer, ViewPort, DrawPort);
 
     if (cOsd::AddPixmap(p)) {
+        if (cOglTrace::Active())
+            cOglTrace::Record(NULL, 0, "pixmap %p %p %d %d %d %d %d %d %d %d %d", this, p, Layer,
+                              ViewPort.X(), ViewPort.Y(), ViewPort.Width(), ViewPort.Height(),
+                              DrawPort.X(), DrawPort.Y(), DrawPort.Width(), DrawPort.Height());
         //find free slot
         for (int i = 0; i < oglPixmaps.Size(); i++)
             if (!oglPixmaps[i])
@@ -2028,8 +2581,11 @@ void cOglOsd::DestroyPixmap(cPixmap *Pixmap) {
         start = 0;
     for (int i = start; i < oglPixmaps.Size(); i++) {
         if (oglPixmaps[i] == Pixmap) {
+            if (cOglTrace::Active())
+                cOglTrace::Record(NULL, 0, "destroy %p %p", this, Pixmap);
             if (Pixmap->Layer() >= 0)
                 oglPixmaps[0]->SetDirty();
+            damage.Combine(oglPixmaps[i]->FlushedArea());
             oglPixmaps[i] = NULL;
             cOsd::DestroyPixmap(Pixmap);
             return;
@@ -2040,38 +2596,55 @@ void cOglOsd::DestroyPixmap(cPixmap *Pixmap) {
 void cOglOsd::Flush(void) {
     if (!oglThread->Active())
         return;
+    if (cOglTrace::Active())
+        cOglTrace::Record(NULL, 0, "flush %p", this);
     LOCK_PIXMAPS;
-    //check if any pixmap is dirty
-    bool dirty = false;
-    for (int i = 0; i < oglPixmaps.Size() && !dirty; i++)
-        if (oglPixmaps[i] && oglPixmaps[i]->Layer() >= 0 && oglPixmaps[i]->IsDirty())
-            dirty = true;
-    if (!dirty)
+    //collect the damaged area of all dirty pixmaps
+    cRect region = damage;
+    damage = cRect::Null;
+    for (int i = 0; i < oglPixmaps.Size(); i++) {
+        cOglPixmap *p = oglPixmaps[i];
+        if (p && p->IsDirty()) {
+            cRect area;
+            if (p->Layer() >= 0)
+                area = cRect(p->ViewPort().X(), (!isSubtitleOsd) ? p->ViewPort().Y() : 0, p->ViewPort().Width(), p->ViewPort().Height());
+            p->FlushDamage(area, region);
+            p->SetDirty(false);
+        }
+    }
+    region = region.Intersected(cRect(0, 0, bFb->Width(), bFb->Height()));
+    if (region.IsEmpty())
         return;
-    //clear buffer
     //uint64_t start = cTimeMs::Now();
     //dsyslog("[softhddev]Start Flush at %" PRIu64 "", cTimeMs::Now());
-    oglThread->DoCmd(new cOglCmdFill(bFb, clrTransparent));
+
+    //the whole frame goes to the OpenGL thread in one batch,
+    //all commands are clipped to the damaged region
+    flushCmds.clear();
+    flushCmds.push_back(new cOglCmdFill(bFb, clrTransparent, region));
 
     //render pixmap textures blended to buffer
     for (int layer = 0; layer < MAXPIXMAPLAYERS; layer++) {
         for (int i = 0; i < oglPixmaps.Size(); i++) {
             if (oglPixmaps[i]) {
                 if (oglPixmaps[i]->Layer() == layer) {
-                    oglThread->DoCmd(new cOglCmdRenderFbToBufferFb( oglPixmaps[i]->Fb(), 
-                                                                    bFb, 
-                                                                    oglPixmaps[i]->ViewPort().X(), 
-                                                                    (!isSubtitleOsd) ? oglPixmaps[i]->ViewPort().Y() : 0,
-                                                                    oglPixmaps[i]->Alpha(),
-                                                                    oglPixmaps[i]->DrawPort().X(),
-                                                                    oglPixmaps[i]->DrawPort().Y()));
-                    oglPixmaps[i]->SetDirty(false);
+                    if (oglPixmaps[i]->FlushedArea().Intersected(region).IsEmpty())
+                        continue;
+                    flushCmds.push_back(new cOglCmdRenderFbToBufferFb( oglPixmaps[i]->Fb(), 
+                                                                       bFb, 
+                                                                       oglPixmaps[i]->ViewPort().X(), 
+                                                                       (!isSubtitleOsd) ? oglPixmaps[i]->ViewPort().Y() : 0,
+                                                                       oglPixmaps[i]->Alpha(),
+                                                                       oglPixmaps[i]->DrawPort().X(),
+                                                                       oglPixmaps[i]->DrawPort().Y(),
+                                                                       region));
                 }
             }
         }
     }
     //copy buffer to output framebuffer
-    oglThread->DoCmd(new cOglCmdCopyBufferToOutputFb(bFb, oFb, Left(), Top()));
+    flushCmds.push_back(new cOglCmdCopyBufferToOutputFb(bFb, oFb, Left(), Top(), region));
+    oglThread->DoCmds(&flushCmds[0], flushCmds.size());
     //dsyslog("[softhddev]End Flush at %" PRIu64 ", duration %d", cTimeMs::Now(), (int)(cTimeMs::Now()-start));
 }
 
@@ -2082,3 +2655,250 @@ void cOglOsd::DrawScaledBitmap(int x, int y, const cBitmap &Bitmap, double Facto
     int yNew = y - oglPixmaps[0]->ViewPort().Y();
     oglPixmaps[0]->DrawBitmap(cPoint(x, yNew), Bitmap);
 }
+
+/******************************************************************************
+* cOglTrace
+******************************************************************************/
+sOglStats OglStats;
+
+cMutex cOglTrace::mutex;
+FILE *cOglTrace::file = NULL;
+std::atomic<bool> cOglTrace::active(false);
+
+bool cOglTrace::Start(const char *fileName) {
+    cMutexLock MutexLock(&mutex);
+    if (file)
+        fclose(file);
+    file = fopen(fileName, "w");
+    if (!file) {
+        esyslog("[softhddev]cannot open OSD trace %s: %m", fileName);
+        active = false;
+        return false;
+    }
+    fprintf(file, "# softhddevice osd trace 1\n");
+    active = true;
+    dsyslog("[softhddev]OSD trace started to %s", fileName);
+    return true;
+}
+
+void cOglTrace::Stop(void) {
+    cMutexLock MutexLock(&mutex);
+    active = false;
+    if (file) {
+        fclose(file);
+        file = NULL;
+        dsyslog("[softhddev]OSD trace stopped");
+    }
+}
+
+// every record is one text line, its payload follows the line as raw bytes
+void cOglTrace::Record(const void *data, int size, const char *format, ...) {
+    va_list ap;
+
+    cMutexLock MutexLock(&mutex);
+    if (!file)
+        return;
+    va_start(ap, format);
+    vfprintf(file, format, ap);
+    va_end(ap);
+    fputc('\n', file);
+    if (data && size > 0)
+        fwrite(data, 1, size, file);
+}
+
+cString cOglTrace::Replay(std::shared_ptr<cOglThread> oglThread, const char *fileName, int loops) {
+    struct sPixmap {
+        void *osd;
+        cPixmap *pixmap;
+    };
+    std::map<void *, cOglOsd *> osds;
+    std::map<void *, sPixmap> pixmaps;
+    std::map<int, int> handles;
+    std::map<std::string, cFont *> fonts;
+    std::vector<tColor> pixels;
+    std::vector<char> text;
+    char line[4096];
+    char cmd[16];
+    void *id, *id2;
+    int a[12];
+    unsigned int c1, c2;
+    int pos, len;
+    int frames = 0;
+    int skipped = 0;
+    double latencySum = 0, latencyMax = 0;
+    uint64_t commands = OglStats.commands;
+    uint64_t glyphHits = OglStats.glyphHits;
+    uint64_t glyphMisses = OglStats.glyphMisses;
+    uint64_t uploadBytes = OglStats.uploadBytes;
+
+    if (!oglThread || !oglThread->Active())
+        return "OpenGL OSD thread not running";
+    FILE *f = fopen(fileName, "r");
+    if (!f)
+        return cString::sprintf("cannot open %s: %m", fileName);
+
+    auto pixmap = [&](void *pm) -> cPixmap * {
+        auto it = pixmaps.find(pm);
+        return it != pixmaps.end() ? it->second.pixmap : NULL;
+    };
+    auto readPixels = [&](int w, int h) -> bool {
+        if (w <= 0 || h <= 0 || w > 8192 || h > 8192)
+            return false;
+        pixels.resize(w * h);
+        return fread(&pixels[0], sizeof(tColor), w * h, f) == (size_t)(w * h);
+    };
+
+    for (int loop = 0; loop < loops; loop++) {
+        rewind(f);
+        while (fgets(line, sizeof(line), f)) {
+            if (line[0] == '#' || sscanf(line, "%15s", cmd) != 1)
+                continue;
+            cPixmap *p = NULL;
+            if (strcmp(cmd, "osd") && strcmp(cmd, "close") && strcmp(cmd, "areas") && strcmp(cmd, "flush") &&
+                strcmp(cmd, "pixmap") && strcmp(cmd, "destroy") && strcmp(cmd, "store") && strcmp(cmd, "drop")) {
+                if (sscanf(line, "%*s %p", &id) != 1 || !(p = pixmap(id))) {
+                    skipped++;
+                    // the payload has to be skipped as well
+                    if (sscanf(line, "image %*p %*d %*d %d %d", &a[0], &a[1]) == 2)
+                        readPixels(a[0], a[1]);
+                    else if (sscanf(line, "text %*p %*d %*d %*x %*x %*d %*d %*d %*d %d", &len) == 1 && len > 0)
+                        fseek(f, len, SEEK_CUR);
+                    continue;
+                }
+            }
+
+            if (!strcmp(cmd, "osd") && sscanf(line, "osd %p %d %d %u", &id, &a[0], &a[1], &c1) == 4) {
+                delete osds[id];
+                osds[id] = new cOglOsd(a[0], a[1], c1, oglThread);
+            } else if (!strcmp(cmd, "close") && sscanf(line, "close %p", &id) == 1 && osds.count(id)) {
+                delete osds[id];
+                osds.erase(id);
+                for (auto it = pixmaps.begin(); it != pixmaps.end(); ) {
+                    if (it->second.osd == id)
+                        it = pixmaps.erase(it);
+                    else
+                        ++it;
+                }
+            } else if (!strcmp(cmd, "areas") && sscanf(line, "areas %p %d%n", &id, &a[0], &pos) == 2 && osds.count(id)) {
+                tArea areas[MAXOSDAREAS];
+                int n = 0;
+                while (n < a[0] && n < MAXOSDAREAS && sscanf(line + pos, "%d %d %d %d %d%n", &areas[n].x1, &areas[n].y1,
+                                                            &areas[n].x2, &areas[n].y2, &areas[n].bpp, &len) == 5) {
+                    pos += len;
+                    n++;
+                }
+                osds[id]->SetAreas(areas, n);
+            } else if (!strcmp(cmd, "pixmap") && sscanf(line, "pixmap %p %p %d %d %d %d %d %d %d %d %d", &id, &id2, &a[0],
+                                                        &a[1], &a[2], &a[3], &a[4], &a[5], &a[6], &a[7], &a[8]) == 11 && osds.count(id)) {
+                cPixmap *created = osds[id]->CreatePixmap(a[0], cRect(a[1], a[2], a[3], a[4]), cRect(a[5], a[6], a[7], a[8]));
+                if (created)
+                    pixmaps[id2] = { id, created };
+                else
+                    skipped++;
+            } else if (!strcmp(cmd, "destroy") && sscanf(line, "destroy %p %p", &id, &id2) == 2 && osds.count(id) && pixmap(id2)) {
+                osds[id]->DestroyPixmap(pixmap(id2));
+                pixmaps.erase(id2);
+            } else if (!strcmp(cmd, "flush") && sscanf(line, "flush %p", &id) == 1 && osds.count(id)) {
+                cCondWait done;
+                auto start = std::chrono::steady_clock::now();
+                osds[id]->Flush();
+                oglThread->DoCmd(new cOglCmdSignal(&done));
+                done.Wait(5000);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                latencySum += ms;
+                latencyMax = std::max(latencyMax, ms);
+                frames++;
+            } else if (!strcmp(cmd, "store") && sscanf(line, "store %d %d %d", &a[0], &a[1], &a[2]) == 3) {
+                if (!readPixels(a[1], a[2]))
+                    break;
+                int handle = oglThread->StoreImage(cImage(cSize(a[1], a[2]), &pixels[0]));
+                if (handle)
+                    handles[a[0]] = handle;
+            } else if (!strcmp(cmd, "drop") && sscanf(line, "drop %d", &a[0]) == 1 && handles.count(a[0])) {
+                oglThread->DropImageData(handles[a[0]]);
+                handles.erase(a[0]);
+            } else if (!strcmp(cmd, "layer") && sscanf(line, "layer %*p %d", &a[0]) == 1) {
+                p->SetLayer(a[0]);
+            } else if (!strcmp(cmd, "alpha") && sscanf(line, "alpha %*p %d", &a[0]) == 1) {
+                p->SetAlpha(a[0]);
+            } else if (!strcmp(cmd, "tile") && sscanf(line, "tile %*p %d", &a[0]) == 1) {
+                p->SetTile(a[0]);
+            } else if (!strcmp(cmd, "viewport") && sscanf(line, "viewport %*p %d %d %d %d", &a[0], &a[1], &a[2], &a[3]) == 4) {
+                p->SetViewPort(cRect(a[0], a[1], a[2], a[3]));
+            } else if (!strcmp(cmd, "drawport") && sscanf(line, "drawport %*p %d %d %d", &a[0], &a[1], &a[2]) == 3) {
+                p->SetDrawPortPoint(cPoint(a[0], a[1]), a[2]);
+            } else if (!strcmp(cmd, "clear")) {
+                p->Clear();
+            } else if (!strcmp(cmd, "fill") && sscanf(line, "fill %*p %x", &c1) == 1) {
+                p->Fill(c1);
+            } else if (!strcmp(cmd, "image") && sscanf(line, "image %*p %d %d %d %d", &a[0], &a[1], &a[2], &a[3]) == 4) {
+                if (!readPixels(a[2], a[3]))
+                    break;
+                p->DrawImage(cPoint(a[0], a[1]), cImage(cSize(a[2], a[3]), &pixels[0]));
+            } else if (!strcmp(cmd, "imageref") && sscanf(line, "imageref %*p %d %d %d", &a[0], &a[1], &a[2]) == 3) {
+                if (handles.count(a[2]))
+                    p->DrawImage(cPoint(a[0], a[1]), handles[a[2]]);
+                else
+                    skipped++;
+            } else if (!strcmp(cmd, "pixel") && sscanf(line, "pixel %*p %d %d %x", &a[0], &a[1], &c1) == 3) {
+                p->DrawPixel(cPoint(a[0], a[1]), c1);
+            } else if (!strcmp(cmd, "text") && sscanf(line, "text %*p %d %d %x %x %d %d %d %d %d %n", &a[0], &a[1], &c1, &c2,
+                                                      &a[2], &a[3], &a[4], &a[5], &a[6], &pos) == 9) {
+                char *name = line + pos;
+                name[strcspn(name, "\n")] = 0;
+                text.resize(a[6] + 1);
+                if (a[6] > 0 && fread(&text[0], 1, a[6], f) != (size_t)a[6])
+                    break;
+                text[a[6]] = 0;
+                std::string key = *cString::sprintf("%s:%d", name, a[5]);
+                if (!fonts.count(key))
+                    fonts[key] = cFont::CreateFont(name, a[5]);
+                p->DrawText(cPoint(a[0], a[1]), &text[0], c1, c2, fonts[key], a[2], a[3], a[4]);
+            } else if (!strcmp(cmd, "rect") && sscanf(line, "rect %*p %d %d %d %d %x", &a[0], &a[1], &a[2], &a[3], &c1) == 5) {
+                p->DrawRectangle(cRect(a[0], a[1], a[2], a[3]), c1);
+            } else if (!strcmp(cmd, "ellipse") && sscanf(line, "ellipse %*p %d %d %d %d %x %d", &a[0], &a[1], &a[2], &a[3], &c1, &a[4]) == 6) {
+                p->DrawEllipse(cRect(a[0], a[1], a[2], a[3]), c1, a[4]);
+            } else if (!strcmp(cmd, "slope") && sscanf(line, "slope %*p %d %d %d %d %x %d", &a[0], &a[1], &a[2], &a[3], &c1, &a[4]) == 6) {
+                p->DrawSlope(cRect(a[0], a[1], a[2], a[3]), c1, a[4]);
+            } else if ((!strcmp(cmd, "render") || !strcmp(cmd, "copy")) &&
+                       sscanf(line, "%*s %*p %p %d %d %d %d %d %d", &id2, &a[0], &a[1], &a[2], &a[3], &a[4], &a[5]) == 7 && pixmap(id2)) {
+                if (!strcmp(cmd, "render"))
+                    p->Render(pixmap(id2), cRect(a[0], a[1], a[2], a[3]), cPoint(a[4], a[5]));
+                else
+                    p->Copy(pixmap(id2), cRect(a[0], a[1], a[2], a[3]), cPoint(a[4], a[5]));
+            } else if ((!strcmp(cmd, "scroll") || !strcmp(cmd, "pan")) &&
+                       sscanf(line, "%*s %*p %d %d %d %d %d %d", &a[0], &a[1], &a[2], &a[3], &a[4], &a[5]) == 6) {
+                if (!strcmp(cmd, "scroll"))
+                    p->Scroll(cPoint(a[0], a[1]), cRect(a[2], a[3], a[4], a[5]));
+                else
+                    p->Pan(cPoint(a[0], a[1]), cRect(a[2], a[3], a[4], a[5]));
+            } else {
+                skipped++;
+            }
+        }
+        // close whatever the trace left open
+        for (auto it = osds.begin(); it != osds.end(); ++it)
+            delete it->second;
+        osds.clear();
+        pixmaps.clear();
+        for (auto it = handles.begin(); it != handles.end(); ++it)
+            oglThread->DropImageData(it->second);
+        handles.clear();
+    }
+    fclose(f);
+    for (auto it = fonts.begin(); it != fonts.end(); ++it)
+        delete it->second;
+
+    if (!frames)
+        return cString::sprintf("no frames flushed in %s", fileName);
+
+    commands = OglStats.commands - commands;
+    glyphHits = OglStats.glyphHits - glyphHits;
+    glyphMisses = OglStats.glyphMisses - glyphMisses;
+    uploadBytes = OglStats.uploadBytes - uploadBytes;
+    return cString::sprintf("%d frames, flush latency avg %.2f ms max %.2f ms, %.1f commands/frame, "
+                            "glyph hit rate %.1f%% of %" PRIu64 ", %" PRIu64 " kb uploaded, %d records skipped",
+                            frames, latencySum / frames, latencyMax, (double)commands / frames,
+                            glyphHits + glyphMisses ? 100.0 * glyphHits / (glyphHits + glyphMisses) : 100.0,
+                            glyphHits + glyphMisses, uploadBytes / 1024, skipped);
+}
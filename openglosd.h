@@ -4,6 +4,12 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <GL/gl.h>
+#ifdef USE_EGL
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -26,8 +32,11 @@ const struct {
 #include FT_ERRORS_H
 
 
+#include <atomic>
+#include <list>
 #include <memory>
-#include <queue>
+#include <unordered_map>
+#include <vector>
 
 #include <vdr/plugin.h>
 #include <vdr/osd.h>
@@ -45,13 +54,21 @@ extern "C"
 //#include "codec.h"
 }
 
-struct sOglImage {
+// Images stored by the skins, texture is GL_NONE while the image waits
+// for its upload or has been evicted from the texture cache; its pixels
+// are kept in data then.
+struct sOglImage : public cListObject {
     GLuint texture;
     GLint width;
     GLint height;
-    bool used;
+    tColor *data;
+    sOglImage(int width, int height, tColor *data) { texture = GL_NONE; this->width = width; this->height = height; this->data = data; }
+    virtual ~sOglImage() { free(data); }
+    long Bytes(void) { return (long)width * height * sizeof(tColor); }
 };
 
+class cOglThread;
+
 /****************************************************************************************
 * Helpers
 ****************************************************************************************/
@@ -65,6 +82,7 @@ enum eShaderType {
     stRect,
     stTexture,
     stText,
+    stShape,
     stCount
 };
 
@@ -90,28 +108,18 @@ public:
 /****************************************************************************************
 * cOglGlyph
 ****************************************************************************************/
-class cOglGlyph : public cListObject {
+class cOglGlyph {
 private:
-    struct tKerning {
-        public:
-            tKerning(uint prevSym, GLfloat kerning = 0.0f)  {
-                this->prevSym = prevSym;
-                this->kerning = kerning;
-            }
-            uint prevSym;
-            GLfloat kerning;
-    };
     uint charCode;
     int bearingLeft;
     int bearingTop;
     int width;
     int height;
     int advanceX;      
-    cVector<tKerning> kerningCache;
-    GLuint texture;
-    void LoadTexture(FT_BitmapGlyph ftGlyph);
+    int atlasX;
+    int atlasY;
 public:
-    cOglGlyph(uint charCode, FT_BitmapGlyph ftGlyph);
+    cOglGlyph(uint charCode, FT_BitmapGlyph ftGlyph, int atlasX, int atlasY);
     virtual ~cOglGlyph();
     uint CharCode(void) { return charCode; }
     int AdvanceX(void) { return advanceX; }
@@ -119,9 +127,8 @@ public:
     int BearingTop(void) const { return bearingTop; }
     int Width(void) const { return width; }
     int Height(void) const { return height; }
-    int GetKerningCache(uint prevSym);
-    void SetKerningCache(uint prevSym, int kerning);
-    void BindTexture(void);
+    int AtlasX(void) const { return atlasX; }
+    int AtlasY(void) const { return atlasY; }
 };
 
 /****************************************************************************************
@@ -137,9 +144,19 @@ private:
     static FT_Library ftLib;
     FT_Face face;
     static cList<cOglFont> *fonts;
-    mutable cList<cOglGlyph> glyphCache;
+    mutable std::unordered_map<uint, cOglGlyph*> glyphCache;
+    mutable std::unordered_map<uint64_t, int> kerningCache;
+    mutable GLuint atlas;
+    mutable int atlasWidth;
+    mutable int atlasHeight;
+    mutable int atlasX;
+    mutable int atlasY;
+    mutable int atlasRowHeight;
+    mutable std::vector<uint8_t> atlasBitmap;
     cOglFont(const char *fontName, int charHeight);
     static void Init(void);
+    bool AtlasPlace(FT_BitmapGlyph ftGlyph, int &x, int &y) const;
+    bool AtlasGrow(void) const;
 public:
     virtual ~cOglFont(void);
     static cOglFont *Get(const char *name, int charHeight);
@@ -150,6 +167,35 @@ public:
     int Height(void) {return height; };
     cOglGlyph* Glyph(uint charCode) const;
     int Kerning(cOglGlyph *glyph, uint prevSym) const;
+    void BindAtlas(void) const;
+};
+
+/****************************************************************************************
+* cOglTextureCache
+* Textures of images drawn from pixel data, keyed by a hash of the pixels.
+* Only used by the OpenGL thread.  Takes 1/OGL_TEXTURE_CACHE_SHARE of the
+* configured GPU cache, the stored images get the rest.
+****************************************************************************************/
+#define OGL_TEXTURE_CACHE_SHARE 4
+
+class cOglTextureCache {
+private:
+    struct sEntry {
+        GLuint texture;
+        long bytes;
+        std::list<uint64_t>::iterator lru;
+    };
+    static std::unordered_map<uint64_t, sEntry> entries;
+    static std::list<uint64_t> lru;     // most recently used first
+    static long memUsed;
+    static long maxSize;
+    static GLuint pbo;
+    static uint64_t Hash(const tColor *argb, GLint width, GLint height);
+    static GLuint Upload(const tColor *argb, GLint width, GLint height);
+public:
+    static GLuint Get(const tColor *argb, GLint width, GLint height);
+    static void SetMaxSize(long bytes) { maxSize = bytes; }
+    static void Cleanup(void);
 };
 
 /****************************************************************************************
@@ -175,6 +221,8 @@ public:
     virtual void Unbind(void);
     bool BindTexture(void);
     void Blit(GLint destX1, GLint destY1, GLint destX2, GLint destY2);
+    void Blit(const cRect &Source, GLint destX, GLint destY);
+    void Scissor(const cRect &Clip);
     GLint Width(void) { return width; };
     GLint Height(void) { return height; };
     bool Scrollable(void) { return scrollable; };
@@ -190,6 +238,7 @@ class cOglOutputFb : public cOglFb {
 private:
     GLvdpauSurfaceNV surface;
 bool run;
+    std::vector<tColor> pixels;
 public:
     cOglOutputFb(GLint width, GLint height);
     virtual ~cOglOutputFb(void);
@@ -197,6 +246,7 @@ public:
     virtual void BindWrite(void);
     virtual void Unbind(void);
     virtual bool Run(){return run;}
+    void CopyToVideo(GLint x, GLint y, GLint w, GLint h);
 };
 
 /****************************************************************************************
@@ -205,8 +255,7 @@ public:
 ****************************************************************************************/
 enum eVertexBufferType {
     vbRect,
-    vbEllipse,
-    vbSlope,
+    vbShape,
     vbTexture,
     vbText,
     vbCount
@@ -221,6 +270,7 @@ private:
     int sizeVertex1;
     int sizeVertex2;
     int numVertices;
+    int maxVertices;
     GLuint drawMode;
 public:
     cOglVb(int type);
@@ -231,6 +281,7 @@ public:
     void ActivateShader(void);
     void EnableBlending(void);
     void DisableBlending(void);
+    void EnableCoverageBlending(void);
     void SetShaderColor(GLint color);
     void SetShaderAlpha(GLint alpha);
     void SetShaderProjectionMatrix(GLint width, GLint height);
@@ -247,6 +298,8 @@ protected:
 public:
     cOglCmd(cOglFb *fb) { this->fb = fb; };
     virtual ~cOglCmd(void) {};
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
     virtual const char* Description(void) = 0;
     virtual bool Execute(void) = 0;
 };
@@ -285,8 +338,9 @@ private:
     GLfloat x, y;
     GLfloat drawPortX, drawPortY;
     GLint transparency;
+    cRect clip;
 public:
-    cOglCmdRenderFbToBufferFb(cOglFb *fb, cOglFb *buffer, GLint x, GLint y, GLint transparency, GLint drawPortX, GLint drawPortY);
+    cOglCmdRenderFbToBufferFb(cOglFb *fb, cOglFb *buffer, GLint x, GLint y, GLint transparency, GLint drawPortX, GLint drawPortY, const cRect &clip = cRect::Null);
     virtual ~cOglCmdRenderFbToBufferFb(void) {};
     virtual const char* Description(void) { return "Render Framebuffer to Buffer"; }
     virtual bool Execute(void);
@@ -296,8 +350,9 @@ class cOglCmdCopyBufferToOutputFb : public cOglCmd {
 private:
     cOglOutputFb *oFb;
     GLint x, y;
+    cRect clip;
 public:
-    cOglCmdCopyBufferToOutputFb(cOglFb *fb, cOglOutputFb *oFb, GLint x, GLint y);
+    cOglCmdCopyBufferToOutputFb(cOglFb *fb, cOglOutputFb *oFb, GLint x, GLint y, const cRect &clip = cRect::Null);
     virtual ~cOglCmdCopyBufferToOutputFb(void) {};
     virtual const char* Description(void) { return "Copy buffer to OutputFramebuffer"; }
     virtual bool Execute(void);
@@ -306,8 +361,9 @@ public:
 class cOglCmdFill : public cOglCmd {
 private:
     GLint color;
+    cRect clip;
 public:
-    cOglCmdFill(cOglFb *fb, GLint color);
+    cOglCmdFill(cOglFb *fb, GLint color, const cRect &clip = cRect::Null);
     virtual ~cOglCmdFill(void) {};
     virtual const char* Description(void) { return "Fill"; }
     virtual bool Execute(void);
@@ -331,9 +387,6 @@ private:
     GLint width, height;
     GLint color;
     GLint quadrants;
-    GLfloat *CreateVerticesFull(int &numVertices);
-    GLfloat *CreateVerticesQuadrant(int &numVertices);
-    GLfloat *CreateVerticesHalf(int &numVertices); 
 public:
     cOglCmdDrawEllipse(cOglFb *fb, GLint x, GLint y, GLint width, GLint height, GLint color, GLint quadrants);
     virtual ~cOglCmdDrawEllipse(void) {};
@@ -384,10 +437,11 @@ public:
 
 class cOglCmdDrawTexture : public cOglCmd {
 private:
-    sOglImage *imageRef;
+    cOglThread *oglThread;
+    int imageHandle;
     GLint x, y;
 public:
-    cOglCmdDrawTexture(cOglFb *fb, sOglImage *imageRef, GLint x, GLint y);
+    cOglCmdDrawTexture(cOglFb *fb, cOglThread *oglThread, int imageHandle, GLint x, GLint y);
     virtual ~cOglCmdDrawTexture(void) {};
     virtual const char* Description(void) { return "Draw Texture"; }
     virtual bool Execute(void);
@@ -395,42 +449,66 @@ public:
 
 class cOglCmdStoreImage : public cOglCmd {
 private:
+    cOglThread *oglThread;
     sOglImage *imageRef;
-    tColor *data;
 public:
-    cOglCmdStoreImage(sOglImage *imageRef, tColor *argb);
-    virtual ~cOglCmdStoreImage(void);
+    cOglCmdStoreImage(cOglThread *oglThread, sOglImage *imageRef);
+    virtual ~cOglCmdStoreImage(void) {};
     virtual const char* Description(void) { return "Store Image"; }
     virtual bool Execute(void);
 };
 
 class cOglCmdDropImage : public cOglCmd {
 private:
-    sOglImage *imageRef;
-    cCondWait *wait;
+    cOglThread *oglThread;
+    int imageHandle;
 public:
-    cOglCmdDropImage(sOglImage *imageRef, cCondWait *wait);
+    cOglCmdDropImage(cOglThread *oglThread, int imageHandle);
     virtual ~cOglCmdDropImage(void) {};
     virtual const char* Description(void) { return "Drop Image"; }
     virtual bool Execute(void);
 };
 
+class cOglCmdSignal : public cOglCmd {
+private:
+    cCondWait *wait;
+public:
+    cOglCmdSignal(cCondWait *wait) : cOglCmd(NULL) { this->wait = wait; };
+    virtual ~cOglCmdSignal(void) {};
+    virtual const char* Description(void) { return "Signal"; }
+    virtual bool Execute(void) { wait->Signal(); return true; };
+};
+
 /******************************************************************************
 * cOglThread
 ******************************************************************************/
-#define OGL_MAX_OSDIMAGES 256
-#define OGL_CMDQUEUE_SIZE 100
+#define OGL_CMDQUEUE_SIZE 1024      // power of 2
 
 class cOglThread : public cThread {
 private:
     cCondWait *startWait;
     cCondWait *wait;
-    bool stalled;
-    std::queue<cOglCmd*> commands;
+    cCondWait *stallWait;
+    std::atomic<bool> stalled;
+    std::atomic<bool> idle;
+    cMutex cmdMutex;
+    cOglCmd *commands[OGL_CMDQUEUE_SIZE];
+    std::atomic<unsigned> cmdHead;
+    std::atomic<unsigned> cmdTail;
     GLint maxTextureSize;
-    sOglImage imageCache[OGL_MAX_OSDIMAGES];
+    std::unordered_map<int, sOglImage *> images;   // stored images by handle
+    int lastImageHandle;
+    cList<sOglImage> imageLru;                      // images on the GPU, most recently used first
     long memCached;
+    long memStored;                                 // bytes of all stored images, locked
     long maxCacheSize;
+#ifdef USE_EGL
+    EGLDisplay eglDisplay;
+    EGLContext eglContext;
+    EGLSurface eglSurface;
+    bool InitEgl(void);
+    void DeleteEgl(void);
+#endif
     bool InitOpenGL(void);
     bool InitShaders(void);
     void DeleteShaders(void);
@@ -438,18 +516,24 @@ private:
     bool InitVertexBuffers(void);
     void DeleteVertexBuffers(void);
     void Cleanup(void);
-    int GetFreeSlot(void);
-    void ClearSlot(int slot);
+    void EvictImages(long bytes);
+    void DeleteImages(void);
 protected:
     virtual void Action(void);
 public:
     cOglThread(cCondWait *startWait, int maxCacheSize);
     virtual ~cOglThread();
     void Stop(void);
-    void DoCmd(cOglCmd* cmd);
+    void DoCmd(cOglCmd* cmd) { DoCmds(&cmd, 1); };
+    void DoCmds(cOglCmd **cmds, int count);
     int StoreImage(const cImage &image);
     void DropImageData(int imageHandle);
-    sOglImage *GetImageRef(int slot);
+    bool GetImageSize(int imageHandle, int *width, int *height);
+    sOglImage *GetImageRef(int imageHandle);
+    bool UploadImage(sOglImage *imageRef);
+    bool BindImage(sOglImage *imageRef);
+    void DeleteImage(int imageHandle);
+    void DeleteImage(sOglImage *imageRef);
     int MaxTextureSize(void) { return maxTextureSize; };
 };
 
@@ -461,6 +545,10 @@ private:
     cOglFb *fb;
     std::shared_ptr<cOglThread> oglThread;
     bool dirty;
+    cRect damage;           // changed area since the last flush, in viewport coordinates
+    cRect flushedArea;      // area covered in the osd buffer at the last flush
+    void MarkDamaged(const cRect &Rect);
+    void MarkAllDamaged(void) { damage = cRect(cPoint(0, 0), ViewPort().Size()); }
 public:
     cOglPixmap(std::shared_ptr<cOglThread> oglThread, int Layer, const cRect &ViewPort, const cRect &DrawPort = cRect::Null);
     virtual ~cOglPixmap(void);
@@ -469,6 +557,9 @@ public:
     int Y(void) { return ViewPort().Y(); };
     virtual bool IsDirty(void) { return dirty; }
     virtual void SetDirty(bool dirty = true) { this->dirty = dirty; }
+    const cRect &FlushedArea(void) { return flushedArea; }
+    void FlushDamage(const cRect &Area, cRect &Region);
+    virtual void SetLayer(int Layer);
     virtual void SetAlpha(int Alpha);
     virtual void SetTile(bool Tile);
     virtual void SetViewPort(const cRect &Rect);
@@ -497,6 +588,8 @@ private:
     cOglFb *bFb;
     std::shared_ptr<cOglThread> oglThread;
     cVector<cOglPixmap *> oglPixmaps;
+    std::vector<cOglCmd *> flushCmds;
+    cRect damage;
     bool isSubtitleOsd;
 protected:
 public:
@@ -510,4 +603,31 @@ public:
     static cOglOutputFb *oFb;
 };
 
+/******************************************************************************
+* OSD statistics and draw traces
+******************************************************************************/
+struct sOglStats {
+    std::atomic<uint64_t> commands;     // commands handed to the OpenGL thread
+    std::atomic<uint64_t> glyphHits;
+    std::atomic<uint64_t> glyphMisses;
+    std::atomic<uint64_t> uploadBytes;  // texture data uploaded
+};
+
+extern sOglStats OglStats;
+
+// Records the OSD and pixmap calls of the skins into a file, which
+// cOglTrace::Replay draws again to benchmark the OpenGL OSD.
+class cOglTrace {
+private:
+    static cMutex mutex;
+    static FILE *file;
+    static std::atomic<bool> active;
+public:
+    static bool Start(const char *fileName);
+    static void Stop(void);
+    static bool Active(void) { return active; }
+    static void Record(const void *data, int size, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+    static cString Replay(std::shared_ptr<cOglThread> oglThread, const char *fileName, int loops);
+};
+
 #endif //__SOFTHDDEVICE_OPENGLOSD_H
\ No newline at end of file
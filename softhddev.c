@@ -37,6 +37,8 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include <libintl.h>
 #define _(str) gettext(str)		///< gettext shortcut
@@ -62,8 +64,8 @@
 #define __USE_GNU
 #endif
 #include <pthread.h>
+#include <stdatomic.h>
 
-#include "iatomic.h"			// portable atomic_t
 #include "misc.h"
 #include "softhddev.h"
 
@@ -505,13 +507,483 @@ void ResetChannelId(void)
     Debug(3, "audio/demux: reset channel id\n");
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//	Start code scanner
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	Find next 0x00 0x00 0x01 start code prefix, portable version.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///
+///	@returns pointer to the first 0x00 of the prefix or NULL.
+///
+static const uint8_t *StartCodeFindC(const uint8_t * p, const uint8_t * end)
+{
+    end -= 2;
+    while (p < end) {
+	if (p[2] > 1) {			// no prefix at p, p+1, p+2
+	    p += 3;
+	} else if (p[1]) {		// no prefix at p, p+1
+	    p += 2;
+	} else if (p[0] || p[2] != 1) {
+	    ++p;
+	} else {
+	    return p;
+	}
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+///
+///	Find next 0x00 0x00 0x01 start code prefix, SSE2 version.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///
+///	@returns pointer to the first 0x00 of the prefix or NULL.
+///
+__attribute__ ((target("sse2")))
+static const uint8_t *StartCodeFindSse2(const uint8_t * p,
+    const uint8_t * end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    while (end - p >= 16 + 2) {
+	__m128i z0;
+	__m128i z1;
+	__m128i o2;
+	unsigned mask;
+
+	z0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero);
+	z1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), zero);
+	o2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), one);
+	mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(z0, z1), o2));
+	if (mask) {
+	    return p + __builtin_ctz(mask);
+	}
+	p += 16;
+    }
+    return StartCodeFindC(p, end);
+}
+
+///
+///	Find next 0x00 0x00 0x01 start code prefix, AVX2 version.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///
+///	@returns pointer to the first 0x00 of the prefix or NULL.
+///
+__attribute__ ((target("avx2")))
+static const uint8_t *StartCodeFindAvx2(const uint8_t * p,
+    const uint8_t * end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    while (end - p >= 32 + 2) {
+	__m256i z0;
+	__m256i z1;
+	__m256i o2;
+	unsigned mask;
+
+	z0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), zero);
+	z1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)),
+	    zero);
+	o2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)),
+	    one);
+	mask =
+	    _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(z0, z1),
+		o2));
+	if (mask) {
+	    return p + __builtin_ctz(mask);
+	}
+	p += 32;
+    }
+    return StartCodeFindSse2(p, end);
+}
+
+#endif
+
+static const uint8_t *StartCodeFindInit(const uint8_t *, const uint8_t *);
+
+    /// start code scanner, selected on first use
+static const uint8_t *(*StartCodeFind) (const uint8_t *, const uint8_t *) =
+    StartCodeFindInit;
+
+///
+///	Select start code scanner by cpu features.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///
+///	@returns pointer to the first 0x00 of the prefix or NULL.
+///
+static const uint8_t *StartCodeFindInit(const uint8_t * p,
+    const uint8_t * end)
+{
+    const char *name;
+
+    StartCodeFind = StartCodeFindC;
+    name = "C";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	StartCodeFind = StartCodeFindAvx2;
+	name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+	StartCodeFind = StartCodeFindSse2;
+	name = "SSE2";
+    }
+#endif
+    Info(_("video: using %s start code scanner\n"), name);
+
+    return StartCodeFind(p, end);
+}
+
+///
+///	Get start code prefix state at end of buffer.
+///
+///	Carried over to the next PES packet, for a prefix split between
+///	two packets.
+///
+///	@param p	begin of buffer
+///	@param n	size of buffer
+///
+///	@retval 3	buffer ends with 0x00 0x00 0x01
+///	@retval 2	buffer ends with 0x00 0x00
+///	@retval 1	buffer ends with 0x00
+///	@retval 0	no prefix at end of buffer
+///
+static int StartCodeTail(const uint8_t * p, int n)
+{
+    p += n;
+    if (n >= 3 && !p[-3] && !p[-2] && p[-1] == 0x01) {
+	return 3;
+    }
+    if (n >= 2 && !p[-2] && !p[-1]) {
+	return 2;
+    }
+    if (n >= 1 && !p[-1]) {
+	return 1;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//	Audio sync detector
+//////////////////////////////////////////////////////////////////////////////
+
+#define AUDIO_SYNC_MPEG	0x01		///< 0xFFE mpeg audio sync
+#define AUDIO_SYNC_LATM	0x02		///< 0x56E AAC LATM sync
+#define AUDIO_SYNC_AC3	0x04		///< 0x0B77 (E-)AC-3 sync
+#define AUDIO_SYNC_ADTS	0x08		///< 0xFFF ADTS sync
+#define AUDIO_SYNC_ALL	0x0F		///< all audio sync classes
+
+///
+///	Audio sync classes, which can start with this byte.
+///
+static const uint8_t AudioSyncTable[256] = {
+    [0x0B] = AUDIO_SYNC_AC3,
+    [0x56] = AUDIO_SYNC_LATM,
+    [0xFF] = AUDIO_SYNC_MPEG | AUDIO_SYNC_ADTS,
+};
+
+///
+///	Last detected audio sync class for each PES stream id.
+///
+static uint8_t AudioSyncLast[256];
+
+///
+///	Audio sync detector result.
+///
+typedef struct _audio_sync_
+{
+    unsigned CodecID;			///< detected codec id
+    int Size;				///< frame size, <0 bytes needed
+    int Confidence;			///< number of sync words checked
+    int Class;				///< AUDIO_SYNC_* of frame
+} AudioSync;
+
+///
+///	Find next byte, which can start an audio frame.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///	@param mask	allowed AUDIO_SYNC_* classes
+///
+///	@returns pointer to the candidate or end.
+///
+static const uint8_t *AudioSyncScanC(const uint8_t * p,
+    const uint8_t * end, unsigned mask)
+{
+    while (p < end && !(AudioSyncTable[*p] & mask)) {
+	++p;
+    }
+    return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+///
+///	Find next byte, which can start an audio frame, SSE2 version.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///	@param mask	allowed AUDIO_SYNC_* classes
+///
+///	@returns pointer to the candidate or end.
+///
+__attribute__ ((target("sse2")))
+static const uint8_t *AudioSyncScanSse2(const uint8_t * p,
+    const uint8_t * end, unsigned mask)
+{
+    const __m128i ac3 = _mm_set1_epi8(0x0B);
+    const __m128i latm = _mm_set1_epi8(0x56);
+    const __m128i mpeg = _mm_set1_epi8((char)0xFF);
+
+    while (end - p >= 16) {
+	__m128i v;
+	__m128i hit;
+	unsigned bits;
+
+	v = _mm_loadu_si128((const __m128i *)p);
+	hit = _mm_setzero_si128();
+	if (mask & AUDIO_SYNC_AC3) {
+	    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, ac3));
+	}
+	if (mask & AUDIO_SYNC_LATM) {
+	    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, latm));
+	}
+	if (mask & (AUDIO_SYNC_MPEG | AUDIO_SYNC_ADTS)) {
+	    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, mpeg));
+	}
+	bits = _mm_movemask_epi8(hit);
+	if (bits) {
+	    return p + __builtin_ctz(bits);
+	}
+	p += 16;
+    }
+    return AudioSyncScanC(p, end, mask);
+}
+
+#endif
+
+static const uint8_t *AudioSyncScanInit(const uint8_t *, const uint8_t *,
+    unsigned);
+
+    /// audio sync candidate scanner, selected on first use
+static const uint8_t *(*AudioSyncScan) (const uint8_t *, const uint8_t *,
+    unsigned) = AudioSyncScanInit;
+
+///
+///	Select audio sync candidate scanner by cpu features.
+///
+///	@param p	begin of buffer
+///	@param end	end of buffer
+///	@param mask	allowed AUDIO_SYNC_* classes
+///
+///	@returns pointer to the candidate or end.
+///
+static const uint8_t *AudioSyncScanInit(const uint8_t * p,
+    const uint8_t * end, unsigned mask)
+{
+    AudioSyncScan = AudioSyncScanC;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+	AudioSyncScan = AudioSyncScanSse2;
+    }
+#endif
+
+    return AudioSyncScan(p, end, mask);
+}
+
+///
+///	Bytes of the next sync word, checked after an audio frame.
+///
+static const uint8_t AudioSyncNext[AUDIO_SYNC_ALL + 1] = {
+    [AUDIO_SYNC_MPEG] = 4,
+    [AUDIO_SYNC_LATM] = 2,
+    [AUDIO_SYNC_AC3] = 5,
+    [AUDIO_SYNC_ADTS] = 3,
+};
+
+///
+///	Check for an audio frame of one sync class.
+///
+///	@param p	candidate frame
+///	@param n	number of bytes
+///	@param class	single AUDIO_SYNC_* class
+///	@param[out] sync	detected codec, frame size and confidence
+///
+///	@retval <0	possible frame, but need more data
+///	@retval 0	no valid frame
+///	@retval >0	valid frame size
+///
+static int AudioSyncCheck(const uint8_t * p, int n, unsigned class,
+    AudioSync * sync)
+{
+    int r;
+
+    switch (class) {
+	case AUDIO_SYNC_MPEG:
+	    if (!FastMpegCheck(p)) {
+		return 0;
+	    }
+	    r = MpegCheck(p, n);
+	    sync->CodecID = AV_CODEC_ID_MP2;
+	    break;
+	case AUDIO_SYNC_LATM:
+	    if (!FastLatmCheck(p)) {
+		return 0;
+	    }
+	    r = LatmCheck(p, n);
+	    sync->CodecID = AV_CODEC_ID_AAC_LATM;
+	    break;
+	case AUDIO_SYNC_AC3:
+	    if (!FastAc3Check(p)) {
+		return 0;
+	    }
+	    r = Ac3Check(p, n);
+	    sync->CodecID =
+		p[5] > (10 << 3) ? AV_CODEC_ID_EAC3 : AV_CODEC_ID_AC3;
+	    break;
+	case AUDIO_SYNC_ADTS:
+	    if (!FastAdtsCheck(p)) {
+		return 0;
+	    }
+	    r = AdtsCheck(p, n);
+	    sync->CodecID = AV_CODEC_ID_AAC;
+	    break;
+	default:
+	    return 0;
+    }
+    sync->Class = class;
+    sync->Size = r;
+    sync->Confidence = r > 0 ? 2 : 0;
+
+    return r;
+}
+
+///
+///	Check the begin of the sync word following a complete frame.
+///
+///	The header checks test each byte on its own, the missing bytes are
+///	taken from the header of the frame itself.
+///
+///	@param p	frame
+///	@param n	number of bytes, frame and begin of next sync word
+///	@param size	frame size
+///	@param class	single AUDIO_SYNC_* class
+///
+///	@returns true, if the bytes after the frame can start a frame of
+///	the same class.
+///
+static int AudioSyncNextPrefix(const uint8_t * p, int n, int size,
+    unsigned class)
+{
+    uint8_t next[5];
+
+    memcpy(next, p, AudioSyncNext[class]);
+    memcpy(next, p + size, n - size);
+    switch (class) {
+	case AUDIO_SYNC_MPEG:
+	    return FastMpegCheck(next);
+	case AUDIO_SYNC_LATM:
+	    return FastLatmCheck(next);
+	case AUDIO_SYNC_AC3:
+	    return FastAc3Check(next);
+	case AUDIO_SYNC_ADTS:
+	    return FastAdtsCheck(next);
+    }
+    return 0;
+}
+
+///
+///	Find next audio frame in a single pass.
+///
+///	Only bytes, which can start a frame of the allowed classes, are
+///	checked.  A frame of the hinted class at the begin of the buffer,
+///	is accepted as soon as it is complete, without waiting for the
+///	complete sync word of the following frame.  Bytes after the frame
+///	must still begin a sync word of the same class.
+///
+///	@param data	buffer with audio elementary stream
+///	@param size	number of bytes in buffer
+///	@param mask	allowed AUDIO_SYNC_* classes
+///	@param hint	AUDIO_SYNC_* class last seen on this stream or 0
+///	@param[out] sync	detected codec, frame size (0 none, <0 need
+///			more bytes) and confidence
+///
+///	@returns offset of the (possible) frame, or number of bytes to skip.
+///
+static int AudioSyncFind(const uint8_t * data, int size, unsigned mask,
+    unsigned hint, AudioSync * sync)
+{
+    const uint8_t *p;
+    const uint8_t *end;
+
+    sync->CodecID = AV_CODEC_ID_NONE;
+    sync->Size = 0;
+    sync->Confidence = 0;
+    sync->Class = 0;
+    if (size < 5) {			// need 5 bytes to check any header
+	return 0;
+    }
+
+    end = data + size - 4;
+    for (p = data; (p = AudioSyncScan(p, end, mask)) < end; ++p) {
+	unsigned classes;
+	int n;
+
+	n = data + size - p;
+	// 0xFF is mpeg or ADTS: lowest class first
+	for (classes = AudioSyncTable[*p] & mask; classes;
+	    classes &= classes - 1) {
+	    unsigned class;
+	    int r;
+
+	    class = classes & -classes;
+	    r = AudioSyncCheck(p, n, class, sync);
+	    if (r < 0 && p == data && (class & hint) && n >= 6
+		&& -r - AudioSyncNext[class] <= n
+		&& AudioSyncNextPrefix(p, n, -r - AudioSyncNext[class],
+		    class)) {
+		// known stream: the complete frame is enough
+		sync->Size = -r - AudioSyncNext[class];
+		sync->Confidence = 1;
+		return 0;
+	    }
+	    if (r) {
+		return p - data;
+	    }
+	}
+    }
+
+    return end - data;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //	Video
 //////////////////////////////////////////////////////////////////////////////
 
-#define VIDEO_BUFFER_SIZE (512 * 1024 * 2)	///< video PES buffer default size
 #define VIDEO_PACKET_MAX 192		///< max number of video packets
 
+    /// smallest video packet buffer size class (16 KiB)
+#define VIDEO_BUFFER_MIN_SHIFT 14
+    /// number of video packet buffer size classes (16 KiB .. 8 MiB)
+#define VIDEO_BUFFER_CLASSES 10
+    /// max free buffers kept per size class
+#define VIDEO_BUFFER_CACHE 8
+
 /**
 **	Video output stream device structure.	Parser, decoder, display.
 */
@@ -524,15 +996,16 @@ struct __video_stream__
     enum AVCodecID CodecID;		///< current codec id
     enum AVCodecID LastCodecID;		///< last codec id
 
-    volatile char NewStream;		///< flag new video stream
-    volatile char ClosingStream;	///< flag closing video stream
-    volatile char SkipStream;		///< skip video stream
-    volatile char Freezed;		///< stream freezed
+    atomic_char NewStream;		///< flag new video stream
+    atomic_char ClosingStream;		///< flag closing video stream
+    atomic_char SkipStream;		///< skip video stream
+    atomic_char Freezed;		///< stream freezed
+
+    atomic_char TrickSpeed;		///< current trick speed
+    atomic_char ClearClose;		///< clear video buffers for close
 
-    volatile char TrickSpeed;		///< current trick speed
-    volatile char Close;		///< command close video stream
-    volatile char ClearBuffers;		///< command clear video buffers
-    volatile char ClearClose;		///< clear video buffers for close
+    /// pending commands for the decoder side (VIDEO_CMD_*)
+    atomic_uint Commands;
 
     int InvalidPesCounter;		///< counter of invalid PES packets
 
@@ -540,9 +1013,18 @@ struct __video_stream__
     AVPacket PacketRb[VIDEO_PACKET_MAX];	///< PES packet ring buffer
     int StartCodeState;			///< last three bytes start code state
 
-    int PacketWrite;			///< ring buffer write pointer
-    int PacketRead;			///< ring buffer read pointer
-    atomic_t PacketsFilled;		///< how many of the ring buffer is used
+    int PacketWrite;			///< ring buffer write pointer (writer)
+    int PacketRead;			///< ring buffer read pointer (reader)
+    atomic_int PacketsFilled;		///< how many of the ring buffer is used
+};
+
+///
+///	Video stream commands, executed by the decoder side.
+///
+enum
+{
+    VIDEO_CMD_CLOSE = 1 << 0,		///< close video stream
+    VIDEO_CMD_CLEAR = 1 << 1,		///< clear video buffers
 };
 
 static VideoStream MyVideoStream[1];	///< normal video stream
@@ -564,85 +1046,387 @@ static volatile char Usr1Signal;	///< true got usr1 signal
 
 //////////////////////////////////////////////////////////////////////////////
 
-/**
-**	Initialize video packet ringbuffer.
-**
-**	@param stream	video stream
-*/
-static void VideoPacketInit(VideoStream * stream)
+///
+///	Video packet buffer pool.
+///
+///	Shared by all video streams.  Buffers are grouped in power of two
+///	size classes, a ring slot only holds a buffer while it contains data.
+///
+static struct _video_buffer_pool_
 {
-    int i;
+    pthread_mutex_t Mutex;		///< pool lock
+    /// free buffers of each size class
+    AVBufferRef *Free[VIDEO_BUFFER_CLASSES][VIDEO_BUFFER_CACHE];
+    int FreeCount[VIDEO_BUFFER_CLASSES];	///< free buffers in class
+    size_t Allocated;			///< bytes allocated by the pool
+    size_t Used;			///< bytes used by ring slots
+    size_t HighWater;			///< max bytes allocated
+} VideoBufferPool = {
+    .Mutex = PTHREAD_MUTEX_INITIALIZER,
+};
 
-    for (i = 0; i < VIDEO_PACKET_MAX; ++i) {
-	AVPacket *avpkt;
+///
+///	Get size class of video packet buffer.
+///
+///	@param size	needed buffer size without padding
+///
+///	@returns size class, VIDEO_BUFFER_CLASSES for oversized buffers.
+///
+static int VideoBufferClass(int size)
+{
+    int i;
 
-	avpkt = &stream->PacketRb[i];
-	// build a clean ffmpeg av packet
-	if (av_new_packet(avpkt, VIDEO_BUFFER_SIZE)) {
-	    Fatal(_("[softhddev] out of memory\n"));
+    for (i = 0; i < VIDEO_BUFFER_CLASSES; ++i) {
+	if (size <= 1 << (VIDEO_BUFFER_MIN_SHIFT + i)) {
+	    break;
 	}
     }
-
-    atomic_set(&stream->PacketsFilled, 0);
-    stream->PacketRead = stream->PacketWrite = 0;
+    return i;
 }
 
-/**
-**	Cleanup video packet ringbuffer.
-**
-**	@param stream	video stream
-*/
-static void VideoPacketExit(VideoStream * stream)
+///
+///	Get a video packet buffer from the pool.
+///
+///	@param size	needed buffer size without padding
+///
+///	@returns buffer with at least size + padding bytes.
+///
+static AVBufferRef *VideoBufferGet(int size)
 {
+    AVBufferRef *buf;
+    int size_class;
     int i;
 
-    atomic_set(&stream->PacketsFilled, 0);
-
-    for (i = 0; i < VIDEO_PACKET_MAX; ++i) {
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(56,28,1)
-	av_free_packet(&stream->PacketRb[i]);
-#else
-	av_packet_unref(&stream->PacketRb[i]);
-#endif
+    size_class = VideoBufferClass(size);
+    if (size_class < VIDEO_BUFFER_CLASSES) {
+	size = 1 << (VIDEO_BUFFER_MIN_SHIFT + size_class);
+    }
+
+    pthread_mutex_lock(&VideoBufferPool.Mutex);
+    if (size_class < VIDEO_BUFFER_CLASSES) {
+	// newest first, skip buffers still referenced by the decoder
+	for (i = VideoBufferPool.FreeCount[size_class] - 1; i >= 0; --i) {
+	    buf = VideoBufferPool.Free[size_class][i];
+	    if (av_buffer_is_writable(buf)) {
+		VideoBufferPool.Free[size_class][i] =
+		    VideoBufferPool.Free[size_class][--VideoBufferPool.
+		    FreeCount[size_class]];
+		VideoBufferPool.Used += buf->size;
+		pthread_mutex_unlock(&VideoBufferPool.Mutex);
+		return buf;
+	    }
+	}
+    }
+    if (!(buf = av_buffer_alloc(size + FF_INPUT_BUFFER_PADDING_SIZE))) {
+	Fatal(_("[softhddev] out of memory\n"));
+    }
+    VideoBufferPool.Allocated += buf->size;
+    VideoBufferPool.Used += buf->size;
+    if (VideoBufferPool.Allocated > VideoBufferPool.HighWater) {
+	VideoBufferPool.HighWater = VideoBufferPool.Allocated;
+	Debug(3, "video: packet pool high-water %zu KiB\n",
+	    VideoBufferPool.HighWater / 1024);
     }
+    pthread_mutex_unlock(&VideoBufferPool.Mutex);
+
+    return buf;
 }
 
-/**
-**	Place video data in packet ringbuffer.
-**
-**	@param stream	video stream
-**	@param pts	presentation timestamp of pes packet
-**	@param data	data of pes packet
-**	@param size	size of pes packet
-*/
-static void VideoEnqueue(VideoStream * stream, int64_t pts, const void *data,
-    int size)
+///
+///	Return a video packet buffer to the pool.
+///
+///	@param buf	buffer from VideoBufferGet
+///
+static void VideoBufferPut(AVBufferRef * buf)
 {
-    AVPacket *avpkt;
+    int size_class;
 
-    // Debug(3, "video: enqueue %d\n", size);
+    size_class = VideoBufferClass(buf->size - FF_INPUT_BUFFER_PADDING_SIZE);
 
-    avpkt = &stream->PacketRb[stream->PacketWrite];
-    if (!avpkt->stream_index) {		// add pts only for first added
-	avpkt->pts = pts;
+    pthread_mutex_lock(&VideoBufferPool.Mutex);
+    VideoBufferPool.Used -= buf->size;
+    if (size_class < VIDEO_BUFFER_CLASSES
+	&& VideoBufferPool.FreeCount[size_class] < VIDEO_BUFFER_CACHE) {
+	VideoBufferPool.Free[size_class][VideoBufferPool.FreeCount[size_class]++] = buf;
+	buf = NULL;
+    } else {
+	VideoBufferPool.Allocated -= buf->size;
     }
-    if (avpkt->stream_index + size >= avpkt->size) {
+    pthread_mutex_unlock(&VideoBufferPool.Mutex);
 
-	Warning(_("video: packet buffer too small for %d\n"),
-	    avpkt->stream_index + size);
+    if (buf) {				// cache full or oversized
+	av_buffer_unref(&buf);
+    }
+}
 
-	// new + grow reserves FF_INPUT_BUFFER_PADDING_SIZE
-	av_grow_packet(avpkt, ((size + VIDEO_BUFFER_SIZE / 2)
-		/ (VIDEO_BUFFER_SIZE / 2)) * (VIDEO_BUFFER_SIZE / 2));
-	// FIXME: out of memory!
-#ifdef DEBUG
-	if (avpkt->size <= avpkt->stream_index + size) {
-	    fprintf(stderr, "%d %d %d\n", avpkt->size, avpkt->stream_index,
-		size);
-	    fflush(stderr);
-	    abort();
+///
+///	Release all cached video packet buffers.
+///
+static void VideoBufferFlush(void)
+{
+    int i;
+
+    pthread_mutex_lock(&VideoBufferPool.Mutex);
+    for (i = 0; i < VIDEO_BUFFER_CLASSES; ++i) {
+	while (VideoBufferPool.FreeCount[i]) {
+	    AVBufferRef *buf;
+
+	    buf = VideoBufferPool.Free[i][--VideoBufferPool.FreeCount[i]];
+	    VideoBufferPool.Allocated -= buf->size;
+	    av_buffer_unref(&buf);
 	}
-#endif
+    }
+    pthread_mutex_unlock(&VideoBufferPool.Mutex);
+}
+
+///
+///	Get video packet buffer pool statistics.
+///
+///	@param[out] used	bytes currently used by packets
+///	@param[out] allocated	bytes currently allocated (used + cached)
+///	@param[out] high_water	max bytes allocated since start
+///
+void GetVideoBufferStats(size_t * used, size_t * allocated,
+    size_t * high_water)
+{
+    pthread_mutex_lock(&VideoBufferPool.Mutex);
+    *used = VideoBufferPool.Used;
+    *allocated = VideoBufferPool.Allocated;
+    *high_water = VideoBufferPool.HighWater;
+    pthread_mutex_unlock(&VideoBufferPool.Mutex);
+}
+
+///
+///	Give packet buffer back to the pool.
+///
+///	@param avpkt	packet of video packet ringbuffer
+///
+static void VideoPacketRelease(AVPacket * avpkt)
+{
+    if (avpkt->buf) {
+	VideoBufferPut(avpkt->buf);
+	avpkt->buf = NULL;
+    }
+    avpkt->data = NULL;
+    avpkt->size = 0;
+    avpkt->stream_index = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//	Buffer back-pressure
+//////////////////////////////////////////////////////////////////////////////
+
+static pthread_mutex_t BufferFreeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t BufferFreeCond = PTHREAD_COND_INITIALIZER;
+static atomic_int BufferFreeWaiters;	///< threads waiting for free space
+
+///
+///	Wake threads waiting for free audio/video buffer space.
+///
+///	Called by the audio thread and the video decoder after they
+///	consumed data, cheap if nobody waits.
+///
+static void BufferFreeWakeup(void)
+{
+    // pairs with the fence in BufferWaitFree: either the waiter sees
+    // the freed space or we see the waiter
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&BufferFreeWaiters, memory_order_relaxed)) {
+	pthread_mutex_lock(&BufferFreeMutex);
+	pthread_cond_broadcast(&BufferFreeCond);
+	pthread_mutex_unlock(&BufferFreeMutex);
+    }
+}
+
+///
+///	Wait until buffers have free space.
+///
+///	@param full	function returns true while buffers are full
+///	@param timeout	timeout in ms
+///
+///	@returns true if buffers have space, false on timeout.
+///
+static int BufferWaitFree(int (*full)(void), int timeout)
+{
+    struct timespec abstime;
+    int busy;
+
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec += timeout / 1000;
+    abstime.tv_nsec += (timeout % 1000) * 1000 * 1000;
+    if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+	// avoid overflow
+	abstime.tv_sec++;
+	abstime.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    atomic_fetch_add_explicit(&BufferFreeWaiters, 1, memory_order_relaxed);
+    pthread_mutex_lock(&BufferFreeMutex);
+    atomic_thread_fence(memory_order_seq_cst);
+    while ((busy = full())) {
+	if (pthread_cond_timedwait(&BufferFreeCond, &BufferFreeMutex,
+		&abstime) == ETIMEDOUT) {
+	    busy = full();
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&BufferFreeMutex);
+    atomic_fetch_sub_explicit(&BufferFreeWaiters, 1, memory_order_relaxed);
+
+    return !busy;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+**	Initialize video packet ringbuffer.
+**
+**	@param stream	video stream
+*/
+static void VideoPacketInit(VideoStream * stream)
+{
+    int i;
+
+    for (i = 0; i < VIDEO_PACKET_MAX; ++i) {
+	AVPacket *avpkt;
+
+	avpkt = &stream->PacketRb[i];
+	// build a clean ffmpeg av packet, buffer is taken from pool on use
+	av_init_packet(avpkt);
+	avpkt->buf = NULL;
+	avpkt->data = NULL;
+	avpkt->size = 0;
+	avpkt->stream_index = 0;
+    }
+
+    atomic_store_explicit(&stream->PacketsFilled, 0, memory_order_relaxed);
+    atomic_store_explicit(&stream->Commands, 0, memory_order_relaxed);
+    stream->PacketRead = stream->PacketWrite = 0;
+}
+
+/**
+**	Cleanup video packet ringbuffer.
+**
+**	@param stream	video stream
+*/
+static void VideoPacketExit(VideoStream * stream)
+{
+    int i;
+
+    atomic_store_explicit(&stream->PacketsFilled, 0, memory_order_relaxed);
+
+    for (i = 0; i < VIDEO_PACKET_MAX; ++i) {
+	VideoPacketRelease(&stream->PacketRb[i]);
+    }
+    BufferFreeWakeup();
+}
+
+/**
+**	Get number of filled packets in video packet ringbuffer.
+**
+**	Acquire pairs with the release in VideoNextPacket/VideoPacketPop:
+**	the reader sees the packet data, the writer sees the slot is free.
+**
+**	@param stream	video stream
+*/
+static inline int VideoPacketsFilled(const VideoStream * stream)
+{
+    return atomic_load_explicit(&stream->PacketsFilled,
+	memory_order_acquire);
+}
+
+/**
+**	Remove the oldest packet from video packet ringbuffer.
+**
+**	Must be called from the reader side.
+**
+**	@param stream	video stream
+*/
+static void VideoPacketPop(VideoStream * stream)
+{
+    // give buffer back, decoder keeps its own reference
+    VideoPacketRelease(&stream->PacketRb[stream->PacketRead]);
+    // advance packet read
+    stream->PacketRead = (stream->PacketRead + 1) % VIDEO_PACKET_MAX;
+    atomic_fetch_sub_explicit(&stream->PacketsFilled, 1,
+	memory_order_release);
+    BufferFreeWakeup();
+}
+
+/**
+**	Drop all filled packets of video packet ringbuffer.
+**
+**	Must be called from the reader side.
+**
+**	@param stream	video stream
+*/
+static void VideoPacketClear(VideoStream * stream)
+{
+    int filled;
+
+    // only drop what is published, the writer may add packets meanwhile
+    filled = VideoPacketsFilled(stream);
+    while (filled--) {
+	VideoPacketPop(stream);
+    }
+}
+
+/**
+**	Send command to the decoder side of a video stream.
+**
+**	@param stream	video stream
+**	@param cmd	VIDEO_CMD_* command
+*/
+static void VideoStreamCommand(VideoStream * stream, unsigned cmd)
+{
+    atomic_fetch_or_explicit(&stream->Commands, cmd, memory_order_release);
+}
+
+/**
+**	Check if video stream command is still pending.
+**
+**	@param stream	video stream
+**	@param cmd	VIDEO_CMD_* command
+*/
+static int VideoStreamCommandPending(VideoStream * stream, unsigned cmd)
+{
+    return atomic_load_explicit(&stream->Commands,
+	memory_order_acquire) & cmd;
+}
+
+/**
+**	Place video data in packet ringbuffer.
+**
+**	@param stream	video stream
+**	@param pts	presentation timestamp of pes packet
+**	@param data	data of pes packet
+**	@param size	size of pes packet
+*/
+static void VideoEnqueue(VideoStream * stream, int64_t pts, const void *data,
+    int size)
+{
+    AVPacket *avpkt;
+
+    // Debug(3, "video: enqueue %d\n", size);
+
+    avpkt = &stream->PacketRb[stream->PacketWrite];
+    if (!avpkt->stream_index) {		// add pts only for first added
+	avpkt->pts = pts;
+    }
+    if (avpkt->stream_index + size >= avpkt->size) {
+	AVBufferRef *buf;
+
+	// move into the next size class, pool reserves padding
+	buf = VideoBufferGet(avpkt->stream_index + size + 1);
+	if (avpkt->buf) {
+	    Debug(4, "video: packet buffer grow %d -> %d\n", avpkt->size,
+		buf->size - FF_INPUT_BUFFER_PADDING_SIZE);
+	    memcpy(buf->data, avpkt->data, avpkt->stream_index);
+	    VideoBufferPut(avpkt->buf);
+	}
+	avpkt->buf = buf;
+	avpkt->data = buf->data;
+	avpkt->size = buf->size - FF_INPUT_BUFFER_PADDING_SIZE;
     }
 
     memcpy(avpkt->data + avpkt->stream_index, data, size);
@@ -691,7 +1475,7 @@ static void VideoNextPacket(VideoStream * stream, int codec_id)
 	Debug(3, "video: possible stream change loss\n");
     }
 
-    if (atomic_read(&stream->PacketsFilled) >= VIDEO_PACKET_MAX - 1) {
+    if (VideoPacketsFilled(stream) >= VIDEO_PACKET_MAX - 1) {
 	// no free slot available drop last packet
 	Error(_("video: no empty slot in packet ringbuffer\n"));
 	avpkt->stream_index = 0;
@@ -701,14 +1485,18 @@ static void VideoNextPacket(VideoStream * stream, int codec_id)
 	return;
     }
     // clear area for decoder, always enough space allocated
-    memset(avpkt->data + avpkt->stream_index, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    if (avpkt->data) {
+	memset(avpkt->data + avpkt->stream_index, 0,
+	    FF_INPUT_BUFFER_PADDING_SIZE);
+    }
 
     stream->CodecIDRb[stream->PacketWrite] = codec_id;
     //DumpH264(avpkt->data, avpkt->stream_index);
 
-    // advance packet write
+    // advance packet write, publish packet to the reader
     stream->PacketWrite = (stream->PacketWrite + 1) % VIDEO_PACKET_MAX;
-    atomic_inc(&stream->PacketsFilled);
+    atomic_fetch_add_explicit(&stream->PacketsFilled, 1,
+	memory_order_release);
 
     VideoDisplayWakeup();
 
@@ -811,12 +1599,19 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
     // b3 b4 b8 00 b5 ... 00 b5 ...
 
     while (n > 3) {
-	if (0 && !p[0] && !p[1] && p[2] == 0x01) {
-	    fprintf(stderr, " %02x", p[3]);
-	}
+	const uint8_t *q;
+
 	// scan for picture header 0x00000100
 	// FIXME: not perfect, must split at 0xb3 also
-	if (!p[0] && !p[1] && p[2] == 0x01 && !p[3]) {
+	q = StartCodeFind(p, p + n);
+	if (!q || q + 3 >= p + n) {	// no complete start code left
+	    p += n - 3;
+	    n = 3;
+	    break;
+	}
+	n -= q - p;
+	p = q;
+	if (!p[3]) {
 	    if (first) {
 		first = 0;
 		n -= 4;
@@ -843,30 +1638,12 @@ static void VideoMpegEnqueue(VideoStream * stream, int64_t pts,
 	    p += 4;
 	    continue;
 	}
-	--n;
-	++p;
+	n -= 3;				// skip 00 00 01 xx
+	p += 3;
     }
 
-    stream->StartCodeState = 0;
-    switch (n) {			// handle packet border start code
-	case 3:
-	    if (!p[0] && !p[1] && p[2] == 0x01) {
-		stream->StartCodeState = 3;
-	    }
-	    break;
-	case 2:
-	    if (!p[0] && !p[1]) {
-		stream->StartCodeState = 2;
-	    }
-	    break;
-	case 1:
-	    if (!p[0]) {
-		stream->StartCodeState = 1;
-	    }
-	    break;
-	case 0:
-	    break;
-    }
+    // handle packet border start code
+    stream->StartCodeState = StartCodeTail(p, n);
     VideoEnqueue(stream, pts, data, size);
 }
 
@@ -906,13 +1683,21 @@ static void FixPacketForFFMpeg(VideoDecoder * vdecoder, AVPacket * avpkt)
 #endif
 
     while (n > 3) {
+	const uint8_t *q;
+
+	// scan for picture header 0x00000100
+	q = StartCodeFind(p, p + n);
+	if (!q || q + 3 >= p + n) {	// no complete start code left
+	    break;
+	}
+	n -= q - p;
+	p = (uint8_t *) q;
 #if STILL_DEBUG>1
-	if (InStillPicture && !p[0] && !p[1] && p[2] == 0x01) {
+	if (InStillPicture) {
 	    fprintf(stderr, " %02x", p[3]);
 	}
 #endif
-	// scan for picture header 0x00000100
-	if (!p[0] && !p[1] && p[2] == 0x01 && !p[3]) {
+	if (!p[3]) {
 	    if (first) {
 		first = 0;
 		n -= 4;
@@ -934,8 +1719,8 @@ static void FixPacketForFFMpeg(VideoDecoder * vdecoder, AVPacket * avpkt)
 	    tmp->data = p;
 	    tmp->size = n;
 	}
-	--n;
-	++p;
+	n -= 3;				// skip 00 00 01 xx
+	p += 3;
     }
 
 #if STILL_DEBUG>1
@@ -1003,6 +1788,42 @@ static void VideoStreamClose(VideoStream * stream, int delhw)
     stream->InvalidPesCounter = 0;
 }
 
+/**
+**	Execute pending video stream commands.
+**
+**	Called from the decoder side only.  The command bit is cleared
+**	after the command is done, so waiters see the finished state.
+**
+**	@param stream	video stream
+**
+**	@retval	1	command executed
+**	@retval	0	nothing pending
+*/
+static int VideoStreamHandleCommands(VideoStream * stream)
+{
+    unsigned cmds;
+
+    cmds = atomic_load_explicit(&stream->Commands, memory_order_acquire);
+    if (cmds & VIDEO_CMD_CLOSE) {	// close stream request
+	VideoStreamClose(stream, 1);
+	atomic_fetch_and_explicit(&stream->Commands, ~VIDEO_CMD_CLOSE,
+	    memory_order_release);
+	return 1;
+    }
+    if (cmds & VIDEO_CMD_CLEAR) {	// clear buffer request
+	VideoPacketClear(stream);
+	// FIXME: ->Decoder already checked
+	if (stream->Decoder) {
+	    CodecVideoFlushBuffers(stream->Decoder);
+	    VideoResetStart(stream->HwDecoder);
+	}
+	atomic_fetch_and_explicit(&stream->Commands, ~VIDEO_CMD_CLEAR,
+	    memory_order_release);
+	return 1;
+    }
+    return 0;
+}
+
 /**
 **	Poll PES packet ringbuffer.
 **
@@ -1022,23 +1843,10 @@ int VideoPollInput(VideoStream * stream)
 	return -1;
     }
 
-    if (stream->Close) {		// close stream request
-	VideoStreamClose(stream, 1);
-	stream->Close = 0;
-	return 1;
-    }
-    if (stream->ClearBuffers) {		// clear buffer request
-	atomic_set(&stream->PacketsFilled, 0);
-	stream->PacketRead = stream->PacketWrite;
-	// FIXME: ->Decoder already checked
-	if (stream->Decoder) {
-	    CodecVideoFlushBuffers(stream->Decoder);
-	    VideoResetStart(stream->HwDecoder);
-	}
-	stream->ClearBuffers = 0;
+    if (VideoStreamHandleCommands(stream)) {
 	return 1;
     }
-    if (!atomic_read(&stream->PacketsFilled)) {
+    if (!VideoPacketsFilled(stream)) {
 	return -1;
     }
     return 1;
@@ -1066,27 +1874,14 @@ int VideoDecodeInput(VideoStream * stream)
 	return -1;
     }
 
-    if (stream->Close) {		// close stream request
-	VideoStreamClose(stream, 1);
-	stream->Close = 0;
-	return 1;
-    }
-    if (stream->ClearBuffers) {		// clear buffer request
-	atomic_set(&stream->PacketsFilled, 0);
-	stream->PacketRead = stream->PacketWrite;
-	// FIXME: ->Decoder already checked
-	if (stream->Decoder) {
-	    CodecVideoFlushBuffers(stream->Decoder);
-	    VideoResetStart(stream->HwDecoder);
-	}
-	stream->ClearBuffers = 0;
+    if (VideoStreamHandleCommands(stream)) {
 	return 1;
     }
     if (stream->Freezed) {		// stream freezed
 	// clear is called during freezed
 	return 1;
     }
-    filled = atomic_read(&stream->PacketsFilled);
+    filled = VideoPacketsFilled(stream);
     if (!filled) {
 	return -1;
     }
@@ -1103,9 +1898,9 @@ int VideoDecodeInput(VideoStream * stream)
 		== AV_CODEC_ID_NONE) {
 		if (f) {
 		    Debug(3, "video: cleared upto close\n");
-		    atomic_sub(f, &stream->PacketsFilled);
-		    stream->PacketRead =
-			(stream->PacketRead + f) % VIDEO_PACKET_MAX;
+		    while (f--) {
+			VideoPacketPop(stream);
+		    }
 		    stream->ClearClose = 0;
 		}
 		break;
@@ -1201,9 +1996,7 @@ int VideoDecodeInput(VideoStream * stream)
     avpkt->size = saved_size;
 
   skip:
-    // advance packet read
-    stream->PacketRead = (stream->PacketRead + 1) % VIDEO_PACKET_MAX;
-    atomic_dec(&stream->PacketsFilled);
+    VideoPacketPop(stream);
 
     return 0;
 }
@@ -1215,7 +2008,7 @@ int VideoDecodeInput(VideoStream * stream)
 */
 int VideoGetBuffers(const VideoStream * stream)
 {
-    return atomic_read(&stream->PacketsFilled);
+    return VideoPacketsFilled(stream);
 }
 
 /**
@@ -1549,74 +2342,48 @@ static void PesParse(PesDemux * pesdx, const uint8_t * data, int size,
 		n = pesdx->Index - pesdx->Skip;
 
 		if(av == TS_PES_AUDIO){ //audio
-			while (n >= 5) {
-			    int r;
-			    unsigned codec_id;
-			    // 4 bytes 0xFFExxxxx Mpeg audio
-			    // 5 bytes 0x0B77xxxxxx AC-3 audio
-			    // 6 bytes 0x0B77xxxxxxxx E-AC-3 audio
-			    // 3 bytes 0x56Exxx AAC LATM audio
-			    // 7/9 bytes 0xFFFxxxxxxxxxxx ADTS audio
+			if (n >= 5) {
+			    AudioSync sync;
+			    int skip;
+
 			    // PCM audio can't be found
-			    // FIXME: simple+faster detection, if codec already known
-			    r = 0;
-			    if (!r && FastMpegCheck(q)) {
-				r = MpegCheck(q, n);
-				codec_id = AV_CODEC_ID_MP2;
-			    }
-			    if (!r && FastAc3Check(q)) {
-				r = Ac3Check(q, n);
-				codec_id = AV_CODEC_ID_AC3;
-				if (r > 0 && q[5] > (10 << 3)) {
-				    codec_id = AV_CODEC_ID_EAC3;
-				}
-			    }
-			    if (!r && FastLatmCheck(q)) {
-				r = LatmCheck(q, n);
-				codec_id = AV_CODEC_ID_AAC_LATM;
-			    }
-			    if (!r && FastAdtsCheck(q)) {
-				r = AdtsCheck(q, n);
-				codec_id = AV_CODEC_ID_AAC;
-			    }
-			    if (r < 0) {	// need more bytes
-				break;
+			    skip = AudioSyncFind(q, n, AUDIO_SYNC_ALL,
+				AudioCodecID == AV_CODEC_ID_NONE ?
+				AudioSyncLast[pesdx->StartCode] : 0, &sync);
+			    if (skip && AudioCodecID != AV_CODEC_ID_NONE) {
+				// shouldn't happen after we have a vaild codec
+				// detected
+				Debug(4, "pesdemux: skip %d @%d %02x\n", skip,
+				    pesdx->Skip, q[0]);
 			    }
-			    if (r > 0) {
+			    pesdx->Skip += skip;
+			    q += skip;
+			    n -= skip;
+			    if (sync.Size > 0) {
 				AVPacket avpkt[1];
 
+				AudioSyncLast[pesdx->StartCode] = sync.Class;
 				// new codec id, close and open new
-				if (AudioCodecID != codec_id) {
+				if (AudioCodecID != sync.CodecID) {
 				    Debug(3, "pesdemux: new codec %#06x -> %#06x\n",
-					AudioCodecID, codec_id);
+					AudioCodecID, sync.CodecID);
 				    CodecAudioClose(MyAudioDecoder);
-				    CodecAudioOpen(MyAudioDecoder, codec_id);
-				    AudioCodecID = codec_id;
+				    CodecAudioOpen(MyAudioDecoder, sync.CodecID);
+				    AudioCodecID = sync.CodecID;
 				}
 				av_init_packet(avpkt);
 				avpkt->data = (void *)q;
-				avpkt->size = r;
+				avpkt->size = sync.Size;
 				avpkt->pts = pesdx->PTS;
 				avpkt->dts = pesdx->DTS;
 				// FIXME: not aligned for ffmpeg
 				CodecAudioDecode(MyAudioDecoder, avpkt);
 				pesdx->PTS = AV_NOPTS_VALUE;
 				pesdx->DTS = AV_NOPTS_VALUE;
-				pesdx->Skip += r;
+				pesdx->Skip += sync.Size;
 				// FIXME: switch to decoder state
 				//pesdx->State = PES_MPEG_DECODE;
-				break;
-			    }
-			    if (AudioCodecID != AV_CODEC_ID_NONE) {
-				// shouldn't happen after we have a vaild codec
-				// detected
-				Debug(4, "pesdemux: skip @%d %02x\n", pesdx->Skip,
-				    q[0]);
 			    }
-			    // try next byte
-			    ++pesdx->Skip;
-			    ++q;
-			    --n;
 			}
 		} else if (av == TS_PES_VIDEO) { //video
 			const uint8_t *check;
@@ -1997,6 +2764,24 @@ static void PesParse(PesDemux * pesdx, const uint8_t * data, int size,
     /// Transport stream packet sync byte
 #define TS_PACKET_SYNC	0x47
 
+    /// Number of pids tracked per transport stream demuxer
+#define TS_DEMUX_PIDS 8
+
+///
+///	transport stream pid context.
+///
+typedef struct _ts_pid_
+{
+    int Pid;				///< packet id, -1 unused
+    int CC;				///< last continuity counter, -1 unknown
+    uint32_t LastUse;			///< packet number of last use
+
+    unsigned Packets;			///< packets received
+    unsigned CcErrors;			///< continuity counter errors
+    unsigned TeiErrors;			///< transport error indicator set
+    unsigned Discontinuities;		///< signalled discontinuities
+} TsPid;
+
 ///
 ///	transport stream demuxer typedef.
 ///
@@ -2007,53 +2792,212 @@ typedef struct _ts_demux_ TsDemux;
 ///
 struct _ts_demux_
 {
-    int Packets;			///< packets between PCR
+    uint32_t Packets;			///< packets demuxed
+    unsigned Resyncs;			///< lost sync byte
+    unsigned SkippedBytes;		///< bytes skipped to resync
+    TsPid Pids[TS_DEMUX_PIDS];		///< pid contexts
+    atomic_int ResetStats;		///< request counter reset by demuxer
 };
 
 static PesDemux PesDemuxer[2];	///< PES demuxer
+static TsDemux TsDemuxers[2];		///< TS demuxer
 
 ///
-///	Transport stream demuxer.
+///	Initialize a transport stream demuxer.
 ///
 ///	@param tsdx	transport stream demuxer
-///	@param data	buffer of transport stream packets
-///	@param size	size of buffer
-///	@param av	audio/video packet
 ///
-///	@returns number of bytes consumed from buffer.
+static void TsInit(TsDemux * tsdx)
+{
+    int i;
+
+    memset(tsdx, 0, sizeof(*tsdx));
+    for (i = 0; i < TS_DEMUX_PIDS; ++i) {
+	tsdx->Pids[i].Pid = -1;
+	tsdx->Pids[i].CC = -1;
+    }
+}
+
 ///
-static int TsDemuxer(TsDemux * tsdx, const uint8_t * data, int size, int av)
+///	Reset transport stream demuxer continuity state.
+///
+///	Counters are kept, on channel switch the continuity restarts.
+///
+///	@param tsdx	transport stream demuxer
+///
+static void TsReset(TsDemux * tsdx)
 {
-    const uint8_t *p;
+    int i;
 
-    p = data;
-    while (size >= TS_PACKET_SIZE) {
-#ifdef DEBUG
-	int pid;
-#endif
-	int payload;
+    for (i = 0; i < TS_DEMUX_PIDS; ++i) {
+	tsdx->Pids[i].CC = -1;
+    }
+}
 
-	if (p[0] != TS_PACKET_SYNC) {
-	    Error(_("tsdemux: transport stream out of sync\n"));
-	    // FIXME: kill all buffers
-	    return size;
-	}
-	++tsdx->Packets;
-	if (p[1] & 0x80) {		// error indicator
-	    Debug(3, "tsdemux: transport error\n");
-	    // FIXME: kill all buffers
-	    goto next_packet;
+///
+///	Clear transport stream demuxer error counters.
+///
+///	Must be called from the demuxer side.
+///
+///	@param tsdx	transport stream demuxer
+///
+static void TsClearStats(TsDemux * tsdx)
+{
+    int i;
+
+    tsdx->Resyncs = 0;
+    tsdx->SkippedBytes = 0;
+    for (i = 0; i < TS_DEMUX_PIDS; ++i) {
+	tsdx->Pids[i].Packets = 0;
+	tsdx->Pids[i].CcErrors = 0;
+	tsdx->Pids[i].TeiErrors = 0;
+	tsdx->Pids[i].Discontinuities = 0;
+    }
+}
+
+///
+///	Drop the partial pes packet after a transport stream error.
+///
+///	Already parsed data of the broken pes packet is discarded too,
+///	the truncated video frame must not reach the decoder.
+///
+///	@param av	audio/video packet
+///
+static void TsDropPes(int av)
+{
+    PesDemux *pesdx;
+
+    pesdx = &PesDemuxer[av];
+    pesdx->State = PES_SKIP;
+    pesdx->Index = 0;
+    pesdx->Skip = 0;
+    pesdx->videoIndex = 0;
+    pesdx->PTS = AV_NOPTS_VALUE;
+    pesdx->DTS = AV_NOPTS_VALUE;
+    if (av == TS_PES_VIDEO) {
+	VideoResetPacket(MyVideoStream);
+    }
+}
+
+///
+///	Get pid context of transport stream demuxer.
+///
+///	Reuses the least recently used slot for a new pid.
+///
+///	@param tsdx	transport stream demuxer
+///	@param pid	packet id
+///
+static TsPid *TsGetPid(TsDemux * tsdx, int pid)
+{
+    TsPid *tspid;
+    int i;
+
+    tspid = tsdx->Pids;
+    for (i = 0; i < TS_DEMUX_PIDS; ++i) {
+	if (tsdx->Pids[i].Pid == pid) {
+	    tspid = &tsdx->Pids[i];
+	    goto found;
 	}
-#ifdef DEBUG
+	if (tsdx->Pids[i].LastUse < tspid->LastUse) {
+	    tspid = &tsdx->Pids[i];
+	}
+    }
+    memset(tspid, 0, sizeof(*tspid));
+    tspid->Pid = pid;
+    tspid->CC = -1;
+
+  found:
+    tspid->LastUse = tsdx->Packets;
+    return tspid;
+}
+
+///
+///	Find transport stream sync.
+///
+///	A sync byte must be followed by another at TS_PACKET_SIZE distance,
+///	unless the buffer ends before.
+///
+///	@param data	buffer of transport stream packets
+///	@param size	size of buffer
+///
+///	@returns offset of next packet start or size.
+///
+static int TsResync(const uint8_t * data, int size)
+{
+    int i;
+
+    for (i = 1; i < size; ++i) {
+	if (data[i] == TS_PACKET_SYNC && (i + TS_PACKET_SIZE >= size
+		|| data[i + TS_PACKET_SIZE] == TS_PACKET_SYNC)) {
+	    return i;
+	}
+    }
+    return size;
+}
+
+///
+///	Transport stream demuxer.
+///
+///	@param tsdx	transport stream demuxer
+///	@param data	buffer of transport stream packets
+///	@param size	size of buffer
+///	@param av	audio/video packet
+///
+///	@returns number of bytes consumed from buffer.
+///
+static int TsDemuxer(TsDemux * tsdx, const uint8_t * data, int size, int av)
+{
+    const uint8_t *p;
+
+    if (atomic_exchange_explicit(&tsdx->ResetStats, 0, memory_order_acquire)) {
+	TsClearStats(tsdx);
+    }
+
+    p = data;
+    while (size >= TS_PACKET_SIZE) {
+	TsPid *tspid;
+	int pid;
+	int payload;
+	int cc;
+
+	if (p[0] != TS_PACKET_SYNC) {
+	    int n;
+
+	    n = TsResync(p, size);
+	    if (!tsdx->Resyncs++) {
+		Error(_("tsdemux: transport stream out of sync\n"));
+	    }
+	    Debug(3, "tsdemux: resync skipped %d bytes\n", n);
+	    tsdx->SkippedBytes += n;
+	    p += n;
+	    size -= n;
+	    continue;
+	}
+	++tsdx->Packets;
 	pid = (p[1] & 0x1F) << 8 | p[2];
+	tspid = TsGetPid(tsdx, pid);
+	++tspid->Packets;
+
+	if (p[1] & 0x80) {		// error indicator
+	    Debug(3, "tsdemux: transport error pid %#04x\n", pid);
+	    ++tspid->TeiErrors;
+	    // header can't be trusted, restart at next unit start
+	    tspid->CC = -1;
+	    TsDropPes(av);
+	    goto next_packet;
+	}
 	Debug(4, "tsdemux: PID: %#04x%s%s\n", pid, p[1] & 0x40 ? " start" : "",
 	    p[3] & 0x10 ? " payload" : "");
-#endif
+
 	// skip adaptation field
 	switch (p[3] & 0x30) {		// adaption field
 	    case 0x00:			// reserved
 	    case 0x20:			// adaptation field only
 	    default:
+		if ((p[3] & 0x20) && p[4] && (p[5] & 0x80)) {
+		    ++tspid->Discontinuities;
+		    tspid->CC = -1;
+		}
 		goto next_packet;
 	    case 0x10:			// only payload
 		payload = 4;
@@ -2065,22 +3009,32 @@ static int TsDemuxer(TsDemux * tsdx, const uint8_t * data, int size, int av)
 		    Debug(3, "tsdemux: illegal adaption field length\n");
 		    goto next_packet;
 		}
+		if (p[4] && (p[5] & 0x80)) {	// discontinuity indicator
+		    Debug(3, "tsdemux: discontinuity pid %#04x\n", pid);
+		    ++tspid->Discontinuities;
+		    tspid->CC = -1;
+		}
 		break;
 	}
 
-	PesParse(&PesDemuxer[av], p + payload, TS_PACKET_SIZE - payload, p[1] & 0x40, av);
-
-#if 0
-	int tmp;
-
 	//	check continuity
-	tmp = p[3] & 0x0F;		// continuity counter
-	if (((tsdx->CC + 1) & 0x0F) != tmp) {
-	    Debug(3, "tsdemux: OUT OF SYNC: %d %d\n", tmp, tsdx->CC);
-	    //TS discontinuity (received 8, expected 0) for PID
+	cc = p[3] & 0x0F;		// continuity counter
+	if (tspid->CC >= 0 && cc != ((tspid->CC + 1) & 0x0F)) {
+	    if (cc == tspid->CC) {	// duplicate packet
+		Debug(4, "tsdemux: duplicate packet pid %#04x\n", pid);
+		goto next_packet;
+	    }
+	    Debug(3, "tsdemux: continuity error pid %#04x %d != %d\n", pid,
+		cc, (tspid->CC + 1) & 0x0F);
+	    ++tspid->CcErrors;
+	    // drop the broken pes packet, restart at next unit start,
+	    // which can be this packet
+	    TsDropPes(av);
 	}
-	tsdx->CC = tmp;
-#endif
+	tspid->CC = cc;
+
+	PesParse(&PesDemuxer[av], p + payload, TS_PACKET_SIZE - payload,
+	    p[1] & 0x40, av);
 
       next_packet:
 	p += TS_PACKET_SIZE;
@@ -2090,6 +3044,62 @@ static int TsDemuxer(TsDemux * tsdx, const uint8_t * data, int size, int av)
     return p - data;
 }
 
+///
+///	Format transport stream demuxer statistics.
+///
+///	@param buf	output buffer
+///	@param size	size of output buffer
+///	@param reset	clear counters after output (done by the demuxer)
+///
+///	@returns number of characters written (without trailing 0).
+///
+int TsDemuxStats(char *buf, int size, int reset)
+{
+    static const char *const names[2] = { "video", "audio" };
+    int n;
+    int av;
+
+    n = 0;
+    buf[0] = '\0';
+    for (av = 0; av < 2; ++av) {
+	TsDemux *tsdx;
+	int i;
+
+	tsdx = &TsDemuxers[av];
+	if (n < size) {
+	    n += snprintf(buf + n, size - n,
+		"%s: packets %u resyncs %u skipped %u bytes\n", names[av],
+		tsdx->Packets, tsdx->Resyncs, tsdx->SkippedBytes);
+	}
+	for (i = 0; i < TS_DEMUX_PIDS; ++i) {
+	    TsPid *tspid;
+
+	    tspid = &tsdx->Pids[i];
+	    if (!tspid->Packets) {
+		continue;
+	    }
+	    if (n < size) {
+		n += snprintf(buf + n, size - n,
+		    "%s pid %#06x: packets %u cc-errors %u tei-errors %u"
+		    " discontinuities %u\n", names[av], tspid->Pid,
+		    tspid->Packets, tspid->CcErrors, tspid->TeiErrors,
+		    tspid->Discontinuities);
+	    }
+	}
+	if (reset) {			// counters are owned by the demuxer
+	    atomic_store_explicit(&tsdx->ResetStats, 1, memory_order_release);
+	}
+    }
+    if (n >= size) {
+	n = size - 1;
+    }
+    // svdrp reply without trailing newline
+    if (n > 0 && buf[n - 1] == '\n') {
+	buf[--n] = '\0';
+    }
+    return n;
+}
+
 #endif
 
 //////////////////////////////////////////////////////////////////////////////
@@ -2107,6 +3117,7 @@ int PlayAudio(const uint8_t * data, int size, uint8_t id)
 {
     int n;
     const uint8_t *p;
+    unsigned mask;
 
     // channel switch: SetAudioChannelDevice: SetDigitalAudioDevice:
 
@@ -2248,71 +3259,48 @@ int PlayAudio(const uint8_t * data, int size, uint8_t id)
     memcpy(AudioAvPkt->data + AudioAvPkt->stream_index, p, n);
     AudioAvPkt->stream_index += n;
 
+    // AC-3 only in private stream 1, dvd tracks can be anything
+    mask = AUDIO_SYNC_ALL & ~AUDIO_SYNC_AC3;
+    if (id == 0xbd) {
+	mask = AUDIO_SYNC_AC3;
+    } else if ((id & 0xF0) == 0x80) {
+	mask = AUDIO_SYNC_ALL;
+    }
+
     n = AudioAvPkt->stream_index;
     p = AudioAvPkt->data;
     while (n >= 5) {
-	int r;
-	unsigned codec_id;
+	AudioSync sync;
+	AVPacket avpkt[1];
+	int skip;
 
-	// 4 bytes 0xFFExxxxx Mpeg audio
-	// 3 bytes 0x56Exxx AAC LATM audio
-	// 5 bytes 0x0B77xxxxxx AC-3 audio
-	// 6 bytes 0x0B77xxxxxxxx E-AC-3 audio
-	// 7/9 bytes 0xFFFxxxxxxxxxxx ADTS audio
 	// PCM audio can't be found
-	r = 0;
-	codec_id = AV_CODEC_ID_NONE;	// keep compiler happy
-	if (id != 0xbd && FastMpegCheck(p)) {
-	    r = MpegCheck(p, n);
-	    codec_id = AV_CODEC_ID_MP2;
-	}
-	if (id != 0xbd && !r && FastLatmCheck(p)) {
-	    r = LatmCheck(p, n);
-	    codec_id = AV_CODEC_ID_AAC_LATM;
-	}
-	if ((id == 0xbd || (id & 0xF0) == 0x80) && !r && FastAc3Check(p)) {
-	    r = Ac3Check(p, n);
-	    codec_id = AV_CODEC_ID_AC3;
-	    if (r > 0 && p[5] > (10 << 3)) {
-		codec_id = AV_CODEC_ID_EAC3;
-	    }
-	    /* faster ac3 detection at end of pes packet (no improvemnts)
-	       if (AudioCodecID == codec_id && -r - 2 == n) {
-	       r = n;
-	       }
-	     */
-	}
-	if (id != 0xbd && !r && FastAdtsCheck(p)) {
-	    r = AdtsCheck(p, n);
-	    codec_id = AV_CODEC_ID_AAC;
-	}
-	if (r < 0) {			// need more bytes
+	skip = AudioSyncFind(p, n, mask,
+	    AudioCodecID == AV_CODEC_ID_NONE ? AudioSyncLast[id] : 0, &sync);
+	p += skip;
+	n -= skip;
+	if (sync.Size <= 0) {		// need more bytes or no sync
 	    break;
 	}
-	if (r > 0) {
-	    AVPacket avpkt[1];
 
-	    // new codec id, close and open new
-	    if (AudioCodecID != codec_id) {
-		CodecAudioClose(MyAudioDecoder);
-		CodecAudioOpen(MyAudioDecoder, codec_id);
-		AudioCodecID = codec_id;
-	    }
-	    av_init_packet(avpkt);
-	    avpkt->data = (void *)p;
-	    avpkt->size = r;
-	    avpkt->pts = AudioAvPkt->pts;
-	    avpkt->dts = AudioAvPkt->dts;
-	    // FIXME: not aligned for ffmpeg
-	    CodecAudioDecode(MyAudioDecoder, avpkt);
-	    AudioAvPkt->pts = AV_NOPTS_VALUE;
-	    AudioAvPkt->dts = AV_NOPTS_VALUE;
-	    p += r;
-	    n -= r;
-	    continue;
+	AudioSyncLast[id] = sync.Class;
+	// new codec id, close and open new
+	if (AudioCodecID != sync.CodecID) {
+	    CodecAudioClose(MyAudioDecoder);
+	    CodecAudioOpen(MyAudioDecoder, sync.CodecID);
+	    AudioCodecID = sync.CodecID;
 	}
-	++p;
-	--n;
+	av_init_packet(avpkt);
+	avpkt->data = (void *)p;
+	avpkt->size = sync.Size;
+	avpkt->pts = AudioAvPkt->pts;
+	avpkt->dts = AudioAvPkt->dts;
+	// FIXME: not aligned for ffmpeg
+	CodecAudioDecode(MyAudioDecoder, avpkt);
+	AudioAvPkt->pts = AV_NOPTS_VALUE;
+	AudioAvPkt->dts = AV_NOPTS_VALUE;
+	p += sync.Size;
+	n -= sync.Size;
     }
 
     // copy remaining bytes to start of packet
@@ -2338,8 +3326,6 @@ int PlayAudio(const uint8_t * data, int size, uint8_t id)
 
 int PlayTsAudio(const uint8_t * data, int size)
 {
-    static TsDemux tsdx[1];
-
     if (SkipAudio || !MyAudioDecoder) {	// skip audio
 	return size;
     }
@@ -2356,6 +3342,7 @@ int PlayTsAudio(const uint8_t * data, int size)
 	AudioChannelID = -1;
 	NewAudioStream = 0;
 	PesReset(&PesDemuxer[TS_PES_AUDIO]);
+	TsReset(&TsDemuxers[TS_PES_AUDIO]);
     }
     // hard limit buffer full: don't overrun audio buffers on replay
     if (AudioFreeBytes() < AUDIO_MIN_BUFFER_FREE) {
@@ -2369,7 +3356,7 @@ int PlayTsAudio(const uint8_t * data, int size)
     }
 #endif
 
-    return TsDemuxer(tsdx, data, size, TS_PES_AUDIO);
+    return TsDemuxer(&TsDemuxers[TS_PES_AUDIO], data, size, TS_PES_AUDIO);
 }
 #endif
 
@@ -2402,7 +3389,7 @@ int PlayVideo3(VideoStream * stream, const uint8_t * data, int size)
     }
     if (stream->NewStream) {		// channel switched
 	Debug(3, "video: new stream %dms\n", GetMsTicks() - VideoSwitch);
-	if (atomic_read(&stream->PacketsFilled) >= VIDEO_PACKET_MAX - 1) {
+	if (VideoPacketsFilled(stream) >= VIDEO_PACKET_MAX - 1) {
 	    Debug(3, "video: new video stream lost\n");
 	    return 0;
 	}
@@ -2442,12 +3429,12 @@ int PlayVideo3(VideoStream * stream, const uint8_t * data, int size)
 	return size;
     }
     // hard limit buffer full: needed for replay
-    if (atomic_read(&stream->PacketsFilled) >= VIDEO_PACKET_MAX - 10) {
+    if (VideoPacketsFilled(stream) >= VIDEO_PACKET_MAX - 10) {
 	return 0;
     }
 #ifdef USE_SOFTLIMIT
     // soft limit buffer full
-    if (AudioSyncStream == stream && atomic_read(&stream->PacketsFilled) > 3
+    if (AudioSyncStream == stream && VideoPacketsFilled(stream) > 3
 	&& AudioUsedBytes() > AUDIO_MIN_BUFFER_FREE * 2) {
 	return 0;
     }
@@ -2651,8 +3638,6 @@ int PlayVideo(const uint8_t * data, int size)
 
 int PlayTsVideo(const uint8_t * data, int size)
 {
-    static TsDemux tsdx[1];
-
     if (!MyVideoStream->Decoder) {// no x11 video started
 	return size;
     }
@@ -2664,7 +3649,7 @@ int PlayTsVideo(const uint8_t * data, int size)
     }
     if (MyVideoStream->NewStream) {// channel switched
 	Debug(3, "video: new stream %dms\n", GetMsTicks() - VideoSwitch);
-	if (atomic_read(&MyVideoStream->PacketsFilled) >= VIDEO_PACKET_MAX - 1) {
+	if (VideoPacketsFilled(MyVideoStream) >= VIDEO_PACKET_MAX - 1) {
 	    Debug(3, "video: new video stream lost\n");
 	    return 0;
 	}
@@ -2673,20 +3658,21 @@ int PlayTsVideo(const uint8_t * data, int size)
 	MyVideoStream->ClosingStream = 1;
 	MyVideoStream->NewStream = 0;
 	PesReset(&PesDemuxer[TS_PES_VIDEO]);
+	TsReset(&TsDemuxers[TS_PES_VIDEO]);
     }
     // hard limit buffer full: needed for replay
-    if (atomic_read(&MyVideoStream->PacketsFilled) >= VIDEO_PACKET_MAX - 10) {
+    if (VideoPacketsFilled(MyVideoStream) >= VIDEO_PACKET_MAX - 10) {
 	Debug(4,"[softhddev] PlayTsVideo Filled %d\n",MyVideoStream->PacketsFilled);
 	return 0;
     }
 #ifdef USE_SOFTLIMIT
     // soft limit buffer full
-    if (AudioSyncStream == MyVideoStream && atomic_read(&MyVideoStream->PacketsFilled) > 3
+    if (AudioSyncStream == MyVideoStream && VideoPacketsFilled(MyVideoStream) > 3
 	&& AudioUsedBytes() > AUDIO_MIN_BUFFER_FREE * 2) {
 	return 0;
     }
 #endif
-    return TsDemuxer(tsdx, data, size, TS_PES_VIDEO);
+    return TsDemuxer(&TsDemuxers[TS_PES_VIDEO], data, size, TS_PES_VIDEO);
 }
 #endif
 
@@ -2761,20 +3747,22 @@ uint8_t *CreateJpeg(uint8_t * image, int raw_size, int *size, int quality,
 uint8_t *GrabImage(int *size, int jpeg, int quality, int width, int height)
 {
     if (jpeg) {
-	uint8_t *image;
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	static uint8_t *image;		// raw image, reused between grabs
+	static int image_size;
+	uint8_t *jpg_image;
 	int raw_size;
 
+	jpg_image = NULL;
 	raw_size = 0;
-	image = VideoGrab(&raw_size, &width, &height, 0);
-	if (image) {			// can fail, suspended, ...
-	    uint8_t *jpg_image;
-
+	pthread_mutex_lock(&mutex);
+	// can fail, suspended, ...
+	if (!VideoGrabBuffer(&image, &image_size, &raw_size, &width, &height,
+		VideoGrabRgb)) {
 	    jpg_image = CreateJpeg(image, size, quality, width, height);
-
-	    free(image);
-	    return jpg_image;
 	}
-	return NULL;
+	pthread_mutex_unlock(&mutex);
+	return jpg_image;
     }
     return VideoGrab(size, &width, &height, 1);
 }
@@ -2912,7 +3900,7 @@ void Clear(void)
     int i;
 
     VideoResetPacket(MyVideoStream);	// terminate work
-    MyVideoStream->ClearBuffers = 1;
+    VideoStreamCommand(MyVideoStream, VIDEO_CMD_CLEAR);
     if (!SkipAudio) {
 	AudioFlushBuffers();
 	//NewAudioStream = 1;
@@ -2921,7 +3909,8 @@ void Clear(void)
 
     // wait for empty buffers
     // FIXME: without softstart sync VideoDecode isn't called.
-    for (i = 0; MyVideoStream->ClearBuffers && i < 20; ++i) {
+    for (i = 0; VideoStreamCommandPending(MyVideoStream, VIDEO_CMD_CLEAR)
+	&& i < 20; ++i) {
 	usleep(1 * 1000);
     }
     Debug(3, "[softhddev]%s: %dms buffers %d\n", __FUNCTION__, i,
@@ -3082,6 +4071,23 @@ void StillPicture(const uint8_t * data, int size)
     VideoSetTrickSpeed(MyVideoStream->HwDecoder, 0);
 }
 
+/**
+**	Check if audio or video buffers are over the replay limits.
+*/
+static int PollBuffersFull(void)
+{
+    int used;
+    int filled;
+
+    used = AudioUsedBytes();
+    // FIXME: no video!
+    filled = VideoPacketsFilled(MyVideoStream);
+    // soft limit + hard limit
+    return (used > AUDIO_MIN_BUFFER_FREE && filled > 3)
+	|| AudioFreeBytes() < AUDIO_MIN_BUFFER_FREE
+	|| filled >= VIDEO_PACKET_MAX - 10;
+}
+
 /**
 **	Poll if device is ready.  Called by replay.
 **
@@ -3099,31 +4105,23 @@ int Poll(int timeout)
 {
     // poll is only called during replay, flush buffers after replay
     MyVideoStream->ClearClose = 1;
-    for (;;) {
-	int full;
-	int t;
-	int used;
-	int filled;
 
-	used = AudioUsedBytes();
-	// FIXME: no video!
-	filled = atomic_read(&MyVideoStream->PacketsFilled);
-	// soft limit + hard limit
-	full = (used > AUDIO_MIN_BUFFER_FREE && filled > 3)
-	    || AudioFreeBytes() < AUDIO_MIN_BUFFER_FREE
-	    || filled >= VIDEO_PACKET_MAX - 10;
-
-	if (!full || !timeout) {
-	    return !full;
-	}
-
-	t = 15;
-	if (timeout < t) {
-	    t = timeout;
-	}
-	usleep(t * 1000);		// let display thread work
-	timeout -= t;
+    if (!PollBuffersFull()) {
+	return 1;
+    }
+    if (!timeout) {
+	return 0;
     }
+    // let display thread work, woken as soon as space is freed
+    return BufferWaitFree(PollBuffersFull, timeout);
+}
+
+/**
+**	Check if video packets are still waiting to be decoded.
+*/
+static int FlushBuffersFilled(void)
+{
+    return VideoPacketsFilled(MyVideoStream);
 }
 
 /**
@@ -3133,13 +4131,14 @@ int Poll(int timeout)
 */
 int Flush(int timeout)
 {
-    if (atomic_read(&MyVideoStream->PacketsFilled)) {
-	if (timeout) {			// let display thread work
-	    usleep(timeout * 1000);
-	}
-	return !atomic_read(&MyVideoStream->PacketsFilled);
+    if (!FlushBuffersFilled()) {
+	return 1;
     }
-    return 1;
+    if (!timeout) {
+	return 0;
+    }
+    // let display thread work, woken on each decoded packet
+    return BufferWaitFree(FlushBuffersFilled, timeout);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -3470,6 +4469,7 @@ void SoftHdDeviceExit(void)
 {
     // lets hope that vdr does a good thread cleanup
 
+    VideoGrabStreamStop();
     AudioExit();
     if (MyAudioDecoder) {
 	CodecAudioClose(MyAudioDecoder);
@@ -3521,6 +4521,8 @@ void SoftHdDeviceExit(void)
 	}
     }
 
+    VideoBufferFlush();
+
     pthread_mutex_destroy(&SuspendLockMutex);
 #ifdef USE_PIP
     pthread_mutex_destroy(&PipVideoStream->DecoderLockMutex);
@@ -3541,6 +4543,7 @@ int Start(void)
 	StartXServer();
     }
     CodecInit();
+    AudioSetFreeCallback(BufferFreeWakeup);
 
     pthread_mutex_init(&MyVideoStream->DecoderLockMutex, NULL);
 #ifdef USE_PIP
@@ -3567,6 +4570,8 @@ int Start(void)
 #ifdef USE_TS
     PesInit(&PesDemuxer[TS_PES_VIDEO]);
     PesInit(&PesDemuxer[TS_PES_AUDIO]);
+    TsInit(&TsDemuxers[TS_PES_VIDEO]);
+    TsInit(&TsDemuxers[TS_PES_AUDIO]);
 #endif
     Info(_("[softhddev] ready%s\n"),
 	ConfigStartSuspended ? ConfigStartSuspended ==
@@ -3582,9 +4587,17 @@ int Start(void)
 */
 void Stop(void)
 {
+    size_t used;
+    size_t allocated;
+    size_t high_water;
+
 #ifdef DEBUG
     Debug(4, "video: max used PES packet size: %d\n", VideoMaxPacketSize);
 #endif
+    GetVideoBufferStats(&used, &allocated, &high_water);
+    Info(_("video: packet pool %zu KiB used, %zu KiB allocated,"
+	    " high-water %zu KiB\n"), used / 1024, allocated / 1024,
+	high_water / 1024);
 }
 
 /**
@@ -3745,6 +4758,27 @@ void GetStats(int *missed, int *duped, int *dropped, int *counter)
     }
 }
 
+/**
+**	Get decode time per packet and display time per frame in us.
+**
+**	@param[out] decode_avg	average decode time
+**	@param[out] decode_max	maximal decode time
+**	@param[out] display_avg	average display time
+**	@param[out] display_max	maximal display time
+*/
+void GetTimingStats(int *decode_avg, int *decode_max, int *display_avg,
+    int *display_max)
+{
+    *decode_avg = 0;
+    *decode_max = 0;
+    *display_avg = 0;
+    *display_max = 0;
+    if (MyVideoStream->HwDecoder) {
+	VideoGetTimingStats(MyVideoStream->HwDecoder, decode_avg, decode_max,
+	    display_avg, display_max);
+    }
+}
+
 /**
 **	Scale the currently shown video.
 **
@@ -3831,8 +4865,9 @@ void PipStop(void)
 
     ScaleVideo(0, 0, 0, 0);
 
-    PipVideoStream->Close = 1;
-    for (i = 0; PipVideoStream->Close && i < 50; ++i) {
+    VideoStreamCommand(PipVideoStream, VIDEO_CMD_CLOSE);
+    for (i = 0; VideoStreamCommandPending(PipVideoStream, VIDEO_CMD_CLOSE)
+	&& i < 50; ++i) {
 	usleep(1 * 1000);
     }
     Info("[softhddev]%s: pip close %dms\n", __FUNCTION__, i);
@@ -3857,3 +4892,1186 @@ int IsReplay(void)
 {
     return !AudioSyncStream || AudioSyncStream->ClearClose;
 }
+
+#if defined(INGEST_TEST) || defined(QUEUE_TEST) || defined(AUDIO_SYNC_TEST)
+
+#include <getopt.h>
+#include <time.h>
+
+//
+//	Symbols normally provided by VDR or softhddevice.cpp
+//
+int SysLogLevel;			///< required
+int ConfigAudioBufferTime = 336;	///< required
+int DisableOglOsd = 1;			///< required
+int ConfigVideoClearOnSwitch;		///< required
+volatile char SoftIsPlayingVideo;	///< required
+#ifndef DEBUG
+uint32_t VideoSwitch;			///< required
+#endif
+
+void FeedKeyPress( __attribute__ ((unused))
+    const char *x, __attribute__ ((unused))
+    const char *y, __attribute__ ((unused))
+    int a, __attribute__ ((unused))
+    int b, __attribute__ ((unused))
+    const char *s)
+{
+}
+
+void DelPip(void)			///< required
+{
+}
+
+#if !defined(USE_JPEG) || JPEG_LIB_VERSION < 80
+uint8_t *CreateJpeg( __attribute__ ((unused))
+    uint8_t * image, __attribute__ ((unused))
+    int *size, __attribute__ ((unused))
+    int quality, __attribute__ ((unused))
+    int width, __attribute__ ((unused))
+    int height)
+{
+    return NULL;
+}
+#endif
+
+///
+///	Monotonic clock in nanoseconds.
+///
+static inline uint64_t IngestNs(void)
+{
+    struct timespec tspec;
+
+    clock_gettime(CLOCK_MONOTONIC, &tspec);
+    return tspec.tv_sec * UINT64_C(1000000000) + tspec.tv_nsec;
+}
+
+#endif
+
+#ifdef INGEST_TEST
+
+//////////////////////////////////////////////////////////////////////////////
+//	Ingest benchmark
+//////////////////////////////////////////////////////////////////////////////
+
+#define INGEST_READ_SIZE (TS_PACKET_SIZE * 2048)	///< file read chunk
+#define INGEST_SAMPLE_MS 10		///< ring fill sample period
+
+static volatile char IngestDone;	///< feeder finished
+static int IngestDrainDelay;		///< us per packet in drain thread
+static uint32_t IngestDrained;		///< video packets drained
+static uint64_t IngestDrainedBytes;	///< video bytes drained
+
+static uint8_t *IngestFill;		///< ring fill samples
+static int IngestFillCount;		///< number of ring fill samples
+static int IngestFillMax;		///< allocated ring fill samples
+
+///
+///	Drain thread, stands in for the display thread.
+///
+///	Consumes the video packet ring like VideoDecodeInput does, but
+///	without decoding, so only the demux side is measured.
+///
+static void *IngestDrainThread( __attribute__ ((unused))
+    void *dummy)
+{
+    uint64_t next_sample;
+
+    next_sample = IngestNs();
+    for (;;) {
+	uint64_t now;
+	int filled;
+
+	filled = VideoPacketsFilled(MyVideoStream);
+
+	now = IngestNs();
+	if (now >= next_sample) {
+	    if (IngestFillCount == IngestFillMax) {
+		IngestFillMax = IngestFillMax ? IngestFillMax * 2 : 4096;
+		IngestFill = realloc(IngestFill, IngestFillMax);
+		if (!IngestFill) {
+		    Fatal(_("ingest: out of memory\n"));
+		}
+	    }
+	    IngestFill[IngestFillCount++] = filled;
+	    next_sample += INGEST_SAMPLE_MS * 1000 * 1000;
+	}
+
+	if (!filled) {
+	    if (IngestDone) {
+		break;
+	    }
+	    usleep(100);
+	    continue;
+	}
+	if (IngestDrainDelay) {
+	    usleep(IngestDrainDelay);
+	}
+	IngestDrainedBytes +=
+	    MyVideoStream->PacketRb[MyVideoStream->PacketRead].stream_index;
+	++IngestDrained;
+	VideoPacketPop(MyVideoStream);
+    }
+    return dummy;
+}
+
+///
+///	Find video and audio pid in a PMT section.
+///
+///	@param p	TS packet payload, pointer field included
+///	@param size	payload size
+///	@param[out] vpid	first video elementary pid
+///	@param[out] apid	first audio elementary pid
+///
+static void IngestParsePmt(const uint8_t * p, int size, int *vpid,
+    int *apid)
+{
+    int section_length;
+    int info_length;
+    int i;
+    int end;
+
+    if (size < 1 || 1 + p[0] + 12 > size) {
+	return;
+    }
+    size -= 1 + p[0];
+    p += 1 + p[0];			// pointer field
+    if (p[0] != 0x02) {			// not a PMT
+	return;
+    }
+    section_length = (p[1] & 0x0F) << 8 | p[2];
+    end = 3 + section_length - 4;	// without crc
+    if (end > size) {
+	end = size;
+    }
+    info_length = (p[10] & 0x0F) << 8 | p[11];
+    for (i = 12 + info_length; i + 5 <= end;) {
+	int type;
+	int pid;
+	int es_length;
+
+	type = p[i];
+	pid = (p[i + 1] & 0x1F) << 8 | p[i + 2];
+	es_length = (p[i + 3] & 0x0F) << 8 | p[i + 4];
+	switch (type) {
+	    case 0x01:			// MPEG-1 video
+	    case 0x02:			// MPEG-2 video
+	    case 0x1B:			// H.264
+	    case 0x24:			// HEVC
+	    case 0x42:			// AVS
+	    case 0xD2:			// AVS2
+		if (*vpid < 0) {
+		    *vpid = pid;
+		}
+		break;
+	    case 0x03:			// MPEG-1 audio
+	    case 0x04:			// MPEG-2 audio
+	    case 0x0F:			// ADTS AAC
+	    case 0x11:			// LATM AAC
+	    case 0x81:			// ATSC AC-3
+		if (*apid < 0) {
+		    *apid = pid;
+		}
+		break;
+	    case 0x06:			// private data, look for AC-3
+		{
+		    int j;
+
+		    for (j = i + 5; j + 2 <= i + 5 + es_length && j + 2 <= end;
+			j += 2 + p[j + 1]) {
+			if ((p[j] == 0x6A || p[j] == 0x7A) && *apid < 0) {
+			    *apid = pid;
+			}
+		    }
+		}
+		break;
+	}
+	i += 5 + es_length;
+    }
+}
+
+///
+///	Compare function for latency sort.
+///
+static int IngestCompare(const void *a, const void *b)
+{
+    uint32_t x;
+    uint32_t y;
+
+    x = *(const uint32_t *)a;
+    y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+///
+///	Print version.
+///
+static void PrintVersion(void)
+{
+    printf("bench-ingest: TS ingest benchmark Version " VERSION
+#ifdef GIT_REV
+	"(GIT-" GIT_REV ")"
+#endif
+	",\n\t(c) 2011 - 2015 by Johns\n"
+	"\tLicense AGPLv3: GNU Affero General Public License version 3\n");
+}
+
+///
+///	Print usage.
+///
+static void PrintUsage(void)
+{
+    printf("Usage: bench-ingest [-?dhv] [-a pid] [-p pid] [-D us] [-i ms]\n"
+	"\t[-n packets] [-r count] [-A] file.ts\n"
+	"\t-a pid\taudio pid, default first audio pid from PMT\n"
+	"\t-p pid\tvideo pid, default first video pid from PMT\n"
+	"\t-A\tdon't feed audio\n"
+	"\t-D us\tdrain thread delay per video packet (emulate decoder)\n"
+	"\t-i ms\tring fill report interval (default 1000)\n"
+	"\t-n num\tstop after num TS packets\n"
+	"\t-r num\tfeed the file num times\n"
+	"\t-d\tenable debug, more -d increase the verbosity\n"
+	"\t-? -h\tdisplay this message\n" "\t-v\tdisplay version information\n"
+	"Only idiots print usage on stderr!\n");
+}
+
+///
+///	Main entry point.
+///
+///	@param argc	number of arguments
+///	@param argv	arguments vector
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(int argc, char *const argv[])
+{
+    const char *file_name;
+    int vpid;
+    int apid;
+    int pmt_pid;
+    int no_audio;
+    int interval;
+    int repeat;
+    uint64_t max_packets;
+    uint8_t *buffer;
+    uint32_t *latency;
+    size_t latency_max;
+    size_t latency_count;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t stalls;
+    uint64_t stall_ns;
+    uint64_t resyncs;
+    uint64_t start;
+    uint64_t elapsed;
+    struct stat st;
+    pthread_t thread;
+    int pass;
+    int i;
+
+    LogLevel = 0;
+    vpid = -1;
+    apid = -1;
+    no_audio = 0;
+    interval = 1000;
+    repeat = 1;
+    max_packets = 0;
+
+    //
+    //	Parse command line arguments
+    //
+    for (;;) {
+	switch (getopt(argc, argv, "hv?-a:dp:AD:i:n:r:")) {
+	    case 'd':			// enabled debug
+		++LogLevel;
+		continue;
+	    case 'a':			// audio pid
+		apid = strtol(optarg, NULL, 0);
+		continue;
+	    case 'p':			// video pid
+		vpid = strtol(optarg, NULL, 0);
+		continue;
+	    case 'A':			// no audio
+		no_audio = 1;
+		continue;
+	    case 'D':			// drain delay
+		IngestDrainDelay = atoi(optarg);
+		continue;
+	    case 'i':			// report interval
+		interval = atoi(optarg);
+		if (interval < INGEST_SAMPLE_MS) {
+		    interval = INGEST_SAMPLE_MS;
+		}
+		continue;
+	    case 'n':			// packet limit
+		max_packets = strtoull(optarg, NULL, 0);
+		continue;
+	    case 'r':			// repeat
+		repeat = atoi(optarg);
+		continue;
+
+	    case EOF:
+		break;
+	    case 'v':			// print version
+		PrintVersion();
+		return 0;
+	    case '?':
+	    case 'h':			// help usage
+		PrintVersion();
+		PrintUsage();
+		return 0;
+	    case '-':
+		PrintVersion();
+		PrintUsage();
+		fprintf(stderr, "\nWe need no long options\n");
+		return -1;
+	    case ':':
+		PrintVersion();
+		fprintf(stderr, "Missing argument for option '%c'\n", optopt);
+		return -1;
+	    default:
+		PrintVersion();
+		fprintf(stderr, "Unknown option '%c'\n", optopt);
+		return -1;
+	}
+	break;
+    }
+    if (optind + 1 != argc) {
+	PrintVersion();
+	PrintUsage();
+	return -1;
+    }
+    file_name = argv[optind];
+    if (stat(file_name, &st) < 0) {
+	fprintf(stderr, "Can't stat '%s'\n", file_name);
+	return -1;
+    }
+    //
+    //	one latency slot per TS packet
+    //
+    latency_max = (st.st_size / TS_PACKET_SIZE + 1) * (repeat > 0 ? repeat : 1);
+    if (max_packets && max_packets < latency_max) {
+	latency_max = max_packets;
+    }
+    latency = malloc(latency_max * sizeof(*latency));
+    buffer = malloc(INGEST_READ_SIZE);
+    if (!latency || !buffer) {
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+    }
+    //
+    //	noop audio + headless video stream
+    //
+    CodecInit();
+    AudioSetDevice("");
+    AudioInit();
+    av_new_packet(AudioAvPkt, AUDIO_BUFFER_SIZE);
+    MyAudioDecoder = CodecAudioNewDecoder();
+    AudioCodecID = AV_CODEC_ID_NONE;
+    AudioChannelID = -1;
+    NewAudioStream = 1;
+
+    pthread_mutex_init(&MyVideoStream->DecoderLockMutex, NULL);
+    MyVideoStream->CodecID = AV_CODEC_ID_NONE;
+    MyVideoStream->LastCodecID = AV_CODEC_ID_NONE;
+    MyVideoStream->Decoder = CodecVideoNewDecoder(NULL);
+    VideoPacketInit(MyVideoStream);
+    MyVideoStream->NewStream = 1;
+
+    PesInit(&PesDemuxer[TS_PES_VIDEO]);
+    PesInit(&PesDemuxer[TS_PES_AUDIO]);
+    TsInit(&TsDemuxers[TS_PES_VIDEO]);
+    TsInit(&TsDemuxers[TS_PES_AUDIO]);
+
+    pthread_create(&thread, NULL, IngestDrainThread, NULL);
+
+    packets = 0;
+    bytes = 0;
+    stalls = 0;
+    stall_ns = 0;
+    resyncs = 0;
+    latency_count = 0;
+    pmt_pid = -1;
+
+    //
+    //	  main loop
+    //
+    start = IngestNs();
+    for (pass = 0; pass < repeat; ++pass) {
+	int fd;
+	int n;
+	int fill;
+
+	if ((fd = open(file_name, O_RDONLY | O_CLOEXEC)) < 0) {
+	    fprintf(stderr, "Can't open '%s'\n", file_name);
+	    return -1;
+	}
+	fill = 0;
+	while ((n = read(fd, buffer + fill, INGEST_READ_SIZE - fill)) > 0) {
+	    const uint8_t *p;
+	    int size;
+
+	    size = fill + n;
+	    p = buffer;
+	    while (size >= TS_PACKET_SIZE) {
+		int pid;
+		int payload;
+
+		if (max_packets && packets >= max_packets) {
+		    goto done;
+		}
+		if (p[0] != TS_PACKET_SYNC) {	// resync
+		    ++resyncs;
+		    ++p;
+		    --size;
+		    continue;
+		}
+		++packets;
+		bytes += TS_PACKET_SIZE;
+		pid = (p[1] & 0x1F) << 8 | p[2];
+
+		payload = 4;
+		if ((p[3] & 0x30) == 0x30) {
+		    payload = 5 + p[4];
+		}
+		if (pid == 0 && (p[1] & 0x40) && payload < TS_PACKET_SIZE - 17
+		    && pmt_pid < 0) {
+		    const uint8_t *q;
+
+		    q = p + payload + 1 + p[payload];	// pointer field
+		    if (q + 16 <= p + TS_PACKET_SIZE && q[0] == 0x00) {
+			pmt_pid = (q[10] & 0x1F) << 8 | q[11];
+			Debug(3, "ingest: PMT pid %d\n", pmt_pid);
+		    }
+		} else if (pid == pmt_pid && (p[1] & 0x40)
+		    && payload < TS_PACKET_SIZE) {
+		    IngestParsePmt(p + payload, TS_PACKET_SIZE - payload,
+			&vpid, &apid);
+		} else if (pid == vpid || (pid == apid && !no_audio)) {
+		    for (;;) {
+			uint64_t t;
+
+			t = IngestNs();
+			n = pid == vpid ? PlayTsVideo(p, TS_PACKET_SIZE)
+			    : PlayTsAudio(p, TS_PACKET_SIZE);
+			t = IngestNs() - t;
+			if (n) {
+			    if (latency_count < latency_max) {
+				latency[latency_count++] =
+				    t > UINT32_MAX ? UINT32_MAX : t;
+			    }
+			    break;
+			}
+			// buffers full, like Poll()
+			++stalls;
+			t = IngestNs();
+			usleep(1000);
+			stall_ns += IngestNs() - t;
+		    }
+		}
+		p += TS_PACKET_SIZE;
+		size -= TS_PACKET_SIZE;
+	    }
+	    memmove(buffer, p, size);
+	    fill = size;
+	}
+	close(fd);
+    }
+  done:
+    elapsed = IngestNs() - start;
+
+    IngestDone = 1;
+    pthread_join(thread, NULL);
+
+    //
+    //	report
+    //
+    printf("pids: video %d audio %d\n", vpid, apid);
+    printf("fed: %" PRIu64 " TS packets %" PRIu64 " bytes in %.3fs"
+	" (%" PRIu64 " resync bytes)\n", packets, bytes, elapsed / 1e9,
+	resyncs);
+    printf("rate: %.2f MB/s, %.0f TS packets/s\n",
+	bytes / (elapsed / 1e9) / (1024 * 1024), packets / (elapsed / 1e9));
+    printf("rate without stalls: %.2f MB/s\n",
+	bytes / ((elapsed - stall_ns) / 1e9) / (1024 * 1024));
+    printf("stalls: %" PRIu64 " (%.3fs)\n", stalls, stall_ns / 1e9);
+    printf("video: %u packets %" PRIu64 " bytes drained\n", IngestDrained,
+	IngestDrainedBytes);
+    {
+	size_t used;
+	size_t allocated;
+	size_t high_water;
+
+	GetVideoBufferStats(&used, &allocated, &high_water);
+	printf("packet pool: %zu KiB used, %zu KiB allocated,"
+	    " high-water %zu KiB\n", used / 1024, allocated / 1024,
+	    high_water / 1024);
+    }
+
+    {
+	char buf[1024];
+
+	TsDemuxStats(buf, sizeof(buf), 0);
+	printf("%s\n", buf);
+    }
+
+    if (latency_count) {
+	static const double percent[] = { 50.0, 90.0, 99.0, 99.9 };
+
+	qsort(latency, latency_count, sizeof(*latency), IngestCompare);
+	printf("latency per call (%zu calls):", latency_count);
+	for (i = 0; i < (int)(sizeof(percent) / sizeof(*percent)); ++i) {
+	    printf(" p%g %uns", percent[i],
+		latency[(size_t) (latency_count * percent[i] / 100.0)]);
+	}
+	printf(" max %uns\n", latency[latency_count - 1]);
+    }
+
+    printf("ring fill (of %d), every %dms: min/avg/max\n", VIDEO_PACKET_MAX,
+	interval);
+    for (i = 0; i < IngestFillCount;) {
+	int j;
+	int min;
+	int max;
+	int sum;
+	int n;
+
+	min = VIDEO_PACKET_MAX;
+	max = 0;
+	sum = 0;
+	n = interval / INGEST_SAMPLE_MS;
+	for (j = 0; j < n && i + j < IngestFillCount; ++j) {
+	    int f;
+
+	    f = IngestFill[i + j];
+	    if (f < min) {
+		min = f;
+	    }
+	    if (f > max) {
+		max = f;
+	    }
+	    sum += f;
+	}
+	printf("%8.2fs %3d %5.1f %3d\n", (double)i * INGEST_SAMPLE_MS / 1000,
+	    min, (double)sum / j, max);
+	i += j;
+    }
+
+    VideoPacketExit(MyVideoStream);
+    VideoBufferFlush();
+    CodecVideoDelDecoder(MyVideoStream->Decoder);
+    CodecAudioDelDecoder(MyAudioDecoder);
+    AudioExit();
+    CodecExit();
+    free(IngestFill);
+    free(latency);
+    free(buffer);
+
+    return 0;
+}
+
+#endif
+
+#ifdef QUEUE_TEST
+
+//////////////////////////////////////////////////////////////////////////////
+//	Video packet queue stress test
+//////////////////////////////////////////////////////////////////////////////
+
+#include <sched.h>
+
+static atomic_char QueueDone;		///< producer finished
+static uint32_t QueueCount = 100000;	///< packets to produce
+static uint32_t QueueConsumed;		///< packets consumed
+static uint32_t QueueDropped;		///< packets dropped by clear
+static uint32_t QueueErrors;		///< verify errors
+
+///
+///	Length of test packet.
+///
+///	@param seq	sequence number of packet
+///
+static int QueueLength(uint32_t seq)
+{
+    // spread over the buffer size classes, I-frames are larger
+    return 4 + (seq * UINT32_C(2654435761) >> 8) % (seq % 12 ? 32 * 1024 :
+	256 * 1024);
+}
+
+///
+///	Producer thread, stands in for the PES demuxer.
+///
+static void *QueueProducer( __attribute__ ((unused))
+    void *dummy)
+{
+    uint8_t *buf;
+    uint32_t seq;
+
+    buf = malloc(4 + 256 * 1024);
+    if (!buf) {
+	Fatal(_("queue: out of memory\n"));
+    }
+    for (seq = 0; seq < QueueCount; ++seq) {
+	int len;
+	int i;
+
+	len = QueueLength(seq);
+	memcpy(buf, &seq, 4);
+	for (i = 4; i < len; ++i) {
+	    buf[i] = seq + i;
+	}
+	// like PES packets, more chunks per packet
+	for (i = 0; i < len; i += TS_PACKET_SIZE * 7) {
+	    VideoEnqueue(MyVideoStream, seq, buf + i,
+		len - i < TS_PACKET_SIZE * 7 ? len - i : TS_PACKET_SIZE * 7);
+	}
+	// keep some slots free, like PlayVideo does
+	while (VideoPacketsFilled(MyVideoStream) >= VIDEO_PACKET_MAX - 10) {
+	    sched_yield();
+	}
+	VideoNextPacket(MyVideoStream, AV_CODEC_ID_H264);
+    }
+    free(buf);
+    atomic_store(&QueueDone, 1);
+
+    return dummy;
+}
+
+///
+///	Consumer thread, stands in for the decoder thread.
+///
+static void *QueueConsumer( __attribute__ ((unused))
+    void *dummy)
+{
+    int64_t last;
+
+    last = -1;
+    for (;;) {
+	const AVPacket *avpkt;
+	uint32_t seq;
+	int i;
+
+	VideoStreamHandleCommands(MyVideoStream);
+	if (!VideoPacketsFilled(MyVideoStream)) {
+	    if (atomic_load(&QueueDone)
+		&& !VideoPacketsFilled(MyVideoStream)) {
+		break;
+	    }
+	    sched_yield();
+	    continue;
+	}
+
+	avpkt = &MyVideoStream->PacketRb[MyVideoStream->PacketRead];
+	seq = avpkt->pts;
+	if ((int64_t) seq <= last) {
+	    Error(_("queue: sequence %u after %" PRId64 "\n"), seq, last);
+	    ++QueueErrors;
+	}
+	QueueDropped += seq - last - 1;
+	last = seq;
+	if (avpkt->stream_index != QueueLength(seq)
+	    || memcmp(avpkt->data, &seq, 4)) {
+	    Error(_("queue: packet %u corrupt header\n"), seq);
+	    ++QueueErrors;
+	} else {
+	    for (i = 4; i < avpkt->stream_index; ++i) {
+		if (avpkt->data[i] != (uint8_t) (seq + i)) {
+		    Error(_("queue: packet %u corrupt at %d\n"), seq, i);
+		    ++QueueErrors;
+		    break;
+		}
+	    }
+	}
+	++QueueConsumed;
+	VideoPacketPop(MyVideoStream);
+    }
+    QueueDropped += QueueCount - 1 - last;	// cleared at the end
+
+    return dummy;
+}
+
+///
+///	Print version.
+///
+static void PrintVersion(void)
+{
+    printf("stress-queue: video packet queue stress test Version " VERSION
+#ifdef GIT_REV
+	"(GIT-" GIT_REV ")"
+#endif
+	",\n\t(c) 2011 - 2015 by Johns\n"
+	"\tLicense AGPLv3: GNU Affero General Public License version 3\n");
+}
+
+///
+///	Print usage.
+///
+static void PrintUsage(void)
+{
+    printf("Usage: stress-queue [-?dhv] [-c ms] [-n packets]\n"
+	"\t-c ms\tclear the queue every ms milliseconds (0 = never)\n"
+	"\t-n num\tproduce num packets (default 100000)\n"
+	"\t-d\tenable debug, more -d increase the verbosity\n"
+	"\t-? -h\tdisplay this message\n" "\t-v\tdisplay version information\n"
+	"Only idiots print usage on stderr!\n");
+}
+
+///
+///	Main entry point.
+///
+///	@param argc	number of arguments
+///	@param argv	arguments vector
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(int argc, char *const argv[])
+{
+    int clear_ms;
+    uint32_t clears;
+    uint64_t start;
+    uint64_t elapsed;
+    pthread_t producer;
+    pthread_t consumer;
+    size_t allocated;
+    size_t used;
+    size_t high_water;
+
+    LogLevel = 0;
+    clear_ms = 5;
+
+    //
+    //	Parse command line arguments
+    //
+    for (;;) {
+	switch (getopt(argc, argv, "hv?-c:dn:")) {
+	    case 'd':			// enabled debug
+		++LogLevel;
+		continue;
+	    case 'c':			// clear interval
+		clear_ms = atoi(optarg);
+		continue;
+	    case 'n':			// packet count
+		QueueCount = strtoul(optarg, NULL, 0);
+		continue;
+
+	    case EOF:
+		break;
+	    case 'v':			// print version
+		PrintVersion();
+		return 0;
+	    case '?':
+	    case 'h':			// help usage
+		PrintVersion();
+		PrintUsage();
+		return 0;
+	    case '-':
+		PrintVersion();
+		PrintUsage();
+		fprintf(stderr, "\nWe need no long options\n");
+		return -1;
+	    case ':':
+		PrintVersion();
+		fprintf(stderr, "Missing argument for option '%c'\n", optopt);
+		return -1;
+	    default:
+		PrintVersion();
+		fprintf(stderr, "Unknown option '%c'\n", optopt);
+		return -1;
+	}
+	break;
+    }
+    if (optind < argc) {
+	PrintVersion();
+	PrintUsage();
+	return -1;
+    }
+    //
+    //	headless video stream without decoder
+    //
+    pthread_mutex_init(&MyVideoStream->DecoderLockMutex, NULL);
+    MyVideoStream->CodecID = AV_CODEC_ID_NONE;
+    MyVideoStream->LastCodecID = AV_CODEC_ID_NONE;
+    VideoPacketInit(MyVideoStream);
+
+    start = IngestNs();
+    pthread_create(&consumer, NULL, QueueConsumer, NULL);
+    pthread_create(&producer, NULL, QueueProducer, NULL);
+
+    clears = 0;
+    while (!atomic_load(&QueueDone)) {
+	if (clear_ms > 0) {
+	    usleep(clear_ms * 1000);
+	    VideoStreamCommand(MyVideoStream, VIDEO_CMD_CLEAR);
+	    ++clears;
+	} else {
+	    usleep(10 * 1000);
+	}
+    }
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    elapsed = IngestNs() - start;
+
+    GetVideoBufferStats(&used, &allocated, &high_water);
+    printf("packets:   %u produced, %u consumed, %u cleared\n", QueueCount,
+	QueueConsumed, QueueDropped);
+    printf("clears:    %u\n", clears);
+    printf("time:      %.3fs, %.0f packets/s\n", elapsed / 1e9,
+	QueueCount / (elapsed / 1e9));
+    printf("buffers:   %zu used, %zu allocated, %zu high water\n", used,
+	allocated, high_water);
+    printf("errors:    %u\n", QueueErrors);
+
+    VideoPacketExit(MyVideoStream);
+    VideoBufferFlush();
+
+    return QueueErrors ? -1 : 0;
+}
+
+#endif
+
+#ifdef AUDIO_SYNC_TEST
+
+//////////////////////////////////////////////////////////////////////////////
+//	Audio sync detection test
+//////////////////////////////////////////////////////////////////////////////
+
+///
+///	Find audio frame with the Fast*Check/*Check cascade.
+///
+///	Reference for AudioSyncFind, the per byte detection used before.
+///
+///	@param data	buffer with audio elementary stream
+///	@param size	number of bytes in buffer
+///	@param[out] sync	detected codec and frame size
+///
+///	@returns offset of the (possible) frame, or number of bytes to skip.
+///
+static int AudioSyncCascade(const uint8_t * data, int size, AudioSync * sync)
+{
+    const uint8_t *q;
+    int n;
+
+    q = data;
+    n = size;
+    while (n >= 5) {
+	int r;
+	unsigned codec_id;
+
+	r = 0;
+	codec_id = AV_CODEC_ID_NONE;
+	if (!r && FastMpegCheck(q)) {
+	    r = MpegCheck(q, n);
+	    codec_id = AV_CODEC_ID_MP2;
+	}
+	if (!r && FastAc3Check(q)) {
+	    r = Ac3Check(q, n);
+	    codec_id = q[5] > (10 << 3) ? AV_CODEC_ID_EAC3 : AV_CODEC_ID_AC3;
+	}
+	if (!r && FastLatmCheck(q)) {
+	    r = LatmCheck(q, n);
+	    codec_id = AV_CODEC_ID_AAC_LATM;
+	}
+	if (!r && FastAdtsCheck(q)) {
+	    r = AdtsCheck(q, n);
+	    codec_id = AV_CODEC_ID_AAC;
+	}
+	if (r) {
+	    sync->Size = r;
+	    sync->CodecID = codec_id;
+	    sync->Confidence = r > 0 ? 2 : 0;
+	    return q - data;
+	}
+	++q;
+	--n;
+    }
+    sync->Size = 0;
+    sync->CodecID = AV_CODEC_ID_NONE;
+    sync->Confidence = 0;
+    return size < 5 ? 0 : q - data;
+}
+
+///
+///	Get sync class of codec found by the cascade.
+///
+///	@param codec_id	audio codec id
+///
+static unsigned AudioSyncClass(int codec_id)
+{
+    switch (codec_id) {
+	case AV_CODEC_ID_MP2:
+	    return AUDIO_SYNC_MPEG;
+	case AV_CODEC_ID_AAC_LATM:
+	    return AUDIO_SYNC_LATM;
+	case AV_CODEC_ID_AAC:
+	    return AUDIO_SYNC_ADTS;
+    }
+    return AUDIO_SYNC_AC3;
+}
+
+///
+///	Find audio frame with the cascade, known stream.
+///
+///	Reference for AudioSyncFind with a hint.  A pending frame of the
+///	hinted class at the begin of the buffer is accepted, if the cascade
+///	accepts it, when the buffer is completed with the frame's own
+///	header as next sync word.
+///
+///	@param data	buffer with audio elementary stream
+///	@param size	number of bytes in buffer
+///	@param hint	AUDIO_SYNC_* classes of the stream
+///	@param[out] sync	detected codec, frame size and confidence
+///
+///	@returns offset of the (possible) frame, or number of bytes to skip.
+///
+static int AudioSyncCascadeHint(const uint8_t * data, int size,
+    unsigned hint, AudioSync * sync)
+{
+    uint8_t buf[4096 + 5];
+    AudioSync ref;
+    unsigned class;
+    int offset;
+    int frame;
+    int i;
+
+    offset = AudioSyncCascade(data, size, sync);
+    if (offset || sync->Size >= 0 || size < 6) {
+	return offset;
+    }
+    class = AudioSyncClass(sync->CodecID);
+    frame = -sync->Size - AudioSyncNext[class];
+    if (!(class & hint) || frame > size) {
+	return offset;
+    }
+    memcpy(buf, data, size);
+    for (i = size; i < frame + AudioSyncNext[class]; ++i) {
+	buf[i] = data[i - frame];
+    }
+    if (!AudioSyncCascade(buf, frame + AudioSyncNext[class], &ref)
+	&& ref.Size == frame) {
+	sync->Size = frame;
+	sync->Confidence = 1;
+    }
+    return offset;
+}
+
+///
+///	Random number for the audio sync test, xorshift32.
+///
+///	@param seed	state of the generator
+///
+static uint32_t AudioSyncRandom(uint32_t * seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+///
+///	Compare AudioSyncFind with the cascade on random buffers.
+///
+///	The buffers mix random bytes with runs of audio frames: random
+///	headers behind a sync word, sized by the cascade and followed by
+///	another header of the same sync word, so complete, partial and
+///	broken frames of all classes are hit.  Half of the buffers start
+///	with a frame, which is often cut inside the next sync word or has
+///	a damaged next sync word, and are searched with a random hint.
+///
+///	@param count	number of buffers to check
+///
+///	@returns number of differences.
+///
+static uint32_t AudioSyncTest(uint32_t count)
+{
+    static const uint8_t syncs[][2] = {
+	{0xFF, 0xE0}, {0xFF, 0xF0}, {0x0B, 0x77}, {0x56, 0xE0},
+    };
+    static const unsigned hints[] = {
+	0, AUDIO_SYNC_MPEG, AUDIO_SYNC_LATM, AUDIO_SYNC_AC3, AUDIO_SYNC_ADTS,
+	AUDIO_SYNC_ALL,
+    };
+    uint8_t buf[4096];
+    uint32_t seed;
+    uint32_t errors;
+    uint32_t found;
+    uint32_t hinted;
+    uint32_t i;
+
+    seed = 0x2545F491;
+    errors = 0;
+    found = 0;
+    hinted = 0;
+    for (i = 0; i < count; ++i) {
+	AudioSync sync;
+	AudioSync ref;
+	unsigned hint;
+	int size;
+	int offset;
+	int j;
+	int k;
+
+	size = 5 + AudioSyncRandom(&seed) % (sizeof(buf) - 5);
+	k = -1;				// no sync word run
+	for (j = 0; j < size;) {
+	    uint32_t r;
+	    int n;
+
+	    r = AudioSyncRandom(&seed);
+	    if ((j || !(i & 1)) && (r % 8 > (k < 0 ? 0U : 5U)
+		    || size - j < 7)) {
+		buf[j++] = r >> 24;
+		k = -1;
+		continue;
+	    }
+	    if (k < 0) {
+		k = r / 8 % (sizeof(syncs) / sizeof(*syncs));
+	    }
+	    // random header behind sync word
+	    buf[j] = syncs[k][0];
+	    buf[j + 1] = syncs[k][1] | ((r >> 8) & ~syncs[k][1] & 0xFF);
+	    for (n = 2; n < 7; ++n) {
+		buf[j + n] = AudioSyncRandom(&seed) >> 24;
+	    }
+	    // frame payload upto the next header
+	    n = 7;
+	    if (!AudioSyncCascade(buf + j, 7, &ref) && ref.Size < 0) {
+		n = -ref.Size - AudioSyncNext[AudioSyncClass(ref.CodecID)];
+	    }
+	    for (j += 7; n-- > 7 && j < size; ++j) {
+		buf[j] = AudioSyncRandom(&seed) >> 24;
+	    }
+	}
+
+	hint = 0;
+	if (i & 1) {
+	    hint = hints[AudioSyncRandom(&seed) % (sizeof(hints) /
+		    sizeof(*hints))];
+	    // cut the buffer inside the sync word after the first frame
+	    if ((i & 2) && !AudioSyncCascade(buf, 7, &ref) && ref.Size < 0
+		&& -ref.Size <= size) {
+		int next;
+		int frame;
+
+		next = AudioSyncNext[AudioSyncClass(ref.CodecID)];
+		frame = -ref.Size - next;
+		size = frame + AudioSyncRandom(&seed) % next;
+		// damage the next sync word
+		if ((i & 4) && size > frame) {
+		    buf[frame + AudioSyncRandom(&seed) % (size - frame)] ^=
+			1 << AudioSyncRandom(&seed) % 8;
+		}
+	    }
+	}
+
+	offset = AudioSyncFind(buf, size, AUDIO_SYNC_ALL, hint, &sync);
+	if (offset != AudioSyncCascadeHint(buf, size, hint, &ref)
+	    || sync.Size != ref.Size || sync.Confidence != ref.Confidence
+	    || (ref.Size && sync.CodecID != ref.CodecID)) {
+	    if (!errors) {
+		Error(_("audio: sync buffer %u hint %#x: offset %d size %d"
+			" codec %#x != size %d codec %#x\n"), i, hint, offset,
+		    sync.Size, sync.CodecID, ref.Size, ref.CodecID);
+	    }
+	    ++errors;
+	}
+	found += ref.Size > 0;
+	hinted += ref.Confidence == 1;
+    }
+    printf("audio:     %u buffers, %u with valid frame, %u by hint\n", count,
+	found, hinted);
+
+    return errors;
+}
+
+///
+///	Print version.
+///
+static void PrintVersion(void)
+{
+    printf("test-audio-sync: audio sync detection test Version " VERSION
+#ifdef GIT_REV
+	"(GIT-" GIT_REV ")"
+#endif
+	",\n\t(c) 2011 - 2015 by Johns\n"
+	"\tLicense AGPLv3: GNU Affero General Public License version 3\n");
+}
+
+///
+///	Print usage.
+///
+static void PrintUsage(void)
+{
+    printf("Usage: test-audio-sync [-?dhv] [-n buffers]\n"
+	"\t-n num\tcheck num random buffers (default 400000)\n"
+	"\t-d\tenable debug, more -d increase the verbosity\n"
+	"\t-? -h\tdisplay this message\n" "\t-v\tdisplay version information\n"
+	"Only idiots print usage on stderr!\n");
+}
+
+///
+///	Main entry point.
+///
+///	@param argc	number of arguments
+///	@param argv	arguments vector
+///
+///	@returns -1 on failures, 0 clean exit.
+///
+int main(int argc, char *const argv[])
+{
+    uint32_t count;
+    uint32_t errors;
+
+    LogLevel = 0;
+    count = 400000;
+
+    //
+    //	Parse command line arguments
+    //
+    for (;;) {
+	switch (getopt(argc, argv, "hv?-dn:")) {
+	    case 'd':			// enabled debug
+		++LogLevel;
+		continue;
+	    case 'n':			// buffer count
+		count = strtoul(optarg, NULL, 0);
+		continue;
+
+	    case EOF:
+		break;
+	    case 'v':			// print version
+		PrintVersion();
+		return 0;
+	    case '?':
+	    case 'h':			// help usage
+		PrintVersion();
+		PrintUsage();
+		return 0;
+	    case '-':
+		PrintVersion();
+		PrintUsage();
+		fprintf(stderr, "\nWe need no long options\n");
+		return -1;
+	    case ':':
+		PrintVersion();
+		fprintf(stderr, "Missing argument for option '%c'\n", optopt);
+		return -1;
+	    default:
+		PrintVersion();
+		fprintf(stderr, "Unknown option '%c'\n", optopt);
+		return -1;
+	}
+	break;
+    }
+    if (optind < argc) {
+	PrintVersion();
+	PrintUsage();
+	return -1;
+    }
+
+    errors = AudioSyncTest(count);
+    printf("errors:    %u\n", errors);
+
+    return errors ? -1 : 0;
+}
+
+#endif
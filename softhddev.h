@@ -99,6 +99,12 @@ extern "C"
 
     /// Get decoder statistics
     extern void GetStats(int *, int *, int *, int *);
+    /// Get decode time per packet and display time per frame
+    extern void GetTimingStats(int *, int *, int *, int *);
+    /// Get video packet buffer pool statistics
+    extern void GetVideoBufferStats(size_t *, size_t *, size_t *);
+    /// Get transport stream demuxer statistics
+    extern int TsDemuxStats(char *, int, int);
     /// C plugin scale video
     extern void ScaleVideo(int, int, int, int);
 
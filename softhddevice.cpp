@@ -22,6 +22,9 @@
 
 #define __STDC_CONSTANT_MACROS		///< needed for ffmpeg UINT64_C
 
+#include <algorithm>
+#include <vector>
+
 #include <vdr/interface.h>
 #include <vdr/plugin.h>
 #include <vdr/player.h>
@@ -104,6 +107,7 @@ static char ConfigVideoStudioLevels;	///< config use studio levels
 static char ConfigVideo60HzMode;	///< config use 60Hz display mode
 static char ConfigVideoSoftStartSync;	///< config use softstart sync
 static char ConfigVideoBlackPicture;	///< config enable black picture mode
+static int ConfigVideoDecodeQueue;	///< config decode thread queue depth
 char ConfigVideoClearOnSwitch;		///< config enable Clear on channel switch
 
 static int ConfigVideoBrightness;	///< config video brightness
@@ -351,11 +355,200 @@ extern "C" void FeedKeyPress(const char *keymap, const char *key, int repeat,
 //	OSD
 //////////////////////////////////////////////////////////////////////////////
 
+    /// unchanged rows, which still join two dirty rectangles
+#define OSD_DIRTY_ROW_GAP 8
+
+/**
+**	Convert palette indices to ARGB, C version.
+**
+**	@param dst	ARGB output
+**	@param src	palette indices
+**	@param n	number of pixels
+**	@param lut	256 entry palette
+*/
+static void OsdIndexToArgbC(uint32_t * dst, const tIndex * src, int n,
+    const tColor * lut)
+{
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+	dst[i + 0] = lut[src[i + 0]];
+	dst[i + 1] = lut[src[i + 1]];
+	dst[i + 2] = lut[src[i + 2]];
+	dst[i + 3] = lut[src[i + 3]];
+    }
+    for (; i < n; ++i) {
+	dst[i] = lut[src[i]];
+    }
+}
+
+//
+//	Bitmaps with up to 16 colors (2 and 4 bpp) are expanded without
+//	gather: the palette is split into four 16 byte planes, each plane is
+//	looked up with one byte shuffle and the planes are interleaved to ARGB.
+//
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+/**
+**	Convert palette indices to ARGB, SSSE3 version for 16 colors.
+**
+**	@param dst	ARGB output
+**	@param src	palette indices (< 16)
+**	@param n	number of pixels
+**	@param lut	256 entry palette
+*/
+__attribute__ ((target("ssse3")))
+static void OsdIndex16ToArgbSsse3(uint32_t * dst, const tIndex * src, int n,
+    const tColor * lut)
+{
+    __m128i p0;
+    __m128i p1;
+    __m128i p2;
+    __m128i p3;
+    __m128i shuffle;
+    int i;
+
+    // transpose the 16 colors into byte planes b, g, r, a
+    shuffle = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(lut + 0)), shuffle);
+    p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(lut + 4)), shuffle);
+    p2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(lut + 8)), shuffle);
+    p3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(lut + 12)), shuffle);
+    {
+	__m128i t0 = _mm_unpacklo_epi32(p0, p1);	// b0-7 g0-7
+	__m128i t1 = _mm_unpackhi_epi32(p0, p1);	// r0-7 a0-7
+	__m128i t2 = _mm_unpacklo_epi32(p2, p3);	// b8-15 g8-15
+	__m128i t3 = _mm_unpackhi_epi32(p2, p3);	// r8-15 a8-15
+
+	p0 = _mm_unpacklo_epi64(t0, t2);
+	p1 = _mm_unpackhi_epi64(t0, t2);
+	p2 = _mm_unpacklo_epi64(t1, t3);
+	p3 = _mm_unpackhi_epi64(t1, t3);
+    }
+
+    for (i = 0; i + 16 <= n; i += 16) {
+	__m128i idx;
+	__m128i bg_lo;
+	__m128i bg_hi;
+	__m128i ra_lo;
+	__m128i ra_hi;
+
+	idx = _mm_loadu_si128((const __m128i *)(src + i));
+	bg_lo = _mm_unpacklo_epi8(_mm_shuffle_epi8(p0, idx),
+	    _mm_shuffle_epi8(p1, idx));
+	bg_hi = _mm_unpackhi_epi8(_mm_shuffle_epi8(p0, idx),
+	    _mm_shuffle_epi8(p1, idx));
+	ra_lo = _mm_unpacklo_epi8(_mm_shuffle_epi8(p2, idx),
+	    _mm_shuffle_epi8(p3, idx));
+	ra_hi = _mm_unpackhi_epi8(_mm_shuffle_epi8(p2, idx),
+	    _mm_shuffle_epi8(p3, idx));
+	_mm_storeu_si128((__m128i *) (dst + i + 0),
+	    _mm_unpacklo_epi16(bg_lo, ra_lo));
+	_mm_storeu_si128((__m128i *) (dst + i + 4),
+	    _mm_unpackhi_epi16(bg_lo, ra_lo));
+	_mm_storeu_si128((__m128i *) (dst + i + 8),
+	    _mm_unpacklo_epi16(bg_hi, ra_hi));
+	_mm_storeu_si128((__m128i *) (dst + i + 12),
+	    _mm_unpackhi_epi16(bg_hi, ra_hi));
+    }
+    OsdIndexToArgbC(dst + i, src + i, n - i, lut);
+}
+
+/**
+**	Check SSSE3 support.
+*/
+static bool OsdCpuSsse3(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+/**
+**	Convert palette indices to ARGB, NEON version for 16 colors.
+**
+**	@param dst	ARGB output
+**	@param src	palette indices (< 16)
+**	@param n	number of pixels
+**	@param lut	256 entry palette
+*/
+static void OsdIndex16ToArgbNeon(uint32_t * dst, const tIndex * src, int n,
+    const tColor * lut)
+{
+    uint8x16x4_t planes;
+    int i;
+
+    planes = vld4q_u8((const uint8_t *)lut);	// de-interleave b, g, r, a
+    for (i = 0; i + 16 <= n; i += 16) {
+	uint8x16_t idx;
+	uint8x16x4_t argb;
+
+	idx = vld1q_u8(src + i);
+	argb.val[0] = vqtbl1q_u8(planes.val[0], idx);
+	argb.val[1] = vqtbl1q_u8(planes.val[1], idx);
+	argb.val[2] = vqtbl1q_u8(planes.val[2], idx);
+	argb.val[3] = vqtbl1q_u8(planes.val[3], idx);
+	vst4q_u8((uint8_t *) (dst + i), argb);
+    }
+    OsdIndexToArgbC(dst + i, src + i, n - i, lut);
+}
+
+#endif
+
+/**
+**	Convert palette indices to ARGB.
+**
+**	@param dst	ARGB output
+**	@param src	palette indices
+**	@param n	number of pixels
+**	@param lut	256 entry palette, unused entries are 0
+**	@param colors	number of used palette entries
+*/
+static void OsdIndexToArgb(uint32_t * dst, const tIndex * src, int n,
+    const tColor * lut, int colors)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool ssse3 = OsdCpuSsse3();
+
+    if (colors <= 16 && ssse3) {
+	OsdIndex16ToArgbSsse3(dst, src, n, lut);
+	return;
+    }
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    if (colors <= 16) {
+	OsdIndex16ToArgbNeon(dst, src, n, lut);
+	return;
+    }
+#endif
+    (void)colors;
+    OsdIndexToArgbC(dst, src, n, lut);
+}
+
 /**
 **	Soft device plugin OSD class.
 */
 class cSoftOsd:public cOsd
 {
+  private:
+    /// last uploaded ARGB of the bitmaps
+    std::vector < uint32_t > Shadow[MAXOSDAREAS];
+    std::vector < uint32_t > ShadowScreen;	///< last uploaded true color
+    int ShadowWidth;			///< width of true color shadow
+    int ShadowHeight;			///< height of true color shadow
+    std::vector < uint32_t > Argb;	///< bitmap conversion buffer
+
+    void DrawDirty(const uint32_t *, int, int, int, uint32_t *, int, int,
+	int);
+
   public:
     static volatile char Dirty;		///< flag force redraw everything
     int OsdLevel;			///< current osd level FIXME: remove
@@ -420,6 +613,8 @@ cSoftOsd::cSoftOsd(int left, int top, uint level)
 #endif
 
     OsdLevel = level;
+    ShadowWidth = 0;
+    ShadowHeight = 0;
 }
 
 /**
@@ -472,9 +667,95 @@ eOsdError cSoftOsd::SetAreas(const tArea * areas, int n)
 	VideoOsdClear();
 	Dirty = 1;
     }
+    for (int i = 0; i < MAXOSDAREAS; ++i) {
+	Shadow[i].clear();
+    }
     return cOsd::SetAreas(areas, n);
 }
 
+/**
+**	Upload the changed rectangles of an ARGB area.
+**
+**	Rows are compared with the last uploaded data, consecutive changed
+**	rows are joined to one rectangle, which is uploaded once.  Menus
+**	changing single lines upload only these lines.
+**
+**	@param argb	ARGB data of the area
+**	@param pitch	pixels per row of argb
+**	@param width	width of the area
+**	@param height	height of the area
+**	@param shadow	last uploaded data of the area, NULL upload all
+**	@param shadow_pitch	pixels per row of shadow
+**	@param x	x-coordinate on screen of the area
+**	@param y	y-coordinate on screen of the area
+*/
+void cSoftOsd::DrawDirty(const uint32_t * argb, int pitch, int width,
+    int height, uint32_t * shadow, int shadow_pitch, int x, int y)
+{
+    int band_y;
+    int band_x1;
+    int band_x2;
+    int gap;
+    int row;
+
+    if (!shadow) {
+	OsdDrawARGB(0, 0, width, height, pitch * sizeof(uint32_t),
+	    (const uint8_t *)argb, x, y);
+	return;
+    }
+
+    band_y = -1;
+    band_x1 = width;
+    band_x2 = -1;
+    gap = 0;
+    for (row = 0; row <= height; ++row) {
+	const uint32_t *s;
+	uint32_t *d;
+	int l;
+	int r;
+
+	l = 0;
+	r = -1;
+	if (row < height) {
+	    s = argb + row * pitch;
+	    d = shadow + row * shadow_pitch;
+	    if (memcmp(s, d, width * sizeof(uint32_t))) {
+		for (l = 0; s[l] == d[l]; ++l) {
+		}
+		for (r = width - 1; s[r] == d[r]; --r) {
+		}
+		memcpy(d + l, s + l, (r - l + 1) * sizeof(uint32_t));
+	    }
+	}
+	if (r >= 0) {			// changed row
+	    if (band_y < 0) {
+		band_y = row;
+	    }
+	    band_x1 = std::min(band_x1, l);
+	    band_x2 = std::max(band_x2, r);
+	    gap = 0;
+	    continue;
+	}
+	// unchanged row or end: close the band after enough clean rows
+	if (band_y >= 0 && (++gap >= OSD_DIRTY_ROW_GAP || row == height)) {
+	    int band_h;
+
+	    band_h = row - gap + 1 - band_y;
+#ifdef OSD_DEBUG
+	    Debug(3, "[softhddev]%s: draw %dx%d%+d%+d dirty\n", __FUNCTION__,
+		band_x2 - band_x1 + 1, band_h, x + band_x1, y + band_y);
+#endif
+	    OsdDrawARGB(band_x1, band_y, band_x2 - band_x1 + 1, band_h,
+		pitch * sizeof(uint32_t), (const uint8_t *)argb, x + band_x1,
+		y + band_y);
+	    band_y = -1;
+	    band_x1 = width;
+	    band_x2 = -1;
+	    gap = 0;
+	}
+    }
+}
+
 /**
 **	Actually commits all data to the OSD hardware.
 */
@@ -520,10 +801,13 @@ void cSoftOsd::Flush(void)
 #endif
 	// draw all bitmaps
 	for (i = 0; (bitmap = GetBitmap(i)); ++i) {
-	    uint8_t *argb;
+	    std::vector < uint32_t > *shadow;
+	    const tColor *colors;
+	    tColor lut[256];
+	    int full;
+	    int n;
 	    int xs;
 	    int ys;
-	    int x;
 	    int y;
 	    int w;
 	    int h;
@@ -595,28 +879,59 @@ void cSoftOsd::Flush(void)
 		abort();
 	    }
 #endif
-	    argb = (uint8_t *) malloc(w * h * sizeof(uint32_t));
+	    // palette with unused entries 0, like cPalette::Color()
+	    colors = bitmap->Colors(n);
+	    memset(lut, 0, sizeof(lut));
+	    memcpy(lut, colors, n * sizeof(tColor));
+
+	    if (Argb.size() < (size_t) (w * h)) {
+		Argb.resize(w * h);
+	    }
 	    for (y = y1; y <= y2; ++y) {
-		for (x = x1; x <= x2; ++x) {
-		    ((uint32_t *) argb)[x - x1 + (y - y1) * w] =
-			bitmap->GetColor(x, y);
+		OsdIndexToArgb(&Argb[(y - y1) * w], bitmap->Data(x1, y), w, lut,
+		    n);
+	    }
+	    // a new shadow must not hide pixels never uploaded
+	    shadow = &Shadow[i];
+	    full = Dirty;
+	    if (shadow->size() != (size_t) (bitmap->Width() * bitmap->Height())) {
+		shadow->assign(bitmap->Width() * bitmap->Height(), 0);
+		full = 1;
+	    }
+	    if (full) {
+		for (y = y1; y <= y2; ++y) {
+		    memcpy(&(*shadow)[x1 + y * bitmap->Width()],
+			&Argb[(y - y1) * w], w * sizeof(uint32_t));
 		}
 	    }
 #ifdef OSD_DEBUG
 	    Debug(3, "[softhddev]%s: draw %dx%d%+d%+d bm\n", __FUNCTION__, w, h,
 		xs + x1, ys + y1);
 #endif
-	    OsdDrawARGB(0, 0, w, h, w * sizeof(uint32_t), argb, xs + x1,
-		ys + y1);
+	    DrawDirty(&Argb[0], w, w, h,
+		full ? NULL : &(*shadow)[x1 + y1 * bitmap->Width()],
+		bitmap->Width(), xs + x1, ys + y1);
 
 	    bitmap->Clean();
-	    // FIXME: reuse argb
-	    free(argb);
 	}
 	Dirty = 0;
 	return;
     }
 
+    // the shadow mirrors the screen, which is cleared on a forced redraw
+    {
+	int width;
+	int height;
+	double video_aspect;
+
+	::GetOsdSize(&width, &height, &video_aspect);
+	if (Dirty || width != ShadowWidth || height != ShadowHeight) {
+	    ShadowScreen.assign(width * height, 0);
+	    ShadowWidth = width;
+	    ShadowHeight = height;
+	}
+    }
+
     LOCK_PIXMAPS;
     while ((pm = (dynamic_cast < cPixmapMemory * >(RenderPixmaps())))) {
 	int xp;
@@ -688,7 +1003,13 @@ void cSoftOsd::Flush(void)
 	Debug(3, "[softhddev]%s: draw %dx%d%+d%+d*%d -> %+d%+d %p\n",
 	    __FUNCTION__, w, h, xp, yp, stride, x, y, pm->Data());
 #endif
-	OsdDrawARGB(xp, yp, w, h, stride, pm->Data(), x, y);
+	if (w > 0 && h > 0) {
+	    const uint32_t *argb;
+
+	    argb = (const uint32_t *)pm->Data() + xp + yp * (stride / 4);
+	    DrawDirty(argb, stride / 4, w, h,
+		&ShadowScreen[x + y * ShadowWidth], ShadowWidth, x, y);
+	}
 
 #if APIVERSNUM >= 20110
 	DestroyPixmap(pm);
@@ -762,6 +1083,7 @@ protected:
     static void StopOpenGlThread(void);
     static const cImage *GetImageData(int ImageHandle);
     static void OsdSizeChanged(void);
+    static cString ReplayOsdTrace(const char *, int);
 #endif
     cSoftOsdProvider(void);		///< OSD provider constructor
     virtual ~cSoftOsdProvider();	///< OSD provider destructor
@@ -786,6 +1108,21 @@ void cSoftOsdProvider::DropImageData(int ImageHandle)
     if (StartOpenGlThread())
         oglThread->DropImageData(ImageHandle);
 }
+
+/**
+**	Replay a recorded OSD trace through the OpenGL OSD.
+**
+**	@param file	trace file written by cOglTrace
+**	@param loops	number of times the trace is drawn
+**
+**	@returns statistics of the replay
+*/
+cString cSoftOsdProvider::ReplayOsdTrace(const char *file, int loops)
+{
+    if (!StartOpenGlThread())
+        return "OpenGL OSD thread not running";
+    return cOglTrace::Replay(oglThread, file, loops);
+}
 #endif
 
 /**
@@ -802,7 +1139,12 @@ cOsd *cSoftOsdProvider::CreateOsd(int left, int top, uint level)
 #endif
 
 #ifdef USE_OPENGLOSD
+#ifdef USE_EGL
+    // without interop the OpenGL OSD renders offscreen through EGL
+    if (DisableOglOsd) {
+#else
     if ((!VideoIsDriverVdpau() && !VideoIsDriverCuvid()) || DisableOglOsd) {
+#endif
         dsyslog("[softhddev]No hw driver or OpenGL Osd disabled - use soft OSD");
         return Osd = new cSoftOsd(left, top, level);
     }
@@ -935,6 +1277,7 @@ class cMenuSetupSoft:public cMenuSetupPage
     int SoftStartSync;
     int BlackPicture;
     int ClearOnSwitch;
+    int DecodeQueue;
 
     int Brightness;
     int Contrast;
@@ -1158,6 +1501,8 @@ void cMenuSetupSoft::Create(void)
 		&BlackPicture, trVDR("no"), trVDR("yes")));
 	Add(new cMenuEditBoolItem(tr("Clear decoder on channel switch"),
 		&ClearOnSwitch, trVDR("no"), trVDR("yes")));
+	Add(new cMenuEditIntItem(tr("Decode thread queue depth (0=off)"),
+		&DecodeQueue, 0, 3));
 
 	if (brightness_active)
 		Add(new cMenuEditIntItem(*cString::sprintf(tr("Brightness (%d..[%d]..%d)"),
@@ -1443,6 +1788,7 @@ cMenuSetupSoft::cMenuSetupSoft(void)
     SoftStartSync = ConfigVideoSoftStartSync;
     BlackPicture = ConfigVideoBlackPicture;
     ClearOnSwitch = ConfigVideoClearOnSwitch;
+    DecodeQueue = ConfigVideoDecodeQueue;
 
     Brightness = ConfigVideoBrightness;
     Contrast = ConfigVideoContrast;
@@ -1453,7 +1799,7 @@ cMenuSetupSoft::cMenuSetupSoft(void)
     for (i = 0; i < RESOLUTIONS; ++i) {
 	ResolutionShown[i] = 0;
 	Scaling[i] = ConfigVideoScaling[i];
-	Deinterlace[i] = ConfigVideoDeinterlace[i];
+	Deinterlace[i] = VideoGetDeinterlaceIndex(ConfigVideoDeinterlace[i]);
 	SkipChromaDeinterlace[i] = ConfigVideoSkipChromaDeinterlace[i];
 	InverseTelecine[i] = ConfigVideoInverseTelecine[i];
 	Denoise[i] = ConfigVideoDenoise[i];
@@ -1602,6 +1948,8 @@ void cMenuSetupSoft::Store(void)
     SetupStore("BlackPicture", ConfigVideoBlackPicture = BlackPicture);
     VideoSetBlackPicture(ConfigVideoBlackPicture);
     SetupStore("ClearOnSwitch", ConfigVideoClearOnSwitch = ClearOnSwitch);
+    SetupStore("DecodeQueue", ConfigVideoDecodeQueue = DecodeQueue);
+    VideoSetDecodeQueue(ConfigVideoDecodeQueue);
 
     SetupStore("Brightness", ConfigVideoBrightness = Brightness);
     VideoSetBrightness(ConfigVideoBrightness);
@@ -1620,7 +1968,8 @@ void cMenuSetupSoft::Store(void)
 	snprintf(buf, sizeof(buf), "%s.%s", Resolution[i], "Scaling");
 	SetupStore(buf, ConfigVideoScaling[i] = Scaling[i]);
 	snprintf(buf, sizeof(buf), "%s.%s", Resolution[i], "Deinterlace");
-	SetupStore(buf, ConfigVideoDeinterlace[i] = Deinterlace[i]);
+	SetupStore(buf, ConfigVideoDeinterlace[i] =
+	    VideoGetDeinterlaceMode(Deinterlace[i]));
 	snprintf(buf, sizeof(buf), "%s.%s", Resolution[i],
 	    "SkipChromaDeinterlace");
 	SetupStore(buf, ConfigVideoSkipChromaDeinterlace[i] =
@@ -2251,6 +2600,10 @@ void cSoftHdMenu::Create(void)
     int duped;
     int dropped;
     int counter;
+    int decode_avg;
+    int decode_max;
+    int display_avg;
+    int display_max;
 
     current = Current();		// get current menu item index
     Clear();				// clear the menu
@@ -2290,6 +2643,13 @@ void cSoftHdMenu::Create(void)
 	cOsdItem(cString::sprintf(tr
 		(" Frames missed(%d) duped(%d) dropped(%d) total(%d)"), missed,
 		duped, dropped, counter), osUnknown, false));
+    GetTimingStats(&decode_avg, &decode_max, &display_avg, &display_max);
+    Add(new
+	cOsdItem(cString::sprintf(tr
+		(" Time decode(%d/%dus per packet) display(%d/%dus per frame)"
+		    " avg/max"),
+		decode_avg, decode_max, display_avg, display_max), osUnknown,
+	    false));
 
     SetCurrent(Get(current));		// restore selected menu entry
     Display();				// display build menu
@@ -3434,6 +3794,10 @@ bool cPluginSoftHdDevice::SetupParse(const char *name, const char *value)
 	ConfigVideoClearOnSwitch = atoi(value);
 	return true;
     }
+    if (!strcasecmp(name, "DecodeQueue")) {
+	VideoSetDecodeQueue(ConfigVideoDecodeQueue = atoi(value));
+	return true;
+    }
     if (!strcasecmp(name, "Brightness")) {
 	VideoSetBrightness(ConfigVideoBrightness = atoi(value));
 	return true;
@@ -3759,6 +4123,66 @@ bool cPluginSoftHdDevice::Service(const char *id, void *data)
 	return true;
     }
 
+    if (strcmp(id, GRAB_STREAM_SERVICE) == 0) {
+	SoftHDDevice_GrabStreamService_v1_0_t *r;
+
+	if (!data) {
+	    return true;
+	}
+
+	r = (SoftHDDevice_GrabStreamService_v1_0_t *) data;
+	if (r->structSize != sizeof(SoftHDDevice_GrabStreamService_v1_0_t)) {
+	    return false;
+	}
+	r->ring = NULL;
+	r->shmName[0] = '\0';
+	if (r->rate <= 0) {		// release reference of a start
+	    VideoGrabStreamRelease();
+	    return true;
+	}
+	if (r->imgType != GRAB_IMG_RGBA_FORMAT_B8G8R8A8
+	    && r->imgType != GRAB_IMG_RGB_FORMAT_R8G8B8) {
+	    return false;
+	}
+	r->ring = VideoGrabStreamStart(r->width, r->height, r->rate, r->slots,
+	    r->imgType == GRAB_IMG_RGB_FORMAT_R8G8B8 ? VideoGrabRgb :
+	    VideoGrabBgra);
+	if (!r->ring) {
+	    return false;
+	}
+	snprintf(r->shmName, sizeof(r->shmName), "%s", GRAB_STREAM_SHM_NAME);
+	return true;
+    }
+
+    if (strcmp(id, ATMO2_GRAB_SERVICE) == 0) {
+	SoftHDDevice_AtmoGrabService_v1_2_t *r;
+	uint8_t *img;
+	int err;
+
+	if (!data) {
+	    return true;
+	}
+
+	if (SuspendMode != NOT_SUSPENDED) {
+	    return false;
+	}
+
+	r = (SoftHDDevice_AtmoGrabService_v1_2_t *) data;
+	if (r->structSize != sizeof(SoftHDDevice_AtmoGrabService_v1_2_t)
+	    || (r->imgType != GRAB_IMG_RGBA_FORMAT_B8G8R8A8
+		&& r->imgType != GRAB_IMG_RGB_FORMAT_R8G8B8)) {
+	    return false;
+	}
+
+	img = (uint8_t *) r->img;
+	err = VideoGrabBuffer(&img, &r->imgAllocated, &r->size, &r->width,
+	    &r->height, r->imgType == GRAB_IMG_RGB_FORMAT_R8G8B8
+	    ? VideoGrabRgb : VideoGrabBgra);
+	r->img = img;			// can be reallocated, even on failure
+
+	return !err;
+    }
+
     return false;
 }
 
@@ -3766,6 +4190,8 @@ bool cPluginSoftHdDevice::Service(const char *id, void *data)
 //	cPlugin SVDRP
 //----------------------------------------------------------------------------
 
+static char SvdrpGrabStream;		///< SVDRP holds a grab stream reference
+
 /**
 **	SVDRP commands help text.
 **	FIXME: translation?
@@ -3827,6 +4253,25 @@ static const char *SVDRPHelpText[] = {
     "RAIS\n" "\040   Raise softhddevice window\n\n"
 	"    If Xserver is not started by softhddevice, the window which\n"
 	"    contains the softhddevice frontend will be raised to the front.\n",
+#ifdef USE_OPENGLOSD
+    "OTRC <file> | OFF\n" "\040   Record the OSD drawing calls into a trace file.\n\n"
+	"    OFF stops the recording.\n",
+    "OBEN <file> [loops]\n" "\040   Replay an OSD trace through the OpenGL OSD.\n\n"
+	"    Reports the flush latency, commands per frame, glyph cache\n"
+	"    hit rate and texture uploads.\n",
+#endif
+    "GRBS [<w>x<h> [rate] [slots] [RGB|BGRA] | OFF]\n"
+	"\040   Stream grabbed frames into shared memory.\n\n"
+	"    Writes <w>x<h> frames, rate per second (default 10), into a\n"
+	"    ring of slots (default 4) in " GRAB_STREAM_SHM_NAME ".  All\n"
+	"    consumers share one grab, a running stream is only changed\n"
+	"    when SVDRP is its only consumer.  OFF releases the SVDRP\n"
+	"    reference, no option shows status.\n",
+#ifdef USE_TS
+    "TSST [RESET]\n" "\040   Display transport stream demuxer statistics.\n\n"
+	"    packets, continuity counter errors, transport errors and\n"
+	"    discontinuities per pid.  RESET clears the counters.\n",
+#endif
     NULL
 };
 
@@ -4023,6 +4468,91 @@ cString cPluginSoftHdDevice::SVDRPCommand(const char *command,
 	}
 	return "Window raised";
     }
+#ifdef USE_OPENGLOSD
+    if (!strcasecmp(command, "OTRC")) {
+	if (!option || !*option) {
+	    reply_code = 501;
+	    return "missing trace file";
+	}
+	if (!strcasecmp(option, "OFF")) {
+	    cOglTrace::Stop();
+	    return "OSD trace stopped";
+	}
+	if (!cOglTrace::Start(option)) {
+	    reply_code = 550;
+	    return cString::sprintf("cannot open %s", option);
+	}
+	return cString::sprintf("OSD trace recording to %s", option);
+    }
+    if (!strcasecmp(command, "OBEN")) {
+	char file[256];
+	int loops;
+
+	loops = 1;
+	if (!option || sscanf(option, "%255s %d", file, &loops) < 1) {
+	    reply_code = 501;
+	    return "missing trace file";
+	}
+	return cSoftOsdProvider::ReplayOsdTrace(file, loops > 0 ? loops : 1);
+    }
+#endif
+    if (!strcasecmp(command, "GRBS")) {
+	char buf[256];
+	char format[8];
+	void *ring;
+	int width;
+	int height;
+	int rate;
+	int slots;
+
+	if (option && !strcasecmp(option, "OFF")) {
+	    if (SvdrpGrabStream) {
+		VideoGrabStreamRelease();
+		SvdrpGrabStream = 0;
+	    }
+	    VideoGrabStreamStatus(buf, sizeof(buf));
+	    return buf;
+	}
+	if (option && *option) {
+	    rate = 10;
+	    slots = 4;
+	    strcpy(format, "RGB");
+	    if (sscanf(option, "%dx%d %d %d %7s", &width, &height, &rate,
+		    &slots, format) < 2
+		|| (strcasecmp(format, "RGB") && strcasecmp(format, "BGRA"))) {
+		reply_code = 501;
+		return "usage: GRBS <w>x<h> [rate] [slots] [RGB|BGRA]";
+	    }
+	    // a running stream is only shared with the same parameters
+	    ring = VideoGrabStreamStart(width, height, rate, slots,
+		strcasecmp(format, "RGB") ? VideoGrabBgra : VideoGrabRgb);
+	    if (SvdrpGrabStream) {
+		// drop old reference, restarts if SVDRP was the only consumer
+		VideoGrabStreamRelease();
+		SvdrpGrabStream = 0;
+		if (!ring) {
+		    ring = VideoGrabStreamStart(width, height, rate, slots,
+			strcasecmp(format, "RGB") ? VideoGrabBgra :
+			VideoGrabRgb);
+		}
+	    }
+	    if (!ring) {
+		reply_code = 550;
+		return "can't start grab stream, running with other parameters?";
+	    }
+	    SvdrpGrabStream = 1;
+	}
+	VideoGrabStreamStatus(buf, sizeof(buf));
+	return buf;
+    }
+#ifdef USE_TS
+    if (!strcasecmp(command, "TSST")) {
+	char buf[2048];
+
+	TsDemuxStats(buf, sizeof(buf), option && !strcasecmp(option, "RESET"));
+	return buf;
+    }
+#endif
 
     return NULL;
 }
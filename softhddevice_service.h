@@ -24,10 +24,11 @@
 
 #define ATMO_GRAB_SERVICE	"SoftHDDevice-AtmoGrabService-v1.0"
 #define ATMO1_GRAB_SERVICE	"SoftHDDevice-AtmoGrabService-v1.1"
+#define ATMO2_GRAB_SERVICE	"SoftHDDevice-AtmoGrabService-v1.2"
 #define OSD_3DMODE_SERVICE	"SoftHDDevice-Osd3DModeService-v1.0"
 
 enum
-{ GRAB_IMG_RGBA_FORMAT_B8G8R8A8 };
+{ GRAB_IMG_RGBA_FORMAT_B8G8R8A8, GRAB_IMG_RGB_FORMAT_R8G8B8 };
 
 typedef struct
 {
@@ -63,3 +64,110 @@ typedef struct
 
     void *img;
 } SoftHDDevice_AtmoGrabService_v1_1_t;
+
+    /// Grab into a caller owned buffer, which is kept between grabs.
+    /// img is grown with realloc(), if it is too small, the caller frees
+    /// it with free().
+typedef struct
+{
+    int structSize;
+
+    // request data
+
+    int imgType;			///< GRAB_IMG_..._FORMAT_...
+
+    // request/reply data
+
+    int width;				///< <= 0 video width
+    int height;				///< <= 0 video height
+    int imgAllocated;			///< allocated size of img
+    void *img;				///< image buffer or NULL
+
+    // reply data
+
+    int size;				///< size of image data in img
+} SoftHDDevice_AtmoGrabService_v1_2_t;
+
+//----------------------------------------------------------------------------
+//	Grab stream
+//----------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#define GRAB_STREAM_SERVICE	"SoftHDDevice-GrabStreamService-v1.0"
+#define GRAB_STREAM_SHM_NAME	"/softhddevice-grab"
+#define GRAB_STREAM_MAGIC	0x42524753	///< "SGRB"
+#define GRAB_STREAM_VERSION	1
+#define GRAB_STREAM_FRAME_DATA	64	///< offset of image data in slot
+
+    ///
+    /// Start the grab stream or take a reference of the running one.
+    ///
+    /// A running stream is only shared with the same width, height,
+    /// rate, slots and imgType, otherwise the call fails.  Each
+    /// successful start must be paired with one call with rate <= 0,
+    /// which releases the reference.  The stream stops with the last
+    /// reference.
+    ///
+typedef struct
+{
+    int structSize;
+
+    // request data
+
+    int width;				///< frame width
+    int height;				///< frame height
+    int rate;				///< frames per second
+    int slots;				///< number of ring slots
+    int imgType;			///< GRAB_IMG_..._FORMAT_...
+
+    // reply data
+
+    void *ring;				///< in process mapping, until released
+    char shmName[64];			///< POSIX shared memory name
+} SoftHDDevice_GrabStreamService_v1_0_t;
+
+    ///
+    /// Grab stream ring, mapped from POSIX shared memory.
+    ///
+    /// The plugin grabs and scales once and writes the frames into
+    /// the slots, every consumer reads them in place.
+    ///
+    /// Reader:
+    ///	n = sequence (acquire); n == 0: no frame written yet, skip;
+    ///	slot = n % slots; frame = ring + slotOffset + slot * slotSize;
+    ///	frame->sequence == n: use frame + GRAB_STREAM_FRAME_DATA,
+    ///	then (acquire fence) frame->sequence still == n: frame was valid.
+    ///
+    /// Frame numbers start at 1, sequence 0 is reserved for no frame
+    /// and slot being written.
+    ///
+    /// active is cleared when the writer stops; remap on restart, the
+    /// geometry can change.
+    ///
+typedef struct
+{
+    uint32_t magic;			///< GRAB_STREAM_MAGIC
+    uint32_t version;			///< GRAB_STREAM_VERSION
+    uint32_t active;			///< writer running
+    uint32_t slots;			///< number of frame slots
+    uint32_t slotSize;			///< bytes per slot, incl. frame header
+    uint32_t slotOffset;		///< offset of first slot in ring
+    uint32_t width;			///< frame width
+    uint32_t height;			///< frame height
+    uint32_t imgType;			///< GRAB_IMG_..._FORMAT_...
+    uint32_t rate;			///< frames per second
+    uint64_t sequence;			///< number of last complete frame
+} SoftHDDevice_GrabStreamRing_t;
+
+    /// Grab stream frame header, at the start of each slot.
+typedef struct
+{
+    uint64_t sequence;			///< frame number, 0 while written
+    uint64_t timestamp;			///< CLOCK_MONOTONIC in us
+    uint32_t width;			///< image width
+    uint32_t height;			///< image height
+    uint32_t stride;			///< bytes per image line
+    uint32_t imgType;			///< GRAB_IMG_..._FORMAT_...
+    uint32_t size;			///< bytes of image data
+} SoftHDDevice_GrabStreamFrame_t;
@@ -57,6 +57,7 @@
 #include <sys/time.h>
 #include <sys/shm.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -64,6 +65,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 
 #include <libintl.h>
@@ -196,8 +199,10 @@ typedef enum
 #include "iatomic.h"			// portable atomic_t
 #include "misc.h"
 #include "video.h"
+#include "softhddevice_service.h"
 #include "audio.h"
 #include "codec.h"
+#include "deint.h"
 
 #define ARRAY_ELEMS(array) (sizeof(array)/sizeof(array[0]))
 
@@ -231,6 +236,8 @@ typedef enum _video_deinterlace_modes_
     VideoDeinterlaceTemporalSpatial,	///< temporal spatial deinterlace
     VideoDeinterlaceSoftBob,		///< software bob deinterlace
     VideoDeinterlaceSoftSpatial,	///< software spatial deinterlace
+    VideoDeinterlaceSoftYadif,		///< software yadif deinterlace
+    VideoDeinterlaceSoftBwdif,		///< software bwdif deinterlace
 } VideoDeinterlaceModes;
 
 ///
@@ -291,6 +298,8 @@ typedef struct _video_module_
     void (*const SetTrickSpeed) (const VideoHwDecoder *, int);
     uint8_t *(*const GrabOutput)(int *, int *, int *);
     void (*const GetStats) (VideoHwDecoder *, int *, int *, int *, int *);
+    /// get number of decoded surfaces waiting for display
+    int (*const GetSurfacesFilled) (const VideoHwDecoder *);
     void (*const SetBackground) (uint32_t);
     void (*const SetVideoMode) (void);
     void (*const ResetAutoCrop) (void);
@@ -509,6 +518,7 @@ static char Video60HzMode;		///< handle 60hz displays
 static char VideoSoftStartSync;		///< soft start sync audio/video
 static const int VideoSoftStartFrames = 100;	///< soft start frames
 static char VideoShowBlackPicture;	///< flag show black picture
+static int VideoDecodeQueueDepth;	///< decode thread surface queue depth
 
 static xcb_atom_t WmDeleteWindowAtom;	///< WM delete message atom
 static xcb_atom_t NetWmState;		///< wm-state message atom
@@ -526,8 +536,6 @@ static pthread_t VideoThread;		///< video decode thread
 static pthread_cond_t VideoWakeupCond;	///< wakeup condition variable
 static pthread_mutex_t VideoMutex;	///< video condition mutex
 static pthread_mutex_t VideoLockMutex;	///< video lock mutex
-extern pthread_mutex_t PTS_mutex;	///< PTS mutex
-extern pthread_mutex_t ReadAdvance_mutex;	///< PTS mutex
 
 #endif
 
@@ -551,6 +559,46 @@ static int OsdDirtyY;			///< osd dirty area y
 static int OsdDirtyWidth;		///< osd dirty area width
 static int OsdDirtyHeight;		///< osd dirty area height
 
+#define OSD_STAGING_RECTS	32	///< pending rectangles before merge
+
+///
+///	OSD rectangle.
+///
+typedef struct _video_osd_rect_
+{
+    int X;				///< x-coordinate of rectangle
+    int Y;				///< y-coordinate of rectangle
+    int Width;				///< width of rectangle
+    int Height;				///< height of rectangle
+} VideoOsdRect;
+
+///
+///	OSD staging surface.
+///
+///	The OSD draws into one of two persistent ARGB buffers, the pending
+///	rectangles are uploaded from the other by the display thread.
+///	Drawing never waits for the display thread and the display thread
+///	never waits for the drawing.
+///
+typedef struct _video_osd_staging_
+{
+    uint32_t *Buffer[2];		///< double buffered ARGB surface
+    int Width;				///< width of the buffers
+    int Height;				///< height of the buffers
+    int Write;				///< buffer written by the OSD
+    int RectN;				///< number of pending rectangles
+    VideoOsdRect Rects[OSD_STAGING_RECTS];	///< pending rectangles
+    int UsedX1;				///< drawn area since clear
+    int UsedY1;				///< drawn area since clear
+    int UsedX2;				///< drawn area since clear
+    int UsedY2;				///< drawn area since clear
+} VideoOsdStaging;
+
+static VideoOsdStaging OsdStaging;	///< OSD staging surface
+    /// protects the OSD staging surface, never held during uploads
+static pthread_mutex_t OsdStagingMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile char OsdStagingPending;	///< rectangles wait for upload
+
 #ifdef USE_OPENGLOSD
 static void (*VideoEventCallback)(void) = NULL;  /// callback function to notify VDR about Video Events
 #endif
@@ -562,10 +610,6 @@ static char DPMSDisabled;		///< flag we have disabled dpms
 static char EnableDPMSatBlackScreen;	///< flag we should enable dpms at black screen
 #endif
 
-uint32_t mutex_start_time;
-int max_mutex_delay;
-max_mutex_delay = 1;
-
 //----------------------------------------------------------------------------
 //	Common Functions
 //----------------------------------------------------------------------------
@@ -574,6 +618,42 @@ static void VideoThreadLock(void);	///< lock video thread
 static void VideoThreadUnlock(void);	///< unlock video thread
 static void VideoThreadExit(void);	///< exit/kill video thread
 
+    /// check if stream is decoded by an own thread
+static int VideoDecodeThreaded(const VideoStream *);
+
+    /// decode one packet of stream and account the time
+static int VideoDecodeTimed(VideoStream *);
+
+    /// wakeup stream decode threads
+static void VideoDecodeWakeup(void);
+
+///
+///	Frame or packet timing statistics.
+///
+typedef struct _video_timing_
+{
+    uint32_t Count;			///< number of frames or packets
+    uint32_t Max;			///< longest time of one in us
+    uint64_t Sum;			///< sum of all times in us
+} VideoTiming;
+
+static VideoTiming VideoDisplayTiming;	///< display time per frame
+
+///
+///	Account time of one frame or packet.
+///
+///	@param timing	frame timing statistics
+///	@param us	time in us
+///
+static inline void VideoTimingAdd(VideoTiming * timing, uint32_t us)
+{
+    timing->Count++;
+    timing->Sum += us;
+    if (us > timing->Max) {
+	timing->Max = us;
+    }
+}
+
 #ifdef USE_SCREENSAVER
 static void X11SuspendScreenSaver(xcb_connection_t *, int);
 static int X11HaveDPMS(xcb_connection_t *);
@@ -834,6 +914,20 @@ static GLXContext GlxContext;		///< our gl context
 
 #ifdef USE_VIDEO_THREAD
 static GLXContext GlxThreadContext;	///< our gl context for the thread
+
+    /// gl context of a stream decode thread, shared with the others
+static __thread GLXContext GlxDecodeContext;
+
+///
+///	Get the gl context of the calling video or decode thread.
+///
+///	A context can be current in only one thread, decode threads
+///	have their own.
+///
+static inline GLXContext GlxCallerContext(void)
+{
+    return GlxDecodeContext ? GlxDecodeContext : GlxThreadContext;
+}
 #endif
 
 //static GLXFBConfig *GlxFBConfigs;	///< our gl fb configs
@@ -966,10 +1060,6 @@ static inline void GlxRenderTexture(GLuint texture, int x, int y, int width,
 static void GlxUploadOsdTexture(int x, int y, int width, int height,
     const uint8_t * argb)
 {
-    // FIXME: use other / faster uploads
-    // ARB_pixelbuffer_object GL_PIXEL_UNPACK_BUFFER glBindBufferARB()
-    // glMapBuffer() glUnmapBuffer()
-
     glEnable(GL_TEXTURE_2D);		// upload 2d texture
 
     glBindTexture(GL_TEXTURE_2D, OsdGlTextures[OsdIndex]);
@@ -1050,7 +1140,7 @@ static void GlxOsdExit(void)
 static void GlxOsdDrawARGB(int xi, int yi, int width, int height, int pitch,
     const uint8_t * argb, int x, int y)
 {
-    uint8_t *tmp;
+    GLXContext context;
 
 #ifdef DEBUG
     uint32_t start;
@@ -1067,25 +1157,18 @@ static void GlxOsdDrawARGB(int xi, int yi, int width, int height, int pitch,
 	GlxContext);
 #endif
     if (!GlxContext) return;
-    // set glx context
-    if (!glXMakeCurrent(XlibDisplay, VideoWindow, GlxContext)) {
+    // the display thread uploads with its own, shared context
+    context = glXGetCurrentContext();
+    if (!context && !glXMakeCurrent(XlibDisplay, VideoWindow, GlxContext)) {
 	Error(_("video/glx: can't make glx context current\n"));
 	return;
     }
-    // FIXME: faster way
-    tmp = malloc(width * height * 4);
-    if (tmp) {
-	int i;
-
-	for (i = 0; i < height; ++i) {
-	    memcpy(tmp + i * width * 4, argb + xi * 4 + (i + yi) * pitch,
-		width * 4);
-	}
-
-	GlxUploadOsdTexture(x, y, width, height, tmp);
+    // upload the sub-rectangle directly from the staging surface
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
+    GlxUploadOsdTexture(x, y, width, height, argb + xi * 4 + yi * pitch);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (!context) {
 	glXMakeCurrent(XlibDisplay, None, NULL);
-
-	free(tmp);
     }
 #ifdef DEBUG
     end = GetMsTicks();
@@ -1504,6 +1587,8 @@ typedef struct _auto_crop_ctx_
 
     int Count;				///< counter to delay switch
     int State;				///< auto-crop state (0, 14, 16)
+    int Width;				///< frame width of detected borders
+    int Height;				///< frame height of detected borders
 
 } AutoCropCtx;
 
@@ -1511,7 +1596,9 @@ typedef struct _auto_crop_ctx_
 
 #define YBLACK 0x20			///< below is black
 #define UVBLACK 0x80			///< around is black
-#define M64 UINT64_C(0x0101010101010101)	///< 64bit multiplicator
+#define UVRANGE 0x10			///< UV within +- range is black
+#define AUTOCROP_GRID 8			///< positions between grid probes
+#define AUTOCROP_ROW_STEP 4		///< rows between column samples
 
     /// auto-crop percent of video width to ignore logos
 static const int AutoCropLogoIgnore = 24;
@@ -1520,38 +1607,309 @@ static int AutoCropDelay;		///< auto-crop switch delay
 static int AutoCropTolerance;		///< auto-crop tolerance
 
 ///
-///	Detect black line Y.
+///	auto-crop frame to check.
+///
+typedef struct _auto_crop_frame_
+{
+    const uint8_t *Data[3];		///< planes data (Y, U, V)
+    uint32_t Pitch[3];			///< planes pitches (Y, U, V)
+    int Planes;				///< 1 only Y, 2 Y + UV, 3 Y + U + V
+    int X0;				///< first pixel of checked rows
+    int X1;				///< last pixel + 1 of checked rows
+    int Y0;				///< first row of checked columns
+    int Y1;				///< last row + 1 of checked columns
+} AutoCropFrame;
+
+///
+///	Check bytes for black.
 ///
-///	@param data	Y plane pixel data
-///	@param length	number of pixel to check
-///	@param pitch	offset of pixels
+///	@param data	pixel data
+///	@param length	number of bytes to check
+///	@param low	lowest black value
+///	@param range	black values are low ... low + range
 ///
-///	@note 8 pixel are checked at once, all values must be 8 aligned
+///	@returns true if all bytes are black.
 ///
-static int AutoCropIsBlackLineY(const uint8_t * data, int length, int pitch)
+static int AutoCropIsBlankC(const uint8_t * data, int length, int low,
+    int range)
 {
-    int n;
-    int o;
-    uint64_t r;
-    const uint64_t *p;
+    int i;
+    uint8_t r;
 
-#ifdef DEBUG
-    if ((size_t) data & 0x7 || pitch & 0x7) {
-	abort();
+    r = 0;
+    for (i = 0; i < length; ++i) {
+	uint8_t v;
+
+	// wrap around, values below low get big
+	v = data[i] - low;
+	r = v > r ? v : r;
+    }
+    return r <= range;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+///
+///	Check bytes for black, SSE2 version.
+///
+///	@param data	pixel data
+///	@param length	number of bytes to check
+///	@param low	lowest black value
+///	@param range	black values are low ... low + range
+///
+__attribute__ ((target("sse2")))
+static int AutoCropIsBlankSse2(const uint8_t * data, int length, int low,
+    int range)
+{
+    const __m128i l = _mm_set1_epi8(low);
+    const __m128i m = _mm_set1_epi8(range);
+    __m128i r;
+    int i;
+
+    r = _mm_setzero_si128();
+    for (i = 0; i + 16 <= length; i += 16) {
+	r = _mm_max_epu8(r, _mm_sub_epi8(_mm_loadu_si128((const __m128i *)
+		    (data + i)), l));
+    }
+    // max(r, range) == range, for all bytes r <= range
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(r, m), m)) != 0xFFFF) {
+	return 0;
+    }
+    return AutoCropIsBlankC(data + i, length - i, low, range);
+}
+
+///
+///	Check bytes for black, AVX2 version.
+///
+///	@param data	pixel data
+///	@param length	number of bytes to check
+///	@param low	lowest black value
+///	@param range	black values are low ... low + range
+///
+__attribute__ ((target("avx2")))
+static int AutoCropIsBlankAvx2(const uint8_t * data, int length, int low,
+    int range)
+{
+    const __m256i l = _mm256_set1_epi8(low);
+    const __m256i m = _mm256_set1_epi8(range);
+    __m256i r;
+    int i;
+
+    r = _mm256_setzero_si256();
+    for (i = 0; i + 32 <= length; i += 32) {
+	r = _mm256_max_epu8(r, _mm256_sub_epi8(_mm256_loadu_si256((const
+			__m256i *)(data + i)), l));
+    }
+    if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(r,
+		    m), m)) != 0xFFFFFFFFU) {
+	return 0;
+    }
+    return AutoCropIsBlankC(data + i, length - i, low, range);
+}
+
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+///
+///	Check bytes for black, NEON version.
+///
+///	@param data	pixel data
+///	@param length	number of bytes to check
+///	@param low	lowest black value
+///	@param range	black values are low ... low + range
+///
+static int AutoCropIsBlankNeon(const uint8_t * data, int length, int low,
+    int range)
+{
+    const uint8x16_t l = vdupq_n_u8(low);
+    uint8x16_t r;
+    int i;
+
+    r = vdupq_n_u8(0);
+    for (i = 0; i + 16 <= length; i += 16) {
+	r = vmaxq_u8(r, vsubq_u8(vld1q_u8(data + i), l));
+    }
+    if (vmaxvq_u8(r) > range) {
+	return 0;
+    }
+    return AutoCropIsBlankC(data + i, length - i, low, range);
+}
+
+#endif
+
+///
+///	Check bytes for black, using the best kernel of the cpu.
+///
+///	@param data	pixel data
+///	@param length	number of bytes to check
+///	@param low	lowest black value
+///	@param range	black values are low ... low + range
+///
+static int AutoCropIsBlank(const uint8_t * data, int length, int low,
+    int range)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static int simd = -1;
+
+    if (simd < 0) {
+	__builtin_cpu_init();
+	simd = __builtin_cpu_supports("avx2") ? 2 :
+	    __builtin_cpu_supports("sse2") ? 1 : 0;
+    }
+    if (simd > 1) {
+	return AutoCropIsBlankAvx2(data, length, low, range);
     }
+    if (simd) {
+	return AutoCropIsBlankSse2(data, length, low, range);
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    return AutoCropIsBlankNeon(data, length, low, range);
 #endif
-    p = (const uint64_t *)data;
-    n = length;				// FIXME: can remove n
-    o = pitch / 8;
+    return AutoCropIsBlankC(data, length, low, range);
+}
+
+///
+///	Check row for black, Y and UV.
+///
+///	@param frame	frame to check
+///	@param y	row to check
+///
+static int AutoCropIsBlackRow(const AutoCropFrame * frame, int y)
+{
+    const uint8_t *uv;
+    int x0;
+    int n;
+
+    x0 = frame->X0;
+    n = frame->X1 - frame->X0;
+    if (!AutoCropIsBlank(frame->Data[0] + y * frame->Pitch[0] + x0, n, 0,
+	    YBLACK - 1)) {
+	return 0;
+    }
+    // 4:2:0 chroma
+    uv = frame->Data[1] + (y >> 1) * frame->Pitch[1];
+    switch (frame->Planes) {
+	case 2:			// interleaved UV, same bytes as Y
+	    return AutoCropIsBlank(uv + x0, n, UVBLACK - UVRANGE,
+		2 * UVRANGE);
+	case 3:
+	    return AutoCropIsBlank(uv + x0 / 2, n / 2, UVBLACK - UVRANGE,
+		2 * UVRANGE)
+		&& AutoCropIsBlank(frame->Data[2] + (y >> 1) * frame->Pitch[2]
+		+ x0 / 2, n / 2, UVBLACK - UVRANGE, 2 * UVRANGE);
+    }
+    return 1;
+}
+
+///
+///	Check column of 8 pixels for black, Y and UV.
+///
+///	Only every AUTOCROP_ROW_STEP row is checked.
+///
+///	@param frame	frame to check
+///	@param x	first pixel of column to check
+///
+static int AutoCropIsBlackColumn(const AutoCropFrame * frame, int x)
+{
+    int y;
+
+    for (y = frame->Y0; y < frame->Y1; y += AUTOCROP_ROW_STEP) {
+	const uint8_t *uv;
 
-    r = 0UL;
-    while (--n >= 0) {
-	r |= *p;
-	p += o;
+	if (!AutoCropIsBlankC(frame->Data[0] + y * frame->Pitch[0] + x, 8, 0,
+		YBLACK - 1)) {
+	    return 0;
+	}
+	uv = frame->Data[1] + (y >> 1) * frame->Pitch[1];
+	switch (frame->Planes) {
+	    case 2:
+		if (!AutoCropIsBlankC(uv + x, 8, UVBLACK - UVRANGE,
+			2 * UVRANGE)) {
+		    return 0;
+		}
+		break;
+	    case 3:
+		if (!AutoCropIsBlankC(uv + x / 2, 4, UVBLACK - UVRANGE,
+			2 * UVRANGE)
+		    || !AutoCropIsBlankC(frame->Data[2] + (y >> 1)
+			* frame->Pitch[2] + x / 2, 4, UVBLACK - UVRANGE,
+			2 * UVRANGE)) {
+		    return 0;
+		}
+		break;
+	}
     }
+    return 1;
+}
+
+///
+///	Search first not black row or column.
+///
+///	Only a sparse grid of every AUTOCROP_GRID position is probed, the
+///	hit is refined with a binary search.  The border found last time
+///	is verified first, a stable border costs only a few probes.  Like
+///	the old linear search, the border is expected as one black block.
+///
+///	@param frame	frame to check
+///	@param black	black check of one row or column
+///	@param start	first position
+///	@param step	distance between positions
+///	@param n	number of positions
+///	@param hint	index of the last found border, -1 for none
+///
+///	@returns index of the first not black position, n if all are black.
+///
+static int AutoCropSearch(const AutoCropFrame * frame,
+    int (*black) (const AutoCropFrame *, int), int start, int step, int n,
+    int hint)
+{
+    int limit;
+    int lo;
+    int hi;
+    int k;
 
-    // below YBLACK(0x20) is black
-    return !(r & ~((YBLACK - 1) * M64));
+    limit = n;
+    if (hint >= 0 && hint < n && !black(frame, start + hint * step)
+	&& (!hint || black(frame, start + (hint - 1) * step))) {
+	if (hint <= 1) {
+	    return hint;
+	}
+	limit = hint - 1;
+    }
+    //
+    //	grid search, lo is black, hi not black
+    //
+    lo = -1;
+    for (k = 0; k < limit; k += AUTOCROP_GRID) {
+	if (!black(frame, start + k * step)) {
+	    break;
+	}
+	lo = k;
+    }
+    if (k < limit) {
+	hi = k;
+    } else if (limit < n) {		// black upto last border
+	return hint;
+    } else {
+	hi = n;
+    }
+    //
+    //	binary search inside the grid cell
+    //
+    while (hi - lo > 1) {
+	k = (lo + hi) / 2;
+	if (black(frame, start + k * step)) {
+	    lo = k;
+	} else {
+	    hi = k;
+	}
+    }
+    return hi;
 }
 
 ///
@@ -1562,24 +1920,24 @@ static int AutoCropIsBlackLineY(const uint8_t * data, int length, int pitch)
 ///	@param height	frame height in pixel
 ///	@param data	frame planes data (Y, U, V)
 ///	@param pitches	frame planes pitches (Y, U, V)
+///	@param planes	valid planes, 1 only Y, 2 NV12, 3 YV12/I420
 ///
-///	@note FIXME: can reduce the checked range, left, right crop isn't
-///		used yet.
-///
-///	@note FIXME: only Y is checked, for black.
+///	@note only 4:2:0 chroma is supported, left, right crop isn't used
+///		yet.
 ///
 static void AutoCropDetect(AutoCropCtx * autocrop, int width, int height,
-    void *data[3], uint32_t pitches[3])
+    void *data[3], uint32_t pitches[3], int planes)
 {
-    const void *data_y;
-    unsigned length_y;
-    int x;
-    int y;
+    AutoCropFrame frame[1];
+    int hinted;
+    int logo_skip;
+    int n;
+    int k;
+    int i;
     int x1;
     int x2;
     int y1;
     int y2;
-    int logo_skip;
 
     //
     //	ignore top+bottom 6 lines and left+right 8 pixels
@@ -1592,62 +1950,62 @@ static void AutoCropDetect(AutoCropCtx * autocrop, int width, int height,
     y2 = 0;
     logo_skip = SKIP_X + (((width * AutoCropLogoIgnore) / 100 + 8) / 8) * 8;
 
-    data_y = data[0];
-    length_y = pitches[0];
+    // last borders are only usable for the same size
+    hinted = autocrop->Width == width && autocrop->Height == height;
+    autocrop->Width = width;
+    autocrop->Height = height;
 
+    for (i = 0; i < 3; ++i) {
+	frame->Data[i] = i < planes ? data[i] : NULL;
+	frame->Pitch[i] = i < planes ? pitches[i] : 0;
+    }
+    frame->Planes = planes;
+    frame->X0 = logo_skip;
+    frame->X1 = (width - logo_skip) & ~7;
+    if (frame->X1 <= frame->X0 || height <= 2 * SKIP_Y
+	|| width <= 2 * SKIP_X + 8) {
+	goto out;
+    }
     //
     //	search top
     //
-    for (y = SKIP_Y; y < y1; ++y) {
-	if (!AutoCropIsBlackLineY(data_y + logo_skip + y * length_y,
-		(width - 2 * logo_skip) / 8, 8)) {
-	    if (y == SKIP_Y) {
-		y = 0;
-	    }
-	    y1 = y;
-	    break;
-	}
+    n = height - 2 * SKIP_Y;
+    k = AutoCropSearch(frame, AutoCropIsBlackRow, SKIP_Y, 1, n,
+	!hinted ? -1 : autocrop->Y1 ? autocrop->Y1 - SKIP_Y : 0);
+    if (k >= n) {			// black frame
+	goto out;
     }
+    frame->Y0 = SKIP_Y + k;
+    y1 = k ? SKIP_Y + k : 0;
     //
-    //	search bottom
+    //	search bottom, the top row isn't black
     //
-    for (y = height - SKIP_Y - 1; y > y2; --y) {
-	if (!AutoCropIsBlackLineY(data_y + logo_skip + y * length_y,
-		(width - 2 * logo_skip) / 8, 8)) {
-	    if (y == height - SKIP_Y - 1) {
-		y = height - 1;
-	    }
-	    y2 = y;
-	    break;
-	}
-    }
+    n = height - SKIP_Y - frame->Y0;
+    k = AutoCropSearch(frame, AutoCropIsBlackRow, height - SKIP_Y - 1, -1, n,
+	!hinted ? -1 : autocrop->Y2 ==
+	height - 1 ? 0 : height - SKIP_Y - 1 - autocrop->Y2);
+    frame->Y1 = height - SKIP_Y - k;
+    y2 = k ? height - SKIP_Y - 1 - k : height - 1;
     //
-    //	search left
+    //	search left, only inside the picture rows
     //
-    for (x = SKIP_X; x < x1; x += 8) {
-	if (!AutoCropIsBlackLineY(data_y + x + SKIP_Y * length_y,
-		height - 2 * SKIP_Y, length_y)) {
-	    if (x == SKIP_X) {
-		x = 0;
-	    }
-	    x1 = x;
-	    break;
-	}
+    n = (width - 2 * SKIP_X) / 8;
+    k = AutoCropSearch(frame, AutoCropIsBlackColumn, SKIP_X, 8, n,
+	!hinted ? -1 : autocrop->X1 ? (autocrop->X1 - SKIP_X) / 8 : 0);
+    if (k < n) {
+	x1 = k ? SKIP_X + k * 8 : 0;
     }
     //
     //	search right
     //
-    for (x = width - SKIP_X - 8; x > x2; x -= 8) {
-	if (!AutoCropIsBlackLineY(data_y + x + SKIP_Y * length_y,
-		height - 2 * SKIP_Y * 8, length_y)) {
-	    if (x == width - SKIP_X - 8) {
-		x = width - 1;
-	    }
-	    x2 = x;
-	    break;
-	}
+    k = AutoCropSearch(frame, AutoCropIsBlackColumn, width - SKIP_X - 8, -8,
+	n, !hinted ? -1 : autocrop->X2 == width - 1 ? 0 : (width - SKIP_X - 8
+	    - autocrop->X2) / 8);
+    if (k < n) {
+	x2 = k ? width - SKIP_X - 8 - k * 8 : width - 1;
     }
 
+  out:
     if (0 && (y1 > SKIP_Y || x1 > SKIP_X)) {
 	Debug(3, "video/autocrop: top=%d bottom=%d left=%d right=%d\n", y1, y2,
 	    x1, x2);
@@ -1723,6 +2081,9 @@ struct _vaapi_decoder_
     int TopFieldFirst;			///< ffmpeg top field displayed first
 
     VAImage DeintImages[5];		///< deinterlace image buffers
+    uint8_t *DeintHistory[2];		///< cpu copies of current, previous
+    size_t DeintHistorySize;		///< size of cpu copies
+    int DeintHistoryN;			///< valid cpu copies
 
     int GetPutImage;			///< flag get/put image can be used
     VAImage Image[1];			///< image buffer to update surface
@@ -2536,6 +2897,12 @@ static void VaapiCleanup(VaapiDecoder * decoder)
     if (decoder->DeintImages[0].image_id != VA_INVALID_ID) {
 	VaapiDestroyDeinterlaceImages(decoder);
     }
+    free(decoder->DeintHistory[0]);
+    free(decoder->DeintHistory[1]);
+    decoder->DeintHistory[0] = NULL;
+    decoder->DeintHistory[1] = NULL;
+    decoder->DeintHistorySize = 0;
+    decoder->DeintHistoryN = 0;
 
     decoder->SurfaceRead = 0;
     decoder->SurfaceWrite = 0;
@@ -4560,6 +4927,7 @@ static void VaapiAutoCrop(VaapiDecoder * decoder)
     void *va_image_data;
     void *data[3];
     uint32_t pitches[3];
+    int planes;
     int crop14;
     int crop16;
     int next_state;
@@ -4613,12 +4981,26 @@ static void VaapiAutoCrop(VaapiDecoder * decoder)
 	return;
     }
     // convert vaapi to our frame format
-    for (i = 0; (unsigned)i < decoder->Image->num_planes; ++i) {
+    for (i = 0; (unsigned)i < decoder->Image->num_planes && i < 3; ++i) {
 	data[i] = va_image_data + decoder->Image->offsets[i];
 	pitches[i] = decoder->Image->pitches[i];
     }
+    // only 8 bit 4:2:0 chroma can be checked
+    switch (decoder->Image->format.fourcc) {
+	case VA_FOURCC_NV12:
+	    planes = 2;
+	    break;
+	case VA_FOURCC_YV12:
+	case VA_FOURCC('I', '4', '2', '0'):
+	    planes = 3;
+	    break;
+	default:
+	    planes = 1;
+	    break;
+    }
 
-    AutoCropDetect(decoder->AutoCrop, width, height, data, pitches);
+    // only the sampled rows of the (derived) image are read
+    AutoCropDetect(decoder->AutoCrop, width, height, data, pitches, planes);
 
     if (vaUnmapBuffer(VaDisplay, decoder->Image->buf) != VA_STATUS_SUCCESS) {
 	Error(_("video/vaapi: can't unmap auto-crop image!\n"));
@@ -5652,6 +6034,97 @@ static void VaapiBob(VaapiDecoder * decoder, VAImage * src, VAImage * dst1,
 #endif
 }
 
+///
+///	Vaapi temporal software deinterlace (yadif, bwdif).
+///
+///	Keeps cpu copies of the current and the previous frame, the copy
+///	is needed anyway, reading the mapped image is slow on intel.  The
+///	history has no look ahead, the second field uses the current frame
+///	as next frame, so no frame delay is added.
+///
+///	@param decoder	VA-API decoder
+///	@param src	interlaced image
+///	@param dst1	image of first field
+///	@param dst2	image of second field
+///	@param mode	deinterlace algorithm
+///
+static void VaapiTemporal(VaapiDecoder * decoder, VAImage * src,
+    VAImage * dst1, VAImage * dst2, enum DeintMode mode)
+{
+    DeintPlane planes[3];
+    void *src_base;
+    void *dst1_base;
+    void *dst2_base;
+    uint8_t *cur;
+    unsigned p;
+
+    if (decoder->DeintHistorySize != src->data_size) {
+	free(decoder->DeintHistory[0]);
+	free(decoder->DeintHistory[1]);
+	decoder->DeintHistory[0] = malloc(src->data_size);
+	decoder->DeintHistory[1] = malloc(src->data_size);
+	decoder->DeintHistorySize = src->data_size;
+	decoder->DeintHistoryN = 0;
+	if (!decoder->DeintHistory[0] || !decoder->DeintHistory[1]) {
+	    Error(_("video/vaapi: out of memory\n"));
+	    free(decoder->DeintHistory[0]);
+	    free(decoder->DeintHistory[1]);
+	    decoder->DeintHistory[0] = NULL;
+	    decoder->DeintHistory[1] = NULL;
+	    decoder->DeintHistorySize = 0;
+	    VaapiBob(decoder, src, dst1, dst2);
+	    return;
+	}
+    }
+
+    if (vaMapBuffer(decoder->VaDisplay, src->buf,
+	    &src_base) != VA_STATUS_SUCCESS) {
+	Fatal("video/vaapi: can't map the image!\n");
+    }
+    if (vaMapBuffer(decoder->VaDisplay, dst1->buf,
+	    &dst1_base) != VA_STATUS_SUCCESS) {
+	Fatal("video/vaapi: can't map the image!\n");
+    }
+    if (vaMapBuffer(decoder->VaDisplay, dst2->buf,
+	    &dst2_base) != VA_STATUS_SUCCESS) {
+	Fatal("video/vaapi: can't map the image!\n");
+    }
+    // rotate the history, like VaapiAddToHistoryQueue the surfaces
+    cur = decoder->DeintHistory[1];
+    decoder->DeintHistory[1] = decoder->DeintHistory[0];
+    decoder->DeintHistory[0] = cur;
+    memcpy(cur, src_base, src->data_size);
+    if (decoder->DeintHistoryN < 2) {
+	++decoder->DeintHistoryN;
+    }
+
+    for (p = 0; p < src->num_planes && p < 3; ++p) {
+	planes[p].Dst[0] = dst1_base + src->offsets[p];
+	planes[p].Dst[1] = dst2_base + src->offsets[p];
+	planes[p].Prev = decoder->DeintHistoryN > 1
+	    ? decoder->DeintHistory[1] + src->offsets[p] : NULL;
+	planes[p].Cur = cur + src->offsets[p];
+	planes[p].Next = NULL;
+	planes[p].Pitch = src->pitches[p];
+	// NV12 UV is interleaved, full width with 2 byte steps
+	planes[p].Width = src->width >> (p && src->num_planes != 2);
+	planes[p].Height = src->height >> (p != 0);
+	planes[p].Step = p && src->num_planes == 2 ? 2 : 1;
+	planes[p].Copy = p && VideoSkipChromaDeinterlace[decoder->Resolution];
+    }
+    DeintFrame(mode, planes, p);
+
+    if (vaUnmapBuffer(decoder->VaDisplay, dst2->buf) != VA_STATUS_SUCCESS) {
+	Error(_("video/vaapi: can't unmap image buffer\n"));
+    }
+    if (vaUnmapBuffer(decoder->VaDisplay, dst1->buf) != VA_STATUS_SUCCESS) {
+	Error(_("video/vaapi: can't unmap image buffer\n"));
+    }
+    if (vaUnmapBuffer(decoder->VaDisplay, src->buf) != VA_STATUS_SUCCESS) {
+	Error(_("video/vaapi: can't unmap image buffer\n"));
+    }
+}
+
 ///
 ///	Create software deinterlace images.
 ///
@@ -5809,6 +6282,12 @@ static void VaapiCpuDerive(VaapiDecoder * decoder, VASurfaceID surface)
 	case VideoDeinterlaceSoftSpatial:
 	    VaapiSpatial(decoder, image, dest1, dest2);
 	    break;
+	case VideoDeinterlaceSoftYadif:
+	    VaapiTemporal(decoder, image, dest1, dest2, DeintYadif);
+	    break;
+	case VideoDeinterlaceSoftBwdif:
+	    VaapiTemporal(decoder, image, dest1, dest2, DeintBwdif);
+	    break;
     }
 #ifdef DEBUG
     tick5 = GetMsTicks();
@@ -5900,6 +6379,12 @@ static void VaapiCpuPut(VaapiDecoder * decoder, VASurfaceID surface)
 	case VideoDeinterlaceSoftSpatial:
 	    VaapiSpatial(decoder, img1, img2, img3);
 	    break;
+	case VideoDeinterlaceSoftYadif:
+	    VaapiTemporal(decoder, img1, img2, img3, DeintYadif);
+	    break;
+	case VideoDeinterlaceSoftBwdif:
+	    VaapiTemporal(decoder, img1, img2, img3, DeintBwdif);
+	    break;
     }
 #ifdef DEBUG
     tick3 = GetMsTicks();
@@ -6514,6 +6999,16 @@ void VaapiGetStats(VaapiDecoder * decoder, int *missed, int *duped,
     *counter = decoder->FrameCounter;
 }
 
+///
+///	Get number of decoded surfaces waiting for display.
+///
+///	@param decoder		VA-API decoder
+///
+static int VaapiGetSurfacesFilled(const VaapiDecoder * decoder)
+{
+    return atomic_read(&decoder->SurfacesFilled);
+}
+
 ///
 ///	Sync decoder output to audio.
 ///
@@ -6534,16 +7029,7 @@ static void VaapiSyncDecoder(VaapiDecoder * decoder)
     int64_t video_clock;
 
     err = 0;
-    mutex_start_time = GetMsTicks();
-    pthread_mutex_lock(&PTS_mutex);
-    pthread_mutex_lock(&ReadAdvance_mutex);
-    audio_clock = AudioGetClock();
-    pthread_mutex_unlock(&ReadAdvance_mutex);
-    pthread_mutex_unlock(&PTS_mutex);
-    if (GetMsTicks() - mutex_start_time > max_mutex_delay) {
-	max_mutex_delay = GetMsTicks() - mutex_start_time;
-	Debug(3, "video: mutex delay: %"PRIu32"ms\n", max_mutex_delay);
-    }
+    audio_clock = AudioGetClock();	// lock free, never stalls
     video_clock = VaapiGetClock(decoder);
     filled = atomic_read(&decoder->SurfacesFilled);
 
@@ -6837,6 +7323,7 @@ static void VaapiDisplayHandlerThread(void)
     int err;
     int allfull;
     int decoded;
+    uint32_t start;
     struct timespec nowtime;
     VaapiDecoder *decoder;
 
@@ -6852,11 +7339,14 @@ static void VaapiDisplayHandlerThread(void)
 	// fill frame output ring buffer
 	//
 	filled = atomic_read(&decoder->SurfacesFilled);
-	if (filled < VIDEO_SURFACES_MAX - 1) {
+	if (VideoDecodeThreaded(decoder->Stream)) {
+	    // filled by the stream decode thread, only watch for eof
+	    err = VideoGetBuffers(decoder->Stream) ? 1 : -1;
+	} else if (filled < VIDEO_SURFACES_MAX - 1) {
 	    // FIXME: hot polling
 	    // fetch+decode or reopen
 	    allfull = 0;
-	    err = VideoDecodeInput(decoder->Stream);
+	    err = VideoDecodeTimed(decoder->Stream);
 	} else {
 	    err = VideoPollInput(decoder->Stream);
 	}
@@ -6894,8 +7384,12 @@ static void VaapiDisplayHandlerThread(void)
     }
 
     pthread_mutex_lock(&VideoLockMutex);
+    start = GetUsTicks();
     VaapiSyncDisplayFrame();
+    VideoTimingAdd(&VideoDisplayTiming, GetUsTicks() - start);
     pthread_mutex_unlock(&VideoLockMutex);
+    // room in the surface queue
+    VideoDecodeWakeup();
 }
 
 #else
@@ -7187,6 +7681,8 @@ static const VideoModule VaapiModule = {
     .GrabOutput = VaapiGrabOutputSurface,
     .GetStats = (void (*const) (VideoHwDecoder *, int *, int *, int *,
 	    int *))VaapiGetStats,
+    .GetSurfacesFilled = (int (*const) (const VideoHwDecoder *))
+	VaapiGetSurfacesFilled,
     .SetBackground = VaapiSetBackground,
     .SetVideoMode = VaapiSetVideoMode,
 #ifdef USE_AUTOCROP
@@ -7231,6 +7727,8 @@ static const VideoModule VaapiGlxModule = {
     .GrabOutput = VaapiGrabOutputSurface,
     .GetStats = (void (*const) (VideoHwDecoder *, int *, int *, int *,
 	    int *))VaapiGetStats,
+    .GetSurfacesFilled = (int (*const) (const VideoHwDecoder *))
+	VaapiGetSurfacesFilled,
     .SetBackground = VaapiSetBackground,
     .SetVideoMode = VaapiSetVideoMode,
 #ifdef USE_AUTOCROP
@@ -9559,6 +10057,7 @@ static void VdpauAutoCrop(VdpauDecoder * decoder)
 		free(base);
 		decoder->AutoCropBuffer = malloc(size);
 		base = decoder->AutoCropBuffer;
+		decoder->AutoCropBufferSize = base ? size : 0;
 	    }
 	    if (!base) {
 		Error(_("video/vdpau: out of memory\n"));
@@ -9583,7 +10082,7 @@ static void VdpauAutoCrop(VdpauDecoder * decoder)
 	return;
     }
 
-    AutoCropDetect(decoder->AutoCrop, width, height, data, pitches);
+    AutoCropDetect(decoder->AutoCrop, width, height, data, pitches, 3);
 
     // ignore black frames
     if (decoder->AutoCrop->Y1 >= decoder->AutoCrop->Y2) {
@@ -10593,6 +11092,16 @@ void VdpauGetStats(VdpauDecoder * decoder, int *missed, int *duped,
     *counter = decoder->FrameCounter;
 }
 
+///
+///	Get number of decoded surfaces waiting for display.
+///
+///	@param decoder		VDPAU hw decoder
+///
+static int VdpauGetSurfacesFilled(const VdpauDecoder * decoder)
+{
+    return atomic_read(&decoder->SurfacesFilled);
+}
+
 void AudioFlushBuffers(void);
 ///
 ///	Sync decoder output to audio.
@@ -10622,16 +11131,7 @@ static void VdpauSyncDecoder(VdpauDecoder * decoder)
 	// FIXME: 60Hz Mode
 	goto skip_sync;
     }
-    mutex_start_time = GetMsTicks();
-    pthread_mutex_lock(&PTS_mutex);
-    pthread_mutex_lock(&ReadAdvance_mutex);
-    audio_clock = AudioGetClock();
-    pthread_mutex_unlock(&ReadAdvance_mutex);
-    pthread_mutex_unlock(&PTS_mutex);
-    if (GetMsTicks() - mutex_start_time > max_mutex_delay) {
-	max_mutex_delay = GetMsTicks() - mutex_start_time;
-	Debug(3, "video: mutex delay: %"PRIu32"ms\n", max_mutex_delay);
-    }
+    audio_clock = AudioGetClock();	// lock free, never stalls
 
     // 60Hz: repeat every 5th field
     if (Video60HzMode && !(decoder->FramesDisplayed % 6)) {
@@ -10985,6 +11485,7 @@ static void VdpauDisplayHandlerThread(void)
     int err;
     int allfull;
     int decoded;
+    uint32_t start;
     struct timespec nowtime;
     VdpauDecoder *decoder;
 
@@ -11000,11 +11501,14 @@ static void VdpauDisplayHandlerThread(void)
 	// fill frame output ring buffer
 	//
 	filled = atomic_read(&decoder->SurfacesFilled);
-	if (filled <= 1 + 2 * decoder->Interlaced) {
+	if (VideoDecodeThreaded(decoder->Stream)) {
+	    // filled by the stream decode thread, only watch for eof
+	    err = VideoGetBuffers(decoder->Stream) ? 1 : -1;
+	} else if (filled <= 1 + 2 * decoder->Interlaced) {
 	    // FIXME: hot polling
 	    // fetch+decode or reopen
 	    allfull = 0;
-	    err = VideoDecodeInput(decoder->Stream);
+	    err = VideoDecodeTimed(decoder->Stream);
 	} else {
 	    err = VideoPollInput(decoder->Stream);
 	}
@@ -11041,8 +11545,12 @@ static void VdpauDisplayHandlerThread(void)
     }
 
     pthread_mutex_lock(&VideoLockMutex);
+    start = GetUsTicks();
     VdpauSyncDisplayFrame();
+    VideoTimingAdd(&VideoDisplayTiming, GetUsTicks() - start);
     pthread_mutex_unlock(&VideoLockMutex);
+    // room in the surface queue
+    VideoDecodeWakeup();
 }
 
 #else
@@ -11362,6 +11870,8 @@ static const VideoModule VdpauModule = {
 #endif
     .GetStats = (void (*const) (VideoHwDecoder *, int *, int *, int *,
 	    int *))VdpauGetStats,
+    .GetSurfacesFilled = (int (*const) (const VideoHwDecoder *))
+	VdpauGetSurfacesFilled,
     .SetBackground = VdpauSetBackground,
     .SetVideoMode = VdpauSetVideoMode,
 #ifdef USE_AUTOCROP
@@ -11549,7 +12059,7 @@ void CuvidCreateGlTexture(CuvidDecoder * decoder, unsigned int size_x, unsigned
 {
     int n, i, ret;
 
-    glXMakeCurrent(XlibDisplay, VideoWindow, GlxThreadContext);
+    glXMakeCurrent(XlibDisplay, VideoWindow, GlxCallerContext());
     GlxCheck();
 
     glGenBuffers(1,&vao_buffer);
@@ -11642,7 +12152,7 @@ static void CuvidDestroySurfaces(CuvidDecoder * decoder)
 {
     int i, j;
 
-    glXMakeCurrent(XlibDisplay, VideoWindow, GlxThreadContext);
+    glXMakeCurrent(XlibDisplay, VideoWindow, GlxCallerContext());
     GlxCheck();
 
     glDeleteTextures(CODEC_SURFACES_MAX, &decoder->gl_textures);
@@ -12318,6 +12828,7 @@ static void CuvidAutoCrop(CuvidDecoder * decoder)
 	free(base);
 	decoder->AutoCropBuffer = malloc(size);
 	base = decoder->AutoCropBuffer;
+	decoder->AutoCropBufferSize = base ? size : 0;
     }
     if (!base) {
 	Error(_("video/cuvid: out of memory\n"));
@@ -12333,7 +12844,7 @@ static void CuvidAutoCrop(CuvidDecoder * decoder)
     //we need Y in data[0] only
     memcpy(base, &decoder->gl_textures[surface*2+0], width * height);
 
-    AutoCropDetect(decoder->AutoCrop, width, height, data, pitches);
+    AutoCropDetect(decoder->AutoCrop, width, height, data, pitches, 1);
 
     // ignore black frames
     if (decoder->AutoCrop->Y1 >= decoder->AutoCrop->Y2) {
@@ -12655,7 +13166,7 @@ static void CuvidRenderFrame(CuvidDecoder * decoder,
             memcpy(outUV + i * 2, frame->data[1] + i, 1); // For NV12, U first
             memcpy(outUV + i * 2 + 1, frame->data[2] + i, 1); // For NV12, V second
         }
-        glXMakeCurrent(XlibDisplay, VideoWindow, GlxThreadContext);
+        glXMakeCurrent(XlibDisplay, VideoWindow, GlxCallerContext());
         GlxCheck();
 
         //Y
@@ -12995,12 +13506,22 @@ void CuvidGetStats(CuvidDecoder * decoder, int *missed, int *duped,
     *counter = decoder->FrameCounter;
 }
 
-void AudioFlushBuffers(void);
 ///
-///	Sync decoder output to audio.
+///	Get number of decoded surfaces waiting for display.
 ///
-///	trick-speed	show frame <n> times
-///	still-picture	show frame until new frame arrives
+///	@param decoder		CUVID hw decoder
+///
+static int CuvidGetSurfacesFilled(const CuvidDecoder * decoder)
+{
+    return atomic_read(&decoder->SurfacesFilled);
+}
+
+void AudioFlushBuffers(void);
+///
+///	Sync decoder output to audio.
+///
+///	trick-speed	show frame <n> times
+///	still-picture	show frame until new frame arrives
 ///	60hz-mode	repeat every 5th picture
 ///	video>audio	slow down video by duplicating frames
 ///	video<audio	speed up video by skipping frames
@@ -13024,16 +13545,7 @@ static void CuvidSyncDecoder(CuvidDecoder * decoder)
 	// FIXME: 60Hz Mode
 	goto skip_sync;
     }
-    mutex_start_time = GetMsTicks();
-    pthread_mutex_lock(&PTS_mutex);
-    pthread_mutex_lock(&ReadAdvance_mutex);
-    audio_clock = AudioGetClock();
-    pthread_mutex_unlock(&ReadAdvance_mutex);
-    pthread_mutex_unlock(&PTS_mutex);
-    if (GetMsTicks() - mutex_start_time > max_mutex_delay) {
-	max_mutex_delay = GetMsTicks() - mutex_start_time;
-	Debug(3, "video: mutex delay: %"PRIu32"ms\n", max_mutex_delay);
-    }
+    audio_clock = AudioGetClock();	// lock free, never stalls
 
     // 60Hz: repeat every 5th field
     if (Video60HzMode && !(decoder->FramesDisplayed % 6)) {
@@ -13320,6 +13832,7 @@ static void CuvidDisplayHandlerThread(void)
     int err;
     int allfull;
     int decoded;
+    uint32_t start;
     struct timespec nowtime;
     CuvidDecoder *decoder;
 
@@ -13335,11 +13848,14 @@ static void CuvidDisplayHandlerThread(void)
 	// fill frame output ring buffer
 	//
 	filled = atomic_read(&decoder->SurfacesFilled);
-	if (filled <= 1 + 2 * decoder->Interlaced) {
+	if (VideoDecodeThreaded(decoder->Stream)) {
+	    // filled by the stream decode thread, only watch for eof
+	    err = VideoGetBuffers(decoder->Stream) ? 1 : -1;
+	} else if (filled <= 1 + 2 * decoder->Interlaced) {
 	    // FIXME: hot polling
 	    // fetch+decode or reopen
 	    allfull = 0;
-	    err = VideoDecodeInput(decoder->Stream);
+	    err = VideoDecodeTimed(decoder->Stream);
 	} else {
 	    err = VideoPollInput(decoder->Stream);
 	}
@@ -13376,8 +13892,12 @@ static void CuvidDisplayHandlerThread(void)
     }
 
     pthread_mutex_lock(&VideoLockMutex);
+    start = GetUsTicks();
     CuvidSyncDisplayFrame();
+    VideoTimingAdd(&VideoDisplayTiming, GetUsTicks() - start);
     pthread_mutex_unlock(&VideoLockMutex);
+    // room in the surface queue
+    VideoDecodeWakeup();
 }
 
 #else
@@ -13465,6 +13985,8 @@ static const VideoModule CuvidModule = {
 #endif
     .GetStats = (void (*const) (VideoHwDecoder *, int *, int *, int *,
 	    int *))CuvidGetStats,
+    .GetSurfacesFilled = (int (*const) (const VideoHwDecoder *))
+	CuvidGetSurfacesFilled,
     .SetBackground = CuvidSetBackground,
     .SetVideoMode = CuvidSetVideoMode,
 #ifdef USE_AUTOCROP
@@ -13651,6 +14173,147 @@ static const VideoModule NoopModule = {
 //	OSD
 //----------------------------------------------------------------------------
 
+///
+///	Allocate the OSD staging surface.
+///
+///	@returns true if the buffers are available.
+///
+///	@note locked by caller
+///
+static int VideoOsdStagingAlloc(void)
+{
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+	free(OsdStaging.Buffer[i]);
+	OsdStaging.Buffer[i] = calloc(OsdWidth * OsdHeight, sizeof(uint32_t));
+	if (!OsdStaging.Buffer[i]) {
+	    Error(_("video: out of memory for osd staging surface\n"));
+	    free(OsdStaging.Buffer[0]);
+	    OsdStaging.Buffer[0] = NULL;
+	    OsdStaging.Width = 0;
+	    OsdStaging.Height = 0;
+	    return 0;
+	}
+    }
+    OsdStaging.Width = OsdWidth;
+    OsdStaging.Height = OsdHeight;
+    OsdStaging.Write = 0;
+    OsdStaging.RectN = 0;
+    OsdStaging.UsedX1 = OsdWidth;
+    OsdStaging.UsedY1 = OsdHeight;
+    OsdStaging.UsedX2 = 0;
+    OsdStaging.UsedY2 = 0;
+    return 1;
+}
+
+///
+///	Free the OSD staging surface.
+///
+///	@note locked by caller, uploads run with the video thread locked
+///
+static void VideoOsdStagingFree(void)
+{
+    pthread_mutex_lock(&OsdStagingMutex);
+    free(OsdStaging.Buffer[0]);
+    free(OsdStaging.Buffer[1]);
+    OsdStaging.Buffer[0] = NULL;
+    OsdStaging.Buffer[1] = NULL;
+    OsdStaging.Width = 0;
+    OsdStaging.Height = 0;
+    OsdStaging.RectN = 0;
+    OsdStagingPending = 0;
+    pthread_mutex_unlock(&OsdStagingMutex);
+}
+
+///
+///	Upload the pending OSD rectangles.
+///
+///	Swaps the staging buffers and uploads the rectangles from the
+///	buffer just written.  If the OSD is drawing right now, the upload
+///	is retried with the next frame.
+///
+///	@note called from the display thread or with video thread locked
+///
+static void VideoOsdStagingCommit(void)
+{
+    VideoOsdRect rects[OSD_STAGING_RECTS];
+    const uint32_t *src;
+    int pitch;
+    int n;
+    int i;
+    int r;
+
+    if (!OsdStagingPending) {
+	return;
+    }
+    if (pthread_mutex_trylock(&OsdStagingMutex)) {
+	return;				// osd drawing, next frame
+    }
+    if (!OsdStaging.Buffer[0]) {
+	pthread_mutex_unlock(&OsdStagingMutex);
+	return;
+    }
+    src = OsdStaging.Buffer[OsdStaging.Write];
+    pitch = OsdStaging.Width * 4;
+    n = OsdStaging.RectN;
+    // the osd adds rectangles, while uploading
+    memcpy(rects, OsdStaging.Rects, n * sizeof(*rects));
+    // keep the other buffer complete, before the osd draws into it
+    OsdStaging.Write ^= 1;
+    for (r = 0; r < n; ++r) {
+	for (i = 0; i < rects[r].Height; ++i) {
+	    int o;
+
+	    o = rects[r].X + (rects[r].Y + i) * OsdStaging.Width;
+	    memcpy(OsdStaging.Buffer[OsdStaging.Write] + o, src + o,
+		rects[r].Width * 4);
+	}
+    }
+    OsdStaging.RectN = 0;
+    OsdStagingPending = 0;
+    pthread_mutex_unlock(&OsdStagingMutex);
+
+    // src isn't written until the next swap, which is done here
+    for (r = 0; r < n; ++r) {
+	int x;
+	int y;
+	int width;
+	int height;
+
+	x = rects[r].X;
+	y = rects[r].Y;
+	width = rects[r].Width;
+	height = rects[r].Height;
+
+	// update dirty area
+	if (x < OsdDirtyX) {
+	    if (OsdDirtyWidth) {
+		OsdDirtyWidth += OsdDirtyX - x;
+	    }
+	    OsdDirtyX = x;
+	}
+	if (y < OsdDirtyY) {
+	    if (OsdDirtyHeight) {
+		OsdDirtyHeight += OsdDirtyY - y;
+	    }
+	    OsdDirtyY = y;
+	}
+	if (x + width > OsdDirtyX + OsdDirtyWidth) {
+	    OsdDirtyWidth = x + width - OsdDirtyX;
+	}
+	if (y + height > OsdDirtyY + OsdDirtyHeight) {
+	    OsdDirtyHeight = y + height - OsdDirtyY;
+	}
+	Debug(4, "video: osd dirty %dx%d%+d%+d -> %dx%d%+d%+d\n", width,
+	    height, x, y, OsdDirtyWidth, OsdDirtyHeight, OsdDirtyX, OsdDirtyY);
+
+	VideoUsedModule->OsdDrawARGB(x, y, width, height, pitch,
+	    (const uint8_t *)src, x, y);
+    }
+    OsdShown = 1;
+}
+
 ///
 ///	Clear the OSD.
 ///
@@ -13660,6 +14323,28 @@ static const VideoModule NoopModule = {
 void VideoOsdClear(void)
 {
     VideoThreadLock();
+    // drop pending rectangles, clear the drawn area of both buffers
+    pthread_mutex_lock(&OsdStagingMutex);
+    if (OsdStaging.Buffer[0] && OsdStaging.UsedX2 > OsdStaging.UsedX1) {
+	int i;
+	int y;
+
+	for (i = 0; i < 2; ++i) {
+	    for (y = OsdStaging.UsedY1; y < OsdStaging.UsedY2; ++y) {
+		memset(OsdStaging.Buffer[i] + y * OsdStaging.Width +
+		    OsdStaging.UsedX1, 0,
+		    (OsdStaging.UsedX2 - OsdStaging.UsedX1) * 4);
+	    }
+	}
+    }
+    OsdStaging.RectN = 0;
+    OsdStaging.UsedX1 = OsdStaging.Width;
+    OsdStaging.UsedY1 = OsdStaging.Height;
+    OsdStaging.UsedX2 = 0;
+    OsdStaging.UsedY2 = 0;
+    OsdStagingPending = 0;
+    pthread_mutex_unlock(&OsdStagingMutex);
+
     VideoUsedModule->OsdClear();
 
     OsdDirtyX = OsdWidth;		// reset dirty area
@@ -13671,6 +14356,83 @@ void VideoOsdClear(void)
     VideoThreadUnlock();
 }
 
+///
+///	Copy an OSD ARGB image into the staging surface.
+///
+///	@returns true if a rectangle is pending for upload.
+///
+static int VideoOsdStagingDraw(int xi, int yi, int width, int height,
+    int pitch, const uint8_t * argb, int x, int y)
+{
+    uint32_t *dst;
+    int i;
+    int n;
+
+    pthread_mutex_lock(&OsdStagingMutex);
+    if (OsdStaging.Width != OsdWidth || OsdStaging.Height != OsdHeight
+	|| !OsdStaging.Buffer[0]) {
+	if (!VideoOsdStagingAlloc()) {
+	    pthread_mutex_unlock(&OsdStagingMutex);
+	    return 0;
+	}
+    }
+    // clip to staging surface
+    if (x < 0) {
+	xi -= x;
+	width += x;
+	x = 0;
+    }
+    if (y < 0) {
+	yi -= y;
+	height += y;
+	y = 0;
+    }
+    if (width > OsdStaging.Width - x) {
+	width = OsdStaging.Width - x;
+    }
+    if (height > OsdStaging.Height - y) {
+	height = OsdStaging.Height - y;
+    }
+    if (width <= 0 || height <= 0) {
+	pthread_mutex_unlock(&OsdStagingMutex);
+	return 0;
+    }
+
+    dst = OsdStaging.Buffer[OsdStaging.Write] + x + y * OsdStaging.Width;
+    for (i = 0; i < height; ++i) {
+	memcpy(dst + i * OsdStaging.Width, argb + xi * 4 + (i + yi) * pitch,
+	    width * 4);
+    }
+
+    // the buffers hold the complete OSD, merging rectangles is always safe
+    n = OsdStaging.RectN;
+    if (n == OSD_STAGING_RECTS) {
+	int x2;
+	int y2;
+
+	--n;
+	x2 = FFMAX(x + width, OsdStaging.Rects[n].X + OsdStaging.Rects[n].Width);
+	y2 = FFMAX(y + height,
+	    OsdStaging.Rects[n].Y + OsdStaging.Rects[n].Height);
+	x = FFMIN(x, OsdStaging.Rects[n].X);
+	y = FFMIN(y, OsdStaging.Rects[n].Y);
+	width = x2 - x;
+	height = y2 - y;
+    }
+    OsdStaging.Rects[n].X = x;
+    OsdStaging.Rects[n].Y = y;
+    OsdStaging.Rects[n].Width = width;
+    OsdStaging.Rects[n].Height = height;
+    OsdStaging.RectN = n + 1;
+    OsdStaging.UsedX1 = FFMIN(OsdStaging.UsedX1, x);
+    OsdStaging.UsedY1 = FFMIN(OsdStaging.UsedY1, y);
+    OsdStaging.UsedX2 = FFMAX(OsdStaging.UsedX2, x + width);
+    OsdStaging.UsedY2 = FFMAX(OsdStaging.UsedY2, y + height);
+    OsdStagingPending = 1;
+    pthread_mutex_unlock(&OsdStagingMutex);
+    return 1;
+}
+
 ///
 ///	Draw an OSD ARGB image.
 ///
@@ -13686,33 +14448,46 @@ void VideoOsdClear(void)
 void VideoOsdDrawARGB(int xi, int yi, int width, int height, int pitch,
     const uint8_t * argb, int x, int y)
 {
-    VideoThreadLock();
-    // update dirty area
-    if (x < OsdDirtyX) {
-	if (OsdDirtyWidth) {
-	    OsdDirtyWidth += OsdDirtyX - x;
-	}
-	OsdDirtyX = x;
+    if (!VideoOsdStagingDraw(xi, yi, width, height, pitch, argb, x, y)) {
+	return;
     }
-    if (y < OsdDirtyY) {
-	if (OsdDirtyHeight) {
-	    OsdDirtyHeight += OsdDirtyY - y;
-	}
-	OsdDirtyY = y;
+#ifdef USE_VIDEO_THREAD
+    if (VideoThread) {			// display thread uploads
+	return;
     }
-    if (x + width > OsdDirtyX + OsdDirtyWidth) {
-	OsdDirtyWidth = x + width - OsdDirtyX;
+#endif
+    // without display thread upload now
+    VideoThreadLock();
+    VideoOsdStagingCommit();
+    VideoThreadUnlock();
+}
+
+///
+///	Stage an OSD ARGB image for the display thread.
+///
+///	Unlike VideoOsdDrawARGB() the image is never uploaded by the
+///	caller, for threads which own another GL context.
+///
+///	@param xi	x-coordinate in argb image
+///	@param yi	y-coordinate in argb image
+///	@paran height	height in pixel in argb image
+///	@paran width	width in pixel in argb image
+///	@param pitch	pitch of argb image
+///	@param argb	32bit ARGB image data
+///	@param x	x-coordinate on screen of argb image
+///	@param y	y-coordinate on screen of argb image
+///
+void VideoOsdStageARGB(int xi, int yi, int width, int height, int pitch,
+    const uint8_t * argb, int x, int y)
+{
+    if (!VideoOsdStagingDraw(xi, yi, width, height, pitch, argb, x, y)) {
+	return;
     }
-    if (y + height > OsdDirtyY + OsdDirtyHeight) {
-	OsdDirtyHeight = y + height - OsdDirtyY;
+#ifdef USE_VIDEO_THREAD
+    if (!VideoThread) {			// start display thread for upload
+	VideoDisplayWakeup();
     }
-    Debug(4, "video: osd dirty %dx%d%+d%+d -> %dx%d%+d%+d\n", width, height, x,
-	y, OsdDirtyWidth, OsdDirtyHeight, OsdDirtyX, OsdDirtyY);
-
-    VideoUsedModule->OsdDrawARGB(xi, yi, width, height, pitch, argb, x, y);
-    OsdShown = 1;
-
-    VideoThreadUnlock();
+#endif
 }
 
 void ActivateOsd(void) {
@@ -13789,6 +14564,8 @@ void VideoOsdExit(void)
 {
     VideoThreadLock();
     VideoUsedModule->OsdExit();
+    // not during an upload of the display thread
+    VideoOsdStagingFree();
     VideoThreadUnlock();
     OsdDirtyWidth = 0;
     OsdDirtyHeight = 0;
@@ -13998,138 +14775,484 @@ static void VideoThreadUnlock(void)
     }
 }
 
+//----------------------------------------------------------------------------
+//	Decode threads
+//----------------------------------------------------------------------------
+
+#define VIDEO_DECODE_THREADS	2	///< normal video and pip stream
+
 ///
-///	Video render thread.
+///	Video stream decode thread.
 ///
-static void *VideoDisplayHandlerThread(void *dummy)
+///	Decodes the packets of one video stream into the surface queue of
+///	its hw decoder, so a slow decode doesn't delay the display.
+///
+typedef struct _video_decode_thread_
 {
-    Debug(3, "video: display thread started\n");
+    VideoStream *Stream;		///< video stream of thread
+    VideoHwDecoder *HwDecoder;		///< current hw decoder of stream
+    pthread_t Thread;			///< decode thread, 0 decode inline
+    VideoTiming Timing;			///< decode time per packet
+} VideoDecodeThread;
 
-#ifdef USE_GLX
-    if (GlxEnabled) {
-	Debug(3, "video/glx: thread context %p <-> %p\n",
-	    glXGetCurrentContext(), GlxThreadContext);
-	Debug(3, "video/glx: context %p <-> %p\n", glXGetCurrentContext(),
-	    GlxContext);
+    /// decode threads, one per video stream
+static VideoDecodeThread VideoDecodeThreads[VIDEO_DECODE_THREADS];
 
-	GlxThreadContext =
-	    glXCreateContext(XlibDisplay, GlxVisualInfo, GlxSharedContext,
-	    GL_TRUE);
-	if (!GlxThreadContext) {
-	    Error(_("video/glx: can't create glx context\n"));
-	    return NULL;
-	}
-	// set glx context
-	GlxSetupWindow(VideoWindow, VideoWindowWidth, VideoWindowHeight,
-	    GlxThreadContext);
-    }
-#endif
+static pthread_cond_t VideoDecodeCond;	///< decode wakeup condition
+static pthread_mutex_t VideoDecodeMutex;	///< decode wakeup mutex
+static uint32_t VideoDecodeWakeups;	///< decode wakeup counter
 
-    for (;;) {
-	// fix dead-lock with VdpauExit
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_testcancel();
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	VideoPollEvent();
-	VideoUsedModule->DisplayHandlerThread();
-    }
-    return dummy;
-}
+    /// flag current thread is a stream decode thread
+static __thread char VideoInDecodeThread;
 
 ///
-///	Initialize video threads.
+///	Get decode thread slot of a video stream.
 ///
-static void VideoThreadInit(void)
+///	@param stream	video stream
+///
+static VideoDecodeThread *VideoDecodeThreadOf(const VideoStream * stream)
 {
-#ifdef USE_GLX
-    glXMakeCurrent(XlibDisplay, None, NULL);
-#endif
-    pthread_mutex_init(&VideoMutex, NULL);
-    pthread_mutex_init(&VideoLockMutex, NULL);
-    pthread_cond_init(&VideoWakeupCond, NULL);
-    pthread_create(&VideoThread, NULL, VideoDisplayHandlerThread, NULL);
-    pthread_setname_np(VideoThread, "softhddev video");
+    int i;
+
+    for (i = 0; i < VIDEO_DECODE_THREADS; ++i) {
+	if (VideoDecodeThreads[i].Stream == stream) {
+	    return &VideoDecodeThreads[i];
+	}
+    }
+    return NULL;
 }
 
 ///
-///	Exit and cleanup video threads.
+///	Check if video stream is decoded by an own thread.
 ///
-static void VideoThreadExit(void)
+///	@param stream	video stream
+///
+static int VideoDecodeThreaded(const VideoStream * stream)
 {
-    if (VideoThread) {
-	void *retval;
+    const VideoDecodeThread *thread;
 
-	Debug(3, "video: video thread canceled\n");
-	//VideoThreadLock();
-	// FIXME: can't cancel locked
-	if (pthread_cancel(VideoThread)) {
-	    Error(_("video: can't queue cancel video display thread\n"));
-	}
-	//VideoThreadUnlock();
-	if (pthread_join(VideoThread, &retval) || retval != PTHREAD_CANCELED) {
-	    Error(_("video: can't cancel video display thread\n"));
-	}
-	VideoThread = 0;
-	pthread_cond_destroy(&VideoWakeupCond);
-	pthread_mutex_destroy(&VideoLockMutex);
-	pthread_mutex_destroy(&VideoMutex);
-    }
+    thread = VideoDecodeThreadOf(stream);
+    return thread && thread->Thread;
 }
 
 ///
-///	Video display wakeup.
+///	Decode one packet of video stream and account the time.
 ///
-///	New video arrived, wakeup video thread.
+///	@param stream	video stream
 ///
-void VideoDisplayWakeup(void)
+///	@returns the result of VideoDecodeInput.
+///
+static int VideoDecodeTimed(VideoStream * stream)
 {
-    if (!XlibDisplay) {			// not yet started
-	return;
-    }
+    VideoDecodeThread *thread;
+    uint32_t start;
+    int err;
 
-    if (!VideoThread) {			// start video thread, if needed
-	VideoThreadInit();
+    start = GetUsTicks();
+    err = VideoDecodeInput(stream);
+    if (!err && (thread = VideoDecodeThreadOf(stream))) {
+	VideoTimingAdd(&thread->Timing, GetUsTicks() - start);
     }
+    return err;
 }
 
+///
+///	Lock video thread, if called from a stream decode thread.
+///
+///	The video thread holds the lock while it decodes inline, decode
+///	threads must take it for everything touching the hw decoder.
+///
+///	@returns true if the lock was taken.
+///
+static int VideoDecodeLock(void)
+{
+    if (VideoInDecodeThread) {
+	VideoThreadLock();
+#ifdef USE_GLX
+	// hw decoder setup creates gl textures and glx surfaces
+	if (GlxDecodeContext
+	    && !glXMakeCurrent(XlibDisplay, VideoWindow, GlxDecodeContext)) {
+	    Error(_("video/glx: can't make glx context current\n"));
+	}
 #endif
-
-//----------------------------------------------------------------------------
-//	Video API
-//----------------------------------------------------------------------------
-
-//----------------------------------------------------------------------------
+	return 1;
+    }
+    return 0;
+}
 
 ///
-///	Table of all video modules.
+///	Unlock video thread, if locked by VideoDecodeLock.
 ///
-static const VideoModule *VideoModules[] = {
-#ifdef USE_VDPAU
-    &VdpauModule,
-#endif
-#ifdef USE_VAAPI
-    &VaapiModule,
-#endif
-#ifdef USE_CUVID
-    &CuvidModule,
-#endif
+///	@param locked	result of VideoDecodeLock
+///
+static void VideoDecodeUnlock(int locked)
+{
+    if (locked) {
 #ifdef USE_GLX
-#ifdef USE_VAAPI
-    &VaapiGlxModule,			// FIXME: if working, prefer this
-#endif
+	// render could have made the thread context current
+	if (GlxEnabled) {
+	    glXMakeCurrent(XlibDisplay, None, NULL);
+	}
 #endif
-    &NoopModule
-};
+	VideoThreadUnlock();
+    }
+}
 
 ///
-///	Video hardware decoder
+///	Wakeup stream decode threads.
 ///
-struct _video_hw_decoder_
+///	Called for new packets and for free space in the surface queue.
+///
+static void VideoDecodeWakeup(void)
 {
-    union
-    {
-#ifdef USE_VAAPI
-	VaapiDecoder Vaapi;		///< VA-API decoder structure
+    pthread_mutex_lock(&VideoDecodeMutex);
+    VideoDecodeWakeups++;
+    pthread_cond_broadcast(&VideoDecodeCond);
+    pthread_mutex_unlock(&VideoDecodeMutex);
+}
+
+///
+///	Cleanup video stream decode thread.
+///
+///	@param dummy	unused
+///
+static void VideoDecodeCleanup( __attribute__ ((unused)) void *dummy)
+{
+#ifdef USE_GLX
+    if (GlxDecodeContext) {
+	VideoThreadLock();
+	glXDestroyContext(XlibDisplay, GlxDecodeContext);
+	VideoThreadUnlock();
+	GlxDecodeContext = NULL;
+    }
+#endif
+}
+
+///
+///	Video stream decode thread.
+///
+static void *VideoDecodeHandlerThread(void *arg)
+{
+    VideoDecodeThread *thread;
+    uint32_t wakeups;
+
+    thread = arg;
+    VideoInDecodeThread = 1;
+    Debug(3, "video: decode thread started\n");
+
+#ifdef USE_GLX
+    if (GlxEnabled) {
+	// the thread context is current in the video thread
+	VideoThreadLock();
+	GlxDecodeContext =
+	    glXCreateContext(XlibDisplay, GlxVisualInfo, GlxSharedContext,
+	    GL_TRUE);
+	VideoThreadUnlock();
+	if (!GlxDecodeContext) {
+	    Error(_("video/glx: can't create glx context\n"));
+	}
+    }
+#endif
+    pthread_cleanup_push(VideoDecodeCleanup, NULL);
+
+    pthread_mutex_lock(&VideoDecodeMutex);
+    wakeups = VideoDecodeWakeups;
+    pthread_mutex_unlock(&VideoDecodeMutex);
+    for (;;) {
+	VideoHwDecoder *hw_decoder;
+	struct timespec abstime;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	pthread_testcancel();
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	hw_decoder = thread->HwDecoder;
+	if (hw_decoder
+	    && VideoUsedModule->GetSurfacesFilled(hw_decoder) <
+	    VideoDecodeQueueDepth) {
+	    if (!VideoDecodeTimed(thread->Stream)) {
+		continue;
+	    }
+	} else {
+	    // surface queue full, only execute stream commands
+	    VideoPollInput(thread->Stream);
+	}
+
+	//
+	//	nothing to decode, wait for new packets or free surfaces
+	//
+	clock_gettime(CLOCK_REALTIME, &abstime);
+	abstime.tv_nsec += 10 * 1000 * 1000;
+	if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+	    abstime.tv_sec++;
+	    abstime.tv_nsec -= 1000 * 1000 * 1000;
+	}
+	pthread_mutex_lock(&VideoDecodeMutex);
+	if (wakeups == VideoDecodeWakeups) {
+	    pthread_cond_timedwait(&VideoDecodeCond, &VideoDecodeMutex,
+		&abstime);
+	}
+	wakeups = VideoDecodeWakeups;
+	pthread_mutex_unlock(&VideoDecodeMutex);
+    }
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+///
+///	Start decode threads of all video streams with hw decoder.
+///
+///	Nothing is started without video thread or with queue depth 0.
+///
+static void VideoDecodeThreadsStart(void)
+{
+    int i;
+
+    if (!VideoThread || !VideoDecodeQueueDepth) {
+	return;
+    }
+    for (i = 0; i < VIDEO_DECODE_THREADS; ++i) {
+	VideoDecodeThread *thread;
+
+	thread = &VideoDecodeThreads[i];
+	if (thread->Stream && thread->HwDecoder && !thread->Thread) {
+	    pthread_t tid;
+
+	    memset(&thread->Timing, 0, sizeof(thread->Timing));
+	    if (pthread_create(&tid, NULL, VideoDecodeHandlerThread, thread)) {
+		Error(_("video: can't create decode thread\n"));
+		continue;
+	    }
+	    pthread_setname_np(tid, "softhddev decode");
+	    // video thread checks the slot with lock held
+	    VideoThreadLock();
+	    thread->Thread = tid;
+	    VideoThreadUnlock();
+	    Debug(3, "video: decode thread %d created\n", i);
+	}
+    }
+}
+
+///
+///	Stop all decode threads, streams are decoded inline again.
+///
+static void VideoDecodeThreadsStop(void)
+{
+    int i;
+
+    for (i = 0; i < VIDEO_DECODE_THREADS; ++i) {
+	VideoDecodeThread *thread;
+	void *retval;
+
+	thread = &VideoDecodeThreads[i];
+	if (!thread->Thread) {
+	    continue;
+	}
+	Debug(3, "video: decode thread %d canceled\n", i);
+	if (pthread_cancel(thread->Thread)) {
+	    Error(_("video: can't queue cancel video decode thread\n"));
+	}
+	if (pthread_join(thread->Thread, &retval)
+	    || retval != PTHREAD_CANCELED) {
+	    Error(_("video: can't cancel video decode thread\n"));
+	}
+	VideoThreadLock();
+	thread->Thread = 0;
+	VideoThreadUnlock();
+    }
+}
+
+///
+///	Register hw decoder of video stream for decoding.
+///
+///	@param stream		video stream
+///	@param hw_decoder	new hw decoder of stream
+///
+static void VideoDecodeThreadAttach(VideoStream * stream,
+    VideoHwDecoder * hw_decoder)
+{
+    VideoDecodeThread *thread;
+
+    if (!stream) {
+	return;
+    }
+    if (!(thread = VideoDecodeThreadOf(stream))) {
+	// get free slot
+	if (!(thread = VideoDecodeThreadOf(NULL))) {
+	    Error(_("video: too many video streams\n"));
+	    return;
+	}
+	thread->Stream = stream;
+    }
+    thread->HwDecoder = hw_decoder;
+    memset(&thread->Timing, 0, sizeof(thread->Timing));
+    memset(&VideoDisplayTiming, 0, sizeof(VideoDisplayTiming));
+
+    VideoDecodeThreadsStart();
+}
+
+///
+///	Unregister hw decoder, the decode thread of the stream idles.
+///
+///	@param hw_decoder	deleted hw decoder
+///
+static void VideoDecodeThreadDetach(const VideoHwDecoder * hw_decoder)
+{
+    int i;
+
+    for (i = 0; i < VIDEO_DECODE_THREADS; ++i) {
+	if (VideoDecodeThreads[i].HwDecoder == hw_decoder) {
+	    VideoDecodeThreads[i].HwDecoder = NULL;
+	}
+    }
+}
+
+///
+///	Video render thread.
+///
+static void *VideoDisplayHandlerThread(void *dummy)
+{
+    Debug(3, "video: display thread started\n");
+
+#ifdef USE_GLX
+    if (GlxEnabled) {
+	Debug(3, "video/glx: thread context %p <-> %p\n",
+	    glXGetCurrentContext(), GlxThreadContext);
+	Debug(3, "video/glx: context %p <-> %p\n", glXGetCurrentContext(),
+	    GlxContext);
+
+	GlxThreadContext =
+	    glXCreateContext(XlibDisplay, GlxVisualInfo, GlxSharedContext,
+	    GL_TRUE);
+	if (!GlxThreadContext) {
+	    Error(_("video/glx: can't create glx context\n"));
+	    return NULL;
+	}
+	// set glx context
+	GlxSetupWindow(VideoWindow, VideoWindowWidth, VideoWindowHeight,
+	    GlxThreadContext);
+    }
+#endif
+
+    for (;;) {
+	// fix dead-lock with VdpauExit
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	pthread_testcancel();
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	VideoPollEvent();
+	if (OsdStagingPending) {
+	    pthread_mutex_lock(&VideoLockMutex);
+	    VideoOsdStagingCommit();
+	    pthread_mutex_unlock(&VideoLockMutex);
+	}
+	VideoUsedModule->DisplayHandlerThread();
+    }
+    return dummy;
+}
+
+///
+///	Initialize video threads.
+///
+static void VideoThreadInit(void)
+{
+#ifdef USE_GLX
+    glXMakeCurrent(XlibDisplay, None, NULL);
+#endif
+    pthread_mutex_init(&VideoMutex, NULL);
+    pthread_mutex_init(&VideoLockMutex, NULL);
+    pthread_cond_init(&VideoWakeupCond, NULL);
+    pthread_mutex_init(&VideoDecodeMutex, NULL);
+    pthread_cond_init(&VideoDecodeCond, NULL);
+    pthread_create(&VideoThread, NULL, VideoDisplayHandlerThread, NULL);
+    pthread_setname_np(VideoThread, "softhddev video");
+
+    VideoDecodeThreadsStart();
+}
+
+///
+///	Exit and cleanup video threads.
+///
+static void VideoThreadExit(void)
+{
+    if (VideoThread) {
+	void *retval;
+
+	VideoDecodeThreadsStop();
+
+	Debug(3, "video: video thread canceled\n");
+	//VideoThreadLock();
+	// FIXME: can't cancel locked
+	if (pthread_cancel(VideoThread)) {
+	    Error(_("video: can't queue cancel video display thread\n"));
+	}
+	//VideoThreadUnlock();
+	if (pthread_join(VideoThread, &retval) || retval != PTHREAD_CANCELED) {
+	    Error(_("video: can't cancel video display thread\n"));
+	}
+	VideoThread = 0;
+	pthread_cond_destroy(&VideoWakeupCond);
+	pthread_mutex_destroy(&VideoLockMutex);
+	pthread_mutex_destroy(&VideoMutex);
+	pthread_cond_destroy(&VideoDecodeCond);
+	pthread_mutex_destroy(&VideoDecodeMutex);
+    }
+}
+
+///
+///	Video display wakeup.
+///
+///	New video arrived, wakeup video thread.
+///
+void VideoDisplayWakeup(void)
+{
+    if (!XlibDisplay) {			// not yet started
+	return;
+    }
+
+    if (!VideoThread) {			// start video thread, if needed
+	VideoThreadInit();
+    }
+    VideoDecodeWakeup();
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//	Video API
+//----------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------
+
+///
+///	Table of all video modules.
+///
+static const VideoModule *VideoModules[] = {
+#ifdef USE_VDPAU
+    &VdpauModule,
+#endif
+#ifdef USE_VAAPI
+    &VaapiModule,
+#endif
+#ifdef USE_CUVID
+    &CuvidModule,
+#endif
+#ifdef USE_GLX
+#ifdef USE_VAAPI
+    &VaapiGlxModule,			// FIXME: if working, prefer this
+#endif
+#endif
+    &NoopModule
+};
+
+///
+///	Video hardware decoder
+///
+struct _video_hw_decoder_
+{
+    union
+    {
+#ifdef USE_VAAPI
+	VaapiDecoder Vaapi;		///< VA-API decoder structure
 #endif
 #ifdef USE_VDPAU
 	VdpauDecoder Vdpau;		///< vdpau decoder structure
@@ -14154,6 +15277,9 @@ VideoHwDecoder *VideoNewHwDecoder(VideoStream * stream)
     VideoThreadLock();
     hw = VideoUsedModule->NewHwDecoder(stream);
     VideoThreadUnlock();
+    if (hw) {
+	VideoDecodeThreadAttach(stream, hw);
+    }
 
     return hw;
 }
@@ -14166,15 +15292,19 @@ VideoHwDecoder *VideoNewHwDecoder(VideoStream * stream)
 void VideoDelHwDecoder(VideoHwDecoder * hw_decoder)
 {
     if (hw_decoder) {
+	int locked;
+
 #ifdef DEBUG
-	if (!pthread_equal(pthread_self(), VideoThread)) {
+	if (!pthread_equal(pthread_self(), VideoThread)
+	    && !VideoInDecodeThread) {
 	    Debug(3, "video: should only be called from inside the thread\n");
 	}
 #endif
-	// only called from inside the thread
-	//VideoThreadLock();
+	// only called from inside the video or decode thread
+	locked = VideoDecodeLock();
+	VideoDecodeThreadDetach(hw_decoder);
 	VideoUsedModule->DelHwDecoder(hw_decoder);
-	//VideoThreadUnlock();
+	VideoDecodeUnlock(locked);
     }
 }
 
@@ -14189,7 +15319,14 @@ void VideoDelHwDecoder(VideoHwDecoder * hw_decoder)
 unsigned VideoGetSurface(VideoHwDecoder * hw_decoder,
     const AVCodecContext * video_ctx)
 {
-    return VideoUsedModule->GetSurface(hw_decoder, video_ctx);
+    unsigned surface;
+    int locked;
+
+    locked = VideoDecodeLock();
+    surface = VideoUsedModule->GetSurface(hw_decoder, video_ctx);
+    VideoDecodeUnlock(locked);
+
+    return surface;
 }
 
 ///
@@ -14200,8 +15337,12 @@ unsigned VideoGetSurface(VideoHwDecoder * hw_decoder,
 ///
 void VideoReleaseSurface(VideoHwDecoder * hw_decoder, unsigned surface)
 {
+    int locked;
+
     // FIXME: must be guarded against calls, after VideoExit
+    locked = VideoDecodeLock();
     VideoUsedModule->ReleaseSurface(hw_decoder, surface);
+    VideoDecodeUnlock(locked);
 }
 
 ///
@@ -14217,6 +15358,9 @@ void VideoReleaseSurface(VideoHwDecoder * hw_decoder, unsigned surface)
 enum AVPixelFormat Video_get_format(VideoHwDecoder * hw_decoder,
     AVCodecContext * video_ctx, const enum AVPixelFormat *fmt)
 {
+    enum AVPixelFormat pix_fmt;
+    int locked;
+
 #ifdef DEBUG
     int ms_delay;
 
@@ -14229,7 +15373,11 @@ enum AVPixelFormat Video_get_format(VideoHwDecoder * hw_decoder,
 	GetMsTicks() - VideoSwitch);
 #endif
 
-    return VideoUsedModule->get_format(hw_decoder, video_ctx, fmt);
+    locked = VideoDecodeLock();
+    pix_fmt = VideoUsedModule->get_format(hw_decoder, video_ctx, fmt);
+    VideoDecodeUnlock(locked);
+
+    return pix_fmt;
 }
 
 ///
@@ -14242,6 +15390,8 @@ enum AVPixelFormat Video_get_format(VideoHwDecoder * hw_decoder,
 void VideoRenderFrame(VideoHwDecoder * hw_decoder,
     const AVCodecContext * video_ctx, const AVFrame * frame)
 {
+    int locked;
+
 #if 0
     fprintf(stderr, "video: render frame pts %s closing %d\n",
 	Timestamp2String(frame->pkt_pts), hw_decoder->Vdpau.Closing);
@@ -14250,7 +15400,9 @@ void VideoRenderFrame(VideoHwDecoder * hw_decoder,
 	Warning(_("video: repeated pict %d found, but not handled\n"),
 	    frame->repeat_pict);
     }
+    locked = VideoDecodeLock();
     VideoUsedModule->RenderFrame(hw_decoder, video_ctx, frame);
+    VideoDecodeUnlock(locked);
 }
 
 ///
@@ -14394,149 +15546,858 @@ void VideoSetTrickSpeed(VideoHwDecoder * hw_decoder, int speed)
     VideoUsedModule->SetTrickSpeed(hw_decoder, speed);
 }
 
+#ifdef USE_GRAB
+
+//----------------------------------------------------------------------------
+//	Grab conversion
+//----------------------------------------------------------------------------
+
+    /// serializes the grab scratch and the cached swscale context
+static pthread_mutex_t VideoGrabMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef USE_SWSCALE
+static struct SwsContext *VideoGrabSwsContext;	///< cached grab scaler
+#else
+static uint32_t *VideoGrabAccu;		///< area scaler row accumulator
+static int *VideoGrabSpan;		///< area scaler column spans
+static int VideoGrabScratchWidth;	///< allocated scratch width
+#endif
+
+/**
+**	Convert BGRA to RGB.
+**
+**	@param dst	RGB output, 3 * n bytes
+**	@param src	BGRA input, 4 * n bytes
+**	@param n	number of pixels
+*/
+static void VideoBgraToRgbC(uint8_t * dst, const uint8_t * src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i) {
+	dst[i * 3 + 0] = src[i * 4 + 2];
+	dst[i * 3 + 1] = src[i * 4 + 1];
+	dst[i * 3 + 2] = src[i * 4 + 0];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+/**
+**	Convert BGRA to RGB, SSSE3 version.
+**
+**	Each pshufb packs 4 pixels into the low 12 bytes, the shifts stitch
+**	16 pixels into three full 16 byte stores.
+**
+**	@param dst	RGB output, 3 * n bytes
+**	@param src	BGRA input, 4 * n bytes
+**	@param n	number of pixels
+*/
+__attribute__ ((target("ssse3")))
+static void VideoBgraToRgbSsse3(uint8_t * dst, const uint8_t * src, int n)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+	12, -1, -1, -1, -1);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+	__m128i a;
+	__m128i b;
+	__m128i c;
+	__m128i d;
+
+	a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4)),
+	    shuffle);
+	b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 +
+		    16)), shuffle);
+	c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 +
+		    32)), shuffle);
+	d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 4 +
+		    48)), shuffle);
+	_mm_storeu_si128((__m128i *) (dst + i * 3),
+	    _mm_or_si128(a, _mm_slli_si128(b, 12)));
+	_mm_storeu_si128((__m128i *) (dst + i * 3 + 16),
+	    _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+	_mm_storeu_si128((__m128i *) (dst + i * 3 + 32),
+	    _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    VideoBgraToRgbC(dst + i * 3, src + i * 4, n - i);
+}
+
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+/**
+**	Convert BGRA to RGB, NEON version.
+**
+**	@param dst	RGB output, 3 * n bytes
+**	@param src	BGRA input, 4 * n bytes
+**	@param n	number of pixels
+*/
+static void VideoBgraToRgbNeon(uint8_t * dst, const uint8_t * src, int n)
+{
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+	uint8x16x4_t bgra;
+	uint8x16x3_t rgb;
+
+	bgra = vld4q_u8(src + i * 4);
+	rgb.val[0] = bgra.val[2];
+	rgb.val[1] = bgra.val[1];
+	rgb.val[2] = bgra.val[0];
+	vst3q_u8(dst + i * 3, rgb);
+    }
+    VideoBgraToRgbC(dst + i * 3, src + i * 4, n - i);
+}
+
+#endif
+
+/**
+**	Convert BGRA to RGB, using the best kernel of the cpu.
+**
+**	@param dst	RGB output, 3 * n bytes
+**	@param src	BGRA input, 4 * n bytes
+**	@param n	number of pixels
+*/
+static void VideoBgraToRgb(uint8_t * dst, const uint8_t * src, int n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static int ssse3 = -1;
+
+    if (ssse3 < 0) {
+	__builtin_cpu_init();
+	ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    }
+    if (ssse3) {
+	VideoBgraToRgbSsse3(dst, src, n);
+	return;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    VideoBgraToRgbNeon(dst, src, n);
+    return;
+#endif
+    VideoBgraToRgbC(dst, src, n);
+}
+
+#ifndef USE_SWSCALE
+
+/**
+**	Scale BGRA image with an area (box) filter.
+**
+**	Separable: every source row is reduced horizontally into the
+**	accumulator row of its output line, the line is divided by the box
+**	size, when its last source row is done.  When upscaling the box
+**	degenerates to a single pixel (nearest neighbour).
+**
+**	@note Must be called with VideoGrabMutex locked.
+**
+**	@param dst	output image
+**	@param dst_width	output width
+**	@param dst_height	output height
+**	@param bpp	output bytes per pixel (3 = RGB, 4 = BGRA)
+**	@param src	BGRA input image
+**	@param src_width	input width
+**	@param src_height	input height
+**
+**	@returns 0 on success, -1 out of memory.
+*/
+static int VideoGrabScale(uint8_t * dst, int dst_width, int dst_height,
+    int bpp, const uint8_t * src, int src_width, int src_height)
+{
+    int x;
+    int y;
+
+    if (dst_width > VideoGrabScratchWidth) {
+	free(VideoGrabAccu);
+	free(VideoGrabSpan);
+	VideoGrabAccu = malloc(dst_width * 4 * sizeof(*VideoGrabAccu));
+	VideoGrabSpan = malloc((dst_width + 1) * sizeof(*VideoGrabSpan));
+	if (!VideoGrabAccu || !VideoGrabSpan) {
+	    free(VideoGrabAccu);
+	    free(VideoGrabSpan);
+	    VideoGrabAccu = NULL;
+	    VideoGrabSpan = NULL;
+	    VideoGrabScratchWidth = 0;
+	    return -1;
+	}
+	VideoGrabScratchWidth = dst_width;
+    }
+    for (x = 0; x <= dst_width; ++x) {
+	VideoGrabSpan[x] = (int64_t)x * src_width / dst_width;
+    }
+
+    for (y = 0; y < dst_height; ++y) {
+	const uint8_t *row;
+	uint8_t *out;
+	int y0;
+	int y1;
+	int sy;
+
+	y0 = (int64_t)y * src_height / dst_height;
+	y1 = (int64_t)(y + 1) * src_height / dst_height;
+	if (y1 <= y0) {
+	    y1 = y0 + 1;
+	}
+	memset(VideoGrabAccu, 0, dst_width * 4 * sizeof(*VideoGrabAccu));
+
+	for (sy = y0; sy < y1; ++sy) {
+	    row = src + sy * src_width * 4;
+	    for (x = 0; x < dst_width; ++x) {
+		uint32_t *accu;
+		int x0;
+		int x1;
+		int sx;
+
+		accu = VideoGrabAccu + x * 4;
+		x0 = VideoGrabSpan[x];
+		x1 = VideoGrabSpan[x + 1];
+		if (x1 <= x0) {
+		    x1 = x0 + 1;
+		}
+		for (sx = x0; sx < x1; ++sx) {
+		    accu[0] += row[sx * 4 + 0];
+		    accu[1] += row[sx * 4 + 1];
+		    accu[2] += row[sx * 4 + 2];
+		    accu[3] += row[sx * 4 + 3];
+		}
+	    }
+	}
+
+	out = dst + y * dst_width * bpp;
+	for (x = 0; x < dst_width; ++x) {
+	    const uint32_t *accu;
+	    uint32_t n;
+
+	    accu = VideoGrabAccu + x * 4;
+	    n = VideoGrabSpan[x + 1] - VideoGrabSpan[x];
+	    n = (n ? n : 1) * (y1 - y0);
+	    if (bpp == 3) {		// BGRA -> RGB
+		out[x * 3 + 0] = (accu[2] + n / 2) / n;
+		out[x * 3 + 1] = (accu[1] + n / 2) / n;
+		out[x * 3 + 2] = (accu[0] + n / 2) / n;
+	    } else {
+		out[x * 4 + 0] = (accu[0] + n / 2) / n;
+		out[x * 4 + 1] = (accu[1] + n / 2) / n;
+		out[x * 4 + 2] = (accu[2] + n / 2) / n;
+		out[x * 4 + 3] = (accu[3] + n / 2) / n;
+	    }
+	}
+    }
+    return 0;
+}
+
+#else
+
+/**
+**	Scale BGRA image with libswscale.
+**
+**	@note Must be called with VideoGrabMutex locked.
+**
+**	@param dst	output image
+**	@param dst_width	output width
+**	@param dst_height	output height
+**	@param bpp	output bytes per pixel (3 = RGB, 4 = BGRA)
+**	@param src	BGRA input image
+**	@param src_width	input width
+**	@param src_height	input height
+**
+**	@returns 0 on success, -1 no scaler.
+*/
+static int VideoGrabScale(uint8_t * dst, int dst_width, int dst_height,
+    int bpp, const uint8_t * src, int src_width, int src_height)
+{
+    const uint8_t *src_slice[4] = { src, NULL, NULL, NULL };
+    uint8_t *dst_slice[4] = { dst, NULL, NULL, NULL };
+    int src_stride[4] = { src_width * 4, 0, 0, 0 };
+    int dst_stride[4] = { dst_width * bpp, 0, 0, 0 };
+
+    VideoGrabSwsContext =
+	sws_getCachedContext(VideoGrabSwsContext, src_width, src_height,
+	AV_PIX_FMT_BGRA, dst_width, dst_height,
+	bpp == 3 ? AV_PIX_FMT_RGB24 : AV_PIX_FMT_BGRA, SWS_AREA, NULL, NULL,
+	NULL);
+    if (!VideoGrabSwsContext) {
+	return -1;
+    }
+    sws_scale(VideoGrabSwsContext, src_slice, src_stride, 0, src_height,
+	dst_slice, dst_stride);
+    return 0;
+}
+
+#endif
+
+/**
+**	Convert grabbed BGRA image to output format and size.
+**
+**	@note Must be called with VideoGrabMutex locked.
+**
+**	@param dst	output image
+**	@param dst_width	output width
+**	@param dst_height	output height
+**	@param bpp	output bytes per pixel (3 = RGB, 4 = BGRA)
+**	@param src	BGRA input image
+**	@param src_width	input width
+**	@param src_height	input height
+**
+**	@returns 0 on success, -1 on failure.
+*/
+static int VideoGrabConvert(uint8_t * dst, int dst_width, int dst_height,
+    int bpp, const uint8_t * src, int src_width, int src_height)
+{
+    // hardware didn't scale for us, use software scaler
+    if (dst_width != src_width || dst_height != src_height) {
+	if (VideoGrabScale(dst, dst_width, dst_height, bpp, src, src_width,
+		src_height)) {
+	    Error(_("video: can't scale grabbed image\n"));
+	    return -1;
+	}
+    } else if (bpp == 3) {
+	VideoBgraToRgb(dst, src, src_width * src_height);
+    } else {
+	memcpy(dst, src, src_width * src_height * 4);
+    }
+    return 0;
+}
+
+#endif
+
 ///
-///	Grab full screen image.
-///
-///	@param size[out]	size of allocated image
-///	@param width[in,out]	width of image
-///	@param height[in,out]	height of image
+///	Grab full screen image into a reusable buffer.
 ///
-uint8_t *VideoGrab(int *size, int *width, int *height, int write_header)
+///	The buffer is grown with realloc, when the image doesn't fit.  Pass
+///	the same buffer again for the next grab, to avoid an allocation per
+///	grab.  The caller frees it with free().
+///
+///	@param buf[in,out]	image buffer or NULL
+///	@param buf_size[in,out]	allocated size of image buffer
+///	@param size[out]	size of image data in buffer
+///	@param width[in,out]	width of image (<= 0 video size)
+///	@param height[in,out]	height of image (<= 0 video size)
+///	@param format		output format
+///
+///	@returns 0 on success, -1 on failure.
+///
+int VideoGrabBuffer(uint8_t ** buf, int *buf_size, int *size, int *width,
+    int *height, enum VideoGrabFormat format)
 {
-    Debug(3, "video: grab\n");
+    Debug(3, "video: grab buffer\n");
 
 #ifdef USE_GRAB
     if (VideoUsedModule->GrabOutput) {
 	uint8_t *data;
-	uint8_t *rgb;
-	char buf[64];
-	int i;
-	int n;
+	uint8_t *out;
+	char header[64];
+	int data_size;
 	int scale_width;
 	int scale_height;
-	int x;
-	int y;
-	double src_x;
-	double src_y;
-	double scale_x;
-	double scale_y;
+	int bpp;
+	int n;
+	int need;
+	int err;
 
 	scale_width = *width;
 	scale_height = *height;
-	n = 0;
-	data = VideoUsedModule->GrabOutput(size, width, height);
-	if (data == NULL)
-	    return NULL;
-
+	data = VideoUsedModule->GrabOutput(&data_size, width, height);
+	if (data == NULL) {
+	    return -1;
+	}
+	// negative width is the atmo marker, hardware has scaled
 	if (scale_width <= 0) {
 	    scale_width = *width;
 	}
 	if (scale_height <= 0) {
 	    scale_height = *height;
 	}
-	// hardware didn't scale for us, use simple software scaler
-	if (scale_width != *width && scale_height != *height) {
-	    if (write_header) {
-		n = snprintf(buf, sizeof(buf), "P6\n%d\n%d\n255\n",
-		    scale_width, scale_height);
-	    }
-	    rgb = malloc(scale_width * scale_height * 3 + n);
-	    if (!rgb) {
+
+	bpp = format == VideoGrabBgra ? 4 : 3;
+	n = 0;
+	if (format == VideoGrabPpm) {
+	    n = snprintf(header, sizeof(header), "P6\n%d\n%d\n255\n",
+		scale_width, scale_height);
+	}
+	need = scale_width * scale_height * bpp + n;
+	if (need > *buf_size || !*buf) {
+	    out = realloc(*buf, need);
+	    if (!out) {
 		Error(_("video: out of memory\n"));
 		free(data);
-		return NULL;
+		return -1;
 	    }
-	    *size = scale_width * scale_height * 3 + n;
-	    memcpy(rgb, buf, n);	// header
+	    *buf = out;
+	    *buf_size = need;
+	}
+	out = *buf;
+	memcpy(out, header, n);
+	out += n;
 
-	    scale_x = (double)*width / scale_width;
-	    scale_y = (double)*height / scale_height;
+	pthread_mutex_lock(&VideoGrabMutex);
+	err =
+	    VideoGrabConvert(out, scale_width, scale_height, bpp, data,
+	    *width, *height);
+	pthread_mutex_unlock(&VideoGrabMutex);
+	free(data);
+	if (err) {
+	    return -1;
+	}
 
-	    src_y = 0.0;
-	    for (y = 0; y < scale_height; y++) {
-		int o;
+	*width = scale_width;
+	*height = scale_height;
+	*size = need;
+	return 0;
+    } else
+#endif
+    {
+	Warning(_("softhddev: grab unsupported\n"));
+    }
 
-		src_x = 0.0;
-		o = (int)src_y **width;
+    (void)buf;
+    (void)buf_size;
+    (void)size;
+    (void)width;
+    (void)height;
+    (void)format;
+    return -1;
+}
 
-		for (x = 0; x < scale_width; x++) {
-		    i = 4 * (o + (int)src_x);
+///
+///	Grab full screen image.
+///
+///	@param size[out]	size of allocated image
+///	@param width[in,out]	width of image
+///	@param height[in,out]	height of image
+///	@param write_header	flag write PPM header
+///
+uint8_t *VideoGrab(int *size, int *width, int *height, int write_header)
+{
+    uint8_t *rgb;
+    int rgb_size;
 
-		    rgb[n + (x + y * scale_width) * 3 + 0] = data[i + 2];
-		    rgb[n + (x + y * scale_width) * 3 + 1] = data[i + 1];
-		    rgb[n + (x + y * scale_width) * 3 + 2] = data[i + 0];
+    Debug(3, "video: grab\n");
 
-		    src_x += scale_x;
-		}
+    rgb = NULL;
+    rgb_size = 0;
+    if (VideoGrabBuffer(&rgb, &rgb_size, size, width, height,
+	    write_header ? VideoGrabPpm : VideoGrabRgb)) {
+	free(rgb);
+	return NULL;
+    }
+    return rgb;
+}
 
-		src_y += scale_y;
-	    }
+///
+///	Grab image service.
+///
+///	@param size[out]	size of allocated image
+///	@param width[in,out]	width of image
+///	@param height[in,out]	height of image
+///
+uint8_t *VideoGrabService(int *size, int *width, int *height)
+{
+    Debug(3, "video: grab service\n");
+
+#ifdef USE_GRAB
+    if (VideoUsedModule->GrabOutput) {
+	return VideoUsedModule->GrabOutput(size, width, height);
+    } else
+#endif
+    {
+	Warning(_("softhddev: grab unsupported\n"));
+    }
+
+    (void)size;
+    (void)width;
+    (void)height;
+    return NULL;
+}
+
+#ifdef USE_GRAB
+
+//----------------------------------------------------------------------------
+//	Grab stream
+//----------------------------------------------------------------------------
+
+static pthread_t VideoGrabStreamThread;	///< grab stream writer thread
+static volatile char VideoGrabStreamRunning;	///< writer should run
+static SoftHDDevice_GrabStreamRing_t *VideoGrabStreamRing;	///< mapped ring
+static size_t VideoGrabStreamSize;	///< size of mapped ring
+static int VideoGrabStreamRefs;		///< references of the consumers
+static uint32_t VideoGrabStreamFrames;	///< frames written
+static uint32_t VideoGrabStreamMissed;	///< grabs failed
+static VideoTiming VideoGrabStreamTiming;	///< grab time per frame
+
+    /// serializes start, release, stop and status of the grab stream
+static pthread_mutex_t VideoGrabStreamMutex = PTHREAD_MUTEX_INITIALIZER;
+
+///
+///	Get size of grab stream ring.
+///
+///	@param width	frame width
+///	@param height	frame height
+///	@param slots	number of ring slots
+///	@param bpp	bytes per pixel
+///	@param[out] slot_size	bytes per slot, incl. frame header
+///
+static size_t VideoGrabStreamRingSize(int width, int height, int slots,
+    int bpp, size_t * slot_size)
+{
+    *slot_size = (GRAB_STREAM_FRAME_DATA + width * height * bpp + 63) & ~63;
+    return GRAB_STREAM_FRAME_DATA + slots * *slot_size;
+}
+
+///
+///	Setup grab stream ring header.
+///
+///	The first frame gets sequence 1, 0 is reserved for no frame and
+///	slot being written.
+///
+static void VideoGrabStreamRingInit(SoftHDDevice_GrabStreamRing_t * ring,
+    int width, int height, int rate, int slots, enum VideoGrabFormat format,
+    size_t slot_size)
+{
+    ring->magic = GRAB_STREAM_MAGIC;
+    ring->version = GRAB_STREAM_VERSION;
+    ring->slots = slots;
+    ring->slotSize = slot_size;
+    ring->slotOffset = GRAB_STREAM_FRAME_DATA;
+    ring->width = width;
+    ring->height = height;
+    ring->imgType =
+	format ==
+	VideoGrabBgra ? GRAB_IMG_RGBA_FORMAT_B8G8R8A8 :
+	GRAB_IMG_RGB_FORMAT_R8G8B8;
+    ring->rate = rate;
+    ring->sequence = 0;
+}
+
+///
+///	Write grabbed image into the next grab stream slot.
+///
+///	@param ring	grab stream ring
+///	@param bpp	bytes per pixel of ring format
+///	@param data	grabbed BGRA image
+///	@param width	width of grabbed image
+///	@param height	height of grabbed image
+///
+///	@returns 0 frame published, -1 failure (slot left invalid).
+///
+static int VideoGrabStreamWrite(SoftHDDevice_GrabStreamRing_t * ring,
+    int bpp, const uint8_t * data, int width, int height)
+{
+    SoftHDDevice_GrabStreamFrame_t *frame;
+    struct timespec ts;
+    uint64_t n;
+
+    n = ring->sequence + 1;
+    frame = (SoftHDDevice_GrabStreamFrame_t *) ((uint8_t *) ring +
+	ring->slotOffset + (n % ring->slots) * ring->slotSize);
+
+    // invalidate slot, before the image is overwritten
+    __atomic_store_n(&frame->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (VideoGrabConvert((uint8_t *) frame + GRAB_STREAM_FRAME_DATA,
+	    ring->width, ring->height, bpp, data, width, height)) {
+	return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    frame->timestamp = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    frame->width = ring->width;
+    frame->height = ring->height;
+    frame->stride = ring->width * bpp;
+    frame->imgType = ring->imgType;
+    frame->size = ring->width * ring->height * bpp;
+    __atomic_store_n(&frame->sequence, n, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->sequence, n, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+///
+///	Grab stream writer thread.
+///
+///	Grabs, scales and converts one frame per period directly into the
+///	next ring slot.  After a failed grab (no video, suspended, ...) it
+///	backs off to one try per second.
+///
+static void *VideoGrabStreamHandlerThread(void *dummy)
+{
+    SoftHDDevice_GrabStreamRing_t *ring;
+    uint32_t period;
+    uint32_t next;
+    int bpp;
+
+    ring = VideoGrabStreamRing;
+    period = 1000000 / ring->rate;
+    bpp = ring->imgType == GRAB_IMG_RGB_FORMAT_R8G8B8 ? 3 : 4;
+    next = GetUsTicks();
+
+    while (VideoGrabStreamRunning) {
+	uint8_t *data;
+	uint32_t start;
+	int32_t delay;
+	int size;
+	int width;
+	int height;
+	int err;
+
+	start = GetUsTicks();
+	width = ring->width;
+	height = ring->height;
+	data = NULL;
+	err = -1;
+
+	pthread_mutex_lock(&VideoGrabMutex);
+	if (VideoUsedModule->GrabOutput) {
+	    data = VideoUsedModule->GrabOutput(&size, &width, &height);
+	}
+	if (data) {
+	    err = VideoGrabStreamWrite(ring, bpp, data, width, height);
+	    free(data);
+	}
+	pthread_mutex_unlock(&VideoGrabMutex);
+
+	if (err) {
+	    VideoGrabStreamMissed++;
+	    next += 1000000 - period;
+	} else {
+	    VideoGrabStreamFrames++;
+	    VideoTimingAdd(&VideoGrabStreamTiming, GetUsTicks() - start);
+	}
+
+	next += period;
+	delay = next - GetUsTicks();
+	if (delay <= 0) {		// fell behind, don't catch up
+	    next = GetUsTicks();
+	} else {
+	    usleep(delay);
+	}
+    }
+
+    (void)dummy;
+    return NULL;
+}
+
+///
+///	Close grab stream.
+///
+///	Stops the writer, marks the ring inactive for the consumers and
+///	unlinks it.  The mapping is only removed without references left,
+///	in process consumers may still read it.
+///
+///	@note VideoGrabStreamMutex locked by caller
+///
+static void VideoGrabStreamClose(void)
+{
+    if (!VideoGrabStreamRing) {
+	return;
+    }
+    Debug(3, "video: grab stream stop, %d references\n", VideoGrabStreamRefs);
+
+    VideoGrabStreamRunning = 0;
+    pthread_join(VideoGrabStreamThread, NULL);
+
+    __atomic_store_n(&VideoGrabStreamRing->active, 0, __ATOMIC_RELEASE);
+    if (!VideoGrabStreamRefs) {
+	munmap(VideoGrabStreamRing, VideoGrabStreamSize);
+    }
+    shm_unlink(GRAB_STREAM_SHM_NAME);
+    VideoGrabStreamRing = NULL;
+    VideoGrabStreamRefs = 0;
+}
+
+///
+///	Open grab stream or take a reference of the running one.
+///
+///	@note VideoGrabStreamMutex locked by caller
+///
+///	@see VideoGrabStreamStart
+///
+static void *VideoGrabStreamOpen(int width, int height, int rate, int slots,
+    enum VideoGrabFormat format)
+{
+    SoftHDDevice_GrabStreamRing_t *ring;
+    size_t slot_size;
+    size_t size;
+    int fd;
+
+    if (width < 16 || width > 4096 || height < 16 || height > 4096
+	|| rate < 1 || rate > 60 || slots < 2 || slots > 64
+	|| format == VideoGrabPpm) {
+	return NULL;
+    }
+    if ((ring = VideoGrabStreamRing)) {
+	// shared, only with the same parameters
+	if ((int)ring->width != width || (int)ring->height != height
+	    || (int)ring->rate != rate || (int)ring->slots != slots
+	    || ring->imgType != (uint32_t) (format == VideoGrabBgra ?
+		GRAB_IMG_RGBA_FORMAT_B8G8R8A8 : GRAB_IMG_RGB_FORMAT_R8G8B8)) {
+	    Info(_("video: grab stream already running %ux%u %u/s %u slots\n"),
+		ring->width, ring->height, ring->rate, ring->slots);
+	    return NULL;
+	}
+	++VideoGrabStreamRefs;
+	return ring;
+    }
+
+    Debug(3, "video: grab stream %dx%d %d/s %d slots\n", width, height, rate,
+	slots);
+
+    size =
+	VideoGrabStreamRingSize(width, height, slots,
+	format == VideoGrabBgra ? 4 : 3, &slot_size);
+
+    // a new object, consumers of an old one see it inactive
+    shm_unlink(GRAB_STREAM_SHM_NAME);
+    fd = shm_open(GRAB_STREAM_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+	Error(_("video: can't create grab stream %s: %s\n"),
+	    GRAB_STREAM_SHM_NAME, strerror(errno));
+	return NULL;
+    }
+    if (ftruncate(fd, size)) {
+	Error(_("video: can't size grab stream: %s\n"), strerror(errno));
+	close(fd);
+	shm_unlink(GRAB_STREAM_SHM_NAME);
+	return NULL;
+    }
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+	Error(_("video: can't map grab stream: %s\n"), strerror(errno));
+	shm_unlink(GRAB_STREAM_SHM_NAME);
+	return NULL;
+    }
+    VideoGrabStreamRingInit(ring, width, height, rate, slots, format,
+	slot_size);
+
+    VideoGrabStreamRing = ring;
+    VideoGrabStreamSize = size;
+    VideoGrabStreamFrames = 0;
+    VideoGrabStreamMissed = 0;
+    memset(&VideoGrabStreamTiming, 0, sizeof(VideoGrabStreamTiming));
+    VideoGrabStreamRunning = 1;
+    if (pthread_create(&VideoGrabStreamThread, NULL,
+	    VideoGrabStreamHandlerThread, NULL)) {
+	Error(_("video: can't create grab stream thread\n"));
+	munmap(ring, size);
+	shm_unlink(GRAB_STREAM_SHM_NAME);
+	VideoGrabStreamRing = NULL;
+	return NULL;
+    }
+    pthread_setname_np(VideoGrabStreamThread, "softhddev grab");
+    __atomic_store_n(&ring->active, 1, __ATOMIC_RELEASE);
+    VideoGrabStreamRefs = 1;
 
-	    *width = scale_width;
-	    *height = scale_height;
+    return ring;
+}
 
-	    // grabed image of correct size convert BGRA -> RGB
-	} else {
-	    if (write_header) {
-		n = snprintf(buf, sizeof(buf), "P6\n%d\n%d\n255\n", *width,
-		    *height);
-	    }
-	    rgb = malloc(*width * *height * 3 + n);
-	    if (!rgb) {
-		Error(_("video: out of memory\n"));
-		free(data);
-		return NULL;
-	    }
-	    memcpy(rgb, buf, n);	// header
+#endif
 
-	    for (i = 0; i < *size / 4; ++i) {	// convert bgra -> rgb
-		rgb[n + i * 3 + 0] = data[i * 4 + 2];
-		rgb[n + i * 3 + 1] = data[i * 4 + 1];
-		rgb[n + i * 3 + 2] = data[i * 4 + 0];
-	    }
+///
+///	Stop grab stream.
+///
+///	Stops the stream for all consumers, used on exit.  Mappings handed
+///	out by VideoGrabStreamStart() stay valid, but are no longer written.
+///
+void VideoGrabStreamStop(void)
+{
+#ifdef USE_GRAB
+    pthread_mutex_lock(&VideoGrabStreamMutex);
+    VideoGrabStreamClose();
+    pthread_mutex_unlock(&VideoGrabStreamMutex);
+#endif
+}
 
-	    *size = *width * *height * 3 + n;
-	}
-	free(data);
+///
+///	Start grab stream or take a reference of the running one.
+///
+///	Frames are grabbed once and written into a POSIX shared memory ring
+///	(#GRAB_STREAM_SHM_NAME), shared by all consumers.  A running stream
+///	is only shared with the same parameters, it is never restarted.
+///	Each successful start must be paired with one
+///	VideoGrabStreamRelease().
+///
+///	@param width	frame width
+///	@param height	frame height
+///	@param rate	frames per second
+///	@param slots	number of ring slots
+///	@param format	VideoGrabRgb or VideoGrabBgra
+///
+///	@returns mapping of the ring, valid until the reference is released,
+///	NULL on failure or running with other parameters.
+///
+void *VideoGrabStreamStart(int width, int height, int rate, int slots,
+    enum VideoGrabFormat format)
+{
+#ifdef USE_GRAB
+    void *ring;
 
-	return rgb;
-    } else
-#endif
-    {
-	Warning(_("softhddev: grab unsupported\n"));
-    }
+    pthread_mutex_lock(&VideoGrabStreamMutex);
+    ring = VideoGrabStreamOpen(width, height, rate, slots, format);
+    pthread_mutex_unlock(&VideoGrabStreamMutex);
 
-    (void)size;
+    return ring;
+#else
     (void)width;
     (void)height;
-    (void)write_header;
+    (void)rate;
+    (void)slots;
+    (void)format;
     return NULL;
+#endif
 }
 
 ///
-///	Grab image service.
+///	Release a grab stream reference.
 ///
-///	@param size[out]	size of allocated image
-///	@param width[in,out]	width of image
-///	@param height[in,out]	height of image
+///	The stream is stopped, unmapped and unlinked with the last reference.
 ///
-uint8_t *VideoGrabService(int *size, int *width, int *height)
+void VideoGrabStreamRelease(void)
 {
-    Debug(3, "video: grab service\n");
-
 #ifdef USE_GRAB
-    if (VideoUsedModule->GrabOutput) {
-	return VideoUsedModule->GrabOutput(size, width, height);
-    } else
-#endif
-    {
-	Warning(_("softhddev: grab unsupported\n"));
+    pthread_mutex_lock(&VideoGrabStreamMutex);
+    if (VideoGrabStreamRefs > 0 && !--VideoGrabStreamRefs) {
+	VideoGrabStreamClose();
     }
+    pthread_mutex_unlock(&VideoGrabStreamMutex);
+#endif
+}
 
-    (void)size;
-    (void)width;
-    (void)height;
-    return NULL;
+///
+///	Get grab stream status.
+///
+///	@param buf	output buffer
+///	@param size	size of output buffer
+///
+void VideoGrabStreamStatus(char *buf, size_t size)
+{
+#ifdef USE_GRAB
+    const SoftHDDevice_GrabStreamRing_t *ring;
+
+    pthread_mutex_lock(&VideoGrabStreamMutex);
+    ring = VideoGrabStreamRing;
+    if (ring) {
+	snprintf(buf, size,
+	    "%s %ux%u %s %u/s %u slots, %d consumers, %u frames, %u missed, "
+	    "grab %u us avg %u us max", GRAB_STREAM_SHM_NAME, ring->width,
+	    ring->height,
+	    ring->imgType == GRAB_IMG_RGB_FORMAT_R8G8B8 ? "RGB" : "BGRA",
+	    ring->rate, ring->slots, VideoGrabStreamRefs,
+	    VideoGrabStreamFrames, VideoGrabStreamMissed,
+	    VideoGrabStreamTiming.Count ? (uint32_t) (VideoGrabStreamTiming.Sum /
+		VideoGrabStreamTiming.Count) : 0, VideoGrabStreamTiming.Max);
+	pthread_mutex_unlock(&VideoGrabStreamMutex);
+	return;
+    }
+    pthread_mutex_unlock(&VideoGrabStreamMutex);
+#endif
+    snprintf(buf, size, "grab stream stopped");
 }
 
 ///
@@ -14554,6 +16415,36 @@ void VideoGetStats(VideoHwDecoder * hw_decoder, int *missed, int *duped,
     VideoUsedModule->GetStats(hw_decoder, missed, duped, dropped, counter);
 }
 
+///
+///	Get decode time per packet and display time per frame.
+///
+///	@param hw_decoder		video hardware decoder
+///	@param[out] decode_avg		average decode time in us
+///	@param[out] decode_max		maximal decode time in us
+///	@param[out] display_avg		average display time in us
+///	@param[out] display_max		maximal display time in us
+///
+void VideoGetTimingStats(VideoHwDecoder * hw_decoder, int *decode_avg,
+    int *decode_max, int *display_avg, int *display_max)
+{
+    int i;
+
+    *decode_avg = 0;
+    *decode_max = 0;
+    for (i = 0; i < VIDEO_DECODE_THREADS; ++i) {
+	const VideoTiming *timing;
+
+	timing = &VideoDecodeThreads[i].Timing;
+	if (VideoDecodeThreads[i].HwDecoder == hw_decoder && timing->Count) {
+	    *decode_avg = timing->Sum / timing->Count;
+	    *decode_max = timing->Max;
+	}
+    }
+    *display_avg = VideoDisplayTiming.Count
+	? VideoDisplayTiming.Sum / VideoDisplayTiming.Count : 0;
+    *display_max = VideoDisplayTiming.Max;
+}
+
 ///
 ///	Get decoder video stream size.
 ///
@@ -14956,6 +16847,28 @@ void VideoSetBlackPicture(int onoff)
     VideoShowBlackPicture = onoff;
 }
 
+///
+///	Set decode thread surface queue depth.
+///
+///	@param depth	decoded surfaces queued ahead of the display,
+///			0 decodes inside the display thread.
+///
+void VideoSetDecodeQueue(int depth)
+{
+    if (depth < 0) {
+	depth = 0;
+    }
+    if (depth > VIDEO_SURFACES_MAX - 1) {
+	depth = VIDEO_SURFACES_MAX - 1;
+    }
+    VideoDecodeQueueDepth = depth;
+    if (depth) {
+	VideoDecodeThreadsStart();
+    } else {
+	VideoDecodeThreadsStop();
+    }
+}
+
 #ifdef USE_VAAPI
 ///
 ///	Vaapi helper to set various video params (brightness, contrast etc.)
@@ -15664,14 +17577,43 @@ static const char *vaapi_deinterlace[] = {
     "Weave/None",         ///< VideoDeinterlaceWeave
     "MotionAdaptive",     ///< VideoDeinterlaceTemporal
     "MotionCompensated",  ///< VideoDeinterlaceTemporalSpatial
+    "Software Bob",       ///< VideoDeinterlaceSoftBob
+    "Software Spatial",   ///< VideoDeinterlaceSoftSpatial
+    "Software Yadif",     ///< VideoDeinterlaceSoftYadif
+    "Software Bwdif"      ///< VideoDeinterlaceSoftBwdif
 };
 
 static const char *vaapi_deinterlace_short[] = {
     "B",                  ///< VideoDeinterlaceBob
     "W",                  ///< VideoDeinterlaceWeave
     "MADI",               ///< VideoDeinterlaceTemporal
-    "MCDI"                ///< VideoDeinterlaceTemporalSpatial
+    "MCDI",               ///< VideoDeinterlaceTemporalSpatial
+    "S+B",                ///< VideoDeinterlaceSoftBob
+    "S+S",                ///< VideoDeinterlaceSoftSpatial
+    "S+Y",                ///< VideoDeinterlaceSoftYadif
+    "S+BW"                ///< VideoDeinterlaceSoftBwdif
 };
+
+    /// offered modes, supported hardware modes followed by software modes
+static const char *vaapi_deinterlace_menu[ARRAY_ELEMS(vaapi_deinterlace)];
+static const char *vaapi_deinterlace_menu_short[ARRAY_ELEMS(vaapi_deinterlace)];
+
+///
+///	Get number of offered VA-API hardware deinterlace modes.
+///
+///	MaxSupportedDeinterlacer is the best VA-API algorithm, deinterlace
+///	mode n uses algorithm n + 1.
+///
+static int VaapiDeinterlaceHwModes(void)
+{
+    unsigned n;
+
+    n = VaapiDecoders[0] ? VaapiDecoders[0]->MaxSupportedDeinterlacer : 0;
+    if (n > VideoDeinterlaceSoftBob) {
+	n = VideoDeinterlaceSoftBob;
+    }
+    return n;
+}
 #endif
 
 #ifdef USE_CUVID
@@ -15709,12 +17651,23 @@ int VideoGetDeinterlaceModes(const char* **long_table, const char* **short_table
 #else
     if (VideoUsedModule == &VaapiModule) {
 #endif
-	unsigned int len = VaapiDecoders[0]->MaxSupportedDeinterlacer;
-	*long_table = vaapi_deinterlace;
-	*short_table = vaapi_deinterlace_short;
-	if (len > ARRAY_ELEMS(vaapi_deinterlace))
-	   len = ARRAY_ELEMS(vaapi_deinterlace);
-	return len;
+	int n;
+	int i;
+
+	// hide unsupported hardware modes, the software modes follow
+	n = VaapiDeinterlaceHwModes();
+	for (i = 0; i < n; ++i) {
+	    vaapi_deinterlace_menu[i] = vaapi_deinterlace[i];
+	    vaapi_deinterlace_menu_short[i] = vaapi_deinterlace_short[i];
+	}
+	for (i = VideoDeinterlaceSoftBob;
+	    i < (int)ARRAY_ELEMS(vaapi_deinterlace); ++i, ++n) {
+	    vaapi_deinterlace_menu[n] = vaapi_deinterlace[i];
+	    vaapi_deinterlace_menu_short[n] = vaapi_deinterlace_short[i];
+	}
+	*long_table = vaapi_deinterlace_menu;
+	*short_table = vaapi_deinterlace_menu_short;
+	return n;
     }
 #endif
 #ifdef USE_CUVID
@@ -15727,6 +17680,51 @@ int VideoGetDeinterlaceModes(const char* **long_table, const char* **short_table
     return 0;
 }
 
+///
+///	Get index of deinterlace mode in the tables of
+///	VideoGetDeinterlaceModes().
+///
+///	@param mode	deinterlace mode, unsupported modes are clamped
+///
+int VideoGetDeinterlaceIndex(int mode)
+{
+    if (VideoIsDriverVaapi()) {
+#ifdef USE_VAAPI
+	int n;
+
+	n = VaapiDeinterlaceHwModes();
+	if (mode >= VideoDeinterlaceSoftBob) {
+	    return n + mode - VideoDeinterlaceSoftBob;
+	}
+	if (mode >= n) {
+	    return n ? n - 1 : 0;
+	}
+#endif
+    }
+    return mode;
+}
+
+///
+///	Get deinterlace mode of index in the tables of
+///	VideoGetDeinterlaceModes().
+///
+///	@param index	index in the mode tables
+///
+int VideoGetDeinterlaceMode(int index)
+{
+    if (VideoIsDriverVaapi()) {
+#ifdef USE_VAAPI
+	int n;
+
+	n = VaapiDeinterlaceHwModes();
+	if (index >= n) {
+	    return VideoDeinterlaceSoftBob + index - n;
+	}
+#endif
+    }
+    return index;
+}
+
 ///
 ///	Set deinterlace mode.
 ///
@@ -15739,9 +17737,12 @@ void VideoSetDeinterlace(int mode[VideoResolutionMax])
     if (VideoUsedModule == &VaapiModule) {
 #endif
 	int i;
+	int n;
+
+	n = VaapiDeinterlaceHwModes();
 	for (i = 0; i < VideoResolutionMax; ++i) {
-            if (mode[i] > (int)VaapiDecoders[0]->MaxSupportedDeinterlacer)
-		mode[i] = VaapiDecoders[0]->MaxSupportedDeinterlacer;
+            if (n && mode[i] < VideoDeinterlaceSoftBob && mode[i] >= n)
+		mode[i] = n - 1;
 	}
     }
 #endif
@@ -16247,12 +18248,32 @@ void VideoExit(void)
 
 #ifdef USE_VIDEO_THREAD
     VideoThreadExit();
+    // hw decoders are freed by module exit
+    memset(VideoDecodeThreads, 0, sizeof(VideoDecodeThreads));
     // VDPAU cleanup hangs in XLockDisplay every 100 exits
     // XUnlockDisplay(XlibDisplay);
     // xcb_flush(Connection);
+#endif
+#ifdef USE_GRAB
+    // the grab stream keeps running, but mustn't grab from a dying module
+    pthread_mutex_lock(&VideoGrabMutex);
 #endif
     VideoUsedModule->Exit();
     VideoUsedModule = &NoopModule;
+    DeintExit();
+#ifdef USE_GRAB
+#ifdef USE_SWSCALE
+    sws_freeContext(VideoGrabSwsContext);
+    VideoGrabSwsContext = NULL;
+#else
+    free(VideoGrabAccu);
+    free(VideoGrabSpan);
+    VideoGrabAccu = NULL;
+    VideoGrabSpan = NULL;
+    VideoGrabScratchWidth = 0;
+#endif
+    pthread_mutex_unlock(&VideoGrabMutex);
+#endif
 #ifdef USE_GLX
     if (GlxEnabled) {
 	GlxExit();
@@ -16326,6 +18347,329 @@ int VideoDecodeInput( __attribute__ ((unused)) VideoStream * stream)
     return -1;
 }
 
+#ifdef USE_AUTOCROP
+
+///
+///	Fill auto-crop test frame.
+///
+///	Black borders have Y 0x10 and the given chroma, the picture has
+///	random Y and chroma.
+///
+///	@param buf	frame buffer (YUV 4:2:0, 1.5 bytes per pixel)
+///	@param width	frame width
+///	@param height	frame height
+///	@param planes	2 NV12, 3 YV12
+///	@param top	black rows at the top
+///	@param bottom	black rows at the bottom
+///	@param side	black columns at left and right
+///	@param uv	chroma of the borders, 0x80 for black
+///	@param data	frame planes data (Y, U, V)
+///	@param pitches	frame planes pitches (Y, U, V)
+///
+static void AutoCropTestFrame(uint8_t * buf, int width, int height,
+    int planes, int top, int bottom, int side, int uv, void *data[3],
+    uint32_t pitches[3])
+{
+    int x;
+    int y;
+
+    data[0] = buf;
+    pitches[0] = width;
+    if (planes == 2) {
+	data[1] = buf + width * height;
+	pitches[1] = width;
+	data[2] = NULL;
+	pitches[2] = 0;
+    } else {
+	data[1] = buf + width * height;
+	data[2] = buf + width * height + width / 2 * height / 2;
+	pitches[1] = width / 2;
+	pitches[2] = width / 2;
+    }
+
+    for (y = 0; y < height; ++y) {
+	for (x = 0; x < width; ++x) {
+	    int black;
+
+	    black = y < top || y >= height - bottom || x < side
+		|| x >= width - side;
+	    ((uint8_t *) data[0])[y * pitches[0] + x] =
+		black ? 0x10 : 0x40 + (rand() & 0x7F);
+	    if ((y & 1) || (x & 1)) {
+		continue;
+	    }
+	    if (planes == 2) {
+		((uint8_t *) data[1])[(y / 2) * pitches[1] + x] =
+		    black ? uv : rand();
+		((uint8_t *) data[1])[(y / 2) * pitches[1] + x + 1] =
+		    black ? uv : rand();
+	    } else {
+		((uint8_t *) data[1])[(y / 2) * pitches[1] + x / 2] =
+		    black ? uv : rand();
+		((uint8_t *) data[2])[(y / 2) * pitches[2] + x / 2] =
+		    black ? uv : rand();
+	    }
+	}
+    }
+}
+
+///
+///	Test auto-crop detection with synthetic frames.
+///
+///	@returns -1 on failures, 0 all tests passed.
+///
+static int AutoCropTest(void)
+{
+    static const struct
+    {
+	const char *Name;		///< test name
+	int Width;			///< frame width
+	int Height;			///< frame height
+	int Planes;			///< 2 NV12, 3 YV12
+	int Top;			///< black rows at the top
+	int Bottom;			///< black rows at the bottom
+	int Side;			///< black columns left and right
+	int Uv;				///< chroma of the borders
+	int X1;				///< expected left border
+	int X2;				///< expected right border
+	int Y1;				///< expected top border
+	int Y2;				///< expected bottom border
+    } tests[] = {
+	{ "NV12 letterbox", 720, 576, 2, 72, 72, 0, 0x80, 0, 719, 72, 503 },
+	{ "YV12 letterbox", 720, 576, 3, 72, 72, 0, 0x80, 0, 719, 72, 503 },
+	{ "NV12 pillarbox", 1920, 1080, 2, 0, 0, 240, 0x80, 240, 1672, 0, 1079 },
+	{ "YV12 pillarbox", 1920, 1080, 3, 0, 0, 240, 0x80, 240, 1672, 0, 1079 },
+	{ "YV12 windowbox", 1920, 1080, 3, 140, 140, 240, 0x80, 240, 1672, 140, 939 },
+	// same size as before, the last borders are a stale hint
+	{ "YV12 stale hint", 1920, 1080, 3, 200, 100, 0, 0x80, 0, 1919, 200, 979 },
+	{ "YV12 no border", 1920, 1080, 3, 0, 0, 0, 0x80, 0, 1919, 0, 1079 },
+	{ "NV12 black", 720, 576, 2, 576, 0, 0, 0x80, 719, 0, 575, 0 },
+	{ "NV12 after black", 720, 576, 2, 72, 72, 0, 0x80, 0, 719, 72, 503 },
+	// dark, but colored borders aren't black
+	{ "NV12 colored", 720, 576, 2, 72, 72, 0, 0xC0, 0, 719, 0, 575 },
+	{ "YV12 colored", 720, 576, 3, 72, 72, 0, 0xC0, 0, 719, 0, 575 },
+    };
+    AutoCropCtx autocrop[1];
+    uint8_t *buf;
+    int errors;
+    int i;
+
+    memset(autocrop, 0, sizeof(autocrop));
+    buf = malloc(1920 * 1080 * 3 / 2);
+    errors = 0;
+    for (i = 0; i < (int)ARRAY_ELEMS(tests); ++i) {
+	void *data[3];
+	uint32_t pitches[3];
+
+	AutoCropTestFrame(buf, tests[i].Width, tests[i].Height,
+	    tests[i].Planes, tests[i].Top, tests[i].Bottom, tests[i].Side,
+	    tests[i].Uv, data, pitches);
+	AutoCropDetect(autocrop, tests[i].Width, tests[i].Height, data,
+	    pitches, tests[i].Planes);
+	if (autocrop->X1 != tests[i].X1 || autocrop->X2 != tests[i].X2
+	    || autocrop->Y1 != tests[i].Y1 || autocrop->Y2 != tests[i].Y2) {
+	    printf("autocrop: %s: %d,%d-%d,%d expected %d,%d-%d,%d\n",
+		tests[i].Name, autocrop->X1, autocrop->Y1, autocrop->X2,
+		autocrop->Y2, tests[i].X1, tests[i].Y1, tests[i].X2,
+		tests[i].Y2);
+	    ++errors;
+	}
+    }
+    free(buf);
+    printf("autocrop: %d tests, %d failed\n", i, errors);
+
+    return errors ? -1 : 0;
+}
+
+#endif
+
+#ifdef USE_GRAB
+
+static SoftHDDevice_GrabStreamRing_t *GrabStreamTestRing;	///< test ring
+static volatile char GrabStreamTestRunning;	///< test writer running
+static int GrabStreamTestCount;		///< frames to write
+
+    /// grab stream test reader results
+typedef struct
+{
+    int Frames;				///< valid frames read
+    int Retries;			///< frames overwritten while read
+    int Errors;				///< torn or wrong frames accepted
+} GrabStreamTestReader;
+
+///
+///	Read newest grab stream frame in place, as documented for the
+///	consumers.
+///
+///	Every image byte must be the low byte of the frame number.
+///
+///	@param ring	grab stream ring
+///	@param[out] seq	frame number
+///	@param[out] hdr	frame header
+///	@param[out] bad	number of wrong image bytes
+///
+///	@returns 1 frame read, 0 no frame yet, -1 overwritten while read.
+///
+static int GrabStreamTestRead(const SoftHDDevice_GrabStreamRing_t * ring,
+    uint64_t * seq, SoftHDDevice_GrabStreamFrame_t * hdr, int *bad)
+{
+    const SoftHDDevice_GrabStreamFrame_t *frame;
+    const uint8_t *data;
+    uint64_t n;
+    int i;
+
+    n = __atomic_load_n(&ring->sequence, __ATOMIC_ACQUIRE);
+    if (!n) {				// no frame written yet
+	return 0;
+    }
+    frame = (const SoftHDDevice_GrabStreamFrame_t *)((const uint8_t *)ring +
+	ring->slotOffset + (n % ring->slots) * ring->slotSize);
+    if (__atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE) != n) {
+	return -1;
+    }
+    sched_yield();			// slow consumer, let writer overtake
+    *hdr = *frame;
+    data = (const uint8_t *)frame + GRAB_STREAM_FRAME_DATA;
+    *bad = 0;
+    for (i = 0; i < (int)(ring->width * ring->height * 3); ++i) {
+	*bad += data[i] != (n & 0xFF);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&frame->sequence, __ATOMIC_RELAXED) != n) {
+	return -1;
+    }
+    *seq = n;
+    return 1;
+}
+
+///
+///	Grab stream test writer thread.
+///
+///	Writes frames with all bytes set to the low byte of the frame
+///	number, through the real slot writer.
+///
+static void *GrabStreamTestWriter( __attribute__ ((unused))
+    void *dummy)
+{
+    SoftHDDevice_GrabStreamRing_t *ring;
+    uint8_t *src;
+    int size;
+    int i;
+
+    ring = GrabStreamTestRing;
+    size = ring->width * ring->height * 4;
+    src = malloc(size);
+    for (i = 0; i < GrabStreamTestCount; ++i) {
+	memset(src, (ring->sequence + 1) & 0xFF, size);
+	VideoGrabStreamWrite(ring, 3, src, ring->width, ring->height);
+    }
+    free(src);
+    GrabStreamTestRunning = 0;
+
+    return NULL;
+}
+
+///
+///	Grab stream test reader thread.
+///
+static void *GrabStreamTestReaderThread(void *arg)
+{
+    GrabStreamTestReader *reader;
+    const SoftHDDevice_GrabStreamRing_t *ring;
+    SoftHDDevice_GrabStreamFrame_t hdr;
+    uint64_t last;
+
+    reader = arg;
+    ring = GrabStreamTestRing;
+    last = 0;
+    while (GrabStreamTestRunning) {
+	uint64_t n;
+	int bad;
+
+	switch (GrabStreamTestRead(ring, &n, &hdr, &bad)) {
+	    case -1:
+		reader->Retries++;
+		continue;
+	    case 0:
+		continue;
+	}
+	reader->Frames++;
+	if (bad || n < last || hdr.width != ring->width
+	    || hdr.height != ring->height
+	    || hdr.size != ring->width * ring->height * 3
+	    || hdr.imgType != GRAB_IMG_RGB_FORMAT_R8G8B8) {
+	    reader->Errors++;
+	}
+	last = n;
+    }
+
+    return NULL;
+}
+
+///
+///	Test grab stream ring protocol with one writer and two readers.
+///
+///	Two slots, so the readers are often overtaken by the writer.
+///
+///	@param count	number of frames to write
+///
+///	@returns -1 on failures, 0 all tests passed.
+///
+static int GrabStreamTest(int count)
+{
+    GrabStreamTestReader readers[2];
+    pthread_t threads[3];
+    SoftHDDevice_GrabStreamFrame_t hdr;
+    uint64_t n;
+    size_t slot_size;
+    size_t size;
+    int errors;
+    int bad;
+    int i;
+
+    // fresh shared memory is zeroed
+    size = VideoGrabStreamRingSize(64, 36, 2, 3, &slot_size);
+    GrabStreamTestRing = calloc(1, size);
+    VideoGrabStreamRingInit(GrabStreamTestRing, 64, 36, 60, 2, VideoGrabRgb,
+	slot_size);
+    GrabStreamTestCount = count;
+
+    errors = 0;
+    // zeroed slot 0 matches sequence 0, must not be read as frame
+    if (GrabStreamTestRead(GrabStreamTestRing, &n, &hdr, &bad)) {
+	printf("grabstream: frame read before first write\n");
+	++errors;
+    }
+
+    memset(readers, 0, sizeof(readers));
+    GrabStreamTestRunning = 1;
+    for (i = 0; i < 2; ++i) {
+	pthread_create(&threads[i], NULL, GrabStreamTestReaderThread,
+	    &readers[i]);
+    }
+    pthread_create(&threads[2], NULL, GrabStreamTestWriter, NULL);
+    for (i = 0; i < 3; ++i) {
+	pthread_join(threads[i], NULL);
+    }
+
+    if (GrabStreamTestRing->sequence != (uint64_t) count) {
+	printf("grabstream: sequence %llu expected %d\n",
+	    (unsigned long long)GrabStreamTestRing->sequence, count);
+	++errors;
+    }
+    for (i = 0; i < 2; ++i) {
+	printf("grabstream: reader %d: %d frames, %d retries, %d errors\n", i,
+	    readers[i].Frames, readers[i].Retries, readers[i].Errors);
+	errors += readers[i].Errors;
+    }
+    free(GrabStreamTestRing);
+    printf("grabstream: %d frames written, %d errors\n", count, errors);
+
+    return errors ? -1 : 0;
+}
+
+#endif
+
 ///
 ///	Print version.
 ///
@@ -16344,8 +18688,14 @@ static void PrintVersion(void)
 ///
 static void PrintUsage(void)
 {
-    printf("Usage: video_test [-?dhv]\n"
+    printf("Usage: video_test [-?adhv] [-r count]\n"
+#ifdef USE_AUTOCROP
+	"\t-a\trun the auto-crop tests and exit\n"
+#endif
 	"\t-d\tenable debug, more -d increase the verbosity\n"
+#ifdef USE_GRAB
+	"\t-r count\trun the grab stream ring test with count frames\n"
+#endif
 	"\t-? -h\tdisplay this message\n" "\t-v\tdisplay version information\n"
 	"Only idiots print usage on stderr!\n");
 }
@@ -16371,7 +18721,15 @@ int main(int argc, char *const argv[])
     //	Parse command line arguments
     //
     for (;;) {
-	switch (getopt(argc, argv, "hv?-c:dg:")) {
+	switch (getopt(argc, argv, "hv?-c:adg:r:")) {
+#ifdef USE_AUTOCROP
+	    case 'a':			// auto-crop tests
+		return AutoCropTest();
+#endif
+#ifdef USE_GRAB
+	    case 'r':			// grab stream ring test
+		return GrabStreamTest(atoi(optarg));
+#endif
 	    case 'd':			// enabled debug
 		++LogLevel;
 		continue;
@@ -43,6 +43,13 @@ enum  VideoHardwareDecoderMode {
     HWOn,
 };
 
+    /// Video grab output formats
+enum VideoGrabFormat {
+    VideoGrabRgb,			///< packed RGB, 3 bytes per pixel
+    VideoGrabPpm,			///< packed RGB with PPM (P6) header
+    VideoGrabBgra,			///< packed BGRA, 4 bytes per pixel
+};
+
 enum VideoOutParameters {
     brightness,
     contrast,
@@ -127,6 +134,9 @@ extern void VideoSetSoftStartSync(int);
     /// Set show black picture during channel switch.
 extern void VideoSetBlackPicture(int);
 
+    /// Set decode thread surface queue depth.
+extern void VideoSetDecodeQueue(int);
+
     /// Set brightness adjustment.
 extern void VideoSetBrightness(int);
 
@@ -178,6 +188,12 @@ extern int VideoGetScalingModes(const char* **long_table, const char* **short_ta
     /// Get deinterlace modes.
 extern int VideoGetDeinterlaceModes(const char* **long_table, const char* **short_table);
 
+    /// Get index of deinterlace mode in the mode tables.
+extern int VideoGetDeinterlaceIndex(int);
+
+    /// Get deinterlace mode of index in the mode tables.
+extern int VideoGetDeinterlaceMode(int);
+
     /// Set deinterlace.
 extern void VideoSetDeinterlace(int[]);
 
@@ -231,6 +247,10 @@ extern void VideoOsdClear(void);
 extern void VideoOsdDrawARGB(int, int, int, int, int, const uint8_t *, int,
     int);
 
+    /// Stage an OSD ARGB image, uploaded by the display thread.
+extern void VideoOsdStageARGB(int, int, int, int, int, const uint8_t *, int,
+    int);
+
     /// Activate displaying OSD
 void ActivateOsd(void);
     /// Get VDPAU DEVICE
@@ -275,9 +295,29 @@ extern uint8_t *VideoGrab(int *, int *, int *, int);
     /// Grab screen raw.
 extern uint8_t *VideoGrabService(int *, int *, int *);
 
+    /// Grab screen into reusable buffer.
+extern int VideoGrabBuffer(uint8_t **, int *, int *, int *, int *,
+    enum VideoGrabFormat);
+
+    /// Start grab stream into shared memory ring.
+extern void *VideoGrabStreamStart(int, int, int, int, enum VideoGrabFormat);
+
+    /// Release grab stream reference.
+extern void VideoGrabStreamRelease(void);
+
+    /// Stop grab stream for all consumers.
+extern void VideoGrabStreamStop(void);
+
+    /// Get grab stream status.
+extern void VideoGrabStreamStatus(char *, size_t);
+
     /// Get decoder statistics.
 extern void VideoGetStats(VideoHwDecoder *, int *, int *, int *, int *);
 
+    /// Get decode time per packet and display time per frame.
+extern void VideoGetTimingStats(VideoHwDecoder *, int *, int *, int *,
+    int *);
+
     /// Get video stream size
 extern void VideoGetVideoSize(VideoHwDecoder *, int *, int *, int *, int *);
 